@@ -1,11 +1,18 @@
 #include "FormulaAST.h"
 
+#include "aggregate.h"
+#include "criteria.h"
+#include "logical.h"
+#include "lookup.h"
+
 #include "FormulaBaseListener.h"
 #include "FormulaLexer.h"
 #include "FormulaParser.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstring>
 #include <memory>
 #include <optional>
 #include <sstream>
@@ -15,6 +22,7 @@ namespace ASTImpl
 
 enum ExprPrecedence
 {
+    EP_COMPARE,
     EP_ADD,
     EP_SUB,
     EP_MUL,
@@ -61,13 +69,17 @@ enum PrecedenceRule
 //     (currently in the table we're always putting in the parentheses)
 // +(A * B) - always okay (the resulting binary op has the highest grammatic precedence)
 // +(A / B) - always okay (the resulting binary op has the highest grammatic precedence)
+// Comparisons have the lowest grammatic precedence and are left-associative:
+// (A < B) < C - always okay, A < (B < C) - never okay,
+// any arithmetic parent of a comparison needs the parentheses
 constexpr PrecedenceRule PRECEDENCE_RULES[EP_END][EP_END] = {
-    /* EP_ADD */ {PR_NONE, PR_NONE, PR_NONE, PR_NONE, PR_NONE, PR_NONE},
-    /* EP_SUB */ {PR_RIGHT, PR_RIGHT, PR_NONE, PR_NONE, PR_NONE, PR_NONE},
-    /* EP_MUL */ {PR_BOTH, PR_BOTH, PR_NONE, PR_NONE, PR_NONE, PR_NONE},
-    /* EP_DIV */ {PR_BOTH, PR_BOTH, PR_RIGHT, PR_RIGHT, PR_NONE, PR_NONE},
-    /* EP_UNARY */ {PR_BOTH, PR_BOTH, PR_NONE, PR_NONE, PR_NONE, PR_NONE},
-    /* EP_ATOM */ {PR_NONE, PR_NONE, PR_NONE, PR_NONE, PR_NONE, PR_NONE},
+    /* EP_COMPARE */ {PR_RIGHT, PR_NONE, PR_NONE, PR_NONE, PR_NONE, PR_NONE, PR_NONE},
+    /* EP_ADD */ {PR_BOTH, PR_NONE, PR_NONE, PR_NONE, PR_NONE, PR_NONE, PR_NONE},
+    /* EP_SUB */ {PR_BOTH, PR_RIGHT, PR_RIGHT, PR_NONE, PR_NONE, PR_NONE, PR_NONE},
+    /* EP_MUL */ {PR_BOTH, PR_BOTH, PR_BOTH, PR_NONE, PR_NONE, PR_NONE, PR_NONE},
+    /* EP_DIV */ {PR_BOTH, PR_BOTH, PR_BOTH, PR_RIGHT, PR_RIGHT, PR_NONE, PR_NONE},
+    /* EP_UNARY */ {PR_BOTH, PR_BOTH, PR_BOTH, PR_NONE, PR_NONE, PR_NONE, PR_NONE},
+    /* EP_ATOM */ {PR_NONE, PR_NONE, PR_NONE, PR_NONE, PR_NONE, PR_NONE, PR_NONE},
 };
 
 class Expr
@@ -76,8 +88,75 @@ public:
     virtual ~Expr() = default;
     virtual void Print(std::ostream& out) const = 0;
     virtual void DoPrintFormula(std::ostream& out, ExprPrecedence precedence) const = 0;
-    virtual double Evaluate(const std::function<double(Position)>& args) const = 0;  //MODIFIED
+    virtual double Evaluate(const FormulaInputs& inputs) const = 0;  //MODIFIED
     virtual ExprPrecedence GetPrecedence() const = 0;
+    // Диапазон, если узел - ссылка на диапазон
+    virtual const Range* AsRange() const
+    {
+        return nullptr;
+    }
+    // Текст, если узел - строковая константа
+    virtual const std::string* AsString() const
+    {
+        return nullptr;
+    }
+    // Имя листа, если узел - ссылка на другой лист (см. SheetReference)
+    virtual const std::string* GetSheet() const
+    {
+        return nullptr;
+    }
+    // Дописывает в program инструкции узла в обратной польской записи
+    virtual void Compile(std::vector<FormulaInstruction>& program) const = 0;
+    // Размер массива, если значение узла - массив (см. формулы массива)
+    virtual std::optional<Size> GetArraySize() const
+    {
+        return std::nullopt;
+    }
+
+    // Записывает значение узла в массивы из size.rows * size.cols элементов
+    // построчно. Значение обычного узла повторяется в каждом элементе,
+    // элементы вне массива узла - #N/A
+    void EvaluateArray(const FormulaInputs& inputs, Size size, double* numbers, ValueCode* codes) const
+    {
+        const std::size_t count = static_cast<std::size_t>(size.rows) * size.cols;
+        const std::optional<Size> own_size = GetArraySize();
+        if (!own_size)
+        {
+            double number = 0.0;
+            ValueCode code = ValueCode::Number;
+            try
+            {
+                number = Evaluate(inputs);
+            }
+            catch (const FormulaError& error)
+            {
+                code = ToValueCode(error);
+            }
+            std::fill_n(numbers, count, number);
+            std::fill_n(codes, count, code);
+            return;
+        }
+        if (*own_size == size)
+        {
+            DoEvaluateArray(inputs, numbers, codes);
+            return;
+        }
+
+        // Массив узла меньше: вычисляем его отдельно и раскладываем по строкам
+        const std::size_t own_count = static_cast<std::size_t>(own_size->rows) * own_size->cols;
+        std::vector<double> own_numbers(own_count);
+        std::vector<ValueCode> own_codes(own_count);
+        DoEvaluateArray(inputs, own_numbers.data(), own_codes.data());
+        std::fill_n(numbers, count, 0.0);
+        std::fill_n(codes, count, ValueCode::ErrorNA);
+        for (int row = 0; row < own_size->rows; ++row)
+        {
+            const std::size_t from = static_cast<std::size_t>(row) * own_size->cols;
+            const std::size_t to = static_cast<std::size_t>(row) * size.cols;
+            std::copy_n(own_numbers.data() + from, own_size->cols, numbers + to);
+            std::copy_n(own_codes.data() + from, own_size->cols, codes + to);
+        }
+    }
 
     void PrintFormula(std::ostream& out, ExprPrecedence parent_precedence,
                       bool right_child = false) const
@@ -97,10 +176,73 @@ public:
             out << ')';
         }
     }
+
+protected:
+    // Вычисляет массив узла (размера GetArraySize()) поэлементно
+    virtual void DoEvaluateArray(const FormulaInputs& /* inputs */, double* /* numbers */,
+                                 ValueCode* /* codes */) const
+    {
+        throw FormulaError(FormulaError::Category::Value);
+    }
 };
 
 namespace
 {
+// Обработчики чтения листа, на котором лежит ссылка expr
+const FormulaInputs& InputsOf(const Expr& expr, const FormulaInputs& inputs)
+{
+    const std::string* sheet = expr.GetSheet();
+    return sheet ? inputs.sheet(*sheet) : inputs;
+}
+
+// Лежат ли ссылки lhs и rhs на одном листе
+bool IsSameSheet(const Expr& lhs, const Expr& rhs)
+{
+    const std::string* lhs_sheet = lhs.GetSheet();
+    const std::string* rhs_sheet = rhs.GetSheet();
+    return lhs_sheet && rhs_sheet ? *lhs_sheet == *rhs_sheet : lhs_sheet == rhs_sheet;
+}
+
+// Число инструкций, занятых строкой из size байт после Op::String или Op::Sheet
+std::size_t GetPayloadSize(std::size_t size)
+{
+    return (size + sizeof(FormulaInstruction) - 1) / sizeof(FormulaInstruction);
+}
+
+// Дописывает в program инструкцию op с байтами text в следующих инструкциях
+void CompileText(std::vector<FormulaInstruction>& program, FormulaInstruction::Op op, const std::string& text)
+{
+    FormulaInstruction instruction;
+    instruction.op = op;
+    instruction.arg_count = static_cast<std::uint16_t>(text.size());
+    program.push_back(instruction);
+
+    // Байты строки занимают следующие инструкции целиком
+    const std::size_t start = program.size();
+    program.resize(start + GetPayloadSize(text.size()));
+    std::memcpy(static_cast<void*>(program.data() + start), text.data(), text.size());
+}
+
+// Размер результата поэлементной операции над значениями размеров lhs и rhs
+std::optional<Size> CombineArraySizes(std::optional<Size> lhs, std::optional<Size> rhs)
+{
+    if (!lhs || !rhs)
+    {
+        return lhs ? lhs : rhs;
+    }
+    return Size{ std::max(lhs->rows, rhs->rows), std::max(lhs->cols, rhs->cols) };
+}
+
+// Ошибка операнда становится ошибкой элемента, ошибка левого операнда -
+// первой, как при вычислении по одному значению
+void MergeArrayCodes(ValueCode* codes, const ValueCode* rhs_codes, std::size_t count)
+{
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        codes[i] = codes[i] == ValueCode::Number ? rhs_codes[i] : codes[i];
+    }
+}
+
 class BinaryOpExpr final : public Expr
 {
 public:
@@ -153,23 +295,47 @@ public:
         }
     }
 
-    double Evaluate(const std::function<double(Position)>& func) const override
+    void Compile(std::vector<FormulaInstruction>& program) const override
+    {
+        lhs_->Compile(program);
+        rhs_->Compile(program);
+
+        FormulaInstruction instruction;
+        switch (type_)
+        {
+        case Type::Add:
+            instruction.op = FormulaInstruction::Op::Add;
+            break;
+        case Type::Subtract:
+            instruction.op = FormulaInstruction::Op::Subtract;
+            break;
+        case Type::Multiply:
+            instruction.op = FormulaInstruction::Op::Multiply;
+            break;
+        case Type::Divide:
+            instruction.op = FormulaInstruction::Op::Divide;
+            break;
+        }
+        program.push_back(instruction);
+    }
+
+    double Evaluate(const FormulaInputs& inputs) const override
     {
         switch (type_)
         {
         case Type::Add:
-            return (lhs_.get()->Evaluate(func) + rhs_.get()->Evaluate(func));
+            return (lhs_.get()->Evaluate(inputs) + rhs_.get()->Evaluate(inputs));
             break;
         case Type::Subtract:
-            return (lhs_.get()->Evaluate(func) - rhs_.get()->Evaluate(func));
+            return (lhs_.get()->Evaluate(inputs) - rhs_.get()->Evaluate(inputs));
             break;
         case Type::Multiply:
-            return (lhs_.get()->Evaluate(func) * rhs_.get()->Evaluate(func));
+            return (lhs_.get()->Evaluate(inputs) * rhs_.get()->Evaluate(inputs));
             break;
         case Type::Divide:
-            if (std::isfinite(lhs_.get()->Evaluate(func) / rhs_.get()->Evaluate(func)))
+            if (std::isfinite(lhs_.get()->Evaluate(inputs) / rhs_.get()->Evaluate(inputs)))
             {
-                return (lhs_.get()->Evaluate(func) / rhs_.get()->Evaluate(func));
+                return (lhs_.get()->Evaluate(inputs) / rhs_.get()->Evaluate(inputs));
             }
             else
             {
@@ -182,7 +348,224 @@ public:
         }
     }
 
+    std::optional<Size> GetArraySize() const override
+    {
+        return CombineArraySizes(lhs_->GetArraySize(), rhs_->GetArraySize());
+    }
+
+protected:
+    // Операция над целыми массивами: циклы без ветвлений по элементам
+    void DoEvaluateArray(const FormulaInputs& inputs, double* numbers, ValueCode* codes) const override
+    {
+        const Size size = *GetArraySize();
+        const std::size_t count = static_cast<std::size_t>(size.rows) * size.cols;
+        lhs_->EvaluateArray(inputs, size, numbers, codes);
+        std::vector<double> rhs_numbers(count);
+        std::vector<ValueCode> rhs_codes(count);
+        rhs_->EvaluateArray(inputs, size, rhs_numbers.data(), rhs_codes.data());
+
+        const double* rhs = rhs_numbers.data();
+        switch (type_)
+        {
+        case Type::Add:
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                numbers[i] += rhs[i];
+            }
+            break;
+        case Type::Subtract:
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                numbers[i] -= rhs[i];
+            }
+            break;
+        case Type::Multiply:
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                numbers[i] *= rhs[i];
+            }
+            break;
+        case Type::Divide:
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                numbers[i] /= rhs[i];
+            }
+            break;
+        }
+        MergeArrayCodes(codes, rhs_codes.data(), count);
+
+        if (type_ == Type::Divide)
+        {
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                if (codes[i] == ValueCode::Number && !std::isfinite(numbers[i]))
+                {
+                    codes[i] = ValueCode::ErrorDiv0;
+                }
+            }
+        }
+    }
+
+private:
+    Type type_;
+    std::unique_ptr<Expr> lhs_;
+    std::unique_ptr<Expr> rhs_;
+};
+
+class ComparisonExpr final : public Expr
+{
+public:
+    enum class Type : std::uint8_t
+    {
+        Equal,
+        NotEqual,
+        Less,
+        LessOrEqual,
+        Greater,
+        GreaterOrEqual,
+    };
+
+public:
+    explicit ComparisonExpr(Type type, std::unique_ptr<Expr> lhs, std::unique_ptr<Expr> rhs)
+        : type_(type)
+        , lhs_(std::move(lhs))
+        , rhs_(std::move(rhs))
+    {}
+
+    void Print(std::ostream& out) const override
+    {
+        out << '(' << GetSymbol() << ' ';
+        lhs_->Print(out);
+        out << ' ';
+        rhs_->Print(out);
+        out << ')';
+    }
+
+    void DoPrintFormula(std::ostream& out, ExprPrecedence precedence) const override
+    {
+        lhs_->PrintFormula(out, precedence);
+        out << GetSymbol();
+        rhs_->PrintFormula(out, precedence, true);
+    }
+
+    ExprPrecedence GetPrecedence() const override
+    {
+        return EP_COMPARE;
+    }
+
+    void Compile(std::vector<FormulaInstruction>& program) const override
+    {
+        lhs_->Compile(program);
+        rhs_->Compile(program);
+
+        FormulaInstruction instruction;
+        instruction.op = FormulaInstruction::Op::Compare;
+        instruction.function = static_cast<std::uint8_t>(type_);
+        program.push_back(instruction);
+    }
+
+    // Истина - 1, ложь - 0
+    double Evaluate(const FormulaInputs& inputs) const override
+    {
+        const double lhs = lhs_->Evaluate(inputs);
+        const double rhs = rhs_->Evaluate(inputs);
+        switch (type_)
+        {
+        case Type::Equal:
+            return lhs == rhs;
+        case Type::NotEqual:
+            return lhs != rhs;
+        case Type::Less:
+            return lhs < rhs;
+        case Type::LessOrEqual:
+            return lhs <= rhs;
+        case Type::Greater:
+            return lhs > rhs;
+        case Type::GreaterOrEqual:
+            return lhs >= rhs;
+        }
+        return 0.0;
+    }
+
+    std::optional<Size> GetArraySize() const override
+    {
+        return CombineArraySizes(lhs_->GetArraySize(), rhs_->GetArraySize());
+    }
+
+protected:
+    void DoEvaluateArray(const FormulaInputs& inputs, double* numbers, ValueCode* codes) const override
+    {
+        const Size size = *GetArraySize();
+        const std::size_t count = static_cast<std::size_t>(size.rows) * size.cols;
+        lhs_->EvaluateArray(inputs, size, numbers, codes);
+        std::vector<double> rhs_numbers(count);
+        std::vector<ValueCode> rhs_codes(count);
+        rhs_->EvaluateArray(inputs, size, rhs_numbers.data(), rhs_codes.data());
+
+        const double* rhs = rhs_numbers.data();
+        switch (type_)
+        {
+        case Type::Equal:
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                numbers[i] = numbers[i] == rhs[i];
+            }
+            break;
+        case Type::NotEqual:
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                numbers[i] = numbers[i] != rhs[i];
+            }
+            break;
+        case Type::Less:
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                numbers[i] = numbers[i] < rhs[i];
+            }
+            break;
+        case Type::LessOrEqual:
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                numbers[i] = numbers[i] <= rhs[i];
+            }
+            break;
+        case Type::Greater:
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                numbers[i] = numbers[i] > rhs[i];
+            }
+            break;
+        case Type::GreaterOrEqual:
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                numbers[i] = numbers[i] >= rhs[i];
+            }
+            break;
+        }
+        MergeArrayCodes(codes, rhs_codes.data(), count);
+    }
+
 private:
+    std::string_view GetSymbol() const
+    {
+        switch (type_)
+        {
+        case Type::Equal:
+            return "=";
+        case Type::NotEqual:
+            return "<>";
+        case Type::Less:
+            return "<";
+        case Type::LessOrEqual:
+            return "<=";
+        case Type::Greater:
+            return ">";
+        case Type::GreaterOrEqual:
+            return ">=";
+        }
+        return {};
+    }
+
     Type type_;
     std::unique_ptr<Expr> lhs_;
     std::unique_ptr<Expr> rhs_;
@@ -221,19 +604,49 @@ public:
         return EP_UNARY;
     }
     
-    double Evaluate(const std::function<double(Position)>& func) const override
+    void Compile(std::vector<FormulaInstruction>& program) const override
+    {
+        operand_->Compile(program);
+
+        FormulaInstruction instruction;
+        instruction.op = (type_ == Type::UnaryMinus) ? FormulaInstruction::Op::UnaryMinus
+                                                     : FormulaInstruction::Op::UnaryPlus;
+        program.push_back(instruction);
+    }
+
+    double Evaluate(const FormulaInputs& inputs) const override
     {
         switch (type_)
         {
         case Type::UnaryMinus:
-            return (-1.0) * operand_->Evaluate(func);
+            return (-1.0) * operand_->Evaluate(inputs);
             break;
         default:
-            return operand_->Evaluate(func);
+            return operand_->Evaluate(inputs);
             break;
         }
     }
 
+    std::optional<Size> GetArraySize() const override
+    {
+        return operand_->GetArraySize();
+    }
+
+protected:
+    void DoEvaluateArray(const FormulaInputs& inputs, double* numbers, ValueCode* codes) const override
+    {
+        const Size size = *GetArraySize();
+        operand_->EvaluateArray(inputs, size, numbers, codes);
+        if (type_ == Type::UnaryMinus)
+        {
+            const std::size_t count = static_cast<std::size_t>(size.rows) * size.cols;
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                numbers[i] = -numbers[i];
+            }
+        }
+    }
+
 private:
     Type type_;
     std::unique_ptr<Expr> operand_;
@@ -242,12 +655,18 @@ private:
 class CellExpr final : public Expr
 {
 public:
-    explicit CellExpr(const Position* cell)
+    // sheet - имя другого листа или nullptr для ячейки листа формулы
+    explicit CellExpr(const Position* cell, const std::string* sheet = nullptr)
         : cell_(cell)
+        , sheet_(sheet)
     {}
 
     void Print(std::ostream& out) const override
     {
+        if (sheet_)
+        {
+            out << *sheet_ << '!';
+        }
         if (!cell_->IsValid())
         {
             out << FormulaError::Category::Ref;
@@ -268,34 +687,58 @@ public:
         return EP_ATOM;
     }
 
-    double Evaluate(const std::function<double(Position)>& func) const override
+    void Compile(std::vector<FormulaInstruction>& program) const override
+    {
+        if (sheet_)
+        {
+            CompileText(program, FormulaInstruction::Op::Sheet, *sheet_);
+        }
+        FormulaInstruction instruction;
+        instruction.op = FormulaInstruction::Op::Cell;
+        instruction.cell = *cell_;
+        program.push_back(instruction);
+    }
+
+    double Evaluate(const FormulaInputs& inputs) const override
     {
         if (!cell_->IsValid())
         {
             throw FormulaError(FormulaError::Category::Ref);
         }
-        return func(*cell_);
+        return InputsOf(*this, inputs).cell(*cell_);
+    }
+
+    const std::string* GetSheet() const override
+    {
+        return sheet_;
     }
 
 private:
     const Position* cell_;
+    const std::string* sheet_;
 };
 
-class NumberExpr final : public Expr
+class RangeExpr final : public Expr
 {
 public:
-    explicit NumberExpr(double value)
-        : value_(value)
+    // sheet - имя другого листа или nullptr для диапазона листа формулы
+    explicit RangeExpr(const Range* range, const std::string* sheet = nullptr)
+        : range_(range)
+        , sheet_(sheet)
     {}
 
     void Print(std::ostream& out) const override
     {
-        out << value_;
+        if (sheet_)
+        {
+            out << *sheet_ << '!';
+        }
+        out << range_->ToString();
     }
 
     void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */) const override
     {
-        out << value_;
+        Print(out);
     }
 
     ExprPrecedence GetPrecedence() const override
@@ -303,56 +746,551 @@ public:
         return EP_ATOM;
     }
 
-    // Для чисел метод возвращает значение числа.
-    double Evaluate(const std::function<double(Position)>& func) const override
+    void Compile(std::vector<FormulaInstruction>& program) const override
     {
-        return value_;
+        if (sheet_)
+        {
+            CompileText(program, FormulaInstruction::Op::Sheet, *sheet_);
+        }
+        FormulaInstruction instruction;
+        instruction.op = FormulaInstruction::Op::Range;
+        instruction.cell = range_->from;
+        instruction.range_end_row = static_cast<std::uint16_t>(range_->to.row);
+        instruction.range_end_col = static_cast<std::uint16_t>(range_->to.col);
+        program.push_back(instruction);
     }
 
-private:
-    double value_;
-};
+    // Вне аргументов функции диапазон - массив (см. EvaluateArray()), как
+    // одно число он значения не имеет
+    double Evaluate(const FormulaInputs& /* inputs */) const override
+    {
+        throw FormulaError(FormulaError::Category::Value);
+    }
 
-class ParseASTListener final : public FormulaBaseListener
-{
-public:
-    std::unique_ptr<Expr> MoveRoot()
+    const Range* AsRange() const override
     {
-        assert(args_.size() == 1);
-        auto root = std::move(args_.front());
-        args_.clear();
+        return range_;
+    }
 
-        return root;
+    const std::string* GetSheet() const override
+    {
+        return sheet_;
     }
 
-    std::forward_list<Position> MoveCells()
+    std::optional<Size> GetArraySize() const override
     {
-        return std::move(cells_);
+        return range_->GetSize();
     }
 
-public:
-    void exitUnaryOp(FormulaParser::UnaryOpContext* ctx) override
+protected:
+    void DoEvaluateArray(const FormulaInputs& inputs, double* numbers, ValueCode* codes) const override
     {
-        assert(args_.size() >= 1);
+        InputsOf(*this, inputs).array(*range_, numbers, codes);
+    }
 
-        auto operand = std::move(args_.back());
+private:
+    const Range* range_;
+    const std::string* sheet_;
+};
 
-        UnaryOpExpr::Type type;
-        if (ctx->SUB())
+// Вызов функции: NAME(arg1,arg2,...)
+class CallExpr : public Expr
+{
+public:
+    CallExpr(std::string_view name, std::vector<std::unique_ptr<Expr>> args)
+        : name_(name)
+        , args_(std::move(args))
+    {}
+
+    void Print(std::ostream& out) const override
+    {
+        out << '(' << name_;
+        for (const auto& arg : args_)
         {
-            type = UnaryOpExpr::UnaryMinus;
+            out << ' ';
+            arg->Print(out);
         }
-        else
+        out << ')';
+    }
+
+    void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */) const override
+    {
+        out << name_ << '(';
+        bool need_separator = false;
+        for (const auto& arg : args_)
         {
-            assert(ctx->ADD() != nullptr);
-            type = UnaryOpExpr::UnaryPlus;
+            if (need_separator)
+            {
+                out << ',';
+            }
+            need_separator = true;
+            arg->PrintFormula(out, EP_ATOM);
         }
-
-        auto node = std::make_unique<UnaryOpExpr>(type, std::move(operand));
-        args_.back() = std::move(node);
+        out << ')';
     }
 
-    void exitLiteral(FormulaParser::LiteralContext* ctx) override
+    ExprPrecedence GetPrecedence() const override
+    {
+        return EP_ATOM;
+    }
+
+protected:
+    // Аргументы и инструкция вызова
+    void CompileCall(std::vector<FormulaInstruction>& program, FormulaInstruction::Op op,
+                     std::uint8_t function) const
+    {
+        for (const auto& arg : args_)
+        {
+            arg->Compile(program);
+        }
+
+        FormulaInstruction instruction;
+        instruction.op = op;
+        instruction.function = function;
+        instruction.arg_count = static_cast<std::uint16_t>(args_.size());
+        program.push_back(instruction);
+    }
+
+    std::string_view name_;
+    std::vector<std::unique_ptr<Expr>> args_;
+};
+
+class FunctionExpr final : public CallExpr
+{
+public:
+    explicit FunctionExpr(AggregateFunction function, std::vector<std::unique_ptr<Expr>> args)
+        : CallExpr(GetAggregateFunctionName(function), std::move(args))
+        , function_(function)
+    {}
+
+    void Compile(std::vector<FormulaInstruction>& program) const override
+    {
+        CompileCall(program, FormulaInstruction::Op::Function, static_cast<std::uint8_t>(function_));
+    }
+
+    double Evaluate(const FormulaInputs& inputs) const override
+    {
+        Aggregate aggregate(function_);
+        for (const auto& arg : args_)
+        {
+            // Диапазон читается блоком, остальные аргументы - по значению
+            if (const Range* range = arg->AsRange())
+            {
+                InputsOf(*arg, inputs).range(*range, aggregate);
+                continue;
+            }
+            try
+            {
+                aggregate.Add(arg->Evaluate(inputs));
+            }
+            catch (const FormulaError& error)
+            {
+                aggregate.AddError(error);
+            }
+        }
+        return aggregate.GetResult();
+    }
+
+private:
+    AggregateFunction function_;
+};
+
+class LookupExpr final : public CallExpr
+{
+public:
+    // Бросает ParsingError, если число аргументов неверно или на месте
+    // вектора не диапазон
+    explicit LookupExpr(LookupFunction function, std::vector<std::unique_ptr<Expr>> args)
+        : CallExpr(GetLookupFunctionName(function), std::move(args))
+        , function_(function)
+    {
+        if (args_.size() < GetLookupMinArgs(function_) || args_.size() > GetLookupMaxArgs(function_))
+        {
+            throw ParsingError("Wrong number of arguments for " + std::string(name_));
+        }
+        // Второй аргумент - вектор или таблица, у XLOOKUP и третий
+        const std::size_t range_args = function_ == LookupFunction::XLookup ? 3 : 2;
+        for (std::size_t i = 1; i < range_args; ++i)
+        {
+            if (!args_[i]->AsRange())
+            {
+                throw ParsingError(std::string(name_) + " expects a range");
+            }
+        }
+    }
+
+    void Compile(std::vector<FormulaInstruction>& program) const override
+    {
+        CompileCall(program, FormulaInstruction::Op::Lookup, static_cast<std::uint8_t>(function_));
+    }
+
+    double Evaluate(const FormulaInputs& inputs) const override
+    {
+        const double key = args_[0]->Evaluate(inputs);
+        const Range& vector = *args_[1]->AsRange();
+        const FormulaInputs& vector_inputs = InputsOf(*args_[1], inputs);
+        switch (function_)
+        {
+        case LookupFunction::Match:
+        {
+            LookupMode mode = LookupMode::LessOrEqual;
+            if (args_.size() > 2)
+            {
+                const double type = args_[2]->Evaluate(inputs);
+                mode = type == 0 ? LookupMode::Exact : type > 0 ? LookupMode::LessOrEqual : LookupMode::GreaterOrEqual;
+            }
+            return FindOrThrow(vector_inputs, vector, key, mode) + 1;
+        }
+        case LookupFunction::VLookup:
+        {
+            const double column = std::trunc(args_[2]->Evaluate(inputs));
+            const bool approximate = args_.size() < 4 || args_[3]->Evaluate(inputs) != 0;
+            if (column < 1)
+            {
+                throw FormulaError(FormulaError::Category::Value);
+            }
+            if (column > vector.GetSize().cols)
+            {
+                throw FormulaError(FormulaError::Category::Ref);
+            }
+            const Range first_column{ vector.from, Position{ vector.to.row, vector.from.col } };
+            const int row = FindOrThrow(vector_inputs, first_column, key,
+                                        approximate ? LookupMode::LessOrEqual : LookupMode::Exact);
+            return vector_inputs.cell(Position{ vector.from.row + row, vector.from.col + static_cast<int>(column) - 1 });
+        }
+        case LookupFunction::XLookup:
+        {
+            const Range& values = *args_[2]->AsRange();
+            if (!(values.GetSize() == vector.GetSize()))
+            {
+                throw FormulaError(FormulaError::Category::Value);
+            }
+            const std::optional<int> index = Find(vector_inputs, vector, key, LookupMode::Exact);
+            if (!index)
+            {
+                if (args_.size() < 4)
+                {
+                    throw FormulaError(FormulaError::Category::NA);
+                }
+                return args_[3]->Evaluate(inputs);
+            }
+            return InputsOf(*args_[2], inputs).cell(GetItem(values, *index));
+        }
+        }
+        return 0.0;
+    }
+
+private:
+    // Ищет ключ в векторе. Бросает #VALUE!, если диапазон не вектор
+    static std::optional<int> Find(const FormulaInputs& inputs, const Range& vector, double key, LookupMode mode)
+    {
+        const Size size = vector.GetSize();
+        if (size.rows != 1 && size.cols != 1)
+        {
+            throw FormulaError(FormulaError::Category::Value);
+        }
+        return inputs.lookup(vector, key, mode);
+    }
+
+    // То же, что Find(), но если ключ не найден, бросает #N/A
+    static int FindOrThrow(const FormulaInputs& inputs, const Range& vector, double key, LookupMode mode)
+    {
+        if (const std::optional<int> index = Find(inputs, vector, key, mode))
+        {
+            return *index;
+        }
+        throw FormulaError(FormulaError::Category::NA);
+    }
+
+    // Ячейка вектора с номером index (с 0)
+    static Position GetItem(const Range& vector, int index)
+    {
+        return vector.GetSize().cols == 1 ? Position{ vector.from.row + index, vector.from.col }
+                                          : Position{ vector.from.row, vector.from.col + index };
+    }
+
+    LookupFunction function_;
+};
+
+class ConditionalExpr final : public CallExpr
+{
+public:
+    // Бросает ParsingError, если число аргументов неверно или на месте
+    // диапазонов не диапазоны
+    explicit ConditionalExpr(ConditionalFunction function, std::vector<std::unique_ptr<Expr>> args)
+        : CallExpr(GetConditionalFunctionName(function), std::move(args))
+        , function_(function)
+    {
+        if (args_.size() < GetConditionalMinArgs(function_) || args_.size() > GetConditionalMaxArgs(function_))
+        {
+            throw ParsingError("Wrong number of arguments for " + std::string(name_));
+        }
+        if (!args_[0]->AsRange() || (args_.size() > 2 && !args_[2]->AsRange()))
+        {
+            throw ParsingError(std::string(name_) + " expects a range");
+        }
+        if (args_.size() > 2 && !IsSameSheet(*args_[0], *args_[2]))
+        {
+            throw ParsingError(std::string(name_) + " expects ranges on one sheet");
+        }
+        // Строковое условие разбирается один раз
+        if (const std::string* text = args_[1]->AsString())
+        {
+            criterion_ = Criterion::Parse(*text);
+        }
+    }
+
+    void Compile(std::vector<FormulaInstruction>& program) const override
+    {
+        CompileCall(program, FormulaInstruction::Op::Conditional, static_cast<std::uint8_t>(function_));
+    }
+
+    double Evaluate(const FormulaInputs& inputs) const override
+    {
+        const Range& range = *args_[0]->AsRange();
+        const Range* values = nullptr;
+        if (function_ != ConditionalFunction::CountIf)
+        {
+            values = args_.size() > 2 ? args_[2]->AsRange() : &range;
+            if (!(values->GetSize() == range.GetSize()))
+            {
+                throw FormulaError(FormulaError::Category::Value);
+            }
+        }
+
+        const FormulaInputs& range_inputs = InputsOf(*args_[0], inputs);
+        const ConditionalResult result = criterion_
+            ? range_inputs.conditional(range, *criterion_, values)
+            : range_inputs.conditional(range, Criterion::Equal(args_[1]->Evaluate(inputs)), values);
+        switch (function_)
+        {
+        case ConditionalFunction::SumIf:
+            return result.values.sum;
+        case ConditionalFunction::CountIf:
+            return static_cast<double>(result.matches);
+        case ConditionalFunction::AverageIf:
+            if (result.values.count == 0)
+            {
+                throw FormulaError(FormulaError::Category::Div0);
+            }
+            return result.values.sum / static_cast<double>(result.values.count);
+        }
+        return 0.0;
+    }
+
+private:
+    ConditionalFunction function_;
+    std::optional<Criterion> criterion_;    // строковое условие
+};
+
+class LogicalExpr final : public CallExpr
+{
+public:
+    // Бросает ParsingError, если число аргументов неверно
+    explicit LogicalExpr(LogicalFunction function, std::vector<std::unique_ptr<Expr>> args)
+        : CallExpr(GetLogicalFunctionName(function), std::move(args))
+        , function_(function)
+    {
+        if (args_.size() < GetLogicalMinArgs(function_) || args_.size() > GetLogicalMaxArgs(function_))
+        {
+            throw ParsingError("Wrong number of arguments for " + std::string(name_));
+        }
+    }
+
+    void Compile(std::vector<FormulaInstruction>& program) const override
+    {
+        CompileCall(program, FormulaInstruction::Op::Logical, static_cast<std::uint8_t>(function_));
+    }
+
+    // Аргументы вычисляются, только пока результат не известен
+    double Evaluate(const FormulaInputs& inputs) const override
+    {
+        switch (function_)
+        {
+        case LogicalFunction::If:
+            if (args_[0]->Evaluate(inputs) != 0)
+            {
+                return args_[1]->Evaluate(inputs);
+            }
+            return args_.size() > 2 ? args_[2]->Evaluate(inputs) : 0.0;
+        case LogicalFunction::And:
+            for (const auto& arg : args_)
+            {
+                if (arg->Evaluate(inputs) == 0)
+                {
+                    return 0.0;
+                }
+            }
+            return 1.0;
+        case LogicalFunction::Or:
+            for (const auto& arg : args_)
+            {
+                if (arg->Evaluate(inputs) != 0)
+                {
+                    return 1.0;
+                }
+            }
+            return 0.0;
+        }
+        return 0.0;
+    }
+
+private:
+    LogicalFunction function_;
+};
+
+// Строковая константа. Имеет значение только как условие функции
+class StringExpr final : public Expr
+{
+public:
+    // Бросает ParsingError, если строка не помещается в инструкцию
+    explicit StringExpr(std::string value)
+        : value_(std::move(value))
+    {
+        if (value_.size() > 0xFFFF)
+        {
+            throw ParsingError("String literal is too long");
+        }
+    }
+
+    void Print(std::ostream& out) const override
+    {
+        out << '"';
+        for (char ch : value_)
+        {
+            if (ch == '"')
+            {
+                out << '"';
+            }
+            out << ch;
+        }
+        out << '"';
+    }
+
+    void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */) const override
+    {
+        Print(out);
+    }
+
+    ExprPrecedence GetPrecedence() const override
+    {
+        return EP_ATOM;
+    }
+
+    void Compile(std::vector<FormulaInstruction>& program) const override
+    {
+        CompileText(program, FormulaInstruction::Op::String, value_);
+    }
+
+    double Evaluate(const FormulaInputs& /* inputs */) const override
+    {
+        throw FormulaError(FormulaError::Category::Value);
+    }
+
+    const std::string* AsString() const override
+    {
+        return &value_;
+    }
+
+private:
+    std::string value_;
+};
+
+class NumberExpr final : public Expr
+{
+public:
+    explicit NumberExpr(double value)
+        : value_(value)
+    {}
+
+    void Print(std::ostream& out) const override
+    {
+        out << value_;
+    }
+
+    void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */) const override
+    {
+        out << value_;
+    }
+
+    ExprPrecedence GetPrecedence() const override
+    {
+        return EP_ATOM;
+    }
+
+    void Compile(std::vector<FormulaInstruction>& program) const override
+    {
+        FormulaInstruction instruction;
+        instruction.op = FormulaInstruction::Op::Number;
+        instruction.number = value_;
+        program.push_back(instruction);
+    }
+
+    // Для чисел метод возвращает значение числа.
+    double Evaluate(const FormulaInputs& /* inputs */) const override
+    {
+        return value_;
+    }
+
+private:
+    double value_;
+};
+
+class ParseASTListener final : public FormulaBaseListener
+{
+public:
+    std::unique_ptr<Expr> MoveRoot()
+    {
+        assert(args_.size() == 1);
+        auto root = std::move(args_.front());
+        args_.clear();
+
+        return root;
+    }
+
+    std::forward_list<Position> MoveCells()
+    {
+        return std::move(cells_);
+    }
+
+    std::forward_list<Range> MoveRanges()
+    {
+        return std::move(ranges_);
+    }
+
+    std::forward_list<SheetReference> MoveSheetReferences()
+    {
+        return std::move(sheet_references_);
+    }
+
+    bool HasBranches() const
+    {
+        return has_branches_;
+    }
+
+public:
+    void exitUnaryOp(FormulaParser::UnaryOpContext* ctx) override
+    {
+        assert(args_.size() >= 1);
+
+        auto operand = std::move(args_.back());
+
+        UnaryOpExpr::Type type;
+        if (ctx->SUB())
+        {
+            type = UnaryOpExpr::UnaryMinus;
+        }
+        else
+        {
+            assert(ctx->ADD() != nullptr);
+            type = UnaryOpExpr::UnaryPlus;
+        }
+
+        auto node = std::make_unique<UnaryOpExpr>(type, std::move(operand));
+        args_.back() = std::move(node);
+    }
+
+    void exitLiteral(FormulaParser::LiteralContext* ctx) override
     {
         double value = 0;
         auto valueStr = ctx->NUMBER()->getSymbol()->getText();
@@ -367,9 +1305,34 @@ public:
         args_.push_back(std::move(node));
     }
 
+    void exitString(FormulaParser::StringContext* ctx) override
+    {
+        // Кавычки по краям снимаются, удвоенная кавычка внутри - одна кавычка
+        const std::string token = ctx->STRING()->getSymbol()->getText();
+        std::string value;
+        value.reserve(token.size());
+        for (std::size_t i = 1; i + 1 < token.size(); ++i)
+        {
+            value += token[i];
+            if (token[i] == '"')
+            {
+                ++i;
+            }
+        }
+        args_.push_back(std::make_unique<StringExpr>(std::move(value)));
+    }
+
     void exitCell(FormulaParser::CellContext* ctx) override
     {
         auto value_str = ctx->CELL()->getSymbol()->getText();
+        if (value_str.find('!') != std::string::npos)
+        {
+            sheet_references_.push_front(SheetReference::FromString(value_str));
+            const SheetReference& reference = sheet_references_.front();
+            args_.push_back(std::make_unique<CellExpr>(&reference.range.from, &reference.sheet));
+            return;
+        }
+
         auto value = Position::FromString(value_str);
         if (!value.IsValid())
         {
@@ -381,6 +1344,115 @@ public:
         args_.push_back(std::move(node));
     }
 
+    void exitRange(FormulaParser::RangeContext* ctx) override
+    {
+        auto first_str = ctx->CELL(0)->getSymbol()->getText();
+        auto second_str = ctx->CELL(1)->getSymbol()->getText();
+        if (const std::size_t bang = first_str.find('!'); bang != std::string::npos)
+        {
+            // Второй угол - на том же листе, с именем листа или без него
+            if (second_str.find('!') != std::string::npos)
+            {
+                if (second_str.compare(0, bang + 1, first_str, 0, bang + 1) != 0)
+                {
+                    throw FormulaException("Range corners on different sheets: " + first_str + ':' + second_str);
+                }
+                second_str.erase(0, bang + 1);
+            }
+            sheet_references_.push_front(SheetReference::FromString(first_str + ':' + second_str));
+            const SheetReference& reference = sheet_references_.front();
+            args_.push_back(std::make_unique<RangeExpr>(&reference.range, &reference.sheet));
+            return;
+        }
+
+        auto first = Position::FromString(first_str);
+        auto second = Position::FromString(second_str);
+        if (!first.IsValid() || !second.IsValid())
+        {
+            throw FormulaException("Invalid range: " + first_str + ':' + second_str);
+        }
+
+        ranges_.push_front(Range::FromCorners(first, second));
+        auto node = std::make_unique<RangeExpr>(&ranges_.front());
+        args_.push_back(std::move(node));
+    }
+
+    void exitFunction(FormulaParser::FunctionContext* ctx) override
+    {
+        auto name = ctx->NAME()->getSymbol()->getText();
+        auto function = FindAggregateFunction(name);
+        auto lookup_function = FindLookupFunction(name);
+        auto conditional_function = FindConditionalFunction(name);
+        auto logical_function = FindLogicalFunction(name);
+        if (!function && !lookup_function && !conditional_function && !logical_function)
+        {
+            throw ParsingError("Unknown function: " + name);
+        }
+
+        const std::size_t arg_count = ctx->expr().size();
+        assert(args_.size() >= arg_count);
+        std::vector<std::unique_ptr<Expr>> args(std::make_move_iterator(args_.end() - arg_count),
+                                                std::make_move_iterator(args_.end()));
+        args_.resize(args_.size() - arg_count);
+
+        if (function)
+        {
+            args_.push_back(std::make_unique<FunctionExpr>(*function, std::move(args)));
+        }
+        else if (lookup_function)
+        {
+            args_.push_back(std::make_unique<LookupExpr>(*lookup_function, std::move(args)));
+        }
+        else if (conditional_function)
+        {
+            args_.push_back(std::make_unique<ConditionalExpr>(*conditional_function, std::move(args)));
+        }
+        else
+        {
+            args_.push_back(std::make_unique<LogicalExpr>(*logical_function, std::move(args)));
+            has_branches_ = true;
+        }
+    }
+
+    void exitComparison(FormulaParser::ComparisonContext* ctx) override
+    {
+        assert(args_.size() >= 2);
+
+        auto rhs = std::move(args_.back());
+        args_.pop_back();
+
+        auto lhs = std::move(args_.back());
+
+        ComparisonExpr::Type type;
+        if (ctx->EQ())
+        {
+            type = ComparisonExpr::Type::Equal;
+        }
+        else if (ctx->NE())
+        {
+            type = ComparisonExpr::Type::NotEqual;
+        }
+        else if (ctx->LT())
+        {
+            type = ComparisonExpr::Type::Less;
+        }
+        else if (ctx->LE())
+        {
+            type = ComparisonExpr::Type::LessOrEqual;
+        }
+        else if (ctx->GT())
+        {
+            type = ComparisonExpr::Type::Greater;
+        }
+        else
+        {
+            assert(ctx->GE() != nullptr);
+            type = ComparisonExpr::Type::GreaterOrEqual;
+        }
+
+        args_.back() = std::make_unique<ComparisonExpr>(type, std::move(lhs), std::move(rhs));
+    }
+
     void exitBinaryOp(FormulaParser::BinaryOpContext* ctx) override
     {
         assert(args_.size() >= 2);
@@ -421,6 +1493,9 @@ public:
 private:
     std::vector<std::unique_ptr<Expr>> args_;
     std::forward_list<Position> cells_;
+    std::forward_list<Range> ranges_;
+    std::forward_list<SheetReference> sheet_references_;
+    bool has_branches_ = false;
 };
 
 class BailErrorListener : public antlr4::BaseErrorListener
@@ -460,7 +1535,9 @@ FormulaAST ParseFormulaAST(std::istream& in)
     ASTImpl::ParseASTListener listener;
     tree::ParseTreeWalker::DEFAULT.walk(&listener, tree);
 
-    return FormulaAST(listener.MoveRoot(), listener.MoveCells());
+    const bool has_branches = listener.HasBranches();
+    return FormulaAST(listener.MoveRoot(), listener.MoveCells(), listener.MoveRanges(), has_branches,
+                      listener.MoveSheetReferences());
 }
 
 FormulaAST ParseFormulaAST(const std::string& in_str)
@@ -469,6 +1546,220 @@ FormulaAST ParseFormulaAST(const std::string& in_str)
     return ParseFormulaAST(in);
 }
 
+FormulaAST LoadFormulaAST(const FormulaInstruction* program, std::size_t size)
+{
+    using namespace ASTImpl;
+    using Op = FormulaInstruction::Op;
+
+    std::vector<std::unique_ptr<Expr>> stack;
+    std::forward_list<Position> cells;
+    std::forward_list<Range> ranges;
+    std::forward_list<SheetReference> sheet_references;
+    bool has_branches = false;
+    // Имя листа из Op::Sheet для следующей ссылки
+    std::optional<std::string> sheet;
+    auto pop = [&stack]()
+    {
+        if (stack.empty())
+        {
+            throw ParsingError("Invalid formula program: stack underflow");
+        }
+        auto operand = std::move(stack.back());
+        stack.pop_back();
+        return operand;
+    };
+
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        const FormulaInstruction& instruction = program[i];
+        if (sheet && instruction.op != Op::Cell && instruction.op != Op::Range)
+        {
+            throw ParsingError("Invalid formula program: sheet name without a reference");
+        }
+        switch (instruction.op)
+        {
+        case Op::Number:
+            stack.push_back(std::make_unique<NumberExpr>(instruction.number));
+            break;
+        case Op::Cell:
+            if (!instruction.cell.IsValid())
+            {
+                throw ParsingError("Invalid formula program: invalid position");
+            }
+            if (sheet)
+            {
+                sheet_references.push_front(SheetReference{ *std::move(sheet), Range{ instruction.cell, instruction.cell } });
+                sheet.reset();
+                stack.push_back(std::make_unique<CellExpr>(&sheet_references.front().range.from,
+                                                           &sheet_references.front().sheet));
+                break;
+            }
+            cells.push_front(instruction.cell);
+            stack.push_back(std::make_unique<CellExpr>(&cells.front()));
+            break;
+        case Op::Range:
+        {
+            const Range range{ instruction.cell,
+                               Position{ instruction.range_end_row, instruction.range_end_col } };
+            if (!range.IsValid())
+            {
+                throw ParsingError("Invalid formula program: invalid range");
+            }
+            if (sheet)
+            {
+                sheet_references.push_front(SheetReference{ *std::move(sheet), range });
+                sheet.reset();
+                stack.push_back(std::make_unique<RangeExpr>(&sheet_references.front().range,
+                                                            &sheet_references.front().sheet));
+                break;
+            }
+            ranges.push_front(range);
+            stack.push_back(std::make_unique<RangeExpr>(&ranges.front()));
+            break;
+        }
+        case Op::Function:
+        {
+            if (instruction.function > static_cast<std::uint8_t>(AggregateFunction::Count)
+                || instruction.arg_count > stack.size())
+            {
+                throw ParsingError("Invalid formula program: invalid function call");
+            }
+            std::vector<std::unique_ptr<Expr>> args(std::make_move_iterator(stack.end() - instruction.arg_count),
+                                                    std::make_move_iterator(stack.end()));
+            stack.resize(stack.size() - instruction.arg_count);
+            stack.push_back(std::make_unique<FunctionExpr>(static_cast<AggregateFunction>(instruction.function),
+                                                           std::move(args)));
+            break;
+        }
+        case Op::Lookup:
+        {
+            if (instruction.function > static_cast<std::uint8_t>(LookupFunction::XLookup)
+                || instruction.arg_count > stack.size())
+            {
+                throw ParsingError("Invalid formula program: invalid function call");
+            }
+            std::vector<std::unique_ptr<Expr>> args(std::make_move_iterator(stack.end() - instruction.arg_count),
+                                                    std::make_move_iterator(stack.end()));
+            stack.resize(stack.size() - instruction.arg_count);
+            stack.push_back(std::make_unique<LookupExpr>(static_cast<LookupFunction>(instruction.function),
+                                                         std::move(args)));
+            break;
+        }
+        case Op::Conditional:
+        {
+            if (instruction.function > static_cast<std::uint8_t>(ConditionalFunction::AverageIf)
+                || instruction.arg_count > stack.size())
+            {
+                throw ParsingError("Invalid formula program: invalid function call");
+            }
+            std::vector<std::unique_ptr<Expr>> args(std::make_move_iterator(stack.end() - instruction.arg_count),
+                                                    std::make_move_iterator(stack.end()));
+            stack.resize(stack.size() - instruction.arg_count);
+            stack.push_back(std::make_unique<ConditionalExpr>(
+                static_cast<ConditionalFunction>(instruction.function), std::move(args)));
+            break;
+        }
+        case Op::Logical:
+        {
+            if (instruction.function > static_cast<std::uint8_t>(LogicalFunction::Or)
+                || instruction.arg_count > stack.size())
+            {
+                throw ParsingError("Invalid formula program: invalid function call");
+            }
+            std::vector<std::unique_ptr<Expr>> args(std::make_move_iterator(stack.end() - instruction.arg_count),
+                                                    std::make_move_iterator(stack.end()));
+            stack.resize(stack.size() - instruction.arg_count);
+            stack.push_back(std::make_unique<LogicalExpr>(static_cast<LogicalFunction>(instruction.function),
+                                                          std::move(args)));
+            has_branches = true;
+            break;
+        }
+        case Op::Compare:
+        {
+            if (instruction.function > static_cast<std::uint8_t>(ComparisonExpr::Type::GreaterOrEqual))
+            {
+                throw ParsingError("Invalid formula program: invalid comparison");
+            }
+            auto rhs = pop();
+            auto lhs = pop();
+            stack.push_back(std::make_unique<ComparisonExpr>(static_cast<ComparisonExpr::Type>(instruction.function),
+                                                             std::move(lhs), std::move(rhs)));
+            break;
+        }
+        case Op::String:
+        {
+            const std::size_t payload = GetPayloadSize(instruction.arg_count);
+            if (payload > size - i - 1)
+            {
+                throw ParsingError("Invalid formula program: truncated string");
+            }
+            std::string value(instruction.arg_count, '\0');
+            std::memcpy(value.data(), static_cast<const void*>(program + i + 1), value.size());
+            i += payload;
+            stack.push_back(std::make_unique<StringExpr>(std::move(value)));
+            break;
+        }
+        case Op::Sheet:
+        {
+            const std::size_t payload = GetPayloadSize(instruction.arg_count);
+            if (payload >= size - i - 1)
+            {
+                throw ParsingError("Invalid formula program: truncated sheet name");
+            }
+            sheet.emplace(instruction.arg_count, '\0');
+            std::memcpy(sheet->data(), static_cast<const void*>(program + i + 1), sheet->size());
+            if (!IsValidSheetName(*sheet))
+            {
+                throw ParsingError("Invalid formula program: invalid sheet name");
+            }
+            i += payload;
+            break;
+        }
+        case Op::Add:
+        case Op::Subtract:
+        case Op::Multiply:
+        case Op::Divide:
+        {
+            auto rhs = pop();
+            auto lhs = pop();
+            BinaryOpExpr::Type type = BinaryOpExpr::Add;
+            if (instruction.op == Op::Subtract)
+            {
+                type = BinaryOpExpr::Subtract;
+            }
+            else if (instruction.op == Op::Multiply)
+            {
+                type = BinaryOpExpr::Multiply;
+            }
+            else if (instruction.op == Op::Divide)
+            {
+                type = BinaryOpExpr::Divide;
+            }
+            stack.push_back(std::make_unique<BinaryOpExpr>(type, std::move(lhs), std::move(rhs)));
+            break;
+        }
+        case Op::UnaryPlus:
+        case Op::UnaryMinus:
+        {
+            auto type = (instruction.op == Op::UnaryMinus) ? UnaryOpExpr::UnaryMinus
+                                                           : UnaryOpExpr::UnaryPlus;
+            stack.push_back(std::make_unique<UnaryOpExpr>(type, pop()));
+            break;
+        }
+        default:
+            throw ParsingError("Invalid formula program: unknown instruction");
+        }
+    }
+
+    if (stack.size() != 1 || sheet)
+    {
+        throw ParsingError("Invalid formula program: unbalanced stack");
+    }
+
+    return FormulaAST(std::move(stack.back()), std::move(cells), std::move(ranges), has_branches,
+                      std::move(sheet_references));
+}
+
 void FormulaAST::PrintCells(std::ostream& out) const
 {
     for (auto cell : cells_)
@@ -487,6 +1778,13 @@ void FormulaAST::PrintFormula(std::ostream& out) const
     root_expr_->PrintFormula(out, ASTImpl::EP_ATOM);
 }
 
+std::vector<FormulaInstruction> FormulaAST::Compile() const
+{
+    std::vector<FormulaInstruction> program;
+    root_expr_->Compile(program);
+    return program;
+}
+
 /*
 * Два подхода для передачи параметров:
 * 1) Можно передать ссылку на таблицу в функцию и делать с ней что угодно
@@ -496,17 +1794,39 @@ void FormulaAST::PrintFormula(std::ostream& out) const
 *    передать в метод, чтобы использовать его для получения доступа к ячейкам таблицы.
 * У нас только CellExpr хранит адрес с индексом ячейки и только его Evaluate() 
 * реально производит вычисления при помощи передаваемого функтора.
+* Диапазоны читает FunctionExpr через второй функтор, FormulaInputs::range,
+* а формула массива - через FormulaInputs::array.
+* Функции поиска и условные функции обращаются к листу через свои функторы.
 */
-double FormulaAST::Execute(const std::function<double(Position)>& func) const
+double FormulaAST::Execute(const FormulaInputs& inputs) const
+{
+    return root_expr_->Evaluate(inputs);
+}
+
+std::optional<Size> FormulaAST::GetArraySize() const
+{
+    return root_expr_->GetArraySize();
+}
+
+void FormulaAST::ExecuteArray(const FormulaInputs& inputs, Size size, double* numbers, ValueCode* codes) const
 {
-    return root_expr_->Evaluate(func);
+    root_expr_->EvaluateArray(inputs, size, numbers, codes);
 }
 
-FormulaAST::FormulaAST(std::unique_ptr<ASTImpl::Expr> root_expr, std::forward_list<Position> cells)
+FormulaAST::FormulaAST(std::unique_ptr<ASTImpl::Expr> root_expr, std::forward_list<Position> cells,
+                       std::forward_list<Range> ranges, bool has_branches,
+                       std::forward_list<SheetReference> sheet_references)
     : root_expr_(std::move(root_expr))
     , cells_(std::move(cells))
+    , ranges_(std::move(ranges))
+    , sheet_references_(std::move(sheet_references))
+    , has_branches_(has_branches)
 {
     cells_.sort();  // to avoid sorting in GetReferencedCells
+    ranges_.sort();
+    sheet_references_.sort();
 }
 
+FormulaAST::FormulaAST(FormulaAST&&) = default;
+FormulaAST& FormulaAST::operator=(FormulaAST&&) = default;
 FormulaAST::~FormulaAST() = default;
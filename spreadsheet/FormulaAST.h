@@ -2,9 +2,13 @@
 
 #include "FormulaLexer.h"
 #include "common.h"
+#include "criteria.h"
+#include "formula.h"
 
+#include <cstdint>
 #include <forward_list>
 #include <functional>
+#include <optional>
 #include <stdexcept>
 
 namespace ASTImpl
@@ -12,6 +16,31 @@ namespace ASTImpl
 class Expr;
 }
 
+class Aggregate;
+enum class LookupMode : std::uint8_t;
+
+// Доступ к значениям листа при вычислении AST. Обработчики бросают
+// FormulaError, если значение - ошибка, кроме array
+struct FormulaInputs
+{
+    // Значение ячейки как числа
+    std::function<double(Position)> cell;
+    // Добавляет значения ячеек диапазона в агрегат
+    std::function<void(const Range&, Aggregate&)> range;
+    // Ищет ключ в векторе (см. Sheet::Lookup())
+    std::function<std::optional<int>(const Range&, double, LookupMode)> lookup;
+    // Условная функция по диапазону (см. Sheet::ConditionalAggregate())
+    std::function<ConditionalResult(const Range&, const Criterion&, const Range*)> conditional;
+    // Записывает значения ячеек диапазона построчно как числа (см. cell):
+    // пустые - 0, числовой текст - число, прочий текст - #VALUE!, ошибки
+    // остаются ошибками в кодах
+    std::function<void(const Range&, double*, ValueCode*)> array;
+    // Обработчики чтения другого листа книги по имени (см. SheetReference).
+    // Бросает FormulaError::Category::Ref, если такого листа нет. Не задан у
+    // формул без ссылок на другие листы
+    std::function<const FormulaInputs&(const std::string&)> sheet;
+};
+
 class ParsingError : public std::runtime_error
 {
     using std::runtime_error::runtime_error;
@@ -20,15 +49,24 @@ class ParsingError : public std::runtime_error
 class FormulaAST
 {
 public:
-    explicit FormulaAST(std::unique_ptr<ASTImpl::Expr> root_expr, std::forward_list<Position> cells);
-    FormulaAST(FormulaAST&&) = default;
-    FormulaAST& operator=(FormulaAST&&) = default;
+    explicit FormulaAST(std::unique_ptr<ASTImpl::Expr> root_expr, std::forward_list<Position> cells,
+                        std::forward_list<Range> ranges = {}, bool has_branches = false,
+                        std::forward_list<SheetReference> sheet_references = {});
+    FormulaAST(FormulaAST&&);
+    FormulaAST& operator=(FormulaAST&&);
     ~FormulaAST();
 
-    double Execute(const std::function<double(Position)>& func) const;
+    double Execute(const FormulaInputs& inputs) const;
+    // Размер массива формулы массива или nullopt (см. FormulaInterface)
+    std::optional<Size> GetArraySize() const;
+    // Вычисляет элементы формулы массива в numbers и codes из size.rows *
+    // size.cols элементов. Число у элемента-ошибки не определено
+    void ExecuteArray(const FormulaInputs& inputs, Size size, double* numbers, ValueCode* codes) const;
     void PrintCells(std::ostream& out) const;
     void Print(std::ostream& out) const;
     void PrintFormula(std::ostream& out) const;
+    // Записывает AST в обратной польской записи (см. FormulaInstruction)
+    std::vector<FormulaInstruction> Compile() const;
 
     std::forward_list<Position>& GetCells()
     {
@@ -40,6 +78,26 @@ public:
         return cells_;
     }
 
+    // Диапазоны формулы, каждый одним элементом. Их ячеек в GetCells() нет
+    const std::forward_list<Range>& GetRanges() const
+    {
+        return ranges_;
+    }
+
+    // Ссылки на другие листы, каждая одним элементом. Их ячеек и диапазонов
+    // в GetCells() и GetRanges() нет
+    const std::forward_list<SheetReference>& GetSheetReferences() const
+    {
+        return sheet_references_;
+    }
+
+    // Есть ли в формуле ветвление (IF, AND, OR): тогда вычисление читает не
+    // все ячейки формулы
+    bool HasBranches() const
+    {
+        return has_branches_;
+    }
+
 private:
     std::unique_ptr<ASTImpl::Expr> root_expr_;
 
@@ -47,7 +105,13 @@ private:
     // efficiently traversed without going through
     // the whole AST
     std::forward_list<Position> cells_;
+    std::forward_list<Range> ranges_;
+    std::forward_list<SheetReference> sheet_references_;
+    bool has_branches_ = false;
 };
 
 FormulaAST ParseFormulaAST(std::istream& in);
 FormulaAST ParseFormulaAST(const std::string& in_str);
+// Строит AST по программе из FormulaAST::Compile(). Бросает ParsingError,
+// если программа некорректна.
+FormulaAST LoadFormulaAST(const FormulaInstruction* program, std::size_t size);
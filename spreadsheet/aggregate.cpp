@@ -0,0 +1,228 @@
+#include "aggregate.h"
+
+#include "formula.h"
+
+#include <algorithm>
+#include <array>
+
+using namespace std::literals;
+
+namespace
+{
+
+constexpr std::array<std::pair<std::string_view, AggregateFunction>, 5> FUNCTION_NAMES = { {
+    { "SUM"sv, AggregateFunction::Sum },
+    { "AVERAGE"sv, AggregateFunction::Average },
+    { "MIN"sv, AggregateFunction::Min },
+    { "MAX"sv, AggregateFunction::Max },
+    { "COUNT"sv, AggregateFunction::Count },
+} };
+
+// Число независимых сумм: сложения не зависят друг от друга и
+// выполняются параллельно (в том числе векторными инструкциями)
+constexpr std::size_t SUM_LANES = 4;
+
+double SumNumbers(const double* numbers, std::size_t size)
+{
+    std::array<double, SUM_LANES> lanes{};
+    std::size_t i = 0;
+    for (; i + SUM_LANES <= size; i += SUM_LANES)
+    {
+        for (std::size_t lane = 0; lane < SUM_LANES; ++lane)
+        {
+            lanes[lane] += numbers[i + lane];
+        }
+    }
+    double sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < size; ++i)
+    {
+        sum += numbers[i];
+    }
+    return sum;
+}
+
+}  // namespace
+
+std::optional<AggregateFunction> FindAggregateFunction(std::string_view name)
+{
+    for (const auto& [function_name, function] : FUNCTION_NAMES)
+    {
+        if (function_name == name)
+        {
+            return function;
+        }
+    }
+    return std::nullopt;
+}
+
+std::string_view GetAggregateFunctionName(AggregateFunction function)
+{
+    for (const auto& [function_name, known_function] : FUNCTION_NAMES)
+    {
+        if (known_function == function)
+        {
+            return function_name;
+        }
+    }
+    return {};
+}
+
+void NumberSummary::Add(double value)
+{
+    sum += value;
+    min = std::min(min, value);
+    max = std::max(max, value);
+    ++count;
+}
+
+void NumberSummary::Merge(const NumberSummary& other)
+{
+    sum += other.sum;
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+    count += other.count;
+}
+
+Aggregate::Aggregate(AggregateFunction function)
+    : function_(function)
+{}
+
+AggregateFunction Aggregate::GetFunction() const
+{
+    return function_;
+}
+
+void Aggregate::Add(double value)
+{
+    numbers_.Add(value);
+}
+
+void Aggregate::AddText(std::string_view text)
+{
+    try
+    {
+        Add(TextToNumber(text));
+    }
+    catch (const FormulaError&)
+    {
+        if (function_ != AggregateFunction::Count)
+        {
+            throw;
+        }
+    }
+}
+
+void Aggregate::AddError(FormulaError error)
+{
+    if (function_ != AggregateFunction::Count)
+    {
+        throw error;
+    }
+}
+
+void Aggregate::AddValues(const double* numbers, const ValueCode* codes, const std::string_view* texts,
+                          std::size_t size)
+{
+    // Старший код блока показывает, есть ли в нём текст или ошибки
+    std::uint8_t top_code = 0;
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        top_code = std::max(top_code, static_cast<std::uint8_t>(codes[i]));
+    }
+    if (top_code <= static_cast<std::uint8_t>(ValueCode::Number))
+    {
+        AddNumbers(numbers, codes, size);
+        return;
+    }
+
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        switch (codes[i])
+        {
+        case ValueCode::Empty:
+            break;
+        case ValueCode::Number:
+            Add(numbers[i]);
+            break;
+        case ValueCode::Text:
+            AddText(texts[i]);
+            break;
+        default:
+            AddError(ToFormulaError(codes[i]));
+            break;
+        }
+    }
+}
+
+void Aggregate::AddSummary(const NumberSummary& summary)
+{
+    numbers_.Merge(summary);
+}
+
+void Aggregate::AddNumbers(const double* numbers, const ValueCode* codes, std::size_t size)
+{
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        count += codes[i] == ValueCode::Number;
+    }
+    numbers_.count += count;
+
+    // Пустые ячейки в numbers - нули: для суммы их отбрасывать не нужно,
+    // для минимума и максимума они заменяются нейтральным значением
+    constexpr double infinity = std::numeric_limits<double>::infinity();
+    switch (function_)
+    {
+    case AggregateFunction::Sum:
+    case AggregateFunction::Average:
+        numbers_.sum += SumNumbers(numbers, size);
+        break;
+    case AggregateFunction::Min:
+    {
+        // Локальная копия: запись в член класса мешала бы векторизации
+        double min = numbers_.min;
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            const double value = codes[i] == ValueCode::Number ? numbers[i] : infinity;
+            min = value < min ? value : min;
+        }
+        numbers_.min = min;
+        break;
+    }
+    case AggregateFunction::Max:
+    {
+        double max = numbers_.max;
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            const double value = codes[i] == ValueCode::Number ? numbers[i] : -infinity;
+            max = value > max ? value : max;
+        }
+        numbers_.max = max;
+        break;
+    }
+    case AggregateFunction::Count:
+        break;
+    }
+}
+
+double Aggregate::GetResult() const
+{
+    switch (function_)
+    {
+    case AggregateFunction::Sum:
+        return numbers_.sum;
+    case AggregateFunction::Average:
+        if (numbers_.count == 0)
+        {
+            throw FormulaError(FormulaError::Category::Div0);
+        }
+        return numbers_.sum / static_cast<double>(numbers_.count);
+    case AggregateFunction::Min:
+        return numbers_.count == 0 ? 0.0 : numbers_.min;
+    case AggregateFunction::Max:
+        return numbers_.count == 0 ? 0.0 : numbers_.max;
+    case AggregateFunction::Count:
+        return static_cast<double>(numbers_.count);
+    }
+    return 0.0;
+}
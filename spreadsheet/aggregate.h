@@ -0,0 +1,80 @@
+#pragma once
+
+#include "cell.h"
+#include "common.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <string_view>
+
+// Агрегатные функции формул: SUM, AVERAGE, MIN, MAX, COUNT.
+// Аргументы функции накапливаются в Aggregate по одному значению или блоками
+// значений диапазона в формате Sheet::GetValues(). Блок без текста и ошибок
+// обрабатывается циклами без ветвлений по непрерывным массивам, которые
+// компилятор векторизует; остальные блоки - поэлементно.
+// Правила для значений:
+// * пустые ячейки диапазона пропускаются;
+// * текст трактуется как число по правилам формул (см. TextToNumber()),
+//   иначе результат - ошибка #VALUE!;
+// * ошибка в любом аргументе становится результатом функции.
+// COUNT считает только числа (в том числе числовой текст) и ошибок не
+// возвращает. AVERAGE без чисел даёт #DIV/0!, MIN и MAX без чисел - 0.
+
+enum class AggregateFunction : std::uint8_t
+{
+    Sum,
+    Average,
+    Min,
+    Max,
+    Count,
+};
+
+// Сводка по набору чисел, из которой вычисляется любая агрегатная функция.
+// Сводки частей набора объединяются (см. ColumnAggregateIndex)
+struct NumberSummary
+{
+    double sum = 0.0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+    std::size_t count = 0;
+
+    void Add(double value);
+    void Merge(const NumberSummary& other);
+};
+
+// Функция по имени в формуле или nullopt, если имя неизвестно
+std::optional<AggregateFunction> FindAggregateFunction(std::string_view name);
+std::string_view GetAggregateFunctionName(AggregateFunction function);
+
+class Aggregate
+{
+public:
+    explicit Aggregate(AggregateFunction function);
+
+    AggregateFunction GetFunction() const;
+
+    // Добавляет значение аргумента
+    void Add(double value);
+    // Добавляет текст ячейки. Бросает FormulaError, если текст не число
+    // (кроме COUNT)
+    void AddText(std::string_view text);
+    // Добавляет ошибку аргумента: бросает её (кроме COUNT)
+    void AddError(FormulaError error);
+    // Добавляет блок из size значений в формате Sheet::GetValues()
+    void AddValues(const double* numbers, const ValueCode* codes, const std::string_view* texts,
+                   std::size_t size);
+    // Добавляет сразу все числа, сведённые в summary
+    void AddSummary(const NumberSummary& summary);
+
+    // Результат функции. Бросает FormulaError
+    double GetResult() const;
+
+private:
+    // Блок только из чисел и пустых ячеек
+    void AddNumbers(const double* numbers, const ValueCode* codes, std::size_t size);
+
+    AggregateFunction function_;
+    NumberSummary numbers_;
+};
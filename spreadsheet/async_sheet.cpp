@@ -0,0 +1,316 @@
+#include "async_sheet.h"
+
+#include "cell.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace
+{
+
+// Сколько ячеек фоновый поток вычисляет и запоминает за одну блокировку читателей
+constexpr std::size_t COMMIT_BATCH = 256;
+
+}  // namespace
+
+AsyncSheet::AsyncSheet()
+    : sheet_ptr_(CreateSheet())
+    , sheet_(dynamic_cast<Sheet&>(*sheet_ptr_))
+{
+    sheet_.Subscribe(*this, {}, NotifyMode::Invalidated);
+    worker_ = std::thread(&AsyncSheet::Run, this);
+}
+
+AsyncSheet::~AsyncSheet()
+{
+    {
+        std::lock_guard<std::mutex> state_lock(state_mutex_);
+        stop_ = true;
+    }
+    state_changed_.notify_all();
+    worker_.join();
+    sheet_.Unsubscribe(*this);
+}
+
+template <typename Edit>
+void AsyncSheet::Apply(Edit&& edit)
+{
+    // Фоновый поток видит ждущую правку и отпускает лист на границе ячеек
+    std::lock_guard<std::mutex> edit_lock(edit_mutex_);
+    edit_waiting_ = true;
+    std::lock_guard<std::mutex> sheet_lock(sheet_mutex_);
+    edit_waiting_ = false;
+    try
+    {
+        edit();
+    }
+    catch (...)
+    {
+        // Правки пакета до некорректной уже применены
+        Schedule();
+        throw;
+    }
+    Schedule();
+}
+
+void AsyncSheet::SetCell(Position pos, const std::string& text)
+{
+    Apply([&]
+          {
+              sheet_.SetCell(pos, text);
+          });
+}
+
+void AsyncSheet::ClearCell(Position pos)
+{
+    Apply([&]
+          {
+              sheet_.ClearCell(pos);
+          });
+}
+
+void AsyncSheet::ApplyEdits(const std::vector<CellEdit>& edits)
+{
+    Apply([&]
+          {
+              sheet_.ApplyEdits(edits);
+          });
+}
+
+AsyncValue AsyncSheet::GetValue(Position pos) const
+{
+    if (!pos.IsValid())
+    {
+        throw InvalidPositionException("Invalid position for AsyncSheet::GetValue()");
+    }
+
+    std::lock_guard<std::mutex> state_lock(state_mutex_);
+    AsyncValue result;
+    if (auto it = values_.find(pos); it != values_.end())
+    {
+        result.value = it->second;
+    }
+    result.stale = stale_.count(pos) != 0;
+    return result;
+}
+
+std::shared_future<CellInterface::Value> AsyncSheet::GetFreshValue(Position pos) const
+{
+    if (!pos.IsValid())
+    {
+        throw InvalidPositionException("Invalid position for AsyncSheet::GetFreshValue()");
+    }
+
+    std::lock_guard<std::mutex> state_lock(state_mutex_);
+    auto stale_it = stale_.find(pos);
+    if (stale_it == stale_.end())
+    {
+        std::promise<CellInterface::Value> ready;
+        auto it = values_.find(pos);
+        ready.set_value(it != values_.end() ? it->second : CellInterface::Value(0.0));
+        return ready.get_future().share();
+    }
+
+    StaleCell& stale = stale_it->second;
+    if (!stale.future.valid())
+    {
+        stale.future = stale.promise.get_future().share();
+        // Ячейка, которую ждёт читатель, пересчитывается первой
+        reorder_ = true;
+    }
+    return stale.future;
+}
+
+void AsyncSheet::SetPriorityRanges(std::vector<Range> ranges)
+{
+    for (const Range& range : ranges)
+    {
+        if (!range.IsValid())
+        {
+            throw InvalidPositionException("Invalid range for AsyncSheet::SetPriorityRanges()");
+        }
+    }
+
+    std::lock_guard<std::mutex> state_lock(state_mutex_);
+    priority_ranges_ = std::move(ranges);
+    reorder_ = true;
+}
+
+void AsyncSheet::WaitIdle() const
+{
+    std::unique_lock<std::mutex> state_lock(state_mutex_);
+    state_changed_.wait(state_lock, [this]
+                        {
+                            return stale_.empty();
+                        });
+}
+
+AsyncRecalcStats AsyncSheet::GetStats() const
+{
+    std::lock_guard<std::mutex> state_lock(state_mutex_);
+    return stats_;
+}
+
+void AsyncSheet::OnValuesInvalidated(Span<const Position> stale)
+{
+    invalidated_.insert(invalidated_.end(), stale.begin(), stale.end());
+}
+
+void AsyncSheet::OnValuesChanged(Span<const Position> changed)
+{
+    // Подписка только на сброс значений
+}
+
+void AsyncSheet::Schedule()
+{
+    {
+        std::lock_guard<std::mutex> state_lock(state_mutex_);
+        for (const Position& pos : invalidated_)
+        {
+            // Ячейки области разлива (не Cell) берут значение у якоря
+            const CellInterface* cell = std::as_const(sheet_).GetCell(pos);
+            const Cell* plain_cell = dynamic_cast<const Cell*>(cell);
+            if (!cell || (plain_cell && plain_cell->IsCacheValid()))
+            {
+                Commit(pos, cell);
+            }
+            else
+            {
+                stale_.try_emplace(pos);
+            }
+        }
+    }
+    invalidated_.clear();
+    state_changed_.notify_all();
+}
+
+void AsyncSheet::Commit(Position pos, const CellInterface* cell)
+{
+    CellInterface::Value value = 0.0;
+    if (cell)
+    {
+        value = cell->GetValue();
+        values_[pos] = value;
+    }
+    else
+    {
+        values_.erase(pos);
+    }
+
+    if (auto it = stale_.find(pos); it != stale_.end())
+    {
+        if (it->second.future.valid())
+        {
+            it->second.promise.set_value(std::move(value));
+        }
+        stale_.erase(it);
+    }
+}
+
+void AsyncSheet::OrderWork(std::vector<Position>& work, std::vector<std::size_t>& class_ends) const
+{
+    // Внутри группы ячейки идут по возрастанию позиции
+    std::vector<Position> queried;
+    std::vector<Position> prioritized;
+    std::vector<Position> rest;
+    for (const auto& [pos, stale] : stale_)
+    {
+        if (stale.future.valid())
+        {
+            queried.push_back(pos);
+        }
+        else if (std::any_of(priority_ranges_.begin(), priority_ranges_.end(), [pos = pos](const Range& range)
+                             {
+                                 return range.Contains(pos);
+                             }))
+        {
+            prioritized.push_back(pos);
+        }
+        else
+        {
+            rest.push_back(pos);
+        }
+    }
+
+    work = std::move(queried);
+    class_ends.assign({ work.size() });
+    work.insert(work.end(), prioritized.begin(), prioritized.end());
+    class_ends.push_back(work.size());
+    work.insert(work.end(), rest.begin(), rest.end());
+    class_ends.push_back(work.size());
+}
+
+void AsyncSheet::Run()
+{
+    std::unique_lock<std::mutex> state_lock(state_mutex_);
+    while (true)
+    {
+        state_changed_.wait(state_lock, [this]
+                            {
+                                return stop_ || (!stale_.empty() && !edit_waiting_);
+                            });
+        if (stop_)
+        {
+            return;
+        }
+
+        std::vector<Position> work;
+        std::vector<std::size_t> class_ends;
+        OrderWork(work, class_ends);
+        reorder_ = false;
+        state_lock.unlock();
+
+        // Пока идёт проход, лист не меняется: ячейки work, ставшие
+        // актуальными из-за правки до него, просто запоминаются заново.
+        // Ячейки вычисляются порциями в пределах одного приоритета, и
+        // значения каждой порции запоминаются за одну блокировку читателей
+        bool cancelled = false;
+        bool reordered = false;
+        {
+            std::lock_guard<std::mutex> sheet_lock(sheet_mutex_);
+            RecalcLimit limit;
+            limit.cancel = &edit_waiting_;
+            std::vector<Range> ranges;
+            std::size_t class_index = 0;
+            for (std::size_t first = 0; first < work.size() && !cancelled;)
+            {
+                if (reorder_)
+                {
+                    reordered = true;
+                    break;
+                }
+                while (class_ends[class_index] <= first)
+                {
+                    ++class_index;
+                }
+                const std::size_t last = std::min(class_ends[class_index], first + COMMIT_BATCH);
+                ranges.clear();
+                for (std::size_t i = first; i < last; ++i)
+                {
+                    ranges.push_back(Range{ work[i], work[i] });
+                }
+                const RecalcProgress progress = sheet_.Recalculate(ranges, limit);
+                cancelled = !progress.complete;
+
+                std::lock_guard<std::mutex> commit_lock(state_mutex_);
+                for (std::size_t i = first; i < last; ++i)
+                {
+                    // Значения ячеек разлива у прерванной порции могут быть
+                    // ещё не вычислены
+                    const CellInterface* cell = std::as_const(sheet_).GetCell(work[i]);
+                    const Cell* plain_cell = dynamic_cast<const Cell*>(cell);
+                    if (!cancelled || !cell || (plain_cell && plain_cell->IsCacheValid()))
+                    {
+                        Commit(work[i], cell);
+                        ++stats_.evaluated;
+                    }
+                }
+                first = last;
+            }
+        }
+
+        state_lock.lock();
+        ++(cancelled ? stats_.cancelled : reordered ? stats_.reordered : stats_.passes);
+        state_changed_.notify_all();
+    }
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include "change_feed.h"
+#include "common.h"
+#include "sheet.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Значение ячейки для читателей AsyncSheet
+struct AsyncValue
+{
+    // Последнее вычисленное значение; у пустой ячейки - 0, как у Cell
+    CellInterface::Value value = 0.0;
+    // Значение могло устареть: ячейка ждёт фонового пересчёта
+    bool stale = false;
+};
+
+// Счётчики фонового пересчёта AsyncSheet
+struct AsyncRecalcStats
+{
+    std::size_t passes = 0;       // проходов пересчёта, доведённых до конца
+    std::size_t cancelled = 0;    // проходов, прерванных более новой правкой
+    std::size_t reordered = 0;    // проходов, прерванных ради новых приоритетных ячеек
+    std::size_t evaluated = 0;    // ячеек, значения которых вычислил фоновый поток
+};
+
+// Лист с фоновым пересчётом. Правка применяет изменение и обновляет граф
+// зависимостей, как Sheet, и сразу возвращается; значения ячеек, которые от
+// неё могли измениться, вычисляет фоновый поток. Читатели в любых потоках
+// получают последнее вычисленное значение с отметкой, не устарело ли оно,
+// или future, которое выполнится, когда значение станет актуальным.
+// Правка прерывает идущий пересчёт между ячейками (см. Sheet::Recalculate()):
+// вычисленные значения остаются в кэше, а остальные пересчитываются уже с
+// учётом новой правки.
+// Пересчёт идёт в порядке приоритета: сначала ячейки, значения которых ждут
+// читатели (GetFreshValue()), затем приоритетные диапазоны (видимое окно,
+// подписки), затем остальные. Значения становятся доступны читателям
+// порциями по мере вычисления, не дожидаясь конца пересчёта.
+class AsyncSheet final : private SheetObserver
+{
+public:
+    AsyncSheet();
+    ~AsyncSheet();
+
+    AsyncSheet(const AsyncSheet&) = delete;
+    AsyncSheet& operator=(const AsyncSheet&) = delete;
+
+    // Любой поток; правки применяются по очереди. Исключения те же, что у
+    // Sheet: некорректная правка не применяется, правки пакета до неё
+    // остаются применёнными
+    void SetCell(Position pos, const std::string& text);
+    void ClearCell(Position pos);
+    void ApplyEdits(const std::vector<CellEdit>& edits);
+
+    // Любой поток, не ждёт пересчёта. Бросает InvalidPositionException для
+    // некорректной позиции
+    AsyncValue GetValue(Position pos) const;
+    // Любой поток: значение pos, как только оно станет актуальным. Если
+    // до этого придёт правка, future выполнится значением с её учётом. Если
+    // лист будет уничтожен раньше, future бросит std::future_error
+    std::shared_future<CellInterface::Value> GetFreshValue(Position pos) const;
+
+    // Любой поток: задаёт приоритетные диапазоны (пустой вектор - нет таких).
+    // Идущий пересчёт переключается на них на границе порции. Бросает
+    // InvalidPositionException для некорректного диапазона
+    void SetPriorityRanges(std::vector<Range> ranges);
+
+    // Ждёт, пока фоновый поток пересчитает все устаревшие значения
+    void WaitIdle() const;
+    AsyncRecalcStats GetStats() const;
+
+private:
+    std::unique_ptr<SheetInterface> sheet_ptr_;
+    Sheet& sheet_;
+    // Лист правится и вычисляется только под этой блокировкой
+    std::mutex sheet_mutex_;
+    // Правки проходят к листу по одной. Правка, ждущая sheet_mutex_,
+    // выставляет edit_waiting_, и фоновый поток отпускает лист
+    std::mutex edit_mutex_;
+    std::atomic<bool> edit_waiting_{ false };
+    // Ячейки, значения которых могла изменить текущая правка (см. OnValuesInvalidated())
+    std::vector<Position> invalidated_;
+
+    // Состояние для читателей и фонового потока
+    mutable std::mutex state_mutex_;
+    mutable std::condition_variable state_changed_;
+    // Последние вычисленные значения существующих ячеек
+    std::map<Position, CellInterface::Value> values_;
+    // Ячейка с устаревшим значением. future создаётся, когда значение
+    // запрашивает читатель (см. GetFreshValue())
+    struct StaleCell
+    {
+        std::promise<CellInterface::Value> promise;
+        std::shared_future<CellInterface::Value> future;
+    };
+    mutable std::map<Position, StaleCell> stale_;
+    std::vector<Range> priority_ranges_;
+    // Появились новые приоритетные ячейки: проход нужно перестроить
+    mutable std::atomic<bool> reorder_{ false };
+    bool stop_ = false;
+    AsyncRecalcStats stats_;
+
+    std::thread worker_;
+
+    void OnValuesInvalidated(Span<const Position> stale) override;
+    void OnValuesChanged(Span<const Position> changed) override;
+
+    // Применяет правку edit под блокировкой листа и планирует пересчёт
+    template <typename Edit>
+    void Apply(Edit&& edit);
+    // Отмечает значения ячеек invalidated_ устаревшими. Значения, известные
+    // без вычисления (текст, пустые ячейки), обновляет сразу
+    void Schedule();
+    // Запоминает актуальное значение ячейки pos и выполняет future читателей
+    void Commit(Position pos, const CellInterface* cell);
+    // Ячейки stale_ в порядке пересчёта. В class_ends - концы групп ячеек
+    // одного приоритета
+    void OrderWork(std::vector<Position>& work, std::vector<std::size_t>& class_ends) const;
+    // Фоновый поток
+    void Run();
+};
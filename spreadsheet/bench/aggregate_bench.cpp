@@ -0,0 +1,85 @@
+// Бенчмарк агрегатных функций по диапазонам: SUM/MIN/COUNT по блоку
+// вычисленных чисел и по блоку числового текста в сравнении с формулой из
+// сложений отдельных ячеек того же столбца.
+//
+// Запуск: aggregate_bench [число строк]
+
+#include "bench_util.h"
+
+#include "common.h"
+
+#include <string>
+
+namespace
+{
+
+constexpr int COLUMNS = 8;
+constexpr int PASSES = 10;
+// Столько ячеек складывает формула-сумма через "+"
+constexpr int PLUS_TERMS = 1000;
+
+void Fill(SheetInterface& sheet, int rows)
+{
+    for (int row = 0; row < rows; ++row)
+    {
+        for (int col = 0; col < COLUMNS; ++col)
+        {
+            const std::string number = std::to_string((row * COLUMNS + col) % 1000);
+            // Левая половина - формулы-числа, правая - числовой текст
+            sheet.SetCell(Position{ row, col }, col < COLUMNS / 2 ? "=" + number : number);
+        }
+    }
+}
+
+// input - ячейка, от которой зависит формула
+void Measure(SheetInterface& sheet, const std::string& name, const std::string& formula,
+             std::size_t cells, Position input, int passes = PASSES)
+{
+    const Position target{ 0, COLUMNS + 1 };
+    sheet.SetCell(target, formula);
+    const std::string input_text = sheet.GetCell(input)->GetText();
+
+    bench::Timer timer;
+    double result = 0;
+    for (int pass = 0; pass < passes; ++pass)
+    {
+        // Правка входной ячейки сбрасывает кэш формулы, поэтому каждый
+        // GetValue() - новое вычисление
+        sheet.SetCell(input, input_text);
+        const CellInterface::Value value = sheet.GetCell(target)->GetValue();
+        result = std::holds_alternative<double>(value) ? std::get<double>(value) : -1.0;
+    }
+    bench::Report(name, cells * passes, timer.Seconds());
+    std::printf("  = %.1f\n", result);
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    const int rows = static_cast<int>(bench::SizeArgument(argc, argv, Position::MAX_ROWS));
+    const std::size_t half = static_cast<std::size_t>(rows) * COLUMNS / 2;
+
+    auto sheet = CreateSheet();
+    Fill(*sheet, rows);
+
+    const Position last_number{ rows - 1, COLUMNS / 2 - 1 };
+    const Position first_text{ 0, COLUMNS / 2 };
+    const Position last_text{ rows - 1, COLUMNS - 1 };
+    const std::string numbers = "A1:" + last_number.ToString();
+    const std::string texts = first_text.ToString() + ":" + last_text.ToString();
+
+    Measure(*sheet, "SUM over computed numbers", "=SUM(" + numbers + ")", half, Position{ 0, 0 });
+    Measure(*sheet, "MIN over computed numbers", "=MIN(" + numbers + ")", half, Position{ 0, 0 });
+    Measure(*sheet, "COUNT over computed numbers", "=COUNT(" + numbers + ")", half, Position{ 0, 0 });
+    Measure(*sheet, "SUM over numeric text", "=SUM(" + texts + ")", half, first_text);
+
+    const int terms = std::min(PLUS_TERMS, rows);
+    std::string plus = "=A1";
+    for (int row = 1; row < terms; ++row)
+    {
+        plus += "+A" + std::to_string(row + 1);
+    }
+    Measure(*sheet, "A1+A2+... per-cell formula", plus, terms, Position{ 0, 0 }, PASSES * 50);
+    return 0;
+}
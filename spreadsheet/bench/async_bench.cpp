@@ -0,0 +1,93 @@
+// Бенчмарк фонового пересчёта: n формул вида =A1+SUM(Ai:Ai+99) в столбце B,
+// все зависят от A1. Сессия - серия правок A1, после каждой поток ввода читает
+// окно из 30 ячеек B. С Sheet правка вместе с чтением ждёт пересчёта всего
+// столбца (его значения нужны, например, подписчикам), с AsyncSheet поток
+// ввода получает последние вычисленные значения, а пересчёт идёт в фоне и
+// прерывается следующей правкой. Измеряются правки в секунду и задержка
+// правки в потоке ввода: медианная и худшая.
+//
+// Запуск: async_bench [число формул]
+
+#include "bench_util.h"
+
+#include "async_sheet.h"
+#include "sheet.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+constexpr int EDITS = 200;
+constexpr int VIEW_ROWS = 30;
+constexpr int WINDOW = 100;
+
+void ReportLatency(const std::string& name, std::vector<double> latencies, double seconds)
+{
+    bench::Report(name, latencies.size(), seconds);
+    std::sort(latencies.begin(), latencies.end());
+    std::printf("  edit latency: median %.3f ms, worst %.3f ms\n", latencies[latencies.size() / 2] * 1000,
+                latencies.back() * 1000);
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    const int rows = static_cast<int>(std::min<std::size_t>(bench::SizeArgument(argc, argv, 10000), Position::MAX_ROWS));
+    std::printf("%d formulas depending on A1, %d edits of A1\n", rows, EDITS);
+
+    std::vector<CellEdit> edits;
+    for (int row = 0; row < rows; ++row)
+    {
+        const std::string n = std::to_string(row + 1);
+        edits.push_back(CellEdit{ Position{ row, 0 }, n });
+        edits.push_back(CellEdit{ Position{ row, 1 }, "=A1+SUM(A" + n + ":A" + std::to_string(std::min(row + WINDOW, rows)) + ")" });
+    }
+    std::vector<double> latencies;
+
+    {
+        auto sheet_ptr = CreateSheet();
+        Sheet& sheet = dynamic_cast<Sheet&>(*sheet_ptr);
+        sheet.ApplyEdits(edits);
+        std::vector<double> numbers(rows);
+        bench::Timer total;
+        for (int edit = 0; edit < EDITS; ++edit)
+        {
+            bench::Timer timer;
+            sheet.SetCell(Position{ 0, 0 }, "=" + std::to_string(edit));
+            sheet.GetValues(Position{ 0, 1 }, Size{ rows, 1 }, ValueBuffers{ numbers.data() });
+            latencies.push_back(timer.Seconds());
+        }
+        ReportLatency("Sheet: edit + recalculate", latencies, total.Seconds());
+    }
+
+    {
+        AsyncSheet sheet;
+        sheet.ApplyEdits(edits);
+        sheet.WaitIdle();
+        latencies.clear();
+        double sum = 0;
+        bench::Timer total;
+        for (int edit = 0; edit < EDITS; ++edit)
+        {
+            bench::Timer timer;
+            sheet.SetCell(Position{ 0, 0 }, "=" + std::to_string(edit));
+            for (int row = 0; row < std::min(VIEW_ROWS, rows); ++row)
+            {
+                const AsyncValue value = sheet.GetValue(Position{ row, 1 });
+                sum += std::get<double>(value.value);
+            }
+            latencies.push_back(timer.Seconds());
+        }
+        ReportLatency("AsyncSheet: edit + read last values", latencies, total.Seconds());
+        sheet.WaitIdle();
+        bench::Report("AsyncSheet: edits until recalculated", EDITS, total.Seconds());
+        const AsyncRecalcStats stats = sheet.GetStats();
+        std::printf("  passes %zu, cancelled %zu, cells evaluated %zu (sum %.0f)\n", stats.passes,
+                    stats.cancelled, stats.evaluated, sum);
+    }
+    return 0;
+}
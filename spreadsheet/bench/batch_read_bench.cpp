@@ -0,0 +1,118 @@
+// Бенчмарк пакетного чтения: сравнивает Sheet::GetValues() с циклом
+// GetCell() + GetValue() по тем же ячейкам. Блок заполнен текстом и числами
+// в виде текста; каждая пятидесятая ячейка - формула-константа.
+//
+// Запуск: batch_read_bench [сторона блока]
+
+#include "bench_util.h"
+
+#include "sheet.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace
+{
+
+constexpr int PASSES = 5;
+
+void Fill(SheetInterface& sheet, int side)
+{
+    for (int row = 0; row < side; ++row)
+    {
+        for (int col = 0; col < side; ++col)
+        {
+            const Position pos{ row, col };
+            const int index = row * side + col;
+            if (index % 50 == 49)
+            {
+                sheet.SetCell(pos, "=" + std::to_string(index % 1000) + ".5");
+            }
+            else if (index % 3 == 0)
+            {
+                sheet.SetCell(pos, "description of item " + std::to_string(index));
+            }
+            else
+            {
+                sheet.SetCell(pos, std::to_string(index));
+            }
+        }
+    }
+}
+
+// Контрольная сумма: сумма чисел и длин текстов
+double CellLoop(const SheetInterface& sheet, int side)
+{
+    double sum = 0;
+    for (int row = 0; row < side; ++row)
+    {
+        for (int col = 0; col < side; ++col)
+        {
+            const CellInterface* cell = sheet.GetCell(Position{ row, col });
+            if (!cell)
+            {
+                continue;
+            }
+            const CellInterface::Value value = cell->GetValue();
+            if (const double* number = std::get_if<double>(&value))
+            {
+                sum += *number;
+            }
+            else if (const std::string* text = std::get_if<std::string>(&value))
+            {
+                sum += static_cast<double>(text->size());
+            }
+        }
+    }
+    return sum;
+}
+
+double BatchRead(const Sheet& sheet, int side, std::vector<double>& numbers,
+                 std::vector<ValueCode>& codes, std::vector<std::string_view>& texts)
+{
+    sheet.GetValues(Position{ 0, 0 }, Size{ side, side },
+                    ValueBuffers{ numbers.data(), codes.data(), texts.data() });
+    double sum = 0;
+    for (std::size_t index = 0; index < codes.size(); ++index)
+    {
+        sum += numbers[index] + static_cast<double>(texts[index].size());
+    }
+    return sum;
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    const int side = static_cast<int>(bench::SizeArgument(argc, argv, 1000));
+    const std::size_t cells = static_cast<std::size_t>(side) * side;
+
+    auto sheet = CreateSheet();
+    Fill(*sheet, side);
+
+    double loop_sum = 0;
+    {
+        bench::Timer timer;
+        for (int pass = 0; pass < PASSES; ++pass)
+        {
+            loop_sum = CellLoop(*sheet, side);
+        }
+        bench::Report("GetCell + GetValue loop", cells * PASSES, timer.Seconds());
+    }
+
+    std::vector<double> numbers(cells);
+    std::vector<ValueCode> codes(cells);
+    std::vector<std::string_view> texts(cells);
+    double batch_sum = 0;
+    {
+        bench::Timer timer;
+        for (int pass = 0; pass < PASSES; ++pass)
+        {
+            batch_sum = BatchRead(dynamic_cast<const Sheet&>(*sheet), side, numbers, codes, texts);
+        }
+        bench::Report("GetValues into buffers", cells * PASSES, timer.Seconds());
+    }
+    std::printf("  checksum %.1f (loop: %.1f)\n", batch_sum, loop_sum);
+    return 0;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+
+// Общие помощники бенчмарков
+namespace bench
+{
+
+class Timer
+{
+public:
+    Timer()
+        : start_(std::chrono::steady_clock::now())
+    {
+    }
+
+    double Seconds() const
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point start_;
+};
+
+// Печатает строку результата: название, число операций, время и пропускную способность
+inline void Report(const std::string& name, std::size_t ops, double seconds)
+{
+    std::printf("%-44s %12zu ops %10.3f s %14.0f ops/s\n", name.c_str(), ops, seconds,
+                seconds > 0 ? static_cast<double>(ops) / seconds : 0.0);
+}
+
+// Размер задачи из первого аргумента командной строки
+inline std::size_t SizeArgument(int argc, char** argv, std::size_t default_size)
+{
+    return argc > 1 ? static_cast<std::size_t>(std::strtoull(argv[1], nullptr, 10)) : default_size;
+}
+
+// Пустой временный каталог для файлов бенчмарка
+inline std::string TempDirectory(const std::string& name)
+{
+    const auto path = std::filesystem::temp_directory_path() / ("spreadsheet-bench-" + name);
+    std::filesystem::remove_all(path);
+    std::filesystem::create_directories(path);
+    return path.string();
+}
+
+}  // namespace bench
@@ -0,0 +1,141 @@
+// Бенчмарк выгрузки по столбцам: сравнивает ExportColumns() с циклом GetValue()
+// по ячейкам, который раскладывает значения в такие же столбцы вручную.
+//
+// Запуск: columnar_bench [число строк]
+
+#include "bench_util.h"
+
+#include "columnar.h"
+
+#include <filesystem>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+constexpr int COLUMNS = 16;
+
+void Fill(SheetInterface& sheet, int rows)
+{
+    for (int row = 0; row < rows; ++row)
+    {
+        for (int col = 0; col < COLUMNS; ++col)
+        {
+            const Position pos{ row, col };
+            if (col % 4 == 3)
+            {
+                sheet.SetCell(pos, "item " + std::to_string(row));
+            }
+            else if (row % 100 == 99)
+            {
+                sheet.SetCell(pos, "=1/0");
+            }
+            else
+            {
+                sheet.SetCell(pos, "=" + std::to_string(row * COLUMNS + col) + ".5");
+            }
+        }
+    }
+}
+
+// Столбец, собранный из GetValue() вручную
+struct ManualColumn
+{
+    std::vector<double> numbers;
+    std::vector<bool> is_number;
+    std::vector<std::string> texts;
+    std::vector<int> errors;
+};
+
+double ManualLoop(const SheetInterface& sheet, int rows)
+{
+    double sum = 0;
+    std::vector<ManualColumn> columns(COLUMNS);
+    for (int col = 0; col < COLUMNS; ++col)
+    {
+        ManualColumn& column = columns[col];
+        column.numbers.resize(rows);
+        column.is_number.resize(rows);
+        column.texts.resize(rows);
+        column.errors.resize(rows, -1);
+        for (int row = 0; row < rows; ++row)
+        {
+            const CellInterface::Value value = sheet.GetCell(Position{ row, col })->GetValue();
+            if (const double* number = std::get_if<double>(&value))
+            {
+                column.numbers[row] = *number;
+                column.is_number[row] = true;
+                sum += *number;
+            }
+            else if (const FormulaError* error = std::get_if<FormulaError>(&value))
+            {
+                column.errors[row] = static_cast<int>(error->GetCategory());
+            }
+            else
+            {
+                column.texts[row] = std::get<std::string>(value);
+            }
+        }
+    }
+    return sum;
+}
+
+double SumNumbers(const ColumnarFile& file)
+{
+    double sum = 0;
+    for (int col = 0; col < file.ColumnCount(); ++col)
+    {
+        const double* numbers = file.Numbers(col);
+        for (int row = 0; row < file.RowCount(); ++row)
+        {
+            sum += numbers[row];
+        }
+    }
+    return sum;
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    const int rows = static_cast<int>(bench::SizeArgument(argc, argv, Position::MAX_ROWS));
+    const std::size_t cells = static_cast<std::size_t>(rows) * COLUMNS;
+
+    auto sheet = CreateSheet();
+    Fill(*sheet, rows);
+
+    double manual_sum = 0;
+    {
+        bench::Timer timer;
+        manual_sum = ManualLoop(*sheet, rows);
+        bench::Report("GetValue loop into columns", cells, timer.Seconds());
+    }
+
+    {
+        bench::Timer timer;
+        std::ostringstream out;
+        ExportColumns(*sheet, Position{ 0, 0 }, Size{ rows, COLUMNS }, out);
+        bench::Report("ExportColumns to memory", cells, timer.Seconds());
+        std::printf("  %.1f MiB\n", out.str().size() / 1048576.0);
+    }
+
+    const std::string path = bench::TempDirectory("columnar") + "/export.bin";
+    {
+        bench::Timer timer;
+        ExportColumns(*sheet, Position{ 0, 0 }, Size{ rows, COLUMNS }, path);
+        bench::Report("ExportColumns to file", cells, timer.Seconds());
+    }
+
+    {
+        bench::Timer timer;
+        ColumnarFile file(path);
+        const double sum = SumNumbers(file);
+        bench::Report("mmap + sum of number columns", cells, timer.Seconds());
+        std::printf("  sum %.1f (GetValue loop: %.1f)\n", sum, manual_sum);
+    }
+
+    std::filesystem::remove_all(std::filesystem::path(path).parent_path());
+    return 0;
+}
@@ -0,0 +1,118 @@
+// Бенчмарк условных функций: много формул SUMIF/COUNTIF по одному столбцу
+// условий высотой в лист. Формулы используют несколько разных условий, и
+// формулы с одинаковым условием делят одну битовую карту. Измеряются первое
+// вычисление (карты строятся чтением столбца), пересчёт после правки
+// столбца условий (перепроверяется одна ячейка в каждой карте) и, для
+// сравнения, первое вычисление формул, условия которых все разные: каждая
+// читает столбец условий целиком.
+//
+// Запуск: conditional_bench [число формул]
+
+#include "bench_util.h"
+
+#include "sheet.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+constexpr int ROWS = Position::MAX_ROWS;
+// Столбцы листа: категории 1..CATEGORIES, значения
+constexpr int CATEGORY_COL = 0;
+constexpr int VALUE_COL = 1;
+constexpr int FIRST_FORMULA_COL = 3;
+constexpr int CATEGORIES = 10;
+constexpr int PASSES = 3;
+
+Position FormulaPosition(int i)
+{
+    return Position{ i % ROWS, FIRST_FORMULA_COL + i / ROWS };
+}
+
+// Вычисляет count формул, возвращает сумму их значений
+double Recalculate(Sheet& sheet, int count)
+{
+    const int cols = (count + ROWS - 1) / ROWS;
+    std::vector<double> values(static_cast<std::size_t>(ROWS) * cols);
+    std::vector<ValueCode> codes(values.size());
+    sheet.GetValues(Position{ 0, FIRST_FORMULA_COL }, Size{ std::min(count, ROWS), cols },
+                    ValueBuffers{ values.data(), codes.data() });
+    double total = 0;
+    for (std::size_t i = 0; i < values.size(); ++i)
+    {
+        total += codes[i] == ValueCode::Number ? values[i] : 0.0;
+    }
+    return total;
+}
+
+// Ставит count формул; condition(i) - условие i-й формулы
+template <typename Condition>
+void SetFormulas(Sheet& sheet, int count, Condition&& condition)
+{
+    const std::string categories = "A1:A" + std::to_string(ROWS);
+    const std::string values = "B1:B" + std::to_string(ROWS);
+    for (int i = 0; i < count; ++i)
+    {
+        const std::string formula = i % 2 == 0
+            ? "=SUMIF(" + categories + ",\"" + condition(i) + "\"," + values + ")"
+            : "=COUNTIF(" + categories + ",\"" + condition(i) + "\")";
+        sheet.SetCell(FormulaPosition(i), formula);
+    }
+}
+
+void FillSheet(Sheet& sheet)
+{
+    for (int row = 0; row < ROWS; ++row)
+    {
+        sheet.SetCell(Position{ row, CATEGORY_COL }, std::to_string(row % CATEGORIES + 1));
+        sheet.SetCell(Position{ row, VALUE_COL }, std::to_string(row));
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    const int count = static_cast<int>(bench::SizeArgument(argc, argv, 2000));
+    std::printf("%d SUMIF/COUNTIF formulas over a %d-row criteria column\n", count, ROWS);
+
+    auto sheet_ptr = CreateSheet();
+    Sheet& sheet = dynamic_cast<Sheet&>(*sheet_ptr);
+    FillSheet(sheet);
+    SetFormulas(sheet, count, [](int i)
+                {
+                    return "<=" + std::to_string(i % CATEGORIES + 1);
+                });
+
+    bench::Timer timer;
+    double total = Recalculate(sheet, count);
+    bench::Report("first evaluation, shared bitmaps", static_cast<std::size_t>(count), timer.Seconds());
+    std::printf("  sum = %.0f\n", total);
+
+    // Правка столбца условий и пересчёт всех формул
+    timer = bench::Timer();
+    for (int pass = 0; pass < PASSES; ++pass)
+    {
+        sheet.SetCell(Position{ pass, CATEGORY_COL }, std::to_string((pass + 5) % CATEGORIES + 1));
+        total = Recalculate(sheet, count);
+    }
+    bench::Report("edit criteria + recalculate", static_cast<std::size_t>(count) * PASSES, timer.Seconds());
+    std::printf("  sum = %.0f\n", total);
+
+    // Те же формулы, но у каждой своё условие: карты не разделяются
+    auto distinct_ptr = CreateSheet();
+    Sheet& distinct = dynamic_cast<Sheet&>(*distinct_ptr);
+    FillSheet(distinct);
+    SetFormulas(distinct, count, [](int i)
+                {
+                    return "<=" + std::to_string(i % CATEGORIES + 1) + ".0" + std::to_string(i);
+                });
+    timer = bench::Timer();
+    total = Recalculate(distinct, count);
+    bench::Report("first evaluation, distinct conditions", static_cast<std::size_t>(count), timer.Seconds());
+    std::printf("  sum = %.0f\n", total);
+    return 0;
+}
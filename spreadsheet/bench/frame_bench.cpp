@@ -0,0 +1,78 @@
+// Бенчмарк пересчёта с бюджетом кадра: n формул вида =A1+SUM(Ai:Ai+49),
+// все зависят от A1. После каждой правки A1 лист пересчитывается либо
+// одним вызовом Sheet::Recalculate() без ограничения, либо кадрами: вызовами
+// с бюджетом 8 мс, пока пересчёт не завершится. Измеряется длительность
+// кадра (медиана, p99, худшая) и время до полного пересчёта.
+//
+// Запуск: frame_bench [число формул]
+
+#include "bench_util.h"
+
+#include "sheet.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+constexpr int ROWS = Position::MAX_ROWS;
+constexpr int WINDOW = 50;
+constexpr int EDITS = 10;
+constexpr std::chrono::milliseconds FRAME_BUDGET{ 8 };
+
+// Правит A1 EDITS раз и пересчитывает лист кадрами с ограничением limit
+void EditAndRecalculate(Sheet& sheet, bool budgeted, const std::string& name)
+{
+    std::vector<double> frames;
+    bench::Timer total;
+    for (int edit = 0; edit < EDITS; ++edit)
+    {
+        sheet.SetCell(Position{ 0, 0 }, "=" + std::to_string(edit));
+        RecalcProgress progress;
+        do
+        {
+            bench::Timer frame;
+            progress = sheet.Recalculate(budgeted ? RecalcLimit::Budget(FRAME_BUDGET) : RecalcLimit{});
+            frames.push_back(frame.Seconds());
+        } while (!progress.complete);
+    }
+    bench::Report(name, EDITS, total.Seconds());
+
+    std::sort(frames.begin(), frames.end());
+    auto percentile = [&frames](double p)
+    {
+        return frames[std::min(frames.size() - 1, static_cast<std::size_t>(p * frames.size()))] * 1000;
+    };
+    std::printf("  %zu frames: median %.2f ms, p99 %.2f ms, worst %.2f ms\n", frames.size(), percentile(0.5),
+                percentile(0.99), frames.back() * 1000);
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    const int count = static_cast<int>(bench::SizeArgument(argc, argv, 50000));
+    const int rows = std::min(count, ROWS);
+    std::printf("%d formulas depending on A1, %d edits, frame budget %lld ms\n", count, EDITS,
+                static_cast<long long>(FRAME_BUDGET.count()));
+
+    auto sheet_ptr = CreateSheet();
+    Sheet& sheet = dynamic_cast<Sheet&>(*sheet_ptr);
+    for (int row = 0; row < rows; ++row)
+    {
+        sheet.SetCell(Position{ row, 0 }, std::to_string(row));
+    }
+    for (int i = 0; i < count; ++i)
+    {
+        const int row = i % ROWS;
+        const std::string window = "A" + std::to_string(row + 1) + ":A" + std::to_string(std::min(row + WINDOW, rows));
+        sheet.SetCell(Position{ row, 1 + i / ROWS }, "=A1+SUM(" + window + ")");
+    }
+
+    EditAndRecalculate(sheet, false, "edit + recalculate at once");
+    EditAndRecalculate(sheet, true, "edit + recalculate in budgeted frames");
+    return 0;
+}
@@ -0,0 +1,100 @@
+// Бенчмарк журнала правок: пропускная способность SetCell() без журнала, с
+// групповым сбросом и со сбросом после каждой правки, а также время
+// восстановления листа по журналу до и после сжатия.
+//
+// Запуск: journal_bench [число правок]
+
+#include "bench_util.h"
+
+#include "journal.h"
+#include "sheet.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <string>
+
+namespace
+{
+
+constexpr int COLUMNS = 64;
+
+// i-я правка: числа вперемешку с формулами, ссылающимися на ячейку выше
+void ApplyEdit(SheetInterface& sheet, std::size_t i)
+{
+    const Position pos{ static_cast<int>(i / COLUMNS), static_cast<int>(i % COLUMNS) };
+    if (i % 4 == 3 && pos.row > 0)
+    {
+        sheet.SetCell(pos, "=" + Position{ pos.row - 1, pos.col }.ToString() + "+1");
+    }
+    else
+    {
+        sheet.SetCell(pos, std::to_string(i));
+    }
+}
+
+double RunEdits(std::size_t count, EditJournal* journal)
+{
+    auto sheet = CreateSheet();
+    dynamic_cast<Sheet&>(*sheet).SetJournal(journal);
+
+    bench::Timer timer;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        ApplyEdit(*sheet, i);
+    }
+    if (journal)
+    {
+        journal->Sync();
+    }
+    return timer.Seconds();
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    const std::size_t count = bench::SizeArgument(argc, argv, 200000);
+    // Сброс после каждой правки упирается в fsync, поэтому правок меньше
+    const std::size_t fsync_count = std::max<std::size_t>(count / 100, 100);
+
+    bench::Report("SetCell, no journal", count, RunEdits(count, nullptr));
+
+    const std::string group_dir = bench::TempDirectory("journal-group");
+    {
+        JournalOptions options;
+        options.compaction_threshold = 0;
+        EditJournal journal(group_dir, options);
+        bench::Report("SetCell, group commit (128 ops / 10 ms)", count, RunEdits(count, &journal));
+        const auto stats = journal.GetStats();
+        std::printf("  %llu records in %llu syncs\n", static_cast<unsigned long long>(stats.records),
+                    static_cast<unsigned long long>(stats.syncs));
+    }
+
+    {
+        const std::string dir = bench::TempDirectory("journal-fsync");
+        JournalOptions options;
+        options.group_commit_ops = 1;
+        options.group_commit_interval = std::chrono::milliseconds(0);
+        options.compaction_threshold = 0;
+        EditJournal journal(dir, options);
+        bench::Report("SetCell, fsync per edit", fsync_count, RunEdits(fsync_count, &journal));
+    }
+
+    {
+        bench::Timer timer;
+        auto sheet = RecoverSheet(group_dir);
+        bench::Report("Recover, journal replay", count, timer.Seconds());
+
+        EditJournal journal(group_dir);
+        journal.Compact(*sheet);
+        journal.WaitForCompaction();
+    }
+    {
+        bench::Timer timer;
+        auto sheet = RecoverSheet(group_dir);
+        bench::Report("Recover, snapshot after compaction", count, timer.Seconds());
+    }
+
+    std::filesystem::remove_all(group_dir);
+    return 0;
+}
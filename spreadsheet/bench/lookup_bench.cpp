@@ -0,0 +1,136 @@
+// Бенчмарк функций поиска: 100 000 формул поиска по ключевому столбцу
+// высотой в лист. Сравниваются точный поиск XLOOKUP через хэш-индекс
+// столбца, приближённый MATCH двоичным поиском по отсортированному столбцу и,
+// для масштаба, точный поиск без индекса (тот же вектор ключей в строке:
+// строки листа не индексируются и просматриваются по порядку).
+//
+// Запуск: lookup_bench [число формул поиска]
+
+#include "bench_util.h"
+
+#include "sheet.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+constexpr int ROWS = Position::MAX_ROWS;
+// Столбцы листа: ключи вразброс, значения, ключи по возрастанию
+constexpr int KEY_COL = 0;
+constexpr int VALUE_COL = 1;
+constexpr int SORTED_COL = 2;
+constexpr int FIRST_FORMULA_COL = 4;
+// Формул поиска без индекса: каждая просматривает в среднем половину строки
+constexpr int SCAN_FORMULAS = 1000;
+constexpr int PASSES = 3;
+
+// Ключ строки row: перестановка чисел 1..ROWS
+int KeyOf(int row)
+{
+    return static_cast<int>((static_cast<long long>(row) * 7919) % ROWS) + 1;
+}
+
+Position FormulaPosition(int i)
+{
+    return Position{ i % ROWS, FIRST_FORMULA_COL + i / ROWS };
+}
+
+// Пересчитывает count формул, возвращает сумму их значений
+double Recalculate(Sheet& sheet, int count)
+{
+    const int cols = (count + ROWS - 1) / ROWS;
+    std::vector<double> values(static_cast<std::size_t>(ROWS) * cols);
+    std::vector<ValueCode> codes(values.size());
+    sheet.GetValues(Position{ 0, FIRST_FORMULA_COL }, Size{ std::min(count, ROWS), cols },
+                    ValueBuffers{ values.data(), codes.data() });
+    double total = 0;
+    for (std::size_t i = 0; i < values.size(); ++i)
+    {
+        total += codes[i] == ValueCode::Number ? values[i] : 0.0;
+    }
+    return total;
+}
+
+// Перед каждым проходом ячейка input, от которой зависят все формулы,
+// записывается заново тем же текстом: это сбрасывает кэш формул
+void Measure(Sheet& sheet, const std::string& name, int count, Position input)
+{
+    const std::string input_text = sheet.GetCell(input)->GetText();
+    double total = 0;
+    bench::Timer timer;
+    for (int pass = 0; pass < PASSES; ++pass)
+    {
+        sheet.SetCell(input, input_text);
+        total = Recalculate(sheet, count);
+    }
+    bench::Report(name, static_cast<std::size_t>(count) * PASSES, timer.Seconds());
+    std::printf("  sum = %.0f\n", total);
+}
+
+void SetFormulas(Sheet& sheet, int count, const std::string& prefix, const std::string& suffix)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        const int key = KeyOf(i * 31 % ROWS);
+        sheet.SetCell(FormulaPosition(i), prefix + std::to_string(key) + suffix);
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    const int count = static_cast<int>(bench::SizeArgument(argc, argv, 100000));
+
+    auto sheet_ptr = CreateSheet();
+    Sheet& sheet = dynamic_cast<Sheet&>(*sheet_ptr);
+    for (int row = 0; row < ROWS; ++row)
+    {
+        sheet.SetCell(Position{ row, KEY_COL }, std::to_string(KeyOf(row)));
+        sheet.SetCell(Position{ row, VALUE_COL }, std::to_string(row));
+        sheet.SetCell(Position{ row, SORTED_COL }, std::to_string(row * 2));
+    }
+    const std::string keys = "A1:A" + std::to_string(ROWS);
+    const std::string values = "B1:B" + std::to_string(ROWS);
+    const std::string sorted = "C1:C" + std::to_string(ROWS);
+    std::printf("%d lookup formulas over a %d-row key column\n", count, ROWS);
+
+    bench::Timer timer;
+    SetFormulas(sheet, count, "=XLOOKUP(", "," + keys + "," + values + ")");
+    bench::Report("set XLOOKUP formulas", static_cast<std::size_t>(count), timer.Seconds());
+    Measure(sheet, "XLOOKUP exact, hash index", count, Position{ 0, KEY_COL });
+
+    // Правка ключевого столбца и пересчёт: индекс перечитывает одну строку
+    timer = bench::Timer();
+    for (int pass = 0; pass < PASSES; ++pass)
+    {
+        sheet.SetCell(Position{ pass, KEY_COL }, std::to_string(KeyOf(pass)));
+        Recalculate(sheet, count);
+    }
+    bench::Report("edit key + recalculate", static_cast<std::size_t>(count) * PASSES, timer.Seconds());
+
+    SetFormulas(sheet, count, "=MATCH(", "," + sorted + ")");
+    Measure(sheet, "MATCH sorted, binary search", count, Position{ 0, SORTED_COL });
+
+    // Тот же вектор ключей в строке листа
+    const int scan_row = ROWS - 1;
+    const int scan_cols = Position::MAX_COLS - FIRST_FORMULA_COL - (count + ROWS - 1) / ROWS - 1;
+    auto scan_ptr = CreateSheet();
+    Sheet& scan = dynamic_cast<Sheet&>(*scan_ptr);
+    for (int col = 0; col < scan_cols; ++col)
+    {
+        scan.SetCell(Position{ scan_row, col }, std::to_string(KeyOf(col)));
+    }
+    const std::string scan_keys = "A" + std::to_string(scan_row + 1) + ":"
+        + Position{ scan_row, scan_cols - 1 }.ToString();
+    for (int i = 0; i < SCAN_FORMULAS; ++i)
+    {
+        scan.SetCell(FormulaPosition(i), "=MATCH(" + std::to_string(KeyOf(i * 31 % scan_cols)) + ","
+                     + scan_keys + ",0)");
+    }
+    Measure(scan, "MATCH exact, no index (row scan)", SCAN_FORMULAS, Position{ scan_row, 0 });
+    return 0;
+}
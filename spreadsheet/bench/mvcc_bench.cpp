@@ -0,0 +1,111 @@
+// Бенчмарк версий листа: один писатель фиксирует пакеты правок, N читателей
+// в это время берут текущую версию и читают из неё случайные ячейки.
+// Лист: n чисел в столбце A и формулы =Ai*2 в столбце B, писатель правит
+// случайные ячейки A пакетами по 10. Для каждого N (1, 2, 4, ... до числа
+// аппаратных потоков, но не меньше 4) измеряются чтения в секунду всех
+// читателей вместе и фиксации писателя за то же время.
+//
+// Запуск: mvcc_bench [число строк]
+
+#include "bench_util.h"
+
+#include "versioned_sheet.h"
+
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+constexpr int BATCH = 10;
+constexpr int READS_PER_PIN = 100;
+constexpr double SECONDS_PER_RUN = 1.0;
+
+struct Result
+{
+    std::uint64_t reads = 0;
+    std::uint64_t commits = 0;
+    double seconds = 0;
+};
+
+Result Run(VersionedSheet& sheet, int rows, int readers)
+{
+    std::atomic<bool> stop = false;
+    std::atomic<std::uint64_t> reads = 0;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < readers; ++i)
+    {
+        threads.emplace_back([&, i]()
+                             {
+                                 std::mt19937 random(i + 1);
+                                 std::uniform_int_distribution<int> row(0, rows - 1);
+                                 std::uint64_t local_reads = 0;
+                                 double total = 0;
+                                 while (!stop.load(std::memory_order_relaxed))
+                                 {
+                                     const auto version = sheet.Pin();
+                                     for (int read = 0; read < READS_PER_PIN; ++read)
+                                     {
+                                         total += version->GetValue(Position{ row(random), 1 }).number;
+                                     }
+                                     local_reads += READS_PER_PIN;
+                                 }
+                                 reads += local_reads + (total < 0 ? 1 : 0);
+                             });
+    }
+
+    std::mt19937 random(0);
+    std::uniform_int_distribution<int> row(0, rows - 1);
+    Result result;
+    bench::Timer timer;
+    std::vector<CellEdit> edits(BATCH);
+    while (timer.Seconds() < SECONDS_PER_RUN)
+    {
+        for (CellEdit& edit : edits)
+        {
+            edit.pos = Position{ row(random), 0 };
+            edit.text = "=" + std::to_string(random() % 1000);
+        }
+        sheet.Commit(edits);
+        ++result.commits;
+    }
+    stop = true;
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    result.seconds = timer.Seconds();
+    result.reads = reads;
+    return result;
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    const int rows = static_cast<int>(std::min<std::size_t>(bench::SizeArgument(argc, argv, 10000), Position::MAX_ROWS));
+    const int max_readers = static_cast<int>(std::max(4u, std::thread::hardware_concurrency()));
+    std::printf("1 writer, batches of %d edits; readers over %d formulas\n", BATCH, rows);
+
+    VersionedSheet sheet;
+    std::vector<CellEdit> edits;
+    for (int row = 0; row < rows; ++row)
+    {
+        const std::string n = std::to_string(row + 1);
+        edits.push_back(CellEdit{ Position{ row, 0 }, n });
+        edits.push_back(CellEdit{ Position{ row, 1 }, "=A" + n + "*2" });
+    }
+    sheet.Commit(edits);
+
+    for (int readers = 1; readers <= max_readers; readers *= 2)
+    {
+        const Result result = Run(sheet, rows, readers);
+        bench::Report(std::to_string(readers) + " readers: reads", result.reads, result.seconds);
+        bench::Report(std::to_string(readers) + " readers: writer commits", result.commits, result.seconds);
+    }
+    return 0;
+}
@@ -0,0 +1,128 @@
+// Бенчмарк подкачки тайлов: заполнение листа, построчный обход и случайный
+// доступ к ячейкам с ограничением памяти и без него.
+//
+// Запуск: paging_bench [число ячеек] [бюджет памяти, МиБ]
+
+#include "bench_util.h"
+
+#include "sheet.h"
+
+#include <cstdlib>
+#include <filesystem>
+#include <random>
+#include <string>
+
+namespace
+{
+
+constexpr int COLUMNS = 128;
+constexpr std::size_t RANDOM_READS = 5000;
+
+void Fill(SheetInterface& sheet, std::size_t count)
+{
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        const Position pos{ static_cast<int>(i / COLUMNS), static_cast<int>(i % COLUMNS) };
+        // Каждая четвёртая ячейка - формула, ссылающаяся на число, обычно
+        // из другого тайла: её вычисление подкачивает чужой тайл
+        if (i % 4 == 3)
+        {
+            sheet.SetCell(pos, "=" + Position{ pos.row / 2, pos.col - 1 }.ToString() + "*2+1");
+        }
+        else
+        {
+            sheet.SetCell(pos, std::to_string(i));
+        }
+    }
+}
+
+// Возвращает число ячеек с числовым значением, чтобы обход не выбросил компилятор
+std::size_t Scan(const SheetInterface& sheet, std::size_t count)
+{
+    std::size_t numbers = 0;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        const Position pos{ static_cast<int>(i / COLUMNS), static_cast<int>(i % COLUMNS) };
+        numbers += std::holds_alternative<double>(sheet.GetCell(pos)->GetValue());
+    }
+    return numbers;
+}
+
+std::size_t RandomReads(const SheetInterface& sheet, std::size_t count)
+{
+    std::mt19937 random(42);
+    std::uniform_int_distribution<std::size_t> index(0, count - 1);
+    std::size_t numbers = 0;
+    for (std::size_t i = 0; i < RANDOM_READS; ++i)
+    {
+        const std::size_t cell = index(random);
+        const Position pos{ static_cast<int>(cell / COLUMNS), static_cast<int>(cell % COLUMNS) };
+        numbers += std::holds_alternative<double>(sheet.GetCell(pos)->GetValue());
+    }
+    return numbers;
+}
+
+void PrintStats(const Sheet& sheet)
+{
+    const PagingStats stats = sheet.GetPagingStats();
+    std::printf("  page-ins %llu, page-outs %llu, tile writes %llu, resident %zu tiles / %.1f MiB, "
+                "store %.1f MiB\n",
+                static_cast<unsigned long long>(stats.page_ins), static_cast<unsigned long long>(stats.page_outs),
+                static_cast<unsigned long long>(stats.tile_writes), stats.resident_tiles,
+                stats.resident_bytes / 1048576.0, stats.stored_bytes / 1048576.0);
+}
+
+void Run(const std::string& name, std::size_t count, std::size_t budget_mib)
+{
+    auto sheet_ptr = CreateSheet();
+    auto& sheet = dynamic_cast<Sheet&>(*sheet_ptr);
+    const std::string store_path = (std::filesystem::temp_directory_path() / "spreadsheet-bench-tiles.bin").string();
+    if (budget_mib != 0)
+    {
+        sheet.EnablePaging(store_path, PagingOptions{ budget_mib * 1024 * 1024 });
+    }
+
+    {
+        bench::Timer timer;
+        Fill(sheet, count);
+        bench::Report(name + ", fill", count, timer.Seconds());
+    }
+    if (budget_mib != 0)
+    {
+        PrintStats(sheet);
+    }
+
+    std::size_t numbers = 0;
+    {
+        bench::Timer timer;
+        numbers += Scan(sheet, count);
+        bench::Report(name + ", row-major scan", count, timer.Seconds());
+    }
+    if (budget_mib != 0)
+    {
+        PrintStats(sheet);
+    }
+
+    {
+        bench::Timer timer;
+        numbers += RandomReads(sheet, count);
+        bench::Report(name + ", random reads", RANDOM_READS, timer.Seconds());
+    }
+    if (budget_mib != 0)
+    {
+        PrintStats(sheet);
+    }
+    std::printf("  (%zu numeric values)\n", numbers);
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    const std::size_t count = bench::SizeArgument(argc, argv, 200000);
+    const std::size_t budget_mib = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 16;
+
+    Run("in memory", count, 0);
+    Run("paged, " + std::to_string(budget_mib) + " MiB budget", count, budget_mib);
+    return 0;
+}
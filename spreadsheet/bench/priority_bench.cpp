@@ -0,0 +1,106 @@
+// Бенчмарк приоритетного пересчёта: n формул вида =A1+SUM(Ai:Ai+99) в
+// столбце B, все зависят от A1; видимое окно - последние 30 строк, до
+// которых пересчёт по порядку позиций доходит последним. После правки A1
+// измеряется время до актуальных значений окна и до конца пересчёта: без
+// приоритетов, с окном в приоритетных диапазонах и с запросом значений окна
+// через GetFreshValue().
+//
+// Запуск: priority_bench [число формул]
+
+#include "bench_util.h"
+
+#include "async_sheet.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+constexpr int EDITS = 5;
+constexpr int VIEW_ROWS = 30;
+constexpr int WINDOW = 100;
+
+enum class Mode
+{
+    Plain,
+    PriorityRange,
+    Query,
+};
+
+// Ждёт актуальных значений окна view
+void WaitVisible(const AsyncSheet& sheet, const Range& view, Mode mode)
+{
+    if (mode == Mode::Query)
+    {
+        std::vector<std::shared_future<CellInterface::Value>> values;
+        for (int row = view.from.row; row <= view.to.row; ++row)
+        {
+            values.push_back(sheet.GetFreshValue(Position{ row, view.from.col }));
+        }
+        for (const auto& value : values)
+        {
+            value.wait();
+        }
+        return;
+    }
+
+    // Опрос, как у интерфейса, перерисовывающего окно
+    for (int row = view.from.row; row <= view.to.row;)
+    {
+        if (sheet.GetValue(Position{ row, view.from.col }).stale)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            continue;
+        }
+        ++row;
+    }
+}
+
+void Measure(AsyncSheet& sheet, const Range& view, Mode mode, const std::string& name)
+{
+    sheet.SetPriorityRanges(mode == Mode::PriorityRange ? std::vector<Range>{ view } : std::vector<Range>{});
+    double visible = 0;
+    double total = 0;
+    for (int edit = 0; edit < EDITS; ++edit)
+    {
+        bench::Timer timer;
+        sheet.SetCell(Position{ 0, 0 }, "=" + std::to_string(edit));
+        WaitVisible(sheet, view, mode);
+        visible += timer.Seconds();
+        sheet.WaitIdle();
+        total += timer.Seconds();
+    }
+    std::printf("%-32s first visible %8.2f ms, full recalculation %8.2f ms\n", name.c_str(),
+                visible / EDITS * 1000, total / EDITS * 1000);
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    const int rows = static_cast<int>(std::min<std::size_t>(bench::SizeArgument(argc, argv, 16000), Position::MAX_ROWS));
+    std::printf("%d formulas depending on A1, viewport of the last %d rows\n", rows, VIEW_ROWS);
+
+    AsyncSheet sheet;
+    std::vector<CellEdit> edits;
+    for (int row = 0; row < rows; ++row)
+    {
+        const std::string n = std::to_string(row + 1);
+        edits.push_back(CellEdit{ Position{ row, 0 }, n });
+        edits.push_back(CellEdit{ Position{ row, 1 }, "=A1+SUM(A" + n + ":A" + std::to_string(std::min(row + WINDOW, rows)) + ")" });
+    }
+    sheet.ApplyEdits(edits);
+    sheet.WaitIdle();
+
+    const Range view{ Position{ std::max(0, rows - VIEW_ROWS), 1 }, Position{ rows - 1, 1 } };
+    Measure(sheet, view, Mode::Plain, "no priorities");
+    Measure(sheet, view, Mode::PriorityRange, "viewport as priority range");
+    Measure(sheet, view, Mode::Query, "viewport queried");
+    const AsyncRecalcStats stats = sheet.GetStats();
+    std::printf("passes %zu, reordered %zu, cancelled %zu\n", stats.passes, stats.reordered, stats.cancelled);
+    return 0;
+}
@@ -0,0 +1,162 @@
+// Бенчмарк репликации по журналу: ведущий непрерывно правит лист пакетами
+// по 64 правки (числа в столбце A, от которых зависят формулы столбца B) с
+// журналом и групповым сбросом по умолчанию, ReplicationLog передаёт группы
+// ведомому в другом потоке. Измеряются скорость правок у ведущего, скорость
+// применения у ведомого (только время применения) и отставание ведомого: от
+// сброса группы на диск до её применения. В конце проверяется, что значения
+// листов совпадают.
+//
+// Запуск: replication_bench [число правок]
+
+#include "bench_util.h"
+
+#include "replication.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+constexpr int ROWS = 10000;
+constexpr std::size_t BATCH = 64;
+
+// Канал от ведущего к ведомому в памяти вместо сокета
+class Channel
+{
+public:
+    bool Push(std::string_view frame)
+    {
+        {
+            std::lock_guard lock(mutex_);
+            frames_.emplace_back(frame);
+        }
+        ready_.notify_one();
+        return true;
+    }
+
+    // Следующий кадр или пустая строка, если канал закрыт
+    std::string Pop()
+    {
+        std::unique_lock lock(mutex_);
+        ready_.wait(lock, [this]
+                    {
+                        return !frames_.empty() || closed_;
+                    });
+        if (frames_.empty())
+        {
+            return {};
+        }
+        std::string frame = std::move(frames_.front());
+        frames_.pop_front();
+        return frame;
+    }
+
+    void Close()
+    {
+        {
+            std::lock_guard lock(mutex_);
+            closed_ = true;
+        }
+        ready_.notify_one();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::deque<std::string> frames_;
+    bool closed_ = false;
+};
+
+std::string Values(const SheetInterface& sheet)
+{
+    std::ostringstream out;
+    sheet.PrintValues(out);
+    return out.str();
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    const std::size_t edits = bench::SizeArgument(argc, argv, 200000);
+    std::printf("%zu edits in batches of %zu, %d formulas\n", edits, BATCH, ROWS);
+    const std::string dir = bench::TempDirectory("replication");
+
+    auto primary_ptr = CreateSheet();
+    Sheet& primary = dynamic_cast<Sheet&>(*primary_ptr);
+    std::vector<CellEdit> batch;
+    for (int row = 0; row < ROWS; ++row)
+    {
+        const std::string n = std::to_string(row + 1);
+        batch.push_back(CellEdit{ Position{ row, 0 }, n });
+        batch.push_back(CellEdit{ Position{ row, 1 }, "=A" + n + "*2+A1" });
+    }
+    primary.ApplyEdits(batch);
+
+    Replica replica(dir);
+    Channel channel;
+    std::vector<double> lags;
+    double apply_seconds = 0;
+    std::thread follower([&]()
+                         {
+                             for (std::string frame = channel.Pop(); !frame.empty(); frame = channel.Pop())
+                             {
+                                 bench::Timer timer;
+                                 replica.Feed(frame);
+                                 apply_seconds += timer.Seconds();
+                                 lags.push_back(std::chrono::duration<double>(replica.GetStats().last_lag).count());
+                             }
+                         });
+
+    {
+        EditJournal journal(dir);
+        primary.SetJournal(&journal);
+        // Начальное заполнение ведомый получает из снимка
+        journal.Compact(primary);
+        journal.WaitForCompaction();
+        replica.CatchUp();
+        ReplicationLog log(journal);
+        log.Subscribe(replica.GetSequence(), [&channel](std::string_view frame)
+                      {
+                          return channel.Push(frame);
+                      });
+
+        bench::Timer timer;
+        for (std::size_t done = 0; done < edits; done += BATCH)
+        {
+            batch.clear();
+            for (std::size_t i = done; i < std::min(edits, done + BATCH); ++i)
+            {
+                batch.push_back(CellEdit{ Position{ static_cast<int>(i * 7919 % ROWS), 0 }, std::to_string(i) });
+            }
+            primary.ApplyEdits(batch);
+        }
+        journal.Sync();
+        bench::Report("primary: edit + journal", edits, timer.Seconds());
+        primary.SetJournal(nullptr);
+    }
+    channel.Close();
+    follower.join();
+
+    const ReplicaStats stats = replica.GetStats();
+    bench::Report("replica: apply", stats.edits, apply_seconds);
+    std::sort(lags.begin(), lags.end());
+    auto percentile = [&lags](double p)
+    {
+        return lags[std::min(lags.size() - 1, static_cast<std::size_t>(p * lags.size()))] * 1000;
+    };
+    std::printf("  %zu frames, lag: p50 %.3f ms, p99 %.3f ms, max %.3f ms\n", stats.frames, percentile(0.5),
+                percentile(0.99), lags.back() * 1000);
+    std::printf("  values converged: %s\n", Values(replica.GetSheet()) == Values(primary) ? "yes" : "NO");
+
+    std::filesystem::remove_all(dir);
+    return 0;
+}
@@ -0,0 +1,78 @@
+// Бенчмарк скользящих окон: 10 000 формул SUM по перекрывающимся окнам
+// одного столбца числового текста. Сравнивается пересчёт всех окон после
+// правки одной ячейки столбца без индекса агрегатов (каждое окно читает
+// свой диапазон) и с индексом (Sheet::EnableAggregateIndex()).
+//
+// Запуск: rolling_window_bench [число строк столбца]
+
+#include "bench_util.h"
+
+#include "sheet.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+constexpr int WINDOWS = 10000;
+constexpr int REFRESHES = 5;
+
+// Правит ячейку столбца и пересчитывает все окна, возвращает сумму результатов
+double Refresh(Sheet& sheet, int rows, int pass, std::vector<double>& results)
+{
+    sheet.SetCell(Position{ (pass * 7919) % rows, 0 }, std::to_string(pass % 100));
+    sheet.GetValues(Position{ 0, 2 }, Size{ WINDOWS, 1 }, ValueBuffers{ results.data() });
+    double total = 0;
+    for (double result : results)
+    {
+        total += result;
+    }
+    return total;
+}
+
+void Measure(Sheet& sheet, const std::string& name, int rows)
+{
+    std::vector<double> results(WINDOWS);
+    double total = 0;
+    bench::Timer timer;
+    for (int pass = 0; pass < REFRESHES; ++pass)
+    {
+        total = Refresh(sheet, rows, pass, results);
+    }
+    bench::Report(name, static_cast<std::size_t>(WINDOWS) * REFRESHES, timer.Seconds());
+    std::printf("  sum of windows = %.1f\n", total);
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    const int rows = static_cast<int>(bench::SizeArgument(argc, argv, Position::MAX_ROWS));
+    // Окна сдвигаются на строку и вместе покрывают весь столбец
+    const int window = std::max(1, rows - WINDOWS + 1);
+
+    auto sheet_ptr = CreateSheet();
+    Sheet& sheet = dynamic_cast<Sheet&>(*sheet_ptr);
+    for (int row = 0; row < rows; ++row)
+    {
+        sheet.SetCell(Position{ row, 0 }, std::to_string(row % 100));
+    }
+    for (int i = 0; i < WINDOWS; ++i)
+    {
+        const Position from{ i % rows, 0 };
+        const Position to{ std::min(i + window, rows) - 1, 0 };
+        sheet.SetCell(Position{ i, 2 }, "=SUM(" + from.ToString() + ":" + to.ToString() + ")");
+    }
+    std::printf("%d windows of %d rows\n", WINDOWS, window);
+
+    Measure(sheet, "edit + refresh, range scan", rows);
+
+    bench::Timer timer;
+    sheet.EnableAggregateIndex(0);
+    bench::Report("build column index", static_cast<std::size_t>(rows), timer.Seconds());
+
+    Measure(sheet, "edit + refresh, column index", rows);
+    return 0;
+}
@@ -0,0 +1,103 @@
+// Бенчмарк образов листа: лист из n строк (число, формула =Ai*2 и текст в
+// каждой строке) фиксируется в VersionedSheet и публикуется образом.
+// Измеряются запись образа, подготовка читателя - отображение образа против
+// загрузки снимка со значениями (то, что каждый процесс делал бы со своей
+// копией листа), обновление читателя на новую версию и случайные чтения
+// значений из образа и из версии в памяти.
+//
+// Запуск: sheet_image_bench [число строк]
+
+#include "bench_util.h"
+
+#include "sheet_image.h"
+#include "snapshot.h"
+
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+constexpr int OPENS = 20;
+constexpr std::size_t READS = 2000000;
+
+template <typename Source>
+double ReadRandom(const Source& source, int rows, std::size_t reads)
+{
+    std::mt19937 random(42);
+    std::uniform_int_distribution<int> row_dist(0, rows - 1);
+    std::uniform_int_distribution<int> col_dist(0, 2);
+    double sum = 0;
+    for (std::size_t i = 0; i < reads; ++i)
+    {
+        sum += source.GetValue(Position{ row_dist(random), col_dist(random) }).number;
+    }
+    return sum;
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    const int rows = static_cast<int>(bench::SizeArgument(argc, argv, Position::MAX_ROWS));
+    std::printf("%d rows, %d cells\n", rows, rows * 3);
+    const std::string dir = bench::TempDirectory("sheet-image");
+    const std::string image_path = dir + "/sheet.image";
+    const std::string snapshot_path = dir + "/sheet.snapshot";
+
+    VersionedSheet sheet;
+    std::vector<CellEdit> edits;
+    for (int row = 0; row < rows; ++row)
+    {
+        const std::string n = std::to_string(row + 1);
+        edits.push_back(CellEdit{ Position{ row, 0 }, "=" + n });
+        edits.push_back(CellEdit{ Position{ row, 1 }, "=A" + n + "*2" });
+        edits.push_back(CellEdit{ Position{ row, 2 }, "item " + n });
+    }
+    auto version = sheet.Commit(edits);
+
+    bench::Timer write_timer;
+    WriteSheetImage(*version, image_path);
+    bench::Report("publish image", 1, write_timer.Seconds());
+    std::printf("  image size %.1f MB\n", std::filesystem::file_size(image_path) / 1048576.0);
+
+    SaveSnapshot(sheet.GetSheet(), snapshot_path, SnapshotOptions{ true });
+    bench::Timer load_timer;
+    for (int i = 0; i < OPENS; ++i)
+    {
+        LoadSnapshot(snapshot_path);
+    }
+    bench::Report("reader setup: load snapshot", OPENS, load_timer.Seconds());
+
+    bench::Timer open_timer;
+    for (int i = 0; i < OPENS; ++i)
+    {
+        SheetImage image(image_path);
+    }
+    bench::Report("reader setup: map image", OPENS, open_timer.Seconds());
+
+    SheetImageReader reader(image_path);
+    bench::Timer refresh_timer;
+    for (int i = 0; i < OPENS; ++i)
+    {
+        version = sheet.Commit({ CellEdit{ Position{ i % rows, 0 }, "=" + std::to_string(i) } });
+        WriteSheetImage(*version, image_path);
+        reader.Refresh();
+    }
+    bench::Report("commit + publish + refresh", OPENS, refresh_timer.Seconds());
+
+    bench::Timer version_timer;
+    const double version_sum = ReadRandom(*version, rows, READS);
+    bench::Report("random reads: version in memory", READS, version_timer.Seconds());
+
+    const auto image = reader.Get();
+    bench::Timer image_timer;
+    const double image_sum = ReadRandom(*image, rows, READS);
+    bench::Report("random reads: mapped image", READS, image_timer.Seconds());
+    std::printf("  values match: %s\n", version_sum == image_sum ? "yes" : "NO");
+
+    std::filesystem::remove_all(dir);
+    return 0;
+}
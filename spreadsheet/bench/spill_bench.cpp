@@ -0,0 +1,142 @@
+// Бенчмарк формул массива: столбец произведений C = A * B высотой n строк
+// задаётся n отдельными формулами =Ai*Bi или одной формулой массива
+// =A1:An*B1:Bn, разливающейся на n ячеек. Измеряются память, занятая
+// формулами (по счётчику выделений), время их ввода и пересчёт столбца после
+// правки A1 с чтением всех значений.
+//
+// Запуск: spill_bench [число строк]
+
+#include "bench_util.h"
+
+#include "sheet.h"
+
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+// Байты, выделенные через operator new и ещё не освобождённые
+std::size_t live_bytes = 0;
+
+// Перед блоком хранится его размер; отступ сохраняет выравнивание malloc()
+constexpr std::size_t HEADER = alignof(std::max_align_t);
+
+constexpr int A_COL = 0;
+constexpr int B_COL = 1;
+constexpr int RESULT_COL = 2;
+constexpr int PASSES = 100;
+
+void FillSheet(Sheet& sheet, int rows)
+{
+    for (int row = 0; row < rows; ++row)
+    {
+        sheet.SetCell(Position{ row, A_COL }, std::to_string(row % 100));
+        sheet.SetCell(Position{ row, B_COL }, std::to_string(row % 7));
+    }
+}
+
+struct Result
+{
+    std::size_t bytes = 0;
+    double set_seconds = 0;
+    double recalc_seconds = 0;
+    double total = 0;
+};
+
+// set_formulas вводит формулы столбца результата
+template <typename SetFormulas>
+Result Run(int rows, SetFormulas&& set_formulas)
+{
+    auto sheet_ptr = CreateSheet();
+    Sheet& sheet = dynamic_cast<Sheet&>(*sheet_ptr);
+    FillSheet(sheet, rows);
+
+    Result result;
+    std::vector<double> numbers(rows);
+    std::vector<ValueCode> codes(rows);
+    const std::size_t bytes_before = live_bytes;
+    bench::Timer timer;
+    set_formulas(sheet);
+    result.set_seconds = timer.Seconds();
+    // Значения вычисляются один раз, чтобы в память попал и массив
+    sheet.GetValues(Position{ 0, RESULT_COL }, Size{ rows, 1 }, ValueBuffers{ numbers.data(), codes.data() });
+    result.bytes = live_bytes - bytes_before;
+
+    timer = bench::Timer();
+    for (int pass = 0; pass < PASSES; ++pass)
+    {
+        sheet.SetCell(Position{ 0, A_COL }, std::to_string(pass));
+        sheet.GetValues(Position{ 0, RESULT_COL }, Size{ rows, 1 }, ValueBuffers{ numbers.data(), codes.data() });
+    }
+    result.recalc_seconds = timer.Seconds();
+    for (double number : numbers)
+    {
+        result.total += number;
+    }
+    return result;
+}
+
+void Print(const std::string& name, int rows, const Result& result)
+{
+    bench::Report(name + ": set formulas", 1, result.set_seconds);
+    bench::Report(name + ": edit + read column", static_cast<std::size_t>(rows) * PASSES, result.recalc_seconds);
+    std::printf("  memory %zu bytes (%.1f per cell), sum = %.0f\n", result.bytes,
+                static_cast<double>(result.bytes) / rows, result.total);
+}
+
+}  // namespace
+
+void* operator new(std::size_t size)
+{
+    auto* block = static_cast<char*>(std::malloc(size + HEADER));
+    if (!block)
+    {
+        throw std::bad_alloc();
+    }
+    *reinterpret_cast<std::size_t*>(block) = size;
+    live_bytes += size;
+    return block + HEADER;
+}
+
+void operator delete(void* ptr) noexcept
+{
+    if (!ptr)
+    {
+        return;
+    }
+    char* block = static_cast<char*>(ptr) - HEADER;
+    live_bytes -= *reinterpret_cast<std::size_t*>(block);
+    std::free(block);
+}
+
+void operator delete(void* ptr, std::size_t /* size */) noexcept
+{
+    operator delete(ptr);
+}
+
+int main(int argc, char** argv)
+{
+    const int rows = static_cast<int>(bench::SizeArgument(argc, argv, 1000));
+    std::printf("C = A * B over %d rows\n", rows);
+
+    const Result cells = Run(rows, [rows](Sheet& sheet)
+                             {
+                                 for (int row = 0; row < rows; ++row)
+                                 {
+                                     const std::string n = std::to_string(row + 1);
+                                     sheet.SetCell(Position{ row, RESULT_COL }, "=A" + n + "*B" + n);
+                                 }
+                             });
+    Print("per-cell formulas", rows, cells);
+
+    const Result spill = Run(rows, [rows](Sheet& sheet)
+                             {
+                                 const std::string n = std::to_string(rows);
+                                 sheet.SetCell(Position{ 0, RESULT_COL }, "=A1:A" + n + "*B1:B" + n);
+                             });
+    Print("spilled array formula", rows, spill);
+    return 0;
+}
@@ -0,0 +1,74 @@
+// Бенчмарк вычисления по окну: n формул вида =A1+Ai, все зависят от A1.
+// После правки A1 пересчитываются либо все формулы листа, либо только окно
+// 30 x 50 ячеек, как видимая часть листа в интерфейсе. Измеряется время
+// правки вместе с вычислением и чтением значений окна.
+//
+// Запуск: viewport_bench [число формул]
+
+#include "bench_util.h"
+
+#include "sheet.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+constexpr int ROWS = Position::MAX_ROWS;
+constexpr int INPUT_COL = 0;
+constexpr int FIRST_FORMULA_COL = 1;
+constexpr int VIEW_ROWS = 30;
+constexpr int VIEW_COLS = 50;
+constexpr int PASSES = 20;
+
+// Правит A1 PASSES раз, каждый раз вычисляя окно view
+void EditAndEvaluate(Sheet& sheet, const Range& view, const std::string& name)
+{
+    const Size size = view.GetSize();
+    std::vector<double> numbers(static_cast<std::size_t>(size.rows) * size.cols);
+    std::vector<ValueCode> codes(numbers.size());
+    ViewportStats stats;
+    bench::Timer timer;
+    for (int pass = 0; pass < PASSES; ++pass)
+    {
+        sheet.SetCell(Position{ 0, INPUT_COL }, std::to_string(pass));
+        stats = sheet.EvaluateViewport(view);
+        sheet.GetValues(view.from, size, ValueBuffers{ numbers.data(), codes.data() });
+    }
+    bench::Report(name, PASSES, timer.Seconds());
+    std::printf("  evaluated %zu, skipped %zu formulas per edit\n", stats.evaluated, stats.skipped);
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    const int count = static_cast<int>(bench::SizeArgument(argc, argv, 100000));
+    std::printf("%d formulas depending on A1, %dx%d viewport\n", count, VIEW_ROWS, VIEW_COLS);
+
+    auto sheet_ptr = CreateSheet();
+    Sheet& sheet = dynamic_cast<Sheet&>(*sheet_ptr);
+    bench::Timer timer;
+    for (int row = 0; row < std::min(count, ROWS); ++row)
+    {
+        sheet.SetCell(Position{ row, INPUT_COL }, std::to_string(row));
+    }
+    for (int i = 0; i < count; ++i)
+    {
+        const int row = i % ROWS;
+        sheet.SetCell(Position{ row, FIRST_FORMULA_COL + i / ROWS }, "=A1+A" + std::to_string(row + 1));
+    }
+    bench::Report("set formulas", static_cast<std::size_t>(count), timer.Seconds());
+
+    const int cols = (count + ROWS - 1) / ROWS;
+    const Range all{ Position{ 0, FIRST_FORMULA_COL },
+                     Position{ std::min(count, ROWS) - 1, FIRST_FORMULA_COL + cols - 1 } };
+    EditAndEvaluate(sheet, all, "edit + evaluate whole sheet");
+
+    const Range view{ Position{ 0, FIRST_FORMULA_COL },
+                      Position{ std::min(VIEW_ROWS, ROWS) - 1, FIRST_FORMULA_COL + std::min(VIEW_COLS, cols) - 1 } };
+    EditAndEvaluate(sheet, view, "edit + evaluate viewport");
+    return 0;
+}
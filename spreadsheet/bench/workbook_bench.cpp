@@ -0,0 +1,114 @@
+// Бенчмарк книги из 50 листов: лист Inputs с n числами, 48 листов модели,
+// формулы которых ссылаются на Inputs!A1 и окно своего столбца, и лист
+// Summary с суммами по каждому листу модели. Измеряются заполнение, полный
+// пересчёт в одном потоке и во всех, правка Inputs!A1 с пересчётом,
+// сохранение и загрузка книги.
+//
+// Запуск: workbook_bench [число строк на лист]
+
+#include "bench_util.h"
+
+#include "workbook.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+constexpr int MODEL_SHEETS = 48;
+constexpr int WINDOW = 20;
+
+std::string ModelName(int i)
+{
+    return "Model" + std::to_string(i);
+}
+
+// Заполняет книгу, seconds - время заполнения
+std::unique_ptr<Workbook> Build(int rows, double& seconds)
+{
+    auto book = std::make_unique<Workbook>();
+    bench::Timer timer;
+    Sheet& inputs = book->AddSheet("Inputs");
+    std::vector<CellEdit> edits;
+    for (int row = 0; row < rows; ++row)
+    {
+        edits.push_back(CellEdit{ Position{ row, 0 }, std::to_string(row % 100) });
+    }
+    inputs.ApplyEdits(edits);
+
+    for (int i = 0; i < MODEL_SHEETS; ++i)
+    {
+        edits.clear();
+        for (int row = 0; row < rows; ++row)
+        {
+            const std::string n = std::to_string(row + 1);
+            edits.push_back(CellEdit{ Position{ row, 0 }, "=Inputs!A" + n + "*" + std::to_string(i + 1) });
+            edits.push_back(CellEdit{ Position{ row, 1 }, "=Inputs!A1+SUM(A" + n + ":A" + std::to_string(std::min(row + WINDOW, rows)) + ")" });
+        }
+        book->AddSheet(ModelName(i)).ApplyEdits(edits);
+    }
+
+    edits.clear();
+    for (int i = 0; i < MODEL_SHEETS; ++i)
+    {
+        edits.push_back(CellEdit{ Position{ i, 0 }, "=SUM(" + ModelName(i) + "!B1:B" + std::to_string(rows) + ")" });
+    }
+    book->AddSheet("Summary").ApplyEdits(edits);
+    seconds = timer.Seconds();
+    return book;
+}
+
+// Правит Inputs!A1 значением value и пересчитывает книгу
+void Recalculate(Workbook& book, int value, unsigned threads, const std::string& name)
+{
+    book.GetSheet("Inputs").SetCell(Position{ 0, 0 }, std::to_string(value));
+    bench::Timer timer;
+    const WorkbookRecalcStats stats = book.Recalculate(threads);
+    bench::Report(name, stats.evaluated, timer.Seconds());
+    std::printf("  %zu sheet groups, %u threads\n", stats.groups, stats.threads);
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    const int rows = static_cast<int>(std::min<std::size_t>(bench::SizeArgument(argc, argv, 2000), Position::MAX_ROWS));
+    std::printf("%d sheets, %d rows per sheet, %u hardware threads\n", MODEL_SHEETS + 2, rows,
+                std::thread::hardware_concurrency());
+
+    double seconds = 0;
+    auto book = Build(rows, seconds);
+    bench::Report("build workbook", static_cast<std::size_t>(rows) * (2 * MODEL_SHEETS + 1) + MODEL_SHEETS, seconds);
+
+    Recalculate(*book, 1, 1, "recalculate, 1 thread");
+    Recalculate(*book, 2, 0, "recalculate, all threads");
+
+    {
+        constexpr int EDITS = 5;
+        bench::Timer timer;
+        for (int edit = 0; edit < EDITS; ++edit)
+        {
+            book->GetSheet("Inputs").SetCell(Position{ 0, 0 }, std::to_string(edit + 3));
+            book->Recalculate();
+        }
+        bench::Report("edit Inputs!A1 + recalculate", EDITS, timer.Seconds());
+    }
+
+    const std::string directory = bench::TempDirectory("workbook");
+    {
+        bench::Timer timer;
+        book->Save(directory);
+        bench::Report("save workbook", book->GetSheetCount(), timer.Seconds());
+    }
+    {
+        bench::Timer timer;
+        auto loaded = Workbook::Load(directory);
+        bench::Report("load workbook", loaded->GetSheetCount(), timer.Seconds());
+    }
+    std::filesystem::remove_all(directory);
+    return 0;
+}
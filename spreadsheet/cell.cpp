@@ -1,11 +1,46 @@
 #include "cell.h"
 
+#include "sheet.h"
+
 #include <cassert>
 #include <iostream>
 #include <string>
 #include <optional>
 #include <cmath>    // for std::isfinite()
+#include <thread>
+
+
+namespace
+{
+
+// Глубина вложенных вычислений формул, после которой влияющие формулы
+// вычисляются без рекурсии (см. Sheet::EvaluatePrecedents())
+constexpr int MAX_RECURSIVE_DEPTH = 64;
+thread_local int evaluation_depth = 0;
+
+// Учитывает вычисление формулы в глубине вложенности текущего потока
+class EvaluationDepth
+{
+public:
+    EvaluationDepth()
+    {
+        ++evaluation_depth;
+    }
+    ~EvaluationDepth()
+    {
+        --evaluation_depth;
+    }
+
+    EvaluationDepth(const EvaluationDepth&) = delete;
+    EvaluationDepth& operator=(const EvaluationDepth&) = delete;
+
+    bool IsDeep() const
+    {
+        return evaluation_depth > MAX_RECURSIVE_DEPTH;
+    }
+};
 
+}  // namespace
 
 // Реализуйте следующие методы
 Cell::Cell(SheetInterface& sheet)
@@ -56,6 +91,12 @@ void Cell::Set(const std::string& text)
     }
 }
 
+void Cell::SetFormula(std::unique_ptr<FormulaInterface> formula,
+                      std::optional<CellInterface::Value> cached_value)
+{
+    impl_ = std::make_unique<FormulaImpl>(sheet_, std::move(formula), std::move(cached_value));
+}
+
 void Cell::Clear()
 {
     // Reset вызывает дефолтный deleter
@@ -65,62 +106,70 @@ void Cell::Clear()
     impl_ = std::make_unique<EmptyImpl>();
 }
 
+CellType Cell::GetType() const
+{
+    return impl_->IGetType();
+}
+
+const FormulaInterface* Cell::GetFormula() const
+{
+    if (impl_->IGetType() != CellType::FORMULA)
+    {
+        return nullptr;
+    }
+    return static_cast<const FormulaImpl*>(impl_.get())->IGetFormula();
+}
+
 Cell::Value Cell::GetValue() const
 {
     return impl_->IGetValue();
 }
 
-std::string Cell::GetText() const
+CellValueView Cell::GetValueView() const
 {
-    return impl_->IGetText();
+    return impl_->IGetValueView();
 }
 
-std::vector<Position> Cell::GetReferencedCells() const
+std::string Cell::GetText() const
 {
-    return impl_.get()->IGetReferencedCells();
+    return std::string(impl_->IGetText());
 }
 
-bool Cell::IsCyclicDependent(const Cell* start_cell_ptr, const Position& end_pos) const
+std::vector<Position> Cell::GetReferencedCells() const
 {
-    // Проверяем все зависимые ячейки
-    for (const auto& referenced_cell_pos : GetReferencedCells())
+    // Ячейки диапазонов раскрывает сама формула
+    if (const FormulaInterface* formula = GetFormula())
     {
+        return formula->GetReferencedCells();
+    }
+    const Span<const Position> cells = impl_->IGetReferencedCells();
+    return { cells.begin(), cells.end() };
+}
 
-        // Позиция ячейки из списка зависимости текущей совпадает с конечной
-        // (циклическая зависимость найдена)
-        if (referenced_cell_pos == end_pos)
-        {
-            return true;
-        }
-
-        // Пытаемся получить указатель на очередную ячейку из списка зависимости текущей
-        const Cell* ref_cell_ptr = dynamic_cast<const Cell*>(sheet_.GetCell(referenced_cell_pos));
+std::string_view Cell::GetTextView() const
+{
+    return impl_->IGetText();
+}
 
-        if (!ref_cell_ptr)
-        {
-            // По заданию, ссылаться на несуществующие ячейки можно. У нас такой случай,
-            // создаем EmptyImpl для текущей referenced_cell_pos
-            sheet_.SetCell(referenced_cell_pos, "");
-            ref_cell_ptr = dynamic_cast<const Cell*>(sheet_.GetCell(referenced_cell_pos));
-        }
+Span<const Position> Cell::GetReferencedCellsView() const
+{
+    return impl_->IGetReferencedCells();
+}
 
-        // Указатели начальной и текущей ячеек совпали
-        // (циклическая зависимость найдена)
-        if (start_cell_ptr == ref_cell_ptr)
-        {
-            return true;
-        }
+Span<const Range> Cell::GetReferencedRangesView() const
+{
+    const FormulaInterface* formula = GetFormula();
+    return formula ? formula->GetReferencedRangesView() : Span<const Range>{};
+}
 
-        // Рекурсивно вызываем проверку для ячеек из списка зависимости текущей. 
-        // start_cell_ptr и end_pos передаем без изменений
-        if (ref_cell_ptr->IsCyclicDependent(start_cell_ptr, end_pos))
-        {
-            return true;
-        }
-    }
+const ArrayValue* Cell::GetArrayValue() const
+{
+    return impl_->IGetArrayValue();
+}
 
-    // Если мы здесь, циклические зависимости не найдены
-    return false;
+void Cell::FillCache()
+{
+    impl_->IFillCache();
 }
 
 void Cell::InvalidateCache()
@@ -143,14 +192,17 @@ CellInterface::Value Cell::EmptyImpl::IGetValue() const
     return 0.0;
 }
 
-std::string Cell::EmptyImpl::IGetText() const
+CellValueView Cell::EmptyImpl::IGetValueView() const
 {
-    using namespace std::literals;
+    return {};
+}
 
-    return ""s;
+std::string_view Cell::EmptyImpl::IGetText() const
+{
+    return {};
 }
 
-std::vector<Position> Cell::EmptyImpl::IGetReferencedCells() const
+Span<const Position> Cell::EmptyImpl::IGetReferencedCells() const
 {
     return {};
 }
@@ -183,23 +235,29 @@ CellType Cell::TextImpl::IGetType() const
 
 CellInterface::Value Cell::TextImpl::IGetValue() const
 {
+    // Текст без апострофа копируется в значение один раз
+    return std::string(IGetValueView().text);
+}
+
+CellValueView Cell::TextImpl::IGetValueView() const
+{
+    CellValueView view;
+    view.code = ValueCode::Text;
+    view.text = cell_text_;
     if (escaped_)
     {
-        // Возвращаем без апострофа
-        return cell_text_.substr(1, cell_text_.size() - 1);
-    }
-    else
-    {
-        return cell_text_;
+        // Без апострофа
+        view.text.remove_prefix(1);
     }
+    return view;
 }
 
-std::string Cell::TextImpl::IGetText() const
+std::string_view Cell::TextImpl::IGetText() const
 {
     return cell_text_;
 }
 
-std::vector<Position> Cell::TextImpl::IGetReferencedCells() const
+Span<const Position> Cell::TextImpl::IGetReferencedCells() const
 {
     return {};
 }
@@ -215,9 +273,26 @@ bool Cell::TextImpl::ICached() const
 }
 
 Cell::FormulaImpl::FormulaImpl(SheetInterface& sheet, std::string formula)
-    : sheet_(sheet), formula_(ParseFormula(formula))
+    : FormulaImpl(sheet, ParseFormula(std::move(formula)), std::nullopt)
 {}
 
+Cell::FormulaImpl::FormulaImpl(SheetInterface& sheet, std::unique_ptr<FormulaInterface> formula,
+                               std::optional<CellInterface::Value> cached_value)
+    : sheet_(sheet), formula_(std::move(formula))
+{
+    const std::string_view expression = formula_->GetExpressionView();
+    formula_text_.reserve(expression.size() + 1);
+    formula_text_ += FORMULA_SIGN;
+    formula_text_ += expression;
+
+    // Формуле массива нужны все элементы, а не только сохранённое значение
+    if (cached_value && !formula_->GetArraySize())
+    {
+        value_ = std::move(*cached_value);
+        state_.store(CacheState::Ready, std::memory_order_relaxed);
+    }
+}
+
 CellType Cell::FormulaImpl::IGetType() const
 {
     return CellType::FORMULA;
@@ -225,48 +300,142 @@ CellType Cell::FormulaImpl::IGetType() const
 
 CellInterface::Value Cell::FormulaImpl::IGetValue() const
 {
+    Compute();
+    return value_;
+}
 
-    // Все расчеты производим только если кэш невалиден
-    if (!cached_value_)
+void Cell::FormulaImpl::Compute() const
+{
+    CacheState state = state_.load(std::memory_order_acquire);
+    while (state != CacheState::Ready)
     {
-        FormulaInterface::Value result = formula_->Evaluate(sheet_);
-        if (std::holds_alternative<double>(result))
+        if (state == CacheState::Computing)
+        {
+            // Значение вычисляет другой поток. Дождаться его можно без
+            // взаимной блокировки: граф зависимостей ацикличен, и поток,
+            // вычисляющий ячейку, не ждёт ячеек, зависящих от неё
+            std::this_thread::yield();
+            state = state_.load(std::memory_order_acquire);
+            continue;
+        }
+        if (!state_.compare_exchange_weak(state, CacheState::Computing, std::memory_order_acquire))
+        {
+            continue;
+        }
+
+        try
         {
-            // Вычисление произведено успешно
-            if (std::isfinite(std::get<double>(result)))
+            // Вычисление может подкачивать тайлы листа, но не должно
+            // выгружать их, пока формула не досчитана
+            Sheet::EvictionGuard guard(sheet_);
+            // Короткие цепочки ссылок вычисляются рекурсивно. В глубокой
+            // цепочке влияющие формулы вычисляются заранее в порядке
+            // зависимостей, и рекурсия дальше не идёт
+            EvaluationDepth depth;
+            if (depth.IsDeep())
+            {
+                if (const Sheet* sheet = dynamic_cast<const Sheet*>(&sheet_))
+                {
+                    sheet->EvaluatePrecedents(*formula_);
+                }
+            }
+            if (formula_->GetArraySize())
             {
-                return std::get<double>(result);
+                ArrayValue array;
+                formula_->EvaluateArray(sheet_, array);
+                array_ = std::move(array);
+                // Значение формулы массива - её первый элемент
+                // (бесконечностей среди элементов нет)
+                if (array_->codes[0] != ValueCode::Number)
+                {
+                    value_ = ToFormulaError(array_->codes[0]);
+                }
+                else
+                {
+                    value_ = array_->numbers[0];
+                }
             }
             else
             {
-                return FormulaError(FormulaError::Category::Div0);
+                FormulaInterface::Value result = formula_->Evaluate(sheet_);
+                if (const double* number = std::get_if<double>(&result))
+                {
+                    // Бесконечность и NaN - результат деления на ноль
+                    value_ = std::isfinite(*number) ? CellInterface::Value(*number)
+                                                    : CellInterface::Value(FormulaError(FormulaError::Category::Div0));
+                }
+                else
+                {
+                    value_ = std::get<FormulaError>(result);
+                }
             }
         }
-
-        // Если мы здесь, вычисление закончилось ошибкой. Возвращаем ее
-        return std::get<FormulaError>(result);
+        catch (...)
+        {
+            state_.store(CacheState::Dirty, std::memory_order_release);
+            throw;
+        }
+        state_.store(CacheState::Ready, std::memory_order_release);
+        return;
     }
+}
 
-    // Если мы здесь, то кэш вычислен и валиден. Возвращаем его значение.
-    return *cached_value_;
+CellValueView Cell::FormulaImpl::IGetValueView() const
+{
+    // Значение формулы - число или ошибка, текст в нём не копируется
+    const CellInterface::Value value = IGetValue();
+    CellValueView view;
+    if (const double* number = std::get_if<double>(&value))
+    {
+        view.code = ValueCode::Number;
+        view.number = *number;
+    }
+    else
+    {
+        view.code = ToValueCode(std::get<FormulaError>(value));
+    }
+    return view;
 }
 
-std::string Cell::FormulaImpl::IGetText() const
+std::string_view Cell::FormulaImpl::IGetText() const
 {
-    return { FORMULA_SIGN + formula_->GetExpression() };
+    return formula_text_;
 }
 
-std::vector<Position> Cell::FormulaImpl::IGetReferencedCells() const
+Span<const Position> Cell::FormulaImpl::IGetReferencedCells() const
 {
-    return formula_.get()->GetReferencedCells();
+    return formula_->GetReferencedCellsView();
 }
 
 void Cell::FormulaImpl::IInvalidateCache()
 {
-    cached_value_.reset();
+    state_.store(CacheState::Dirty, std::memory_order_relaxed);
+    array_.reset();
+    // Прочитанное при прошлом вычислении больше не определяет значение
+    formula_->ForgetReads();
 }
 
 bool Cell::FormulaImpl::ICached() const
 {
-    return cached_value_.has_value();
+    return state_.load(std::memory_order_acquire) == CacheState::Ready;
+}
+
+void Cell::FormulaImpl::IFillCache()
+{
+    Compute();
+}
+
+const ArrayValue* Cell::FormulaImpl::IGetArrayValue() const
+{
+    if (!formula_->GetArraySize())
+    {
+        return nullptr;
+    }
+    Compute();
+    return &*array_;
+}
+
+const FormulaInterface* Cell::FormulaImpl::IGetFormula() const
+{
+    return formula_.get();
 }
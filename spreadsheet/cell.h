@@ -4,7 +4,10 @@
 #include "formula.h"
 
 //#include <set>    // для dependent_cells_
+#include <atomic>
+#include <cstdint>
 #include <optional>
+#include <string_view>
 #include <functional>     // из прекода к заданию
 #include <unordered_set>  // из прекода к заданию
 
@@ -17,20 +20,50 @@ enum class CellType
     ERROR
 };
 
+// Значение ячейки без построения CellInterface::Value: текст не копируется
+struct CellValueView
+{
+    ValueCode code = ValueCode::Empty;
+    double number = 0.0;
+    std::string_view text;    // ссылается на текст ячейки, пока она не изменена
+};
+
 class Cell : public CellInterface {
 public:
     Cell(SheetInterface& sheet);    // Конструктор теперь принимает ссылку на лист таблицы
     ~Cell();
 
     void Set(const std::string& text);
+    // Задает ячейке уже скомпилированную формулу (без парсинга текста) и,
+    // если передано, ранее вычисленное значение для кэша
+    void SetFormula(std::unique_ptr<FormulaInterface> formula,
+                    std::optional<CellInterface::Value> cached_value = std::nullopt);
     void Clear();
 
+    // Возвращает тип содержимого ячейки
+    CellType GetType() const;
+    // Возвращает формулу ячейки или nullptr, если ячейка не содержит формулу
+    const FormulaInterface* GetFormula() const;
+
     CellInterface::Value GetValue() const override;
     std::string GetText() const override;
     std::vector<Position> GetReferencedCells() const override;
-
-    // Метод проверяет циклическую зависимость start_cell_ptr от end_pos
-    bool IsCyclicDependent(const Cell* start_cell_ptr, const Position& end_pos) const;
+    // То же, что GetValue(), но без копирования текста. Формула при
+    // необходимости вычисляется
+    CellValueView GetValueView() const;
+    // То же, что GetText() и GetReferencedCells(), но без копирования.
+    // Действительны, пока содержимое ячейки не изменено. Диапазоны формулы
+    // не раскрываются (см. FormulaInterface::GetReferencedRangesView())
+    std::string_view GetTextView() const;
+    Span<const Position> GetReferencedCellsView() const;
+    Span<const Range> GetReferencedRangesView() const;
+    // Элементы формулы массива (см. FormulaInterface::GetArraySize()) или
+    // nullptr, если ячейка не содержит формулу массива. Вычисляются при
+    // первом обращении и хранятся до сброса кэша ячейки
+    const ArrayValue* GetArrayValue() const;
+    // Вычисляет формулу ячейки, если её значения нет в кэше, и сохраняет
+    // значение в кэше до его сброса. Для остальных ячеек ничего не делает
+    void FillCache();
     // Метод сбрасывает содержимое кэша ячейки
     void InvalidateCache();
     // Метод проверяет кэшированы ли данные в ячейке
@@ -48,11 +81,18 @@ private:
         virtual ~Impl() = default;
         virtual CellType IGetType() const = 0;
         virtual CellInterface::Value IGetValue() const = 0;
-        virtual std::string IGetText() const = 0;
+        virtual CellValueView IGetValueView() const = 0;
+        virtual std::string_view IGetText() const = 0;
 
-        virtual std::vector<Position> IGetReferencedCells() const = 0;    // Получить список ячеек, от которых зависит текущая
+        virtual Span<const Position> IGetReferencedCells() const = 0;    // Получить список ячеек, от которых зависит текущая
         virtual void IInvalidateCache() = 0;     // Инвалидация кэша
         virtual bool ICached() const = 0;        // Проверка валидности кэша
+        virtual void IFillCache()                // Вычисление значения в кэш
+        {}
+        virtual const ArrayValue* IGetArrayValue() const    // Элементы формулы массива
+        {
+            return nullptr;
+        }
     };
 
     // Класс "Пустая ячейка"
@@ -62,9 +102,10 @@ private:
         EmptyImpl() = default;
         CellType IGetType() const override;
         CellInterface::Value IGetValue() const override;    // Возвразщает пустую строку
-        std::string IGetText() const override;              // Возвразщает пустую строку
+        CellValueView IGetValueView() const override;
+        std::string_view IGetText() const override;         // Возвразщает пустую строку
 
-        std::vector<Position> IGetReferencedCells() const override; 
+        Span<const Position> IGetReferencedCells() const override;
         void IInvalidateCache() override;
         bool ICached() const override;
     };
@@ -76,9 +117,10 @@ private:
         explicit TextImpl(std::string text);
         CellType IGetType() const override;
         CellInterface::Value IGetValue() const override;    // Возвращает очищенный текст ячейки
-        std::string IGetText() const override;              // Возвращает текст ячейки со всеми экранирующими символами
+        CellValueView IGetValueView() const override;
+        std::string_view IGetText() const override;         // Возвращает текст ячейки со всеми экранирующими символами
 
-        std::vector<Position> IGetReferencedCells() const override;
+        Span<const Position> IGetReferencedCells() const override;
         void IInvalidateCache() override;
         bool ICached() const override;
     private:
@@ -91,16 +133,44 @@ private:
     {
     public:
         FormulaImpl(SheetInterface& sheet_, std::string formula);
+        FormulaImpl(SheetInterface& sheet_, std::unique_ptr<FormulaInterface> formula,
+                    std::optional<CellInterface::Value> cached_value);
         CellType IGetType() const override;
         CellInterface::Value IGetValue() const override;    // Возвращает вычисленное значение формулы
-        std::string IGetText() const override;              // Возвращает текст формулы ячейки (как для редактирования)
+        CellValueView IGetValueView() const override;
+        std::string_view IGetText() const override;         // Возвращает текст формулы ячейки (как для редактирования)
 
-        std::vector<Position> IGetReferencedCells() const override;
+        Span<const Position> IGetReferencedCells() const override;
         void IInvalidateCache() override;
         bool ICached() const override;
+        void IFillCache() override;
+        const ArrayValue* IGetArrayValue() const override;
+
+        const FormulaInterface* IGetFormula() const;
     private:
+        // Состояние кэша. Значение вычисляется при первом чтении и хранится
+        // до сброса кэша. Читать ячейку можно из нескольких потоков сразу:
+        // вычисляет значение поток, переведший состояние из Dirty в
+        // Computing, остальные ждут Ready. Сбрасывается кэш только при правке
+        // листа, когда ячейку никто не читает
+        enum class CacheState : std::uint8_t
+        {
+            Dirty,        // значения нет
+            Computing,    // значение вычисляется
+            Ready         // value_ (и array_ формулы массива) вычислено
+        };
+
         SheetInterface& sheet_;    // Ссылка на лист таблицы (пробрасывается через конструктор Cell) для работы формул
         std::unique_ptr<FormulaInterface> formula_;
-        std::optional<CellInterface::Value> cached_value_;
+        mutable std::atomic<CacheState> state_{ CacheState::Dirty };
+        // Публикуются записью Ready в state_ (release), читаются после
+        // чтения Ready (acquire)
+        mutable CellInterface::Value value_;
+        mutable std::optional<ArrayValue> array_;    // элементы формулы массива
+        std::string formula_text_;    // '=' и выражение формулы, строится один раз
+
+        // Вычисляет value_ и array_, если их нет, или ждёт потока, который
+        // их вычисляет
+        void Compute() const;
     };
 };
@@ -0,0 +1,41 @@
+#include "change_feed.h"
+
+#include <functional>
+#include <string_view>
+
+bool PublishedValues::Value::operator==(const Value& other) const
+{
+    return code == other.code && number == other.number && text_hash == other.text_hash;
+}
+
+bool PublishedValues::Update(Position pos, const CellValueView& view)
+{
+    Value value;
+    value.code = view.code;
+    value.number = view.code == ValueCode::Number ? view.number : 0.0;
+    value.text_hash = view.code == ValueCode::Text ? std::hash<std::string_view>{}(view.text) : 0;
+
+    const std::uint32_t id = TileId(TilePosition(pos));
+    auto it = tiles_.find(id);
+    if (it == tiles_.end())
+    {
+        if (value == Value{})
+        {
+            return false;
+        }
+        it = tiles_.emplace(id, std::make_unique<Tile>()).first;
+    }
+
+    Value& published = (*it->second)[TileCellIndex(pos)];
+    if (published == value)
+    {
+        return false;
+    }
+    published = value;
+    return true;
+}
+
+void PublishedValues::Clear()
+{
+    tiles_.clear();
+}
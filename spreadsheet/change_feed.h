@@ -0,0 +1,59 @@
+#pragma once
+
+#include "cell.h"
+#include "common.h"
+#include "tile_store.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+
+// Когда подписчик узнаёт о правке листа (см. Sheet::Subscribe())
+enum class NotifyMode
+{
+    Changed,        // после вычисления: ячейки, значения которых изменились
+    Invalidated,    // сразу, без вычислений: ячейки, значения которых могли измениться
+};
+
+// Подписчик на изменения значений ячеек листа (см. Sheet::Subscribe())
+class SheetObserver
+{
+public:
+    virtual ~SheetObserver() = default;
+
+    // Вызывается после правки листа, если изменились значения наблюдаемых
+    // ячеек: changed - их позиции по возрастанию. Буфер принадлежит листу и
+    // действителен до возврата из метода. Менять лист внутри нельзя
+    virtual void OnValuesChanged(Span<const Position> changed) = 0;
+    // То же для подписки NotifyMode::Invalidated: stale - наблюдаемые ячейки,
+    // значения которых могли измениться. Формулы среди них ещё не вычислены
+    virtual void OnValuesInvalidated(Span<const Position> stale) {}
+};
+
+// Последние значения, о которых узнали подписчики. Хранятся тайлами того же
+// размера, что и ячейки листа; тайл создаётся при первой записи непустого
+// значения. Текст хранится хэшем: совпадение хэшей разных текстов
+// пропустит изменение, но вероятность этого пренебрежимо мала.
+class PublishedValues
+{
+public:
+    // Запоминает значение value ячейки pos. Возвращает true, если оно
+    // отличается от запомненного раньше (по умолчанию значение пустое)
+    bool Update(Position pos, const CellValueView& value);
+    void Clear();
+
+private:
+    struct Value
+    {
+        ValueCode code = ValueCode::Empty;
+        double number = 0.0;
+        std::size_t text_hash = 0;
+
+        bool operator==(const Value& other) const;
+    };
+    using Tile = std::array<Value, TILE_CELLS>;
+
+    std::unordered_map<std::uint32_t, std::unique_ptr<Tile>> tiles_;
+};
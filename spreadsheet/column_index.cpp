@@ -0,0 +1,157 @@
+#include "column_index.h"
+
+#include "cell.h"
+
+#include <algorithm>
+
+namespace
+{
+
+// Наименьшее число листьев: небольшие столбцы не перестраиваются часто
+constexpr int MIN_CAPACITY = 1024;
+
+}  // namespace
+
+void ColumnAggregateIndex::Summary::Merge(const Summary& other)
+{
+    numbers.Merge(other.numbers);
+    invalid_texts += other.invalid_texts;
+}
+
+void ColumnAggregateIndex::Set(int row, const Cell* cell)
+{
+    Summary leaf;
+    bool is_formula = false;
+    if (cell && cell->GetType() == CellType::FORMULA)
+    {
+        is_formula = true;
+    }
+    else if (cell)
+    {
+        // Значение текстовой ячейки известно без вычислений
+        const CellValueView value = cell->GetValueView();
+        if (value.code == ValueCode::Text)
+        {
+            try
+            {
+                leaf.numbers.Add(TextToNumber(value.text));
+            }
+            catch (const FormulaError&)
+            {
+                leaf.invalid_texts = 1;
+            }
+        }
+    }
+
+    if (is_formula)
+    {
+        formula_rows_.insert(row);
+    }
+    else
+    {
+        formula_rows_.erase(row);
+    }
+
+    if (row >= capacity_)
+    {
+        if (leaf.numbers.count == 0 && leaf.invalid_texts == 0)
+        {
+            // Пустой лист за пределами дерева и так пуст
+            return;
+        }
+        Grow(row);
+    }
+
+    int node = capacity_ + row;
+    tree_[node] = leaf;
+    for (node /= 2; node >= 1; node /= 2)
+    {
+        tree_[node] = tree_[2 * node];
+        tree_[node].Merge(tree_[2 * node + 1]);
+    }
+}
+
+ColumnAggregateIndex::Summary ColumnAggregateIndex::Query(int from_row, int to_row) const
+{
+    Summary result;
+    // Снизу вверх: на каждом уровне берётся не больше двух узлов с краёв отрезка
+    int left = capacity_ + std::max(from_row, 0);
+    int right = capacity_ + std::min(to_row, capacity_ - 1) + 1;
+    while (left < right)
+    {
+        if (left & 1)
+        {
+            result.Merge(tree_[left++]);
+        }
+        if (right & 1)
+        {
+            result.Merge(tree_[--right]);
+        }
+        left /= 2;
+        right /= 2;
+    }
+    return result;
+}
+
+void ColumnAggregateIndex::Grow(int row)
+{
+    int capacity = std::max(capacity_, MIN_CAPACITY);
+    while (capacity <= row)
+    {
+        capacity *= 2;
+    }
+
+    std::vector<Summary> tree(2 * static_cast<std::size_t>(capacity));
+    std::copy(tree_.begin() + capacity_, tree_.end(), tree.begin() + capacity);
+    for (int node = capacity - 1; node >= 1; --node)
+    {
+        tree[node] = tree[2 * node];
+        tree[node].Merge(tree[2 * node + 1]);
+    }
+    tree_ = std::move(tree);
+    capacity_ = capacity;
+}
+
+void ColumnLookupIndex::MarkDirty(int row)
+{
+    if (!dirty_rows_.insert(row).second)
+    {
+        return;
+    }
+
+    auto key_it = keys_.find(row);
+    if (key_it == keys_.end())
+    {
+        return;
+    }
+    auto rows_it = rows_.find(key_it->second);
+    std::vector<int>& rows = rows_it->second;
+    rows.erase(std::lower_bound(rows.begin(), rows.end(), row));
+    if (rows.empty())
+    {
+        rows_.erase(rows_it);
+    }
+    keys_.erase(key_it);
+}
+
+std::optional<int> ColumnLookupIndex::Find(double key, int from_row, int to_row) const
+{
+    auto it = rows_.find(key);
+    if (it == rows_.end())
+    {
+        return std::nullopt;
+    }
+    auto row_it = std::lower_bound(it->second.begin(), it->second.end(), from_row);
+    if (row_it == it->second.end() || *row_it > to_row)
+    {
+        return std::nullopt;
+    }
+    return *row_it;
+}
+
+void ColumnLookupIndex::Insert(int row, double key)
+{
+    std::vector<int>& rows = rows_[key];
+    rows.insert(std::lower_bound(rows.begin(), rows.end(), row), row);
+    keys_[row] = key;
+}
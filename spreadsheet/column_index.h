@@ -0,0 +1,111 @@
+#pragma once
+
+#include "aggregate.h"
+#include "common.h"
+
+#include <cstdint>
+#include <optional>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+class Cell;
+
+// Индекс агрегатов одного столбца листа (дерево отрезков).
+// Листья дерева - строки столбца: сводка NumberSummary по числу ячейки
+// (числовой текст) и счётчик текстов, которые не являются числом. Узел
+// хранит объединение сводок своих листьев, поэтому сводка любого отрезка
+// строк собирается из O(log n) узлов, а изменение ячейки обновляет путь от
+// листа к корню за O(log n). Узлы пересчитываются из детей, а не правятся
+// на разность, так что погрешность суммы не накапливается от правки к правке.
+// Значения формул в дереве не хранятся: они меняются без правки самой
+// ячейки. Строки с формулами хранятся отдельно и вычисляются при запросе.
+class ColumnAggregateIndex
+{
+public:
+    // Сводка отрезка строк
+    struct Summary
+    {
+        NumberSummary numbers;
+        std::uint32_t invalid_texts = 0;    // тексты, которые не являются числом
+
+        void Merge(const Summary& other);
+    };
+
+    // Обновляет строку row по новому содержимому ячейки (nullptr - ячейки нет)
+    void Set(int row, const Cell* cell);
+
+    // Сводка по ячейкам без формул в строках [from_row, to_row]
+    Summary Query(int from_row, int to_row) const;
+
+    // Вызывает callback(row) для каждой строки с формулой из
+    // [from_row, to_row] по возрастанию
+    template <typename Callback>
+    void ForEachFormula(int from_row, int to_row, Callback&& callback) const;
+
+private:
+    // Увеличивает число листьев до степени двойки, вмещающей строку row
+    void Grow(int row);
+
+    // Узлы от корня (1) до листьев (capacity_ + row), узел 0 не используется
+    std::vector<Summary> tree_;
+    int capacity_ = 0;
+    std::set<int> formula_rows_;
+};
+
+// Хэш-индекс ключей поиска одного столбца (см. lookup.h): ключ - строки
+// столбца с этим ключом по возрастанию. Изменённые строки, в том числе
+// формулы, значение которых могло измениться, только отмечаются устаревшими
+// и перечитываются при следующем поиске по отрезку строк, который их
+// содержит. Поэтому правка ячейки стоит O(число строк с тем же ключом), а
+// поиск - O(1) плюс перечитывание устаревших строк отрезка.
+class ColumnLookupIndex
+{
+public:
+    // Отмечает строку row устаревшей
+    void MarkDirty(int row);
+
+    // Перечитывает устаревшие строки [from_row, to_row]: key_at(row)
+    // возвращает ключ строки или nullopt. key_at может вычислять формулы,
+    // которые сами ищут по этому столбцу
+    template <typename KeyAt>
+    void Refresh(int from_row, int to_row, KeyAt&& key_at);
+
+    // Первая строка из [from_row, to_row] с ключом key. Устаревшие строки
+    // отрезка должны быть перечитаны через Refresh()
+    std::optional<int> Find(double key, int from_row, int to_row) const;
+
+private:
+    void Insert(int row, double key);
+
+    std::unordered_map<double, std::vector<int>> rows_;
+    std::unordered_map<int, double> keys_;    // ключ строки, если он есть в rows_
+    std::set<int> dirty_rows_;
+};
+
+template <typename KeyAt>
+void ColumnLookupIndex::Refresh(int from_row, int to_row, KeyAt&& key_at)
+{
+    // Строка снимается с учёта до вычисления: вложенный поиск по тому же
+    // столбцу не должен вычислять её повторно. Итератор после вычисления
+    // ищется заново, так как вложенный поиск мог изменить множество
+    for (auto it = dirty_rows_.lower_bound(from_row); it != dirty_rows_.end() && *it <= to_row;
+         it = dirty_rows_.lower_bound(from_row))
+    {
+        const int row = *it;
+        dirty_rows_.erase(it);
+        if (const std::optional<double> key = key_at(row))
+        {
+            Insert(row, *key);
+        }
+    }
+}
+
+template <typename Callback>
+void ColumnAggregateIndex::ForEachFormula(int from_row, int to_row, Callback&& callback) const
+{
+    for (auto it = formula_rows_.lower_bound(from_row); it != formula_rows_.end() && *it <= to_row; ++it)
+    {
+        callback(*it);
+    }
+}
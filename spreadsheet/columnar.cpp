@@ -0,0 +1,348 @@
+#include "columnar.h"
+
+#include "cell.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <vector>
+
+namespace
+{
+
+std::uint64_t AlignUp(std::uint64_t offset)
+{
+    return (offset + columnar::ALIGNMENT - 1) & ~(columnar::ALIGNMENT - 1);
+}
+
+// Последовательная запись буферов с выравниванием
+class BufferWriter
+{
+public:
+    explicit BufferWriter(std::ostream& out)
+        : out_(out)
+    {
+    }
+
+    // Записывает буфер с начала выровненного адреса и возвращает ссылку на него
+    columnar::BufferRef Write(const void* data, std::uint64_t length)
+    {
+        Pad();
+        columnar::BufferRef ref{ offset_, length };
+        out_.write(static_cast<const char*>(data), static_cast<std::streamsize>(length));
+        offset_ += length;
+        return ref;
+    }
+
+    // Дополняет файл нулями до выровненной длины
+    void Pad()
+    {
+        static const char zeros[columnar::ALIGNMENT] = {};
+        const std::uint64_t aligned = AlignUp(offset_);
+        out_.write(zeros, static_cast<std::streamsize>(aligned - offset_));
+        offset_ = aligned;
+    }
+
+    std::uint64_t Offset() const
+    {
+        return offset_;
+    }
+
+private:
+    std::ostream& out_;
+    std::uint64_t offset_ = 0;
+};
+
+// Буферы одного столбца
+struct ColumnBuffers
+{
+    explicit ColumnBuffers(int rows)
+        : number_validity((rows + 7) / 8)
+        , numbers(rows)
+        , error_validity((rows + 7) / 8)
+        , errors(rows)
+        , text_validity((rows + 7) / 8)
+        , text_offsets(rows + 1)
+    {
+    }
+
+    void Clear()
+    {
+        std::fill(number_validity.begin(), number_validity.end(), 0);
+        std::fill(error_validity.begin(), error_validity.end(), 0);
+        std::fill(text_validity.begin(), text_validity.end(), 0);
+        text_data.clear();
+    }
+
+    static void SetValid(std::vector<std::uint8_t>& bitmap, int row)
+    {
+        bitmap[row / 8] |= static_cast<std::uint8_t>(1u << (row % 8));
+    }
+
+    std::vector<std::uint8_t> number_validity;
+    std::vector<double> numbers;
+    std::vector<std::uint8_t> error_validity;
+    std::vector<std::int8_t> errors;
+    std::vector<std::uint8_t> text_validity;
+    std::vector<std::int32_t> text_offsets;
+    std::string text_data;
+};
+
+}  // namespace
+
+void ExportColumns(const SheetInterface& sheet, Position top_left, Size size, std::ostream& out)
+{
+    const Position bottom_right{ top_left.row + size.rows - 1, top_left.col + size.cols - 1 };
+    if (size.rows < 0 || size.cols < 0 || !top_left.IsValid()
+        || (size.rows > 0 && size.cols > 0 && !bottom_right.IsValid()))
+    {
+        throw InvalidPositionException("Invalid range for ExportColumns()");
+    }
+
+    BufferWriter writer(out);
+    columnar::Header header{};
+    std::memcpy(header.magic, columnar::MAGIC, sizeof(header.magic));
+    header.version = columnar::VERSION;
+    header.endian_mark = columnar::ENDIAN_MARK;
+    header.first_row = top_left.row;
+    header.first_col = top_left.col;
+    header.row_count = size.rows;
+    header.column_count = size.cols;
+    writer.Write(&header, sizeof(header));
+
+    std::vector<columnar::BufferRef> directory;
+    directory.reserve(static_cast<std::size_t>(size.cols) * columnar::BUFFER_COUNT);
+
+    // Буферы переиспользуются от столбца к столбцу
+    ColumnBuffers buffers(size.rows);
+    for (int col = 0; col < size.cols; ++col)
+    {
+        buffers.Clear();
+        for (int row = 0; row < size.rows; ++row)
+        {
+            buffers.numbers[row] = 0.0;
+            buffers.errors[row] = 0;
+            buffers.text_offsets[row] = static_cast<std::int32_t>(buffers.text_data.size());
+
+            const CellInterface* cell = sheet.GetCell(Position{ top_left.row + row, top_left.col + col });
+            if (!cell)
+            {
+                continue;
+            }
+            // Пустая ячейка - null, а не ноль, которым она считается в формулах
+            const auto* sheet_cell = dynamic_cast<const Cell*>(cell);
+            if (sheet_cell && sheet_cell->GetType() == CellType::EMPTY)
+            {
+                continue;
+            }
+
+            const CellInterface::Value value = cell->GetValue();
+            if (const double* number = std::get_if<double>(&value))
+            {
+                buffers.numbers[row] = *number;
+                ColumnBuffers::SetValid(buffers.number_validity, row);
+            }
+            else if (const FormulaError* error = std::get_if<FormulaError>(&value))
+            {
+                buffers.errors[row] = static_cast<std::int8_t>(error->GetCategory());
+                ColumnBuffers::SetValid(buffers.error_validity, row);
+            }
+            else
+            {
+                const std::string& text = std::get<std::string>(value);
+                if (buffers.text_data.size() + text.size()
+                    > static_cast<std::size_t>(std::numeric_limits<std::int32_t>::max()))
+                {
+                    throw ColumnarException("Text column exceeds 2 GiB");
+                }
+                buffers.text_data += text;
+                ColumnBuffers::SetValid(buffers.text_validity, row);
+            }
+        }
+        buffers.text_offsets[size.rows] = static_cast<std::int32_t>(buffers.text_data.size());
+
+        directory.push_back(writer.Write(buffers.number_validity.data(), buffers.number_validity.size()));
+        directory.push_back(writer.Write(buffers.numbers.data(), buffers.numbers.size() * sizeof(double)));
+        directory.push_back(writer.Write(buffers.error_validity.data(), buffers.error_validity.size()));
+        directory.push_back(writer.Write(buffers.errors.data(), buffers.errors.size()));
+        directory.push_back(writer.Write(buffers.text_validity.data(), buffers.text_validity.size()));
+        directory.push_back(writer.Write(buffers.text_offsets.data(),
+                                         buffers.text_offsets.size() * sizeof(std::int32_t)));
+        directory.push_back(writer.Write(buffers.text_data.data(), buffers.text_data.size()));
+    }
+
+    columnar::Trailer trailer{};
+    trailer.directory_offset = AlignUp(writer.Offset());
+    std::memcpy(trailer.magic, columnar::MAGIC, sizeof(trailer.magic));
+    writer.Write(directory.data(), directory.size() * sizeof(columnar::BufferRef));
+    out.write(reinterpret_cast<const char*>(&trailer), sizeof(trailer));
+
+    if (!out)
+    {
+        throw ColumnarException("Cannot write columnar export");
+    }
+}
+
+void ExportColumns(const SheetInterface& sheet, Position top_left, Size size, const std::string& path)
+{
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out)
+    {
+        throw ColumnarException("Cannot create columnar export file " + path);
+    }
+    ExportColumns(sheet, top_left, size, out);
+    out.close();
+    if (!out)
+    {
+        throw ColumnarException("Cannot write columnar export file " + path);
+    }
+}
+
+ColumnarFile::ColumnarFile(const std::string& path)
+{
+    try
+    {
+        file_ = std::make_unique<MappedFile>(path);
+    }
+    catch (const std::runtime_error& ex)
+    {
+        throw ColumnarException(ex.what());
+    }
+
+    const char* data = file_->Data();
+    const std::uint64_t size = file_->Size();
+    if (size < sizeof(columnar::Header) + sizeof(columnar::Trailer))
+    {
+        throw ColumnarException("Columnar export file is too small");
+    }
+
+    std::memcpy(&header_, data, sizeof(header_));
+    columnar::Trailer trailer;
+    std::memcpy(&trailer, data + size - sizeof(trailer), sizeof(trailer));
+    if (std::memcmp(header_.magic, columnar::MAGIC, sizeof(header_.magic)) != 0
+        || std::memcmp(trailer.magic, columnar::MAGIC, sizeof(trailer.magic)) != 0)
+    {
+        throw ColumnarException("Not a columnar export file");
+    }
+    if (header_.version != columnar::VERSION || header_.endian_mark != columnar::ENDIAN_MARK)
+    {
+        throw ColumnarException("Unsupported columnar export version or platform");
+    }
+    if (header_.row_count < 0 || header_.column_count < 0)
+    {
+        throw ColumnarException("Columnar export header is invalid");
+    }
+
+    // Таблица буферов должна целиком лежать между буферами и завершающей записью
+    const std::uint64_t entries = std::uint64_t{ static_cast<std::uint32_t>(header_.column_count) }
+                                  * columnar::BUFFER_COUNT;
+    const std::uint64_t directory_end = size - sizeof(trailer);
+    if (trailer.directory_offset % columnar::ALIGNMENT != 0 || trailer.directory_offset > directory_end
+        || entries > (directory_end - trailer.directory_offset) / sizeof(columnar::BufferRef))
+    {
+        throw ColumnarException("Columnar export directory is out of file bounds");
+    }
+    directory_ = reinterpret_cast<const columnar::BufferRef*>(data + trailer.directory_offset);
+
+    // Длины буферов должны соответствовать числу строк
+    const std::uint64_t rows = static_cast<std::uint32_t>(header_.row_count);
+    const std::uint64_t bitmap_size = (rows + 7) / 8;
+    const std::uint64_t expected[columnar::BUFFER_COUNT] = {
+        bitmap_size, rows * sizeof(double), bitmap_size, rows, bitmap_size, (rows + 1) * sizeof(std::int32_t), 0,
+    };
+    for (std::uint64_t i = 0; i < entries; ++i)
+    {
+        const columnar::BufferRef& ref = directory_[i];
+        const auto index = static_cast<columnar::BufferIndex>(i % columnar::BUFFER_COUNT);
+        if (ref.offset % columnar::ALIGNMENT != 0 || ref.offset > trailer.directory_offset
+            || ref.length > trailer.directory_offset - ref.offset
+            || (index != columnar::TEXT_DATA && ref.length != expected[index]))
+        {
+            throw ColumnarException("Columnar export buffer is invalid");
+        }
+    }
+
+    // Смещения строк должны возрастать и не выходить за данные
+    for (int col = 0; col < header_.column_count; ++col)
+    {
+        const std::int32_t* offsets = TextOffsets(col);
+        const std::uint64_t data_size = directory_[col * columnar::BUFFER_COUNT + columnar::TEXT_DATA].length;
+        if (offsets[0] != 0 || static_cast<std::uint64_t>(offsets[header_.row_count]) != data_size)
+        {
+            throw ColumnarException("Columnar export text offsets are invalid");
+        }
+        for (int row = 0; row < header_.row_count; ++row)
+        {
+            if (offsets[row] > offsets[row + 1])
+            {
+                throw ColumnarException("Columnar export text offsets are invalid");
+            }
+        }
+    }
+}
+
+Position ColumnarFile::TopLeft() const
+{
+    return Position{ header_.first_row, header_.first_col };
+}
+
+int ColumnarFile::RowCount() const
+{
+    return header_.row_count;
+}
+
+int ColumnarFile::ColumnCount() const
+{
+    return header_.column_count;
+}
+
+const std::uint8_t* ColumnarFile::NumberValidity(int col) const
+{
+    return reinterpret_cast<const std::uint8_t*>(Buffer(col, columnar::NUMBER_VALIDITY));
+}
+
+const double* ColumnarFile::Numbers(int col) const
+{
+    return reinterpret_cast<const double*>(Buffer(col, columnar::NUMBERS));
+}
+
+const std::uint8_t* ColumnarFile::ErrorValidity(int col) const
+{
+    return reinterpret_cast<const std::uint8_t*>(Buffer(col, columnar::ERROR_VALIDITY));
+}
+
+const std::int8_t* ColumnarFile::Errors(int col) const
+{
+    return reinterpret_cast<const std::int8_t*>(Buffer(col, columnar::ERRORS));
+}
+
+const std::uint8_t* ColumnarFile::TextValidity(int col) const
+{
+    return reinterpret_cast<const std::uint8_t*>(Buffer(col, columnar::TEXT_VALIDITY));
+}
+
+const std::int32_t* ColumnarFile::TextOffsets(int col) const
+{
+    return reinterpret_cast<const std::int32_t*>(Buffer(col, columnar::TEXT_OFFSETS));
+}
+
+const char* ColumnarFile::TextData(int col) const
+{
+    return Buffer(col, columnar::TEXT_DATA);
+}
+
+std::string_view ColumnarFile::Text(int col, int row) const
+{
+    const std::int32_t* offsets = TextOffsets(col);
+    return std::string_view(TextData(col) + offsets[row], static_cast<std::size_t>(offsets[row + 1] - offsets[row]));
+}
+
+const char* ColumnarFile::Buffer(int col, columnar::BufferIndex index) const
+{
+    if (col < 0 || col >= header_.column_count)
+    {
+        throw std::out_of_range("Columnar export column is out of range");
+    }
+    return file_->Data() + directory_[col * columnar::BUFFER_COUNT + index].offset;
+}
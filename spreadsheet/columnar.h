@@ -0,0 +1,130 @@
+#pragma once
+
+#include "common.h"
+#include "mapped_file.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+// Выгрузка значений прямоугольного диапазона листа по столбцам.
+// Каждый столбец диапазона записывается как три массива в формате Arrow:
+//  * числа:  битовая карта валидности и float64 на каждую строку;
+//  * ошибки: битовая карта валидности и int8 (FormulaError::Category);
+//  * текст:  битовая карта валидности, int32 смещения (строк + 1) и байты
+//            строк подряд (Arrow Utf8).
+// Для каждой строки установлен бит не более чем в одной из трёх карт;
+// отсутствующая или пустая ячейка - null во всех трёх.
+// Буферы следуют правилам Arrow: начинаются с адресов, кратных 64 байтам, и
+// дополнены до кратной 64 длины, биты карт идут от младшего к старшему. Поэтому
+// после отображения файла в память их можно передать потребителю (например,
+// в arrow::Buffer или pyarrow.foreign_buffer) без копирования.
+// Метаданные - собственные, а не FlatBuffers-сообщения Arrow IPC: заголовок в
+// начале файла, таблица буферов и завершающая запись в конце, как у файла
+// Arrow. Формат привязан к платформе (порядок байт проверяется при чтении).
+
+// Исключение, выбрасываемое при ошибке записи или чтения выгрузки
+class ColumnarException : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+namespace columnar
+{
+
+inline constexpr char MAGIC[4] = { 'S', 'P', 'C', 'L' };
+inline constexpr std::uint32_t VERSION = 1;
+inline constexpr std::uint32_t ENDIAN_MARK = 0x01020304;
+// Выравнивание буферов, рекомендованное Arrow
+inline constexpr std::uint64_t ALIGNMENT = 64;
+
+// Буферы одного столбца диапазона в порядке записи
+enum BufferIndex
+{
+    NUMBER_VALIDITY,
+    NUMBERS,
+    ERROR_VALIDITY,
+    ERRORS,
+    TEXT_VALIDITY,
+    TEXT_OFFSETS,
+    TEXT_DATA,
+    BUFFER_COUNT,
+};
+
+struct Header
+{
+    char magic[4];
+    std::uint32_t version;
+    std::uint32_t endian_mark;
+    std::int32_t first_row;
+    std::int32_t first_col;
+    std::int32_t row_count;
+    std::int32_t column_count;
+    std::uint32_t reserved;
+};
+
+// Буфер: смещение от начала файла и длина в байтах (без выравнивания)
+struct BufferRef
+{
+    std::uint64_t offset;
+    std::uint64_t length;
+};
+
+// Таблица буферов - BUFFER_COUNT записей BufferRef на столбец - лежит после
+// всех буферов; её положение хранится в завершающей записи в конце файла
+struct Trailer
+{
+    std::uint64_t directory_offset;
+    char magic[4];
+    std::uint32_t reserved;
+};
+
+}  // namespace columnar
+
+// Выгружает значения ячеек диапазона size с левым верхним углом top_left.
+// Формулы при необходимости вычисляются.
+// Бросает InvalidPositionException для диапазона за пределами листа и
+// ColumnarException при ошибке записи.
+void ExportColumns(const SheetInterface& sheet, Position top_left, Size size, std::ostream& out);
+void ExportColumns(const SheetInterface& sheet, Position top_left, Size size, const std::string& path);
+
+// Выгрузка, отображённая в память. Методы возвращают указатели прямо в
+// отображение; они валидны, пока жив объект.
+// Конструктор бросает ColumnarException, если файл повреждён.
+class ColumnarFile
+{
+public:
+    explicit ColumnarFile(const std::string& path);
+
+    Position TopLeft() const;
+    int RowCount() const;
+    int ColumnCount() const;
+
+    const std::uint8_t* NumberValidity(int col) const;
+    const double* Numbers(int col) const;
+    const std::uint8_t* ErrorValidity(int col) const;
+    const std::int8_t* Errors(int col) const;
+    const std::uint8_t* TextValidity(int col) const;
+    const std::int32_t* TextOffsets(int col) const;
+    const char* TextData(int col) const;
+
+    // Текст строки row столбца col (пустой, если это не текст)
+    std::string_view Text(int col, int row) const;
+
+    static bool IsValid(const std::uint8_t* bitmap, int row)
+    {
+        return (bitmap[row / 8] >> (row % 8)) & 1;
+    }
+
+private:
+    const char* Buffer(int col, columnar::BufferIndex index) const;
+
+    std::unique_ptr<MappedFile> file_;
+    columnar::Header header_{};
+    const columnar::BufferRef* directory_ = nullptr;
+};
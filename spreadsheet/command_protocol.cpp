@@ -0,0 +1,258 @@
+#include "command_protocol.h"
+
+#include "snapshot.h"
+
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <utility>
+
+using namespace std::literals;
+
+namespace
+{
+
+// Наибольший диапазон get-range: ответ собирается в памяти целиком
+constexpr std::size_t MAX_RANGE_CELLS = std::size_t{ 1 } << 20;
+
+// Отделяет от строки line первое поле до пробела
+std::string_view NextField(std::string_view& line)
+{
+    const std::size_t space = line.find(' ');
+    const std::string_view field = line.substr(0, space);
+    line = space == std::string_view::npos ? std::string_view{} : line.substr(space + 1);
+    return field;
+}
+
+Position ParsePosition(std::string_view text)
+{
+    const Position pos = Position::FromString(text);
+    if (!pos.IsValid())
+    {
+        throw InvalidPositionException("Invalid position: " + std::string(text));
+    }
+    return pos;
+}
+
+Range ParseRange(std::string_view text)
+{
+    const std::size_t colon = text.find(':');
+    if (colon == std::string_view::npos)
+    {
+        const Position pos = ParsePosition(text);
+        return Range{ pos, pos };
+    }
+    return Range::FromCorners(ParsePosition(text.substr(0, colon)), ParsePosition(text.substr(colon + 1)));
+}
+
+// Ответ об ошибке: сообщение в одну строку
+void WriteError(std::string_view message, std::string& output)
+{
+    output += "ERR "sv;
+    const std::size_t start = output.size();
+    output += message;
+    std::replace(output.begin() + start, output.end(), '\n', ' ');
+    output += '\n';
+}
+
+}  // namespace
+
+CommandProcessor::CommandProcessor(Sheet& sheet, bool read_only)
+    : sheet_(&sheet)
+    , read_only_(read_only)
+{}
+
+void CommandProcessor::SetSheet(Sheet& sheet)
+{
+    sheet_ = &sheet;
+}
+
+void CommandProcessor::Feed(std::string_view input, std::string& output)
+{
+    if (closed_)
+    {
+        return;
+    }
+    input_ += input;
+
+    std::size_t start = 0;
+    for (std::size_t end = input_.find('\n'); end != std::string::npos && !closed_;
+         end = input_.find('\n', start))
+    {
+        std::string_view line(input_.data() + start, end - start);
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.remove_suffix(1);
+        }
+        Execute(line, output);
+        start = end + 1;
+    }
+    input_.erase(0, start);
+    // Правки в конце порции не ждут следующей: клиент может ждать ответов
+    ApplyEdits(output);
+}
+
+void CommandProcessor::Finish(std::string& output)
+{
+    if (!input_.empty())
+    {
+        Feed("\n"sv, output);
+    }
+}
+
+bool CommandProcessor::IsClosed() const
+{
+    return closed_;
+}
+
+CommandProcessor::Stats CommandProcessor::GetStats() const
+{
+    return stats_;
+}
+
+void CommandProcessor::Execute(std::string_view line, std::string& output)
+{
+    if (line.empty())
+    {
+        return;
+    }
+    ++stats_.commands;
+
+    std::string_view args = line;
+    const std::string_view command = NextField(args);
+    try
+    {
+        if ((command == "set"sv || command == "clear"sv) && !read_only_)
+        {
+            const Position pos = ParsePosition(NextField(args));
+            ++stats_.edits;
+            edits_.push_back(command == "set"sv ? CellEdit{ pos, std::string(args) } : CellEdit{ pos, std::nullopt });
+            return;
+        }
+
+        // Ответы идут в порядке команд: сначала ответы на правки перед командой
+        ApplyEdits(output);
+        if (command == "get"sv)
+        {
+            const Position pos = ParsePosition(args);
+            output += "OK "sv;
+            WriteValues(Range{ pos, pos }, output);
+        }
+        else if (command == "get-range"sv)
+        {
+            const Range range = ParseRange(args);
+            const Size size = range.GetSize();
+            if (static_cast<std::size_t>(size.rows) * size.cols > MAX_RANGE_CELLS)
+            {
+                throw std::invalid_argument("Range is too large: " + range.ToString());
+            }
+            output += "OK " + std::to_string(size.rows) + ' ' + std::to_string(size.cols) + '\n';
+            WriteValues(range, output);
+        }
+        else if (command == "print"sv)
+        {
+            const Size size = sheet_->GetPrintableSize();
+            format_.str({});
+            sheet_->PrintValues(format_);
+            output += "OK " + std::to_string(size.rows) + ' ' + std::to_string(size.cols) + '\n';
+            output += format_.str();
+        }
+        else if (command == "snapshot"sv)
+        {
+            if (args.empty())
+            {
+                throw std::invalid_argument("snapshot requires a path");
+            }
+            SaveSnapshot(*sheet_, std::string(args), SnapshotOptions{ true });
+            output += "OK\n"sv;
+        }
+        else if (command == "set"sv || command == "clear"sv)
+        {
+            WriteError("Read-only replica", output);
+        }
+        else if (command == "quit"sv)
+        {
+            closed_ = true;
+            output += "OK\n"sv;
+        }
+        else
+        {
+            WriteError("Unknown command: " + std::string(command), output);
+        }
+    }
+    catch (const std::exception& error)
+    {
+        ApplyEdits(output);
+        WriteError(error.what(), output);
+    }
+}
+
+void CommandProcessor::ApplyEdits(std::string& output)
+{
+    // Некорректная правка прерывает пакет: правки до неё применены,
+    // остальные применяются следующим пакетом
+    while (!edits_.empty())
+    {
+        ++stats_.batches;
+        std::size_t applied = 0;
+        try
+        {
+            sheet_->ApplyEdits(edits_, &applied);
+            applied = edits_.size();
+        }
+        catch (const std::exception& error)
+        {
+            for (std::size_t i = 0; i < applied; ++i)
+            {
+                output += "OK\n"sv;
+            }
+            if (applied < edits_.size())
+            {
+                WriteError(error.what(), output);
+                ++applied;
+            }
+            edits_.erase(edits_.begin(), edits_.begin() + applied);
+            continue;
+        }
+        for (std::size_t i = 0; i < applied; ++i)
+        {
+            output += "OK\n"sv;
+        }
+        edits_.clear();
+    }
+}
+
+void CommandProcessor::WriteValues(const Range& range, std::string& output)
+{
+    const Size size = range.GetSize();
+    const std::size_t count = static_cast<std::size_t>(size.rows) * size.cols;
+    numbers_.resize(count);
+    codes_.resize(count);
+    texts_.resize(count);
+    sheet_->GetValues(range.from, size, ValueBuffers{ numbers_.data(), codes_.data(), texts_.data() });
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        if (i > 0)
+        {
+            output += i % size.cols == 0 ? '\n' : '\t';
+        }
+        switch (codes_[i])
+        {
+        case ValueCode::Empty:
+            break;
+        case ValueCode::Text:
+            output += texts_[i];
+            break;
+        case ValueCode::Number:
+            format_.str({});
+            format_ << numbers_[i];
+            output += format_.str();
+            break;
+        default:
+            output += ToFormulaError(codes_[i]).ToString();
+            break;
+        }
+    }
+    output += '\n';
+}
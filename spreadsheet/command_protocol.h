@@ -0,0 +1,80 @@
+#pragma once
+
+#include "sheet.h"
+
+#include <cstddef>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Построчный текстовый протокол сервера листа (см. server/spreadsheet_server.cpp).
+// Команда - строка, поля разделены одним пробелом:
+//   set <ячейка> <текст>   - SetCell(); текст - остаток строки, может быть пустым
+//   clear <ячейка>         - ClearCell()
+//   get <ячейка>           - значение ячейки
+//   get-range <A1:B2>      - значения диапазона
+//   print                  - значения всей области печати, как PrintValues()
+//   snapshot <путь>        - SaveSnapshot() со значениями формул
+//   quit                   - завершить сеанс
+// На каждую команду приходит ровно один ответ в порядке команд: строка
+// "OK" (для get - "OK <значение>") или "ERR <сообщение>". Ответы get-range
+// и print - "OK <строк> <столбцов>" и следом столько строк значений через
+// табуляцию. Значения печатаются так же, как в PrintValues(); у пустой
+// ячейки значение - пустая строка.
+//
+// Клиент может отправлять команды, не дожидаясь ответов (конвейер). Правки
+// set и clear, идущие подряд в уже полученных данных, применяются одним
+// пакетом Sheet::ApplyEdits(): кэш зависимых формул сбрасывается один раз, а
+// вычисляются они при следующем чтении. Некорректная правка получает ERR и
+// не мешает остальным правкам пакета.
+class CommandProcessor
+{
+public:
+    // Счётчики сеанса
+    struct Stats
+    {
+        std::size_t commands = 0;    // выполнено команд
+        std::size_t edits = 0;       // из них правок set и clear
+        std::size_t batches = 0;     // вызовов ApplyEdits()
+    };
+
+    // read_only - сеанс реплики (см. replication.h): правки set и clear
+    // получают ERR
+    explicit CommandProcessor(Sheet& sheet, bool read_only = false);
+
+    // Переключает сеанс на другой лист, например после перезагрузки реплики
+    void SetSheet(Sheet& sheet);
+
+    // Принимает очередную порцию входных данных сеанса и выполняет все
+    // полученные целиком строки; ответы дописываются в output. Незавершённая
+    // последняя строка ждёт следующей порции
+    void Feed(std::string_view input, std::string& output);
+    // Конец входных данных: выполняет незавершённую последнюю строку
+    void Finish(std::string& output);
+    // Получена ли команда quit. Данные после неё не выполняются
+    bool IsClosed() const;
+
+    Stats GetStats() const;
+
+private:
+    Sheet* sheet_;
+    bool read_only_;
+    std::string input_;
+    // Правки, ждущие применения одним пакетом
+    std::vector<CellEdit> edits_;
+    // Буферы чтения значений и печати чисел, чтобы не выделять память на
+    // каждую команду
+    std::vector<double> numbers_;
+    std::vector<ValueCode> codes_;
+    std::vector<std::string_view> texts_;
+    std::ostringstream format_;
+    bool closed_ = false;
+    Stats stats_;
+
+    void Execute(std::string_view line, std::string& output);
+    // Применяет накопленные правки и пишет ответы на них
+    void ApplyEdits(std::string& output);
+    // Пишет значения диапазона range: строки через '\n', столбцы через '\t'
+    void WriteValues(const Range& range, std::string& output);
+};
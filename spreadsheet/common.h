@@ -1,10 +1,13 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <iosfwd>
 #include <memory>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <type_traits>
 #include <variant>
 #include <vector>
 
@@ -26,6 +29,43 @@ struct Position {
     static const Position NONE;
 };
 
+// Непрерывная последовательность элементов без владения ими (вместо std::span
+// из C++20). Действительна, пока жив и не изменён владелец данных.
+template <typename T>
+class Span {
+public:
+    Span() = default;
+    Span(T* data, std::size_t size)
+        : data_(data), size_(size) {
+    }
+    Span(const std::vector<std::remove_const_t<T>>& items)
+        : data_(items.data()), size_(items.size()) {
+    }
+
+    T* begin() const {
+        return data_;
+    }
+    T* end() const {
+        return data_ + size_;
+    }
+    T* data() const {
+        return data_;
+    }
+    std::size_t size() const {
+        return size_;
+    }
+    bool empty() const {
+        return size_ == 0;
+    }
+    T& operator[](std::size_t index) const {
+        return data_[index];
+    }
+
+private:
+    T* data_ = nullptr;
+    std::size_t size_ = 0;
+};
+
 struct Size {
     int rows = 0;
     int cols = 0;
@@ -33,6 +73,24 @@ struct Size {
     bool operator==(Size rhs) const;
 };
 
+// Прямоугольный диапазон ячеек, например A1:B10. Обе границы входят в диапазон.
+struct Range {
+    Position from;    // левый верхний угол
+    Position to;      // правый нижний угол
+
+    bool operator==(const Range& rhs) const;
+    bool operator<(const Range& rhs) const;
+
+    // Диапазон по двум произвольным углам
+    static Range FromCorners(Position first, Position second);
+
+    bool IsValid() const;
+    bool Contains(Position pos) const;
+    bool Intersects(const Range& other) const;
+    Size GetSize() const;
+    std::string ToString() const;
+};
+
 // Описывает ошибки, которые могут возникнуть при вычислении формулы.
 class FormulaError {
 public:
@@ -40,6 +98,8 @@ public:
         Ref,    // ссылка на ячейку с некорректной позицией
         Value,  // ячейка не может быть трактована как число
         Div0,  // в результате вычисления возникло деление на ноль
+        NA,    // функция поиска не нашла значение
+        Spill, // массиву формулы негде разлиться
     };
 
     FormulaError(Category category);
@@ -56,6 +116,27 @@ private:
 
 std::ostream& operator<<(std::ostream& output, FormulaError fe);
 
+// Код значения ячейки при пакетном чтении (см. Sheet::GetValues())
+enum class ValueCode : std::uint8_t {
+    Empty,         // ячейки нет или она пуста
+    Number,
+    Text,
+    ErrorRef,      // FormulaError::Category::Ref
+    ErrorValue,    // FormulaError::Category::Value
+    ErrorDiv0,     // FormulaError::Category::Div0
+    ErrorNA,       // FormulaError::Category::NA
+    ErrorSpill,    // FormulaError::Category::Spill
+};
+
+// Преобразования между ошибками формул и кодами ValueCode::ErrorRef..ErrorSpill
+inline ValueCode ToValueCode(FormulaError error) {
+    return static_cast<ValueCode>(static_cast<int>(ValueCode::ErrorRef) + static_cast<int>(error.GetCategory()));
+}
+
+inline FormulaError ToFormulaError(ValueCode code) {
+    return FormulaError(static_cast<FormulaError::Category>(static_cast<int>(code) - static_cast<int>(ValueCode::ErrorRef)));
+}
+
 // Исключение, выбрасываемое при попытке передать в метод некорректную позицию
 class InvalidPositionException : public std::out_of_range {
 public:
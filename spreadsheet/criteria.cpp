@@ -0,0 +1,285 @@
+#include "criteria.h"
+
+#include "lookup.h"
+
+#include <array>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <sstream>
+
+using namespace std::literals;
+
+namespace
+{
+
+struct ConditionalFunctionInfo
+{
+    std::string_view name;
+    ConditionalFunction function;
+    std::size_t min_args;
+    std::size_t max_args;
+};
+
+constexpr std::array<ConditionalFunctionInfo, 3> FUNCTIONS = { {
+    { "SUMIF"sv, ConditionalFunction::SumIf, 2, 3 },
+    { "COUNTIF"sv, ConditionalFunction::CountIf, 2, 2 },
+    { "AVERAGEIF"sv, ConditionalFunction::AverageIf, 2, 3 },
+} };
+
+// Если устаревших ячеек карты больше этой доли, карта строится заново
+// целиком: построчное чтение дешевле, чем поиск каждой ячейки
+constexpr std::size_t REBUILD_FRACTION = 8;
+
+const ConditionalFunctionInfo& GetInfo(ConditionalFunction function)
+{
+    return FUNCTIONS[static_cast<std::size_t>(function)];
+}
+
+// Число, если text целиком его запись, иначе nullopt
+std::optional<double> ParseNumber(std::string_view text)
+{
+    if (text.empty() || !(std::isdigit(static_cast<unsigned char>(text[0])) || text[0] == '.'
+                          || text[0] == '-' || text[0] == '+'))
+    {
+        return std::nullopt;
+    }
+    const std::string str(text);
+    char* end = nullptr;
+    const double number = std::strtod(str.c_str(), &end);
+    if (end != str.c_str() + str.size() || !std::isfinite(number))
+    {
+        return std::nullopt;
+    }
+    return number;
+}
+
+// Сравнение текстов без учёта регистра латиницы: <0, 0 или >0
+int CompareText(std::string_view lhs, std::string_view upper_rhs)
+{
+    const std::size_t size = std::min(lhs.size(), upper_rhs.size());
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        const auto ch = static_cast<unsigned char>(std::toupper(static_cast<unsigned char>(lhs[i])));
+        const auto rhs_ch = static_cast<unsigned char>(upper_rhs[i]);
+        if (ch != rhs_ch)
+        {
+            return ch < rhs_ch ? -1 : 1;
+        }
+    }
+    return lhs.size() == upper_rhs.size() ? 0 : lhs.size() < upper_rhs.size() ? -1 : 1;
+}
+
+bool IsError(ValueCode code)
+{
+    return code >= ValueCode::ErrorRef;
+}
+
+}  // namespace
+
+std::optional<ConditionalFunction> FindConditionalFunction(std::string_view name)
+{
+    for (const auto& info : FUNCTIONS)
+    {
+        if (info.name == name)
+        {
+            return info.function;
+        }
+    }
+    return std::nullopt;
+}
+
+std::string_view GetConditionalFunctionName(ConditionalFunction function)
+{
+    return GetInfo(function).name;
+}
+
+std::size_t GetConditionalMinArgs(ConditionalFunction function)
+{
+    return GetInfo(function).min_args;
+}
+
+std::size_t GetConditionalMaxArgs(ConditionalFunction function)
+{
+    return GetInfo(function).max_args;
+}
+
+Criterion Criterion::Parse(std::string_view text)
+{
+    // Двухсимвольные операторы проверяются раньше односимвольных
+    constexpr std::array<std::pair<std::string_view, Operator>, 6> OPERATORS = { {
+        { "<="sv, Operator::LessOrEqual },
+        { ">="sv, Operator::GreaterOrEqual },
+        { "<>"sv, Operator::NotEqual },
+        { "<"sv, Operator::Less },
+        { ">"sv, Operator::Greater },
+        { "="sv, Operator::Equal },
+    } };
+
+    Operator op = Operator::Equal;
+    for (const auto& [prefix, prefix_op] : OPERATORS)
+    {
+        if (text.substr(0, prefix.size()) == prefix)
+        {
+            op = prefix_op;
+            text.remove_prefix(prefix.size());
+            break;
+        }
+    }
+
+    if (text.empty())
+    {
+        return Criterion(op, Operand::Empty, 0.0, {});
+    }
+    if (const std::optional<double> number = ParseNumber(text))
+    {
+        return Criterion(op, Operand::Number, *number, {});
+    }
+    std::string upper(text);
+    for (char& ch : upper)
+    {
+        ch = static_cast<char>(std::toupper(static_cast<unsigned char>(ch)));
+    }
+    return Criterion(op, Operand::Text, 0.0, std::move(upper));
+}
+
+Criterion Criterion::Equal(double number)
+{
+    return Criterion(Operator::Equal, Operand::Number, number, {});
+}
+
+Criterion::Criterion(Operator op, Operand operand, double number, std::string text)
+    : op_(op)
+    , operand_(operand)
+    , number_(number)
+    , text_(std::move(text))
+{
+    std::ostringstream key;
+    key << static_cast<int>(op_) << static_cast<int>(operand_);
+    if (operand_ == Operand::Number)
+    {
+        key << std::setprecision(17) << number_;
+    }
+    key << text_;
+    key_ = key.str();
+}
+
+template <typename T>
+bool Criterion::Compare(const T& lhs, const T& rhs) const
+{
+    switch (op_)
+    {
+    case Operator::Equal:
+        return lhs == rhs;
+    case Operator::NotEqual:
+        return lhs != rhs;
+    case Operator::Less:
+        return lhs < rhs;
+    case Operator::LessOrEqual:
+        return lhs <= rhs;
+    case Operator::Greater:
+        return lhs > rhs;
+    case Operator::GreaterOrEqual:
+        return lhs >= rhs;
+    }
+    return false;
+}
+
+bool Criterion::Matches(const CellValueView& value) const
+{
+    if (IsError(value.code))
+    {
+        return false;
+    }
+    switch (operand_)
+    {
+    case Operand::Empty:
+    {
+        const bool empty = value.code == ValueCode::Empty || (value.code == ValueCode::Text && value.text.empty());
+        return op_ == Operator::Equal ? empty : op_ == Operator::NotEqual && !empty;
+    }
+    case Operand::Number:
+        if (value.code == ValueCode::Number)
+        {
+            return Compare(value.number, number_);
+        }
+        if (const std::optional<double> number = ToLookupKey(value))
+        {
+            return Compare(*number, number_);
+        }
+        break;
+    case Operand::Text:
+        if (value.code == ValueCode::Text)
+        {
+            return Compare(CompareText(value.text, text_), 0);
+        }
+        break;
+    }
+    // Значение несравнимо с операндом
+    return op_ == Operator::NotEqual;
+}
+
+void Criterion::MatchValues(const double* numbers, const ValueCode* codes, const std::string_view* texts,
+                            std::size_t size, std::uint64_t* bits, std::size_t first_bit) const
+{
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        if (Matches(CellValueView{ codes[i], numbers[i], texts[i] }))
+        {
+            const std::size_t bit = first_bit + i;
+            bits[bit / 64] |= std::uint64_t{ 1 } << (bit % 64);
+        }
+    }
+}
+
+PredicateBitmap& PredicateCache::Get(const Range& range, const Criterion& criterion)
+{
+    PredicateBitmap& bitmap = bitmaps_[range][criterion.GetKey()];
+    if (bitmap.bits.empty())
+    {
+        const Size size = range.GetSize();
+        const std::size_t cells = static_cast<std::size_t>(size.rows) * size.cols;
+        bitmap.bits.resize((cells + 63) / 64);
+        bit_count_ += cells;
+    }
+    return bitmap;
+}
+
+void PredicateCache::MarkDirty(Position pos)
+{
+    // Диапазоны упорядочены по левому верхнему углу: содержать pos могут
+    // только начинающиеся не позже pos
+    const Range last{ pos, Position{ Position::MAX_ROWS - 1, Position::MAX_COLS - 1 } };
+    for (auto it = bitmaps_.begin(); it != bitmaps_.end() && !(last < it->first); ++it)
+    {
+        const Range& range = it->first;
+        if (!range.Contains(pos))
+        {
+            continue;
+        }
+        const Size size = range.GetSize();
+        const auto cell = static_cast<std::uint32_t>((pos.row - range.from.row) * size.cols + pos.col - range.from.col);
+        const std::size_t cells = static_cast<std::size_t>(size.rows) * size.cols;
+        for (auto& [key, bitmap] : it->second)
+        {
+            if (!bitmap.built)
+            {
+                continue;
+            }
+            if (bitmap.dirty.size() >= cells / REBUILD_FRACTION)
+            {
+                bitmap.built = false;
+                bitmap.dirty.clear();
+                continue;
+            }
+            bitmap.dirty.push_back(cell);
+        }
+    }
+}
+
+void PredicateCache::Clear()
+{
+    bitmaps_.clear();
+    bit_count_ = 0;
+}
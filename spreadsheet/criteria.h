@@ -0,0 +1,141 @@
+#pragma once
+
+#include "aggregate.h"
+#include "cell.h"
+#include "common.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Условные агрегатные функции формул:
+// * COUNTIF(диапазон, условие) - число ячеек диапазона, удовлетворяющих условию;
+// * SUMIF(диапазон, условие[, диапазон суммы]) - сумма чисел диапазона суммы
+//   (по умолчанию - самого диапазона) на местах подходящих ячеек;
+// * AVERAGEIF(диапазон, условие[, диапазон среднего]) - их среднее, #DIV/0!,
+//   если чисел нет.
+// Диапазон суммы должен совпадать по размеру с диапазоном условия, иначе
+// результат - #VALUE!. Из диапазона суммы берутся числа и числовой текст,
+// прочий текст и пустые ячейки пропускаются, ошибка становится результатом.
+//
+// Условие - строка вида "<оператор><операнд>" с оператором =, <>, <, <=, >,
+// >= (по умолчанию =), например ">5", "<>0", "abc", или число (равенство).
+// Если операнд - число, с ним сравниваются числа и числовой текст ячеек;
+// иначе текст ячеек сравнивается с операндом без учёта регистра латиницы.
+// Пустой операнд ("" или "=") подходит пустым ячейкам, "<>" - непустым.
+// Оператор <> подходит и ячейкам, которые с операндом несравнимы. Ошибки не
+// подходят ни одному условию.
+
+enum class ConditionalFunction : std::uint8_t
+{
+    SumIf,
+    CountIf,
+    AverageIf,
+};
+
+// Функция по имени в формуле или nullopt, если имя неизвестно
+std::optional<ConditionalFunction> FindConditionalFunction(std::string_view name);
+std::string_view GetConditionalFunctionName(ConditionalFunction function);
+// Допустимое число аргументов функции
+std::size_t GetConditionalMinArgs(ConditionalFunction function);
+std::size_t GetConditionalMaxArgs(ConditionalFunction function);
+
+class Criterion
+{
+public:
+    // Условие из строки (см. выше)
+    static Criterion Parse(std::string_view text);
+    // Равенство числу
+    static Criterion Equal(double number);
+
+    bool Matches(const CellValueView& value) const;
+    // Устанавливает в bits биты first_bit + i для подходящих значений
+    // numbers[i], codes[i], texts[i], i < size. Остальные биты не трогает
+    void MatchValues(const double* numbers, const ValueCode* codes, const std::string_view* texts,
+                     std::size_t size, std::uint64_t* bits, std::size_t first_bit) const;
+
+    // Каноническая запись условия: равные условия (">5" и ">5.0") имеют
+    // одинаковый ключ
+    const std::string& GetKey() const
+    {
+        return key_;
+    }
+
+private:
+    enum class Operator : std::uint8_t
+    {
+        Equal,
+        NotEqual,
+        Less,
+        LessOrEqual,
+        Greater,
+        GreaterOrEqual,
+    };
+    enum class Operand : std::uint8_t
+    {
+        Empty,
+        Number,
+        Text,
+    };
+
+    Criterion(Operator op, Operand operand, double number, std::string text);
+
+    template <typename T>
+    bool Compare(const T& lhs, const T& rhs) const;
+
+    Operator op_;
+    Operand operand_;
+    double number_ = 0.0;
+    std::string text_;    // операнд-текст в верхнем регистре
+    std::string key_;
+};
+
+// Результат условной функции по диапазону
+struct ConditionalResult
+{
+    std::size_t matches = 0;    // число подходящих ячеек
+    NumberSummary values;       // числа диапазона суммы на их местах
+};
+
+// Битовая карта ячеек диапазона, удовлетворяющих условию: бит i - ячейка i
+// диапазона при построчном обходе
+struct PredicateBitmap
+{
+    std::vector<std::uint64_t> bits;
+    // Номера ячеек, значения которых могли измениться после построения.
+    // Пока карта не построена, список не ведётся
+    std::vector<std::uint32_t> dirty;
+    bool built = false;
+};
+
+// Кэш битовых карт условий листа. Формулы с одинаковым условием по одному
+// диапазону пользуются одной картой. Лист отмечает в кэше изменённые ячейки,
+// и при следующем обращении к карте перепроверяются только они.
+class PredicateCache
+{
+public:
+    // Карта условия criterion по диапазону range, пустая при первом
+    // обращении. Ссылка действительна до Clear()
+    PredicateBitmap& Get(const Range& range, const Criterion& criterion);
+
+    // Отмечает значение ячейки pos изменившимся во всех картах, диапазон
+    // которых её содержит
+    void MarkDirty(Position pos);
+
+    // Число бит во всех картах
+    std::size_t GetBitCount() const
+    {
+        return bit_count_;
+    }
+    void Clear();
+
+private:
+    // Карты одного диапазона по ключу условия
+    std::map<Range, std::unordered_map<std::string, PredicateBitmap>> bitmaps_;
+    std::size_t bit_count_ = 0;
+};
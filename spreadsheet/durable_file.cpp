@@ -0,0 +1,231 @@
+#include "durable_file.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <system_error>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+
+[[noreturn]] void ThrowSystemError(const std::string& what)
+{
+#ifdef _WIN32
+    throw std::system_error(static_cast<int>(GetLastError()), std::system_category(), what);
+#else
+    throw std::system_error(errno, std::generic_category(), what);
+#endif
+}
+
+}  // namespace
+
+#ifdef _WIN32
+
+AppendFile::AppendFile(const std::string& path)
+{
+    HANDLE handle = CreateFileA(path.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ, nullptr,
+                                OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        ThrowSystemError("Cannot open file " + path);
+    }
+    handle_ = handle;
+}
+
+void AppendFile::Write(std::string_view data)
+{
+    while (!data.empty())
+    {
+        DWORD written = 0;
+        DWORD chunk = static_cast<DWORD>(std::min<std::size_t>(data.size(), 1u << 30));
+        if (!WriteFile(handle_, data.data(), chunk, &written, nullptr))
+        {
+            ThrowSystemError("Cannot write file");
+        }
+        data.remove_prefix(written);
+    }
+}
+
+void AppendFile::Sync()
+{
+    if (!FlushFileBuffers(handle_))
+    {
+        ThrowSystemError("Cannot sync file");
+    }
+}
+
+void AppendFile::Close()
+{
+    if (handle_)
+    {
+        CloseHandle(handle_);
+        handle_ = nullptr;
+    }
+}
+
+bool AppendFile::IsOpen() const
+{
+    return handle_ != nullptr;
+}
+
+AppendFile::AppendFile(AppendFile&& other) noexcept
+    : handle_(std::exchange(other.handle_, nullptr))
+{}
+
+AppendFile& AppendFile::operator=(AppendFile&& other) noexcept
+{
+    if (this != &other)
+    {
+        Close();
+        handle_ = std::exchange(other.handle_, nullptr);
+    }
+    return *this;
+}
+
+void SyncFile(const std::string& path)
+{
+    HANDLE handle = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        ThrowSystemError("Cannot open file " + path);
+    }
+    BOOL ok = FlushFileBuffers(handle);
+    CloseHandle(handle);
+    if (!ok)
+    {
+        ThrowSystemError("Cannot sync file " + path);
+    }
+}
+
+void SyncDirectory(const std::string& /* path */)
+{
+    // NTFS журналирует метаданные сам, отдельной синхронизации каталога нет
+}
+
+#else
+
+AppendFile::AppendFile(const std::string& path)
+{
+    fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd_ < 0)
+    {
+        ThrowSystemError("Cannot open file " + path);
+    }
+}
+
+void AppendFile::Write(std::string_view data)
+{
+    while (!data.empty())
+    {
+        ssize_t written = write(fd_, data.data(), data.size());
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            ThrowSystemError("Cannot write file");
+        }
+        data.remove_prefix(static_cast<std::size_t>(written));
+    }
+}
+
+void AppendFile::Sync()
+{
+    if (fsync(fd_) != 0)
+    {
+        ThrowSystemError("Cannot sync file");
+    }
+}
+
+void AppendFile::Close()
+{
+    if (fd_ >= 0)
+    {
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+bool AppendFile::IsOpen() const
+{
+    return fd_ >= 0;
+}
+
+AppendFile::AppendFile(AppendFile&& other) noexcept
+    : fd_(std::exchange(other.fd_, -1))
+{}
+
+AppendFile& AppendFile::operator=(AppendFile&& other) noexcept
+{
+    if (this != &other)
+    {
+        Close();
+        fd_ = std::exchange(other.fd_, -1);
+    }
+    return *this;
+}
+
+void SyncFile(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        ThrowSystemError("Cannot open file " + path);
+    }
+    int result = fsync(fd);
+    close(fd);
+    if (result != 0)
+    {
+        ThrowSystemError("Cannot sync file " + path);
+    }
+}
+
+void SyncDirectory(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+    {
+        ThrowSystemError("Cannot open directory " + path);
+    }
+    fsync(fd);    // ошибку игнорируем: не все ФС поддерживают fsync каталога
+    close(fd);
+}
+
+#endif
+
+AppendFile::~AppendFile()
+{
+    Close();
+}
+
+void ReplaceFileDurably(const std::string& tmp_path, const std::string& path)
+{
+    SyncFile(tmp_path);
+    std::filesystem::rename(tmp_path, path);
+
+    auto directory = std::filesystem::path(path).parent_path();
+    SyncDirectory(directory.empty() ? "." : directory.string());
+}
+
+void WriteFileDurably(const std::string& path, std::string_view data)
+{
+    const std::string tmp_path = path + ".tmp";
+    std::filesystem::remove(tmp_path);
+    {
+        AppendFile file(tmp_path);
+        file.Write(data);
+    }
+    ReplaceFileDurably(tmp_path, path);
+}
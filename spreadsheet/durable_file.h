@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// Файл, открытый на дозапись. Данные попадают на диск гарантированно только
+// после вызова Sync().
+// Методы бросают std::system_error при ошибках ввода-вывода.
+class AppendFile
+{
+public:
+    AppendFile() = default;
+    explicit AppendFile(const std::string& path);
+    ~AppendFile();
+
+    AppendFile(AppendFile&& other) noexcept;
+    AppendFile& operator=(AppendFile&& other) noexcept;
+    AppendFile(const AppendFile&) = delete;
+    AppendFile& operator=(const AppendFile&) = delete;
+
+    void Write(std::string_view data);
+    // Сбрасывает данные файла на диск (fsync)
+    void Sync();
+    void Close();
+
+    bool IsOpen() const;
+
+private:
+#ifdef _WIN32
+    void* handle_ = nullptr;
+#else
+    int fd_ = -1;
+#endif
+};
+
+// Сбрасывает на диск содержимое уже записанного файла
+void SyncFile(const std::string& path);
+// Сбрасывает на диск каталог (нужно после создания, удаления и
+// переименования файлов). На Windows ничего не делает.
+void SyncDirectory(const std::string& path);
+// Атомарно заменяет path файлом tmp_path: сбрасывает tmp_path на диск,
+// переименовывает его и сбрасывает на диск каталог
+void ReplaceFileDurably(const std::string& tmp_path, const std::string& path);
+// Записывает data в path через временный файл и ReplaceFileDurably()
+void WriteFileDurably(const std::string& path, std::string_view data);
@@ -1,110 +1,651 @@
 #include "formula.h"
 
 #include "FormulaAST.h"
+#include "aggregate.h"
+#include "criteria.h"
+#include "lookup.h"
+#include "sheet.h"
 
 #include <algorithm>
 #include <cassert>
 #include <cctype>
+#include <cmath>
+#include <map>
 #include <sstream>
-#include <set>
 
 using namespace std::literals;
 
 std::ostream& operator<<(std::ostream& output, FormulaError fe)
 {
-    // Выводит "#REF!", "#VALUE!", "#DIV/0!" или ""
+    // Выводит "#REF!", "#VALUE!", "#DIV/0!", "#N/A", "#SPILL!" или ""
     return output << fe.ToString();
 }
 
+double TextToNumber(std::string_view text)
+{
+    try
+    {
+        if (std::all_of(text.cbegin(), text.cend(), [](char ch)
+                        {
+                            return (std::isdigit(ch) || ch == '.');
+                        }))
+        {
+            return std::stod(std::string(text));
+        }
+    }
+    catch (...)
+    {
+    }
+    throw FormulaError(FormulaError::Category::Value);
+}
+
+bool IsValidSheetName(std::string_view name)
+{
+    auto is_name_char = [](char ch)
+    {
+        return (ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z') || (ch >= '0' && ch <= '9') || ch == '_';
+    };
+    return !name.empty() && name.size() <= MAX_SHEET_NAME && !(name.front() >= '0' && name.front() <= '9')
+        && std::all_of(name.begin(), name.end(), is_name_char);
+}
+
+bool SheetReference::operator==(const SheetReference& rhs) const
+{
+    return sheet == rhs.sheet && range == rhs.range;
+}
+
+bool SheetReference::operator<(const SheetReference& rhs) const
+{
+    return sheet != rhs.sheet ? sheet < rhs.sheet : range < rhs.range;
+}
+
+SheetReference SheetReference::FromString(std::string_view str)
+{
+    const std::size_t bang = str.rfind('!');
+    if (bang == std::string_view::npos || !IsValidSheetName(str.substr(0, bang)))
+    {
+        throw FormulaException("Invalid sheet reference: " + std::string(str));
+    }
+
+    SheetReference reference{ std::string(str.substr(0, bang)), {} };
+    const std::string_view address = str.substr(bang + 1);
+    const std::size_t colon = address.find(':');
+    const Position first = Position::FromString(address.substr(0, colon));
+    const Position second = colon == std::string_view::npos ? first : Position::FromString(address.substr(colon + 1));
+    if (!first.IsValid() || !second.IsValid())
+    {
+        throw FormulaException("Invalid sheet reference: " + std::string(str));
+    }
+    reference.range = Range::FromCorners(first, second);
+    return reference;
+}
+
+std::string SheetReference::ToString() const
+{
+    return sheet + '!' + (range.from == range.to ? range.from.ToString() : range.ToString());
+}
+
 namespace {
-class Formula : public FormulaInterface {
-public:
-// Реализуйте следующие методы:
-    explicit Formula(std::string expression) 
-        : ast_(ParseFormulaAST(std::move(expression))), 
-          referenced_cells_(ast_.GetCells().begin(), ast_.GetCells().end())
-    {}
+// Диапазон читается блоками не больше этого числа ячеек
+constexpr int RANGE_BLOCK_CELLS = 1024;
 
-    Value Evaluate(const SheetInterface& sheet) const override
+// Добавляет значения ячеек диапазона в агрегат
+void AddRangeValues(const SheetInterface& sheet, const Range& range, Aggregate& aggregate)
+{
+    const Size size = range.GetSize();
+
+    if (const auto* tiled_sheet = dynamic_cast<const Sheet*>(&sheet))
+    {
+        // Столбцы с индексом агрегатов читать не нужно
+        if (tiled_sheet->AggregateRange(range, aggregate))
+        {
+            return;
+        }
+
+        // Блок - несколько целых строк диапазона, прочитанных одним вызовом
+        const int block_rows = std::max(1, RANGE_BLOCK_CELLS / size.cols);
+        const std::size_t block_cells = static_cast<std::size_t>(std::min(block_rows, size.rows)) * size.cols;
+        std::vector<double> numbers(block_cells);
+        std::vector<ValueCode> codes(block_cells);
+        std::vector<std::string_view> texts(block_cells);
+        for (int row = range.from.row; row <= range.to.row; row += block_rows)
+        {
+            const int rows = std::min(block_rows, range.to.row - row + 1);
+            tiled_sheet->GetValues(Position{ row, range.from.col }, Size{ rows, size.cols },
+                                   ValueBuffers{ numbers.data(), codes.data(), texts.data() });
+            aggregate.AddValues(numbers.data(), codes.data(), texts.data(),
+                                static_cast<std::size_t>(rows) * size.cols);
+        }
+        return;
+    }
+
+    // Другие реализации листа читаем по ячейке
+    for (int row = range.from.row; row <= range.to.row; ++row)
+    {
+        for (int col = range.from.col; col <= range.to.col; ++col)
+        {
+            const CellInterface* cell = sheet.GetCell(Position{ row, col });
+            if (!cell || cell->GetText().empty())
+            {
+                continue;
+            }
+            const CellInterface::Value value = cell->GetValue();
+            if (const double* number = std::get_if<double>(&value))
+            {
+                aggregate.Add(*number);
+            }
+            else if (const std::string* text = std::get_if<std::string>(&value))
+            {
+                aggregate.AddText(*text);
+            }
+            else
+            {
+                aggregate.AddError(std::get<FormulaError>(value));
+            }
+        }
+    }
+}
+
+// Значение ячейки формулы как числа в элементе массива (см. FormulaInputs::array)
+void ToArrayElement(const CellValueView& value, double& number, ValueCode& code)
+{
+    number = 0.0;
+    code = ValueCode::Number;
+    switch (value.code)
     {
+    case ValueCode::Empty:
+        break;
+    case ValueCode::Number:
+        number = value.number;
+        break;
+    case ValueCode::Text:
         try
         {
-            return ast_.Execute(
-                [&sheet](const Position& pos)
+            number = TextToNumber(value.text);
+        }
+        catch (const FormulaError& error)
+        {
+            code = ToValueCode(error);
+        }
+        break;
+    default:
+        code = value.code;
+        break;
+    }
+}
+
+// Записывает значения диапазона листа в элементы массива
+void ReadRangeNumbers(const SheetInterface& sheet, const Range& range, double* numbers, ValueCode* codes)
+{
+    const Size size = range.GetSize();
+
+    if (const auto* tiled_sheet = dynamic_cast<const Sheet*>(&sheet))
+    {
+        // Числа и коды читаются прямо в массив, тексты - блоками строк
+        const int block_rows = std::max(1, RANGE_BLOCK_CELLS / size.cols);
+        std::vector<std::string_view> texts(static_cast<std::size_t>(std::min(block_rows, size.rows)) * size.cols);
+        for (int row = range.from.row; row <= range.to.row; row += block_rows)
+        {
+            const int rows = std::min(block_rows, range.to.row - row + 1);
+            const std::size_t offset = static_cast<std::size_t>(row - range.from.row) * size.cols;
+            tiled_sheet->GetValues(Position{ row, range.from.col }, Size{ rows, size.cols },
+                                   ValueBuffers{ numbers + offset, codes + offset, texts.data() });
+            const std::size_t count = static_cast<std::size_t>(rows) * size.cols;
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                if (codes[offset + i] == ValueCode::Empty || codes[offset + i] == ValueCode::Text)
+                {
+                    ToArrayElement(CellValueView{ codes[offset + i], 0.0, texts[i] }, numbers[offset + i],
+                                   codes[offset + i]);
+                }
+            }
+        }
+        return;
+    }
+
+    // Другие реализации листа читаем по ячейке
+    std::size_t index = 0;
+    for (int row = range.from.row; row <= range.to.row; ++row)
+    {
+        for (int col = range.from.col; col <= range.to.col; ++col, ++index)
+        {
+            const CellInterface* cell = sheet.GetCell(Position{ row, col });
+            CellInterface::Value value;
+            CellValueView view;
+            if (cell)
+            {
+                value = cell->GetValue();
+                if (const double* number = std::get_if<double>(&value))
+                {
+                    view = CellValueView{ ValueCode::Number, *number, {} };
+                }
+                else if (const std::string* text = std::get_if<std::string>(&value))
+                {
+                    view = CellValueView{ ValueCode::Text, 0.0, *text };
+                }
+                else
                 {
-                    if (sheet.GetCell(pos) == nullptr)
-                    {
-                        return 0.0;
-                    }
-                    auto value = sheet.GetCell(pos)->GetValue();
-                    if (std::holds_alternative<double>(value))
-                    {
-                        return std::get<double>(value);
-                    }
-                    else if (std::holds_alternative<std::string>(value))
-                    {
-                        try
+                    view.code = ToValueCode(std::get<FormulaError>(value));
+                }
+            }
+            ToArrayElement(view, numbers[index], codes[index]);
+        }
+    }
+}
+
+// Ищет ключ в векторе листа (см. Sheet::Lookup())
+std::optional<int> LookupInVector(const SheetInterface& sheet, const Range& vector, double key, LookupMode mode)
+{
+    if (const auto* tiled_sheet = dynamic_cast<const Sheet*>(&sheet))
+    {
+        return tiled_sheet->Lookup(vector, key, mode);
+    }
+
+    // Другие реализации листа читаем по ячейке
+    const bool is_column = vector.GetSize().cols == 1;
+    const int length = is_column ? vector.GetSize().rows : vector.GetSize().cols;
+    return FindInVector(length, key, mode, [&](int i) -> std::optional<double>
                         {
-                            std::string tmp = std::get<std::string>(value);
-                            if (std::all_of(tmp.cbegin(), tmp.cend(), [](char ch)
-                                            {
-                                                return (std::isdigit(ch) || ch == '.');
-                                            }))
+                            const CellInterface* cell = sheet.GetCell(
+                                is_column ? Position{ vector.from.row + i, vector.from.col }
+                                          : Position{ vector.from.row, vector.from.col + i });
+                            if (!cell || cell->GetText().empty())
                             {
-                                return std::stod(tmp);
+                                return std::nullopt;
                             }
-                            else
+                            const CellInterface::Value value = cell->GetValue();
+                            if (const double* number = std::get_if<double>(&value))
                             {
-                                throw FormulaError(FormulaError::Category::Value);
-                                return 0.0;
+                                return *number;
                             }
-                        }
-                        catch (...)
-                        {
-                            throw FormulaError(FormulaError::Category::Value);
-                        }
-                    }
-                    else
-                    {
-                        throw std::get<FormulaError>(value);
-                    }
-                    return 0.0;
+                            if (const std::string* text = std::get_if<std::string>(&value))
+                            {
+                                return ToLookupKey(CellValueView{ ValueCode::Text, 0.0, *text });
+                            }
+                            return std::nullopt;
+                        });
+}
+
+// Условная функция по диапазону листа (см. Sheet::ConditionalAggregate())
+ConditionalResult AggregateIf(const SheetInterface& sheet, const Range& range, const Criterion& criterion,
+                              const Range* values)
+{
+    if (const auto* tiled_sheet = dynamic_cast<const Sheet*>(&sheet))
+    {
+        return tiled_sheet->ConditionalAggregate(range, criterion, values);
+    }
+
+    // Другие реализации листа читаем по ячейке, без кэша условий
+    ConditionalResult result;
+    for (int row = range.from.row; row <= range.to.row; ++row)
+    {
+        for (int col = range.from.col; col <= range.to.col; ++col)
+        {
+            const CellInterface* cell = sheet.GetCell(Position{ row, col });
+            CellValueView view;
+            CellInterface::Value value;
+            if (cell && !cell->GetText().empty())
+            {
+                value = cell->GetValue();
+                if (const double* number = std::get_if<double>(&value))
+                {
+                    view = CellValueView{ ValueCode::Number, *number, {} };
+                }
+                else if (const std::string* text = std::get_if<std::string>(&value))
+                {
+                    view = CellValueView{ ValueCode::Text, 0.0, *text };
                 }
-            );
+                else
+                {
+                    view.code = ToValueCode(std::get<FormulaError>(value));
+                }
+            }
+            if (!criterion.Matches(view))
+            {
+                continue;
+            }
+            ++result.matches;
+            if (!values)
+            {
+                continue;
+            }
+            const CellInterface* value_cell = sheet.GetCell(
+                Position{ values->from.row + row - range.from.row, values->from.col + col - range.from.col });
+            if (!value_cell || value_cell->GetText().empty())
+            {
+                continue;
+            }
+            value = value_cell->GetValue();
+            if (const double* number = std::get_if<double>(&value))
+            {
+                result.values.Add(*number);
+            }
+            else if (const std::string* text = std::get_if<std::string>(&value))
+            {
+                if (const std::optional<double> number = ToLookupKey(CellValueView{ ValueCode::Text, 0.0, *text }))
+                {
+                    result.values.Add(*number);
+                }
+            }
+            else
+            {
+                throw std::get<FormulaError>(value);
+            }
+        }
+    }
+    return result;
+}
+
+class Formula : public FormulaInterface {
+public:
+// Реализуйте следующие методы:
+    explicit Formula(std::string expression) 
+        : Formula(ParseFormulaAST(std::move(expression)))
+    {}
+
+    // Формула из уже построенного AST (например, загруженного из программы)
+    explicit Formula(FormulaAST ast)
+        : ast_(std::move(ast)),
+          referenced_cells_(ast_.GetCells().begin(), ast_.GetCells().end()),
+          referenced_ranges_(ast_.GetRanges().begin(), ast_.GetRanges().end()),
+          sheet_references_(ast_.GetSheetReferences().begin(), ast_.GetSheetReferences().end()),
+          array_size_(ast_.GetArraySize())
+    {
+        // "Очищенное" выражение без лишних скобок из
+        // FormulaAST::PrintFormula(std::ostream& out) печатаем один раз
+        std::ostringstream out;
+        ast_.PrintFormula(out);
+        expression_ = out.str();
+
+        // Список ячеек AST уже отсортирован, но может содержать повторы
+        std::sort(referenced_cells_.begin(), referenced_cells_.end());
+        referenced_cells_.erase(std::unique(referenced_cells_.begin(), referenced_cells_.end()),
+                                referenced_cells_.end());
+        referenced_cells_.shrink_to_fit();
+        referenced_ranges_.erase(std::unique(referenced_ranges_.begin(), referenced_ranges_.end()),
+                                 referenced_ranges_.end());
+        sheet_references_.erase(std::unique(sheet_references_.begin(), sheet_references_.end()),
+                                sheet_references_.end());
+    }
+
+    Value Evaluate(const SheetInterface& sheet) const override
+    {
+        if (array_size_)
+        {
+            ArrayValue array;
+            EvaluateArray(sheet, array);
+            if (array.codes[0] != ValueCode::Number)
+            {
+                return ToFormulaError(array.codes[0]);
+            }
+            return array.numbers[0];
+        }
+
+        const bool track_reads = BeginReads();
+        Value result;
+        try
+        {
+            result = ast_.Execute(MakeInputs(sheet, track_reads));
         }
         catch (FormulaError& ex_fe)
         {
-            return ex_fe;
+            result = ex_fe;
         }
+        // Ошибка тоже определяется только прочитанными значениями
+        reads_are_known_ = track_reads;
+        return result;
+    }
+
+    void EvaluateArray(const SheetInterface& sheet, ArrayValue& value) const override
+    {
+        assert(array_size_);
+        const std::size_t count = static_cast<std::size_t>(array_size_->rows) * array_size_->cols;
+        if (count > MAX_ARRAY_CELLS)
+        {
+            value = ArrayValue{ Size{ 1, 1 }, { 0.0 }, { ValueCode::ErrorSpill } };
+            return;
+        }
+        value.size = *array_size_;
+        value.numbers.resize(count);
+        value.codes.resize(count);
+
+        const bool track_reads = BeginReads();
+        ast_.ExecuteArray(MakeInputs(sheet, track_reads), value.size, value.numbers.data(), value.codes.data());
+        reads_are_known_ = track_reads;
+
+        // Бесконечность и NaN - #DIV/0!, как у значения обычной формулы
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            if (value.codes[i] == ValueCode::Number && !std::isfinite(value.numbers[i]))
+            {
+                value.codes[i] = ValueCode::ErrorDiv0;
+            }
+            if (value.codes[i] != ValueCode::Number)
+            {
+                value.numbers[i] = 0.0;
+            }
+        }
+    }
+
+    std::optional<Size> GetArraySize() const override
+    {
+        return array_size_;
     }
 
-    // Используем "очищенную" формулу без лишних скобок из 
-    // FormulaAST::PrintFormula(std::ostream& out).
     std::string GetExpression() const override
     {
-        std::stringstream ss;
-        ast_.PrintFormula(ss);
-        return ss.str();
+        return expression_;
     }
 
     std::vector<Position> GetReferencedCells() const override
     {
-        // Вектор результатов (будет возвращен через NVRO)
-        std::vector<Position> result;
+        if (referenced_ranges_.empty())
+        {
+            return referenced_cells_;
+        }
+
+        // Ячейки диапазонов раскрываются только здесь
+        std::vector<Position> result = referenced_cells_;
+        for (const Range& range : referenced_ranges_)
+        {
+            for (int row = range.from.row; row <= range.to.row; ++row)
+            {
+                for (int col = range.from.col; col <= range.to.col; ++col)
+                {
+                    result.push_back(Position{ row, col });
+                }
+            }
+        }
+        std::sort(result.begin(), result.end());
+        result.erase(std::unique(result.begin(), result.end()), result.end());
+        return result;
+    }
+
+    std::string_view GetExpressionView() const override
+    {
+        return expression_;
+    }
+
+    Span<const Position> GetReferencedCellsView() const override
+    {
+        return referenced_cells_;
+    }
+
+    Span<const Range> GetReferencedRangesView() const override
+    {
+        return referenced_ranges_;
+    }
+
+    Span<const SheetReference> GetSheetReferencesView() const override
+    {
+        return sheet_references_;
+    }
 
-        // Убираем дублирование ячеек, прогоняя их через std::set
-        std::set<Position> unique_ref_cells(referenced_cells_.begin(), referenced_cells_.end());
-        for (const auto& cell : unique_ref_cells)
+    std::vector<FormulaInstruction> GetProgram() const override
+    {
+        return ast_.Compile();
+    }
+
+    bool MayDependOn(Position pos) const override
+    {
+        if (!reads_are_known_)
         {
-            result.push_back(cell);
+            return true;
         }
-        return result;  //NVRO
+        // Прочитанного формулой с ветвлением обычно немного
+        return std::find(read_cells_.begin(), read_cells_.end(), pos) != read_cells_.end()
+            || std::any_of(read_ranges_.begin(), read_ranges_.end(), [pos](const Range& range)
+                           {
+                               return range.Contains(pos);
+                           });
     }
 
+    void ForgetReads() override
+    {
+        reads_are_known_ = false;
+    }
 
 private:
+    // Формула с ветвлением запоминает, что прочитала (см. MayDependOn()).
+    // Возвращает, нужно ли запоминать
+    bool BeginReads() const
+    {
+        const bool track_reads = ast_.HasBranches();
+        if (track_reads)
+        {
+            reads_are_known_ = false;
+            read_cells_.clear();
+            read_ranges_.clear();
+        }
+        return track_reads;
+    }
+
+    // Обработчики чтения листа для вычисления AST, с обработчиками других
+    // листов книги для ссылок на них
+    FormulaInputs MakeInputs(const SheetInterface& sheet, bool track_reads) const
+    {
+        FormulaInputs inputs = MakeSheetInputs(sheet, track_reads);
+        if (sheet_references_.empty())
+        {
+            return inputs;
+        }
+
+        // Обработчики другого листа строятся при первой ссылке на него и
+        // живут, пока живы обработчики формулы. Чтения других листов не
+        // запоминаются: правка там сбрасывает кэш формулы в любом случае
+        // (см. Workbook)
+        const auto* tiled_sheet = dynamic_cast<const Sheet*>(&sheet);
+        auto linked = std::make_shared<std::map<std::string, FormulaInputs, std::less<>>>();
+        inputs.sheet = [this, tiled_sheet, linked](const std::string& name) -> const FormulaInputs&
+        {
+            auto it = linked->find(name);
+            if (it == linked->end())
+            {
+                const Sheet* other = tiled_sheet ? tiled_sheet->GetLinkedSheet(name) : nullptr;
+                if (!other)
+                {
+                    throw FormulaError(FormulaError::Category::Ref);
+                }
+                it = linked->emplace(name, MakeSheetInputs(*other, false)).first;
+            }
+            return it->second;
+        };
+        return inputs;
+    }
+
+    // Обработчики чтения одного листа sheet
+    FormulaInputs MakeSheetInputs(const SheetInterface& sheet, bool track_reads) const
+    {
+        auto read_range = [this, track_reads](const Range& range)
+        {
+            if (track_reads)
+            {
+                read_ranges_.push_back(range);
+            }
+        };
+
+        FormulaInputs inputs;
+        const auto* tiled_sheet = dynamic_cast<const Sheet*>(&sheet);
+        inputs.cell = [&sheet, tiled_sheet, this, track_reads](const Position& pos)
+        {
+            if (track_reads)
+            {
+                read_cells_.push_back(pos);
+            }
+            if (tiled_sheet)
+            {
+                // Одно обращение к тайлу, текст ячейки не копируется
+                const CellValueView view = tiled_sheet->GetValueView(pos);
+                switch (view.code)
+                {
+                case ValueCode::Empty:
+                    return 0.0;
+                case ValueCode::Number:
+                    return view.number;
+                case ValueCode::Text:
+                    return TextToNumber(view.text);
+                default:
+                    throw ToFormulaError(view.code);
+                }
+            }
+
+            const CellInterface* cell = sheet.GetCell(pos);
+            if (cell == nullptr)
+            {
+                return 0.0;
+            }
+            auto value = cell->GetValue();
+            if (std::holds_alternative<double>(value))
+            {
+                return std::get<double>(value);
+            }
+            else if (std::holds_alternative<std::string>(value))
+            {
+                return TextToNumber(std::get<std::string>(value));
+            }
+            else
+            {
+                throw std::get<FormulaError>(value);
+            }
+        };
+        inputs.range = [&sheet, read_range](const Range& range, Aggregate& aggregate)
+        {
+            read_range(range);
+            AddRangeValues(sheet, range, aggregate);
+        };
+        inputs.lookup = [&sheet, read_range](const Range& vector, double key, LookupMode mode)
+        {
+            read_range(vector);
+            return LookupInVector(sheet, vector, key, mode);
+        };
+        inputs.conditional = [&sheet, read_range](const Range& range, const Criterion& criterion,
+                                                  const Range* values)
+        {
+            read_range(range);
+            if (values)
+            {
+                read_range(*values);
+            }
+            return AggregateIf(sheet, range, criterion, values);
+        };
+        inputs.array = [&sheet, read_range](const Range& range, double* numbers, ValueCode* codes)
+        {
+            read_range(range);
+            ReadRangeNumbers(sheet, range, numbers, codes);
+        };
+        return inputs;
+    }
+
     FormulaAST ast_;
-    std::vector<Position> referenced_cells_;
+    std::vector<Position> referenced_cells_;    // отсортированы, без повторов
+    std::vector<Range> referenced_ranges_;      // отсортированы, без повторов
+    std::vector<SheetReference> sheet_references_;    // отсортированы, без повторов
+    std::string expression_;
+    std::optional<Size> array_size_;    // для формулы массива
+    // Прочитанное при последнем вычислении, только для формул с ветвлением
+    mutable std::vector<Position> read_cells_;
+    mutable std::vector<Range> read_ranges_;
+    mutable bool reads_are_known_ = false;
 };
 }  // namespace
 
@@ -118,3 +659,15 @@ std::unique_ptr<FormulaInterface> ParseFormula(std::string expression) {
         throw FormulaException("Formula parse error");
     }
 }
+
+std::unique_ptr<FormulaInterface> LoadFormula(const FormulaInstruction* program, std::size_t size)
+{
+    try
+    {
+        return std::make_unique<Formula>(LoadFormulaAST(program, size));
+    }
+    catch (const std::exception&)
+    {
+        throw FormulaException("Formula program error");
+    }
+}
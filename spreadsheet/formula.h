@@ -2,13 +2,117 @@
 
 #include "common.h"
 
+#include <cstddef>
+#include <cstdint>
 #include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
 #include <vector>
 
+// Инструкция "скомпилированной" формулы. Программа формулы - это её AST,
+// записанное в обратной польской записи: операнды (числа, ячейки и
+// диапазоны) кладутся на стек, операции и функции снимают со стека свои
+// аргументы и кладут результат.
+// Структура имеет фиксированный размер и не содержит указателей, поэтому
+// программы можно копировать в бинарный файл и обратно целыми блоками.
+struct FormulaInstruction
+{
+    enum class Op : std::uint8_t
+    {
+        Number,        // положить на стек число number
+        Cell,          // положить на стек значение ячейки cell
+        Add,
+        Subtract,
+        Multiply,
+        Divide,
+        UnaryPlus,
+        UnaryMinus,
+        Range,         // положить на стек диапазон от cell до range_end_row/col
+        Function,      // вызвать функцию function от arg_count аргументов
+        Lookup,        // вызвать функцию поиска function от arg_count аргументов
+        String,        // положить на стек строку из arg_count байт, записанных
+                       // в следующих инструкциях (они не исполняются)
+        Conditional,   // вызвать условную функцию function от arg_count аргументов
+        Compare,       // сравнить два операнда оператором function (ComparisonExpr::Type)
+        Logical,       // вызвать логическую функцию function от arg_count аргументов
+        Sheet,         // следующая инструкция Cell или Range ссылается на лист
+                       // с именем из arg_count байт, записанных в инструкциях
+                       // между ними (как у Op::String)
+    };
+
+    double number = 0.0;
+    Position cell = Position::NONE;
+    Op op = Op::Number;
+    // Поля ниже занимают место выравнивания и не меняют размер инструкции
+    std::uint8_t function = 0;        // функция вызова или оператор сравнения
+    std::uint16_t arg_count = 0;      // для вызовов функций и Op::String
+    std::uint16_t range_end_row = 0;  // для Op::Range
+    std::uint16_t range_end_col = 0;  // для Op::Range
+};
+
+static_assert(Position::MAX_ROWS <= 0xFFFF && Position::MAX_COLS <= 0xFFFF,
+              "Range end must fit into FormulaInstruction");
+
+// Значение формулы массива: элементы построчно, каждый - число (код
+// ValueCode::Number) или ошибка
+struct ArrayValue
+{
+    Size size;
+    std::vector<double> numbers;
+    std::vector<ValueCode> codes;
+};
+
+// Ссылка формулы на ячейку или диапазон другого листа книги (см. workbook.h):
+// Sheet2!A1 или Sheet2!A1:B10. У ссылки на ячейку from и to совпадают
+struct SheetReference
+{
+    std::string sheet;
+    Range range;
+
+    bool operator==(const SheetReference& rhs) const;
+    bool operator<(const SheetReference& rhs) const;
+
+    // Разбирает запись ссылки. Бросает FormulaException, если в ней нет имени
+    // листа или имя, адрес ячейки или диапазона некорректны
+    static SheetReference FromString(std::string_view str);
+    std::string ToString() const;
+};
+
+// Годится ли name в имена листов: от 1 до MAX_SHEET_NAME латинских букв,
+// цифр и "_", первый символ не цифра. Другие имена в записи формулы не
+// отличить от её текста
+inline constexpr std::size_t MAX_SHEET_NAME = 255;
+bool IsValidSheetName(std::string_view name);
+
+// Формула массива с большим числом элементов не вычисляется: её значение -
+// один элемент #SPILL!
+inline constexpr std::size_t MAX_ARRAY_CELLS = std::size_t{ 1 } << 20;
+
 // Формула, позволяющая вычислять и обновлять арифметическое выражение.
 // Поддерживаемые возможности:
 // * Простые бинарные операции и числа, скобки: 1+2*3, 2.5*(2+3.5/7)
 // * Значения ячеек в качестве переменных: A1+B2*C3
+// * Агрегатные функции от чисел, ячеек и диапазонов: SUM(A1:A100, B1)*2
+//   (см. aggregate.h). Диапазон вне аргументов функции даёт ошибку #VALUE!
+// * Функции поиска: VLOOKUP(5, A1:C100, 3, 0), MATCH(B1, A1:A100, 0)
+//   (см. lookup.h)
+// * Условные функции: SUMIF(A1:A100, ">5", B1:B100), COUNTIF(A1:A100, "abc")
+//   (см. criteria.h). Строковая константа в кавычках ("" внутри - кавычка)
+//   допустима только как условие
+// * Сравнения =, <>, <, <=, >, >= (1 или 0, приоритет ниже арифметики) и
+//   логические функции IF, AND, OR с ленивым вычислением аргументов:
+//   IF(A1>0, B1, C1) (см. logical.h)
+// * Ссылки на ячейки и диапазоны других листов книги: Sheet2!A1,
+//   SUM(Sheet2!A1:A100) (см. SheetReference). Вычисляются через лист, на
+//   котором лежит формула (см. Sheet::GetLinkedSheet()); ссылка на лист,
+//   которого нет, даёт ошибку #REF!. Диапазоны условной функции должны
+//   лежать на одном листе
+// * Формулы массива: диапазон вне аргументов функции - массив его значений,
+//   а арифметика и сравнения над массивами поэлементные: A1:A100*B1:B100,
+//   A1:A100>5. Число и значение функции участвуют в каждом элементе.
+//   Элементы вне меньшего из двух массивов разного размера - #N/A. Массив
+//   формулы разливается на соседние ячейки листа (см. Sheet)
 // Ячейки, указанные в формуле, могут быть как формулами, так и текстом. Если это
 // текст, но он представляет число, тогда его нужно трактовать как число. Пустая
 // ячейка или ячейка с пустым текстом трактуется как число ноль.
@@ -34,8 +138,52 @@ public:
     // формулы. Список отсортирован по возрастанию и не содержит повторяющихся
     // ячеек.
     virtual std::vector<Position> GetReferencedCells() const = 0;
+
+    // То же, что GetExpression() и GetReferencedCells(), но без копирования:
+    // выражение и список ячеек строятся один раз при создании формулы и
+    // действительны, пока жив её объект.
+    // Диапазоны формулы в представлении не раскрываются: в
+    // GetReferencedCellsView() входят только отдельные ячейки, а каждый
+    // диапазон - один элемент GetReferencedRangesView(). GetReferencedCells()
+    // возвращает и ячейки диапазонов.
+    virtual std::string_view GetExpressionView() const = 0;
+    virtual Span<const Position> GetReferencedCellsView() const = 0;
+    virtual Span<const Range> GetReferencedRangesView() const = 0;
+    // Ссылки на другие листы, отсортированы, без повторов. В
+    // GetReferencedCells() и двух представлениях выше их нет: те описывают
+    // только ячейки листа самой формулы
+    virtual Span<const SheetReference> GetSheetReferencesView() const = 0;
+
+    // Возвращает программу формулы (см. FormulaInstruction).
+    virtual std::vector<FormulaInstruction> GetProgram() const = 0;
+
+    // Формула с ветвлением (IF, AND, OR) читает только вычисленные ветви и
+    // запоминает прочитанные ячейки и диапазоны. Возвращает false, если при
+    // последнем вычислении формула не читала ячейку pos ни отдельно, ни в
+    // составе диапазона: пока прочитанные ячейки не изменились, значение
+    // формулы от pos не зависит. Для формул без ветвления, до первого
+    // вычисления и после ForgetReads() возвращает true.
+    virtual bool MayDependOn(Position pos) const = 0;
+    // Забывает прочитанные ячейки: значение одной из них изменилось
+    virtual void ForgetReads() = 0;
+
+    // Размер массива для формулы массива или nullopt для обычной формулы.
+    // Зависит только от выражения
+    virtual std::optional<Size> GetArraySize() const = 0;
+    // Вычисляет все элементы формулы массива за один проход по её
+    // диапазонам. Значение Evaluate() такой формулы - первый элемент
+    virtual void EvaluateArray(const SheetInterface& sheet, ArrayValue& value) const = 0;
 };
 
+// Значение текста ячейки, на которую ссылается формула, как числа. Бросает
+// FormulaError::Category::Value, если текст не является числом.
+double TextToNumber(std::string_view text);
+
 // Парсит переданное выражение и возвращает объект формулы.
 // Бросает FormulaException в случае, если формула синтаксически некорректна.
 std::unique_ptr<FormulaInterface> ParseFormula(std::string expression);
+
+// Восстанавливает объект формулы из программы, полученной через GetProgram(),
+// без повторного парсинга выражения.
+// Бросает FormulaException в случае, если программа некорректна.
+std::unique_ptr<FormulaInterface> LoadFormula(const FormulaInstruction* program, std::size_t size);
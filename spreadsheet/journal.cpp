@@ -0,0 +1,588 @@
+#include "journal.h"
+
+#include "mapped_file.h"
+#include "sheet.h"
+#include "snapshot.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <sstream>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+
+constexpr std::uint8_t OP_SET = 1;
+constexpr std::uint8_t OP_CLEAR = 2;
+
+constexpr const char* SNAPSHOT_FILE = "snapshot.bin";
+constexpr const char* SEGMENT_PREFIX = "journal-";
+constexpr const char* SEGMENT_SUFFIX = ".log";
+
+// Размер заголовка записи (размер данных и CRC32) и фиксированной части данных
+constexpr std::size_t RECORD_HEADER_SIZE = 2 * sizeof(std::uint32_t);
+constexpr std::size_t PAYLOAD_FIXED_SIZE = sizeof(std::uint64_t) + sizeof(std::uint8_t)
+                                           + 2 * sizeof(std::int32_t);
+
+// Размер пакета правок при восстановлении
+constexpr std::size_t REPLAY_BATCH_SIZE = 4096;
+
+// CRC32 (полином 0xEDB88320, как в zlib)
+std::uint32_t Crc32(const char* data, std::size_t size)
+{
+    static const auto table = []()
+    {
+        std::array<std::uint32_t, 256> result{};
+        for (std::uint32_t i = 0; i < 256; ++i)
+        {
+            std::uint32_t crc = i;
+            for (int bit = 0; bit < 8; ++bit)
+            {
+                crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+            }
+            result[i] = crc;
+        }
+        return result;
+    }();
+
+    std::uint32_t crc = 0xFFFFFFFFu;
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+struct Record
+{
+    std::uint64_t sequence = 0;
+    std::uint8_t op = 0;
+    Position pos;
+    std::string_view text;
+};
+
+void EncodeRecord(std::string& out, const Record& record)
+{
+    const auto payload_size = static_cast<std::uint32_t>(PAYLOAD_FIXED_SIZE + record.text.size());
+    const std::size_t start = out.size();
+    out.resize(start + RECORD_HEADER_SIZE + payload_size);
+
+    char* payload = &out[start + RECORD_HEADER_SIZE];
+    char* p = payload;
+    std::memcpy(p, &record.sequence, sizeof(record.sequence));
+    p += sizeof(record.sequence);
+    std::memcpy(p, &record.op, sizeof(record.op));
+    p += sizeof(record.op);
+    std::memcpy(p, &record.pos.row, sizeof(record.pos.row));
+    p += sizeof(record.pos.row);
+    std::memcpy(p, &record.pos.col, sizeof(record.pos.col));
+    p += sizeof(record.pos.col);
+    if (!record.text.empty())
+    {
+        std::memcpy(p, record.text.data(), record.text.size());
+    }
+
+    const std::uint32_t crc = Crc32(payload, payload_size);
+    std::memcpy(&out[start], &payload_size, sizeof(payload_size));
+    std::memcpy(&out[start + sizeof(payload_size)], &crc, sizeof(crc));
+}
+
+// Разбирает записи data по порядку до конца данных или до первой
+// повреждённой (недописанной) записи. Возвращает число разобранных байт
+template <typename Callback>
+std::size_t ParseRecords(const char* data, std::size_t size, Callback&& callback)
+{
+    std::size_t offset = 0;
+    while (size - offset >= RECORD_HEADER_SIZE)
+    {
+        std::uint32_t payload_size;
+        std::uint32_t crc;
+        std::memcpy(&payload_size, data + offset, sizeof(payload_size));
+        std::memcpy(&crc, data + offset + sizeof(payload_size), sizeof(crc));
+        if (payload_size < PAYLOAD_FIXED_SIZE || payload_size > size - offset - RECORD_HEADER_SIZE)
+        {
+            break;
+        }
+
+        const char* payload = data + offset + RECORD_HEADER_SIZE;
+        if (Crc32(payload, payload_size) != crc)
+        {
+            break;
+        }
+
+        Record record;
+        const char* p = payload;
+        std::memcpy(&record.sequence, p, sizeof(record.sequence));
+        p += sizeof(record.sequence);
+        std::memcpy(&record.op, p, sizeof(record.op));
+        p += sizeof(record.op);
+        std::memcpy(&record.pos.row, p, sizeof(record.pos.row));
+        p += sizeof(record.pos.row);
+        std::memcpy(&record.pos.col, p, sizeof(record.pos.col));
+        p += sizeof(record.pos.col);
+        record.text = std::string_view(p, payload_size - PAYLOAD_FIXED_SIZE);
+
+        callback(record);
+        offset += RECORD_HEADER_SIZE + payload_size;
+    }
+    return offset;
+}
+
+// Читает записи сегмента по порядку до конца файла или до первой
+// повреждённой (недописанной) записи
+template <typename Callback>
+void ReadSegment(const std::string& path, Callback&& callback)
+{
+    std::unique_ptr<MappedFile> file;
+    try
+    {
+        file = std::make_unique<MappedFile>(path);
+    }
+    catch (const std::runtime_error& ex)
+    {
+        throw JournalException(ex.what());
+    }
+    ParseRecords(file->Data(), file->Size(), callback);
+}
+
+CellEdit ToEdit(const Record& record)
+{
+    CellEdit edit;
+    edit.pos = record.pos;
+    if (record.op == OP_SET)
+    {
+        edit.text = std::string(record.text);
+    }
+    return edit;
+}
+
+std::string SegmentPath(const std::string& directory, std::uint64_t first)
+{
+    char name[64];
+    std::snprintf(name, sizeof(name), "%s%020llu%s", SEGMENT_PREFIX,
+                  static_cast<unsigned long long>(first), SEGMENT_SUFFIX);
+    return (fs::path(directory) / name).string();
+}
+
+// Сегменты каталога (номер первой записи, путь), отсортированные по номеру
+std::vector<std::pair<std::uint64_t, std::string>> ListSegments(const std::string& directory)
+{
+    std::vector<std::pair<std::uint64_t, std::string>> result;
+    const std::string prefix = SEGMENT_PREFIX;
+    const std::string suffix = SEGMENT_SUFFIX;
+    for (const auto& entry : fs::directory_iterator(directory))
+    {
+        const std::string name = entry.path().filename().string();
+        if (name.size() <= prefix.size() + suffix.size() || name.compare(0, prefix.size(), prefix) != 0
+            || name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0)
+        {
+            continue;
+        }
+        const std::string number = name.substr(prefix.size(), name.size() - prefix.size() - suffix.size());
+        if (!std::all_of(number.begin(), number.end(), [](char ch) { return ch >= '0' && ch <= '9'; }))
+        {
+            continue;
+        }
+        result.emplace_back(std::stoull(number), entry.path().string());
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+}  // namespace
+
+EditJournal::EditJournal(std::string directory, JournalOptions options)
+    : directory_(std::move(directory))
+    , options_(options)
+{
+    try
+    {
+        fs::create_directories(directory_);
+
+        // Нумерация продолжается после последней правки - в снимке или в сегментах
+        const std::string snapshot_path = (fs::path(directory_) / SNAPSHOT_FILE).string();
+        if (fs::exists(snapshot_path))
+        {
+            last_sequence_ = ReadSnapshotInfo(snapshot_path).edit_sequence;
+        }
+        for (const auto& [first, path] : ListSegments(directory_))
+        {
+            ReadSegment(path, [this](const Record& record)
+                        {
+                            last_sequence_ = std::max(last_sequence_, record.sequence);
+                        });
+        }
+
+        std::lock_guard io_lock(io_mutex_);
+        OpenSegment(last_sequence_ + 1);
+    }
+    catch (const fs::filesystem_error& ex)
+    {
+        throw JournalException(ex.what());
+    }
+    catch (const std::system_error& ex)
+    {
+        throw JournalException(ex.what());
+    }
+
+    if (options_.group_commit_interval.count() > 0)
+    {
+        flusher_ = std::thread([this]() { FlusherLoop(); });
+    }
+}
+
+EditJournal::~EditJournal()
+{
+    {
+        std::lock_guard lock(mutex_);
+        stop_ = true;
+    }
+    flusher_cv_.notify_all();
+    if (flusher_.joinable())
+    {
+        flusher_.join();
+    }
+
+    // Из деструктора исключения не выпускаем
+    try
+    {
+        Sync();
+    }
+    catch (...)
+    {
+    }
+    try
+    {
+        WaitForCompaction();
+    }
+    catch (...)
+    {
+    }
+}
+
+void EditJournal::LogSet(Position pos, std::string_view text)
+{
+    Append(OP_SET, pos, text);
+}
+
+void EditJournal::LogClear(Position pos)
+{
+    Append(OP_CLEAR, pos, {});
+}
+
+void EditJournal::Append(std::uint8_t op, Position pos, std::string_view text)
+{
+    bool commit = false;
+    {
+        std::lock_guard lock(mutex_);
+        if (error_)
+        {
+            std::rethrow_exception(error_);
+        }
+
+        Record record;
+        record.sequence = ++last_sequence_;
+        record.op = op;
+        record.pos = pos;
+        record.text = text;
+        EncodeRecord(buffer_, record);
+
+        ++pending_ops_;
+        ++stats_.records;
+        commit = options_.group_commit_ops != 0 && pending_ops_ >= options_.group_commit_ops;
+    }
+
+    if (commit)
+    {
+        Sync();
+    }
+}
+
+void EditJournal::Sync()
+{
+    {
+        std::lock_guard io_lock(io_mutex_);
+        SyncLocked();
+    }
+    ThrowIfFailed();
+}
+
+std::uint64_t EditJournal::SetSyncListener(std::function<void(const JournalBatch&)> listener)
+{
+    std::lock_guard io_lock(io_mutex_);
+    sync_listener_ = std::move(listener);
+    // Под io_mutex_ группы не сбрасываются: записи буфера ещё не на диске
+    std::lock_guard lock(mutex_);
+    return last_sequence_ - pending_ops_;
+}
+
+void EditJournal::SyncLocked()
+{
+    std::string data;
+    JournalBatch batch;
+    {
+        std::lock_guard lock(mutex_);
+        // После сбоя записи хвост сегмента мог остаться оборванным: писать
+        // за ним нельзя, при восстановлении всё после него потеряется
+        if (error_)
+        {
+            return;
+        }
+        data.swap(buffer_);
+        batch.last = last_sequence_;
+        batch.first = last_sequence_ + 1 - pending_ops_;
+        pending_ops_ = 0;
+    }
+    if (data.empty())
+    {
+        return;
+    }
+
+    try
+    {
+        segment_.Write(data);
+        segment_.Sync();
+    }
+    catch (const std::system_error& ex)
+    {
+        // Записи группы уже вынуты из буфера. Журнал перестаёт принимать
+        // правки, чтобы на диске не было пропусков в нумерации
+        JournalException error(ex.what());
+        std::lock_guard lock(mutex_);
+        error_ = std::make_exception_ptr(error);
+        throw error;
+    }
+    segment_size_ += data.size();
+    {
+        std::lock_guard lock(mutex_);
+        ++stats_.syncs;
+    }
+
+    if (sync_listener_)
+    {
+        batch.records = data;
+        sync_listener_(batch);
+    }
+}
+
+void EditJournal::FlusherLoop()
+{
+    std::unique_lock lock(mutex_);
+    while (!stop_)
+    {
+        flusher_cv_.wait_for(lock, options_.group_commit_interval);
+        if (stop_ || pending_ops_ == 0)
+        {
+            continue;
+        }
+
+        lock.unlock();
+        std::exception_ptr error;
+        try
+        {
+            std::lock_guard io_lock(io_mutex_);
+            SyncLocked();
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+        lock.lock();
+        if (error)
+        {
+            // Ошибку получит следующий вызов LogSet()/LogClear()/Sync()
+            error_ = error;
+        }
+    }
+}
+
+void EditJournal::ThrowIfFailed()
+{
+    std::lock_guard lock(mutex_);
+    if (error_)
+    {
+        std::rethrow_exception(error_);
+    }
+}
+
+void EditJournal::OpenSegment(std::uint64_t first)
+{
+    // Сегмент с таким номером мог остаться от прошлого запуска, но уцелевших
+    // записей в нём нет (иначе нумерация продолжилась бы дальше)
+    const std::string path = SegmentPath(directory_, first);
+    fs::remove(path);
+
+    segment_ = AppendFile(path);
+    segment_first_ = first;
+    segment_size_ = 0;
+    SyncDirectory(directory_);
+}
+
+void EditJournal::Compact(const SheetInterface& sheet)
+{
+    WaitForCompaction();
+
+    std::uint64_t sequence = 0;
+    std::vector<std::string> obsolete;
+    {
+        std::lock_guard io_lock(io_mutex_);
+        SyncLocked();
+        {
+            std::lock_guard lock(mutex_);
+            sequence = last_sequence_;
+        }
+
+        // Все записи до sequence включительно попадут в снимок. Новые записи
+        // пойдут в новый сегмент, а старые сегменты станут не нужны
+        try
+        {
+            if (segment_first_ != sequence + 1)
+            {
+                OpenSegment(sequence + 1);
+            }
+            for (const auto& [first, path] : ListSegments(directory_))
+            {
+                if (first <= sequence)
+                {
+                    obsolete.push_back(path);
+                }
+            }
+        }
+        catch (const std::exception& ex)
+        {
+            throw JournalException(ex.what());
+        }
+    }
+
+    std::ostringstream out;
+    SnapshotOptions snapshot_options;
+    snapshot_options.edit_sequence = sequence;
+    WriteSnapshot(sheet, out, snapshot_options);
+
+    compaction_ = std::async(std::launch::async,
+                             [this, data = out.str(), obsolete = std::move(obsolete)]()
+                             {
+                                 WriteFileDurably((fs::path(directory_) / SNAPSHOT_FILE).string(), data);
+                                 for (const auto& path : obsolete)
+                                 {
+                                     fs::remove(path);
+                                 }
+                                 SyncDirectory(directory_);
+
+                                 std::lock_guard lock(mutex_);
+                                 ++stats_.compactions;
+                             });
+}
+
+void EditJournal::WaitForCompaction()
+{
+    if (compaction_.valid())
+    {
+        compaction_.get();
+    }
+}
+
+bool EditJournal::NeedsCompaction() const
+{
+    return options_.compaction_threshold != 0 && segment_size_ >= options_.compaction_threshold;
+}
+
+std::uint64_t EditJournal::LastSequence() const
+{
+    std::lock_guard lock(mutex_);
+    return last_sequence_;
+}
+
+EditJournal::Stats EditJournal::GetStats() const
+{
+    std::lock_guard lock(mutex_);
+    return stats_;
+}
+
+std::unique_ptr<SheetInterface> RecoverSheet(const std::string& directory, std::uint64_t* sequence)
+{
+    std::unique_ptr<SheetInterface> sheet;
+    std::uint64_t last = 0;
+
+    const std::string snapshot_path = (fs::path(directory) / SNAPSHOT_FILE).string();
+    if (fs::exists(snapshot_path))
+    {
+        // Номер последней правки берётся из того же файла, что и лист: снимок
+        // может смениться, пока идёт чтение (см. Replica::CatchUp())
+        SnapshotInfo info;
+        sheet = LoadSnapshot(snapshot_path, &info);
+        last = info.edit_sequence;
+    }
+    else
+    {
+        sheet = CreateSheet();
+    }
+    if (sequence)
+    {
+        *sequence = last;
+    }
+    if (!fs::exists(directory))
+    {
+        return sheet;
+    }
+
+    Sheet& target = dynamic_cast<Sheet&>(*sheet);
+    std::vector<CellEdit> batch;
+    batch.reserve(REPLAY_BATCH_SIZE);
+    for (const auto& [first, path] : ListSegments(directory))
+    {
+        ReadSegment(path, [&](const Record& record)
+                    {
+                        // Записи, вошедшие в снимок, пропускаем
+                        if (record.sequence <= last)
+                        {
+                            return;
+                        }
+                        // Номера записей идут подряд: пропуск значит, что
+                        // сегмент удалили после чтения снимка
+                        if (record.sequence != last + 1)
+                        {
+                            throw JournalException("Missing journal records after " + std::to_string(last)
+                                                   + " in " + directory);
+                        }
+                        last = record.sequence;
+
+                        batch.push_back(ToEdit(record));
+                        if (batch.size() == REPLAY_BATCH_SIZE)
+                        {
+                            target.ApplyEdits(batch);
+                            batch.clear();
+                        }
+                    });
+    }
+    target.ApplyEdits(batch);
+
+    if (sequence)
+    {
+        *sequence = last;
+    }
+    return sheet;
+}
+
+std::uint64_t DecodeJournalRecords(std::string_view records, std::uint64_t after, std::vector<CellEdit>& edits)
+{
+    std::uint64_t last = after;
+    const std::size_t parsed = ParseRecords(records.data(), records.size(), [&](const Record& record)
+                                            {
+                                                if (record.sequence > after)
+                                                {
+                                                    edits.push_back(ToEdit(record));
+                                                }
+                                                last = std::max(last, record.sequence);
+                                            });
+    if (parsed != records.size())
+    {
+        throw JournalException("Damaged journal records");
+    }
+    return last;
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include "common.h"
+#include "durable_file.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+struct CellEdit;
+
+// Журнал правок листа (write-ahead log).
+// Каталог журнала содержит последний снимок листа (snapshot.bin, см.
+// snapshot.h) и сегменты журнала journal-<номер первой записи>.log. Каждая
+// запись - одна правка SetCell()/ClearCell() со сквозным номером; снимок
+// хранит номер последней вошедшей в него правки.
+//
+// Записи копятся в памяти и сбрасываются на диск (write + fsync) группами:
+// после каждых group_commit_ops правок или не реже, чем раз в
+// group_commit_interval. Правка считается сохранённой только после сброса
+// её группы, поэтому при сбое теряется не больше одной группы.
+//
+// Запись журнала:
+//   u32 размер данных, u32 CRC32 данных,
+//   данные: u64 номер, u8 операция, i32 строка, i32 столбец, текст ячейки.
+// Повреждённый или недописанный хвост сегмента при восстановлении
+// отбрасывается.
+
+struct JournalOptions
+{
+    // Условия сброса группы на диск. 0 отключает соответствующее условие
+    std::size_t group_commit_ops = 128;
+    std::chrono::milliseconds group_commit_interval{ 10 };
+    // Размер текущего сегмента, после которого Sheet запускает сжатие
+    // журнала (0 - сжатие только по явному вызову Compact())
+    std::uint64_t compaction_threshold = 64 * 1024 * 1024;
+};
+
+// Группа записей журнала, сброшенная на диск (см. EditJournal::SetSyncListener())
+struct JournalBatch
+{
+    std::uint64_t first = 0;    // номер первой записи группы
+    std::uint64_t last = 0;     // номер последней записи группы
+    std::string_view records;   // записи подряд в формате журнала
+};
+
+// Исключение, выбрасываемое при ошибке чтения или записи журнала
+class JournalException : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+class EditJournal
+{
+public:
+    // Статистика журнала
+    struct Stats
+    {
+        std::uint64_t records = 0;        // записано правок
+        std::uint64_t syncs = 0;          // сброшено групп
+        std::uint64_t compactions = 0;    // завершено сжатий
+    };
+
+    // Открывает журнал в каталоге directory (каталог создаётся при
+    // необходимости). Новые записи продолжают нумерацию после последней
+    // уцелевшей записи и пишутся в новый сегмент.
+    explicit EditJournal(std::string directory, JournalOptions options = {});
+    // Сбрасывает накопленные записи и дожидается фонового сжатия
+    ~EditJournal();
+
+    EditJournal(const EditJournal&) = delete;
+    EditJournal& operator=(const EditJournal&) = delete;
+
+    void LogSet(Position pos, std::string_view text);
+    void LogClear(Position pos);
+
+    // Сбрасывает накопленные записи на диск, не дожидаясь условий группы
+    void Sync();
+    // Перебрасывает запомненную ошибку сброса на диск, если она была. Лист
+    // проверяет её до правки, чтобы не применять правки, которые журнал уже
+    // не примет
+    void ThrowIfFailed();
+    // Подключает listener (пустая функция - отключает), который получает
+    // каждую группу записей сразу после её сброса на диск: так правки можно
+    // передавать дальше, только когда они сохранены (см. replication.h).
+    // Вызывается по порядку групп, в потоке, сбросившем группу (в том числе
+    // в фоновом потоке сброса по времени); не должен обращаться к журналу и
+    // бросать исключения. Возвращает номер последней уже сброшенной записи:
+    // первая группа, которую получит listener, начнётся сразу после неё.
+    std::uint64_t SetSyncListener(std::function<void(const JournalBatch&)> listener);
+
+    // Сжимает журнал: записывает снимок sheet и удаляет сегменты, которые
+    // он покрывает. Лист сериализуется в память в вызывающем потоке, запись
+    // снимка на диск и удаление сегментов выполняются в фоне. Если
+    // предыдущее сжатие ещё идёт, метод сначала дожидается его.
+    void Compact(const SheetInterface& sheet);
+    // Дожидается окончания фонового сжатия. Бросает исключение, если оно
+    // завершилось ошибкой
+    void WaitForCompaction();
+    // Превышен ли порог размера текущего сегмента
+    bool NeedsCompaction() const;
+
+    // Номер последней записанной правки
+    std::uint64_t LastSequence() const;
+    Stats GetStats() const;
+
+private:
+    void Append(std::uint8_t op, Position pos, std::string_view text);
+    // Сбрасывает буфер на диск. Вызывается под io_mutex_. Сбой записи
+    // запоминается в error_, после чего журнал отказывает во всех правках
+    void SyncLocked();
+    void FlusherLoop();
+    // Открывает новый сегмент, начинающийся с записи first. Вызывается под
+    // io_mutex_
+    void OpenSegment(std::uint64_t first);
+
+    std::string directory_;
+    JournalOptions options_;
+
+    // Защищает буфер записей, счётчики и ошибку сброса на диск
+    mutable std::mutex mutex_;
+    std::string buffer_;
+    std::size_t pending_ops_ = 0;
+    std::uint64_t last_sequence_ = 0;
+    Stats stats_;
+    std::exception_ptr error_;
+
+    // Защищает текущий сегмент
+    std::mutex io_mutex_;
+    AppendFile segment_;
+    std::uint64_t segment_first_ = 0;              // номер первой записи сегмента
+    std::atomic<std::uint64_t> segment_size_{ 0 };
+    std::function<void(const JournalBatch&)> sync_listener_;
+
+    // Поток сброса по времени
+    std::condition_variable flusher_cv_;
+    bool stop_ = false;
+    std::thread flusher_;
+
+    std::future<void> compaction_;
+};
+
+// Восстанавливает лист из каталога журнала: загружает снимок (если он
+// есть) и применяет записи журнала после него пакетами через
+// Sheet::ApplyEdits(). Если sequence не nullptr, в него записывается номер
+// последней применённой правки. Бросает JournalException или
+// SnapshotException, если снимок повреждён или в нумерации записей после
+// снимка есть пропуск (например, журнал сжали во время чтения).
+std::unique_ptr<SheetInterface> RecoverSheet(const std::string& directory, std::uint64_t* sequence = nullptr);
+
+// Разбирает записи records (формат журнала, см. выше) и дописывает в edits
+// правки записей с номерами больше after. Возвращает номер последней записи
+// или after, если записей нет. Бросает JournalException, если записи
+// повреждены или обрываются.
+std::uint64_t DecodeJournalRecords(std::string_view records, std::uint64_t after, std::vector<CellEdit>& edits);
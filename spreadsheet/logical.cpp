@@ -0,0 +1,59 @@
+#include "logical.h"
+
+#include <array>
+#include <limits>
+
+using namespace std::literals;
+
+namespace
+{
+
+struct LogicalFunctionInfo
+{
+    std::string_view name;
+    LogicalFunction function;
+    std::size_t min_args;
+    std::size_t max_args;
+};
+
+constexpr std::size_t UNLIMITED = std::numeric_limits<std::uint16_t>::max();
+
+constexpr std::array<LogicalFunctionInfo, 3> FUNCTIONS = { {
+    { "IF"sv, LogicalFunction::If, 2, 3 },
+    { "AND"sv, LogicalFunction::And, 1, UNLIMITED },
+    { "OR"sv, LogicalFunction::Or, 1, UNLIMITED },
+} };
+
+const LogicalFunctionInfo& GetInfo(LogicalFunction function)
+{
+    return FUNCTIONS[static_cast<std::size_t>(function)];
+}
+
+}  // namespace
+
+std::optional<LogicalFunction> FindLogicalFunction(std::string_view name)
+{
+    for (const auto& info : FUNCTIONS)
+    {
+        if (info.name == name)
+        {
+            return info.function;
+        }
+    }
+    return std::nullopt;
+}
+
+std::string_view GetLogicalFunctionName(LogicalFunction function)
+{
+    return GetInfo(function).name;
+}
+
+std::size_t GetLogicalMinArgs(LogicalFunction function)
+{
+    return GetInfo(function).min_args;
+}
+
+std::size_t GetLogicalMaxArgs(LogicalFunction function)
+{
+    return GetInfo(function).max_args;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+// Логические функции формул. Аргументы вычисляются лениво, слева направо, и
+// только пока результат не определён:
+// * IF(условие, если да[, если нет]) - "если да", если условие не 0, иначе
+//   "если нет" (по умолчанию 0). Невыбранная ветвь не вычисляется;
+// * AND(a, b, ...) - 1, если все аргументы не 0, иначе 0. Аргументы после
+//   первого нуля не вычисляются;
+// * OR(a, b, ...) - 1, если хотя бы один аргумент не 0, иначе 0. Аргументы
+//   после первого не нуля не вычисляются.
+// Ошибка вычисленного аргумента становится результатом. Условия обычно
+// записываются операторами сравнения =, <>, <, <=, >, >=, значение которых -
+// 1 или 0.
+
+enum class LogicalFunction : std::uint8_t
+{
+    If,
+    And,
+    Or,
+};
+
+// Функция по имени в формуле или nullopt, если имя неизвестно
+std::optional<LogicalFunction> FindLogicalFunction(std::string_view name);
+std::string_view GetLogicalFunctionName(LogicalFunction function);
+// Допустимое число аргументов функции
+std::size_t GetLogicalMinArgs(LogicalFunction function);
+std::size_t GetLogicalMaxArgs(LogicalFunction function);
@@ -0,0 +1,119 @@
+#include "lookup.h"
+
+#include <array>
+
+using namespace std::literals;
+
+namespace
+{
+
+struct LookupFunctionInfo
+{
+    std::string_view name;
+    LookupFunction function;
+    std::size_t min_args;
+    std::size_t max_args;
+};
+
+constexpr std::array<LookupFunctionInfo, 3> FUNCTIONS = { {
+    { "MATCH"sv, LookupFunction::Match, 2, 3 },
+    { "VLOOKUP"sv, LookupFunction::VLookup, 3, 4 },
+    { "XLOOKUP"sv, LookupFunction::XLookup, 3, 4 },
+} };
+
+const LookupFunctionInfo& GetInfo(LookupFunction function)
+{
+    return FUNCTIONS[static_cast<std::size_t>(function)];
+}
+
+}  // namespace
+
+std::optional<LookupFunction> FindLookupFunction(std::string_view name)
+{
+    for (const auto& info : FUNCTIONS)
+    {
+        if (info.name == name)
+        {
+            return info.function;
+        }
+    }
+    return std::nullopt;
+}
+
+std::string_view GetLookupFunctionName(LookupFunction function)
+{
+    return GetInfo(function).name;
+}
+
+std::size_t GetLookupMinArgs(LookupFunction function)
+{
+    return GetInfo(function).min_args;
+}
+
+std::size_t GetLookupMaxArgs(LookupFunction function)
+{
+    return GetInfo(function).max_args;
+}
+
+std::optional<double> ToLookupKey(const CellValueView& value)
+{
+    switch (value.code)
+    {
+    case ValueCode::Number:
+        return value.number;
+    case ValueCode::Text:
+        try
+        {
+            return TextToNumber(value.text);
+        }
+        catch (const FormulaError&)
+        {
+            return std::nullopt;
+        }
+    default:
+        return std::nullopt;
+    }
+}
+
+std::optional<int> FindInVector(int size, double key, LookupMode mode,
+                                const std::function<std::optional<double>(int)>& key_at)
+{
+    if (mode == LookupMode::Exact)
+    {
+        for (int i = 0; i < size; ++i)
+        {
+            if (key_at(i) == key)
+            {
+                return i;
+            }
+        }
+        return std::nullopt;
+    }
+
+    // В отсортированном векторе подходящие значения образуют начало вектора,
+    // ищется его последний элемент
+    auto fits = [&](int i)
+    {
+        const std::optional<double> value = key_at(i);
+        return value && (mode == LookupMode::LessOrEqual ? *value <= key : *value >= key);
+    };
+    int begin = 0;
+    int end = size;
+    while (begin < end)
+    {
+        const int middle = begin + (end - begin) / 2;
+        if (fits(middle))
+        {
+            begin = middle + 1;
+        }
+        else
+        {
+            end = middle;
+        }
+    }
+    if (begin == 0)
+    {
+        return std::nullopt;
+    }
+    return begin - 1;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "cell.h"
+#include "common.h"
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string_view>
+
+// Функции поиска формул:
+// * MATCH(ключ, вектор[, тип]) - номер (с 1) найденного значения в векторе.
+//   Тип 0 - точное совпадение, 1 (по умолчанию) - наибольшее значение не
+//   больше ключа в векторе по возрастанию, -1 - наименьшее значение не
+//   меньше ключа в векторе по убыванию;
+// * VLOOKUP(ключ, таблица, столбец[, приближённо]) - значение столбца
+//   таблицы (с 1) в строке, найденной в первом столбце. Приближённый поиск
+//   (по умолчанию) - как MATCH с типом 1, 0 - точное совпадение;
+// * XLOOKUP(ключ, вектор, вектор значений[, если не найдено]) - значение
+//   вектора значений на месте точного совпадения в векторе.
+// Вектор - диапазон из одной строки или одного столбца. Ключи - числа:
+// значения формул и числовой текст (см. TextToNumber()); пустые ячейки,
+// прочий текст и ошибки ни с чем не совпадают. Если значение не найдено,
+// результат - ошибка #N/A.
+// Приближённый поиск - двоичный, поэтому вектор должен быть отсортирован;
+// значения, не являющиеся числами, считаются расположенными после всех чисел
+// (например, пустой хвост столбца). Точный поиск по столбцу лист ведёт через
+// хэш-индекс столбца (см. ColumnLookupIndex).
+
+enum class LookupFunction : std::uint8_t
+{
+    Match,
+    VLookup,
+    XLookup,
+};
+
+// Функция по имени в формуле или nullopt, если имя неизвестно
+std::optional<LookupFunction> FindLookupFunction(std::string_view name);
+std::string_view GetLookupFunctionName(LookupFunction function);
+// Допустимое число аргументов функции
+std::size_t GetLookupMinArgs(LookupFunction function);
+std::size_t GetLookupMaxArgs(LookupFunction function);
+
+enum class LookupMode : std::uint8_t
+{
+    Exact,             // первое значение, равное ключу
+    LessOrEqual,       // последнее значение не больше ключа (по возрастанию)
+    GreaterOrEqual,    // последнее значение не меньше ключа (по убыванию)
+};
+
+// Ключ значения ячейки или nullopt, если значение не может быть ключом
+std::optional<double> ToLookupKey(const CellValueView& value);
+
+// Ищет ключ среди size значений вектора, key_at(i) возвращает ключ i-го
+// значения. Возвращает номер найденного значения (с 0) или nullopt.
+// Точный поиск просматривает значения по порядку, приближённый - двоичный
+std::optional<int> FindInVector(int size, double key, LookupMode mode,
+                                const std::function<std::optional<double>(int)>& key_at);
@@ -1,6 +1,29 @@
+#include "async_sheet.h"
+#include "columnar.h"
+#include "command_protocol.h"
 #include "common.h"
 #include "formula.h"
+#include "journal.h"
+#include "range_index.h"
+#include "replication.h"
+#include "sheet.h"
+#include "sheet_image.h"
+#include "snapshot.h"
 #include "test_runner_p.h"
+#include "versioned_sheet.h"
+#include "workbook.h"
+
+#include <filesystem>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <limits>
+#include <thread>
+
+#ifndef _WIN32
+#include <csignal>
+#include <sys/resource.h>
+#endif
 
 inline std::ostream& operator<<(std::ostream& output, Position pos) {
     return output << "(" << pos.row << ", " << pos.col << ")";
@@ -193,6 +216,29 @@ void TestFormulaReferencedCells() {
     ASSERT_EQUAL(tricky->GetReferencedCells(), (std::vector{"A1"_pos, "A2"_pos, "A3"_pos}));
 }
 
+void TestZeroCopyAccessors() {
+    auto formula = ParseFormula("(C3+A1)*A1/((B2))");
+    ASSERT_EQUAL(formula->GetExpressionView(), formula->GetExpression());
+    const Span<const Position> refs = formula->GetReferencedCellsView();
+    ASSERT_EQUAL(std::vector<Position>(refs.begin(), refs.end()),
+                 (std::vector{"A1"_pos, "B2"_pos, "C3"_pos}));
+    // Представления не пересобираются при каждом вызове
+    ASSERT(formula->GetExpressionView().data() == formula->GetExpressionView().data());
+    ASSERT(formula->GetReferencedCellsView().data() == refs.data());
+
+    auto sheet = CreateSheet();
+    sheet->SetCell("A1"_pos, "'=text");
+    sheet->SetCell("A2"_pos, "=(A1+B1)*B1");
+    const auto* text_cell = dynamic_cast<const Cell*>(sheet->GetCell("A1"_pos));
+    const auto* formula_cell = dynamic_cast<const Cell*>(sheet->GetCell("A2"_pos));
+    ASSERT_EQUAL(text_cell->GetTextView(), "'=text");
+    ASSERT(text_cell->GetReferencedCellsView().empty());
+    ASSERT_EQUAL(formula_cell->GetTextView(), "=(A1+B1)*B1");
+    ASSERT_EQUAL(formula_cell->GetTextView(), formula_cell->GetText());
+    ASSERT_EQUAL(formula_cell->GetReferencedCellsView().size(), 2u);
+    ASSERT_EQUAL(formula_cell->GetReferencedCellsView()[1], "B1"_pos);
+}
+
 void TestErrorValue() {
     auto sheet = CreateSheet();
     sheet->SetCell("E2"_pos, "A1");
@@ -250,7 +296,7 @@ void TestErrorDiv0() {
 void TestEmptyCellTreatedAsZero() {
     auto sheet = CreateSheet();
     sheet->SetCell("A1"_pos, "=B2");
-    ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(), CellInterface::Value(0));
+    ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(), CellInterface::Value(0.0));
 }
 
 void TestFormulaInvalidPosition() {
@@ -347,6 +393,1818 @@ void TestCellCircularReferences() {
     ASSERT(caught);
     ASSERT_EQUAL(sheet->GetCell("M6"_pos)->GetText(), "Ready");
 }
+void TestFormulaProgramRoundTrip() {
+    auto formula = ParseFormula("-(A1+2.5)*B2/(C3-4)");
+    auto program = formula->GetProgram();
+    auto loaded = LoadFormula(program.data(), program.size());
+    ASSERT_EQUAL(loaded->GetExpression(), formula->GetExpression());
+    ASSERT_EQUAL(loaded->GetReferencedCells(), formula->GetReferencedCells());
+
+    FormulaInstruction add;
+    add.op = FormulaInstruction::Op::Add;
+    bool caught = false;
+    try {
+        LoadFormula(&add, 1);
+    } catch (const FormulaException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+}
+
+void TestRangeAggregates() {
+    auto formula = ParseFormula("SUM( B2:A1 , 3)*2+MAX(C1,-1)");
+    ASSERT_EQUAL(formula->GetExpression(), "SUM(A1:B2,3)*2+MAX(C1,-1)");
+    ASSERT_EQUAL(formula->GetReferencedRangesView().size(), 1u);
+    ASSERT_EQUAL(formula->GetReferencedRangesView()[0].ToString(), "A1:B2");
+    ASSERT_EQUAL(formula->GetReferencedCellsView().size(), 1u);
+    ASSERT_EQUAL(formula->GetReferencedCells(),
+                 (std::vector{"A1"_pos, "B1"_pos, "C1"_pos, "A2"_pos, "B2"_pos}));
+
+    // Диапазон и функции переживают компиляцию в программу
+    auto program = formula->GetProgram();
+    auto loaded = LoadFormula(program.data(), program.size());
+    ASSERT_EQUAL(loaded->GetExpression(), formula->GetExpression());
+    ASSERT_EQUAL(loaded->GetReferencedCells(), formula->GetReferencedCells());
+
+    auto sheet = CreateSheet();
+    sheet->SetCell("A1"_pos, "=1");
+    sheet->SetCell("A2"_pos, "2");        // числовой текст
+    sheet->SetCell("A4"_pos, "=A1+5");    // A3 пустая и пропускается
+    auto value = [&sheet](std::string expression) {
+        sheet->SetCell("C1"_pos, "=" + expression);
+        return sheet->GetCell("C1"_pos)->GetValue();
+    };
+    ASSERT_EQUAL(value("SUM(A1:A4)"), CellInterface::Value(9.0));
+    ASSERT_EQUAL(value("AVERAGE(A1:A4)"), CellInterface::Value(3.0));
+    ASSERT_EQUAL(value("MIN(A1:A4)"), CellInterface::Value(1.0));
+    ASSERT_EQUAL(value("MAX(A1:A4,10)"), CellInterface::Value(10.0));
+    ASSERT_EQUAL(value("COUNT(A1:A4)"), CellInterface::Value(3.0));
+    ASSERT_EQUAL(value("SUM()"), CellInterface::Value(0.0));
+    ASSERT_EQUAL(value("MIN(A10:A20)"), CellInterface::Value(0.0));
+    ASSERT_EQUAL(value("AVERAGE(A10:A20)"), CellInterface::Value(FormulaError::Category::Div0));
+    ASSERT_EQUAL(value("A1:A4"), CellInterface::Value(1.0));    // формула массива (см. TestSpillArrays)
+    ASSERT_EQUAL(value("SUM(A1:A4)-A4"), CellInterface::Value(3.0));
+
+    // Текст и ошибки - по правилам формул, COUNT их пропускает
+    sheet->SetCell("A3"_pos, "text");
+    ASSERT_EQUAL(value("SUM(A1:A4)"), CellInterface::Value(FormulaError::Category::Value));
+    ASSERT_EQUAL(value("COUNT(A1:A4)"), CellInterface::Value(3.0));
+    sheet->SetCell("A3"_pos, "=1/0");
+    ASSERT_EQUAL(value("MAX(A1:A4)"), CellInterface::Value(FormulaError::Category::Div0));
+    ASSERT_EQUAL(value("COUNT(A1:A4,A3)"), CellInterface::Value(3.0));
+
+    // Диапазон через несколько блоков чтения и тайлов
+    for (int row = 0; row < 3000; ++row) {
+        sheet->SetCell(Position{row, 3}, std::to_string(row % 10));
+    }
+    sheet->SetCell(Position{1500, 3}, "=D1+0.5");
+    ASSERT_EQUAL(value("SUM(D1:D3000)"), CellInterface::Value(13500.0 + 0.5));
+    // Результат зависит от изменений внутри диапазона
+    sheet->SetCell("D1"_pos, "1");
+    ASSERT_EQUAL(value("SUM(D1:D3000)"), CellInterface::Value(13502.5));
+
+    bool caught = false;
+    try {
+        sheet->SetCell("D2"_pos, "=COUNT(D1:D3000)");
+    } catch (const CircularDependencyException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+    caught = false;
+    try {
+        sheet->SetCell("E1"_pos, "=FOO(A1)");
+    } catch (const FormulaException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+}
+
+void TestRangeDependencyIndex() {
+    // Индекс сам по себе: много записей, чтобы дерево делилось и сжималось
+    RangeIndex index;
+    auto dependents = [&index](Position pos) {
+        std::set<Position> result;
+        index.ForEachDependent(pos, [&result](Position dependent) {
+            result.insert(dependent);
+        });
+        return result;
+    };
+    for (int i = 0; i < 1000; ++i) {
+        Range range{{i, i % 50}, {i + 9, i % 50 + 2}};
+        index.Insert(range, Position{i, 100});
+    }
+    ASSERT_EQUAL(index.Size(), 1000u);
+    ASSERT_EQUAL(dependents(Position{5, 5}), (std::set{Position{3, 100}, Position{4, 100}, Position{5, 100}}));
+    ASSERT(dependents(Position{5, 60}).empty());
+    ASSERT(!index.Erase(Range{{0, 0}, {9, 2}}, Position{1, 100}));
+    for (int i = 0; i < 1000; i += 2) {
+        Range range{{i, i % 50}, {i + 9, i % 50 + 2}};
+        ASSERT(index.Erase(range, Position{i, 100}));
+    }
+    ASSERT_EQUAL(index.Size(), 500u);
+    ASSERT_EQUAL(dependents(Position{5, 5}), (std::set{Position{3, 100}, Position{5, 100}}));
+    for (int i = 1; i < 1000; i += 2) {
+        Range range{{i, i % 50}, {i + 9, i % 50 + 2}};
+        ASSERT(index.Erase(range, Position{i, 100}));
+    }
+    ASSERT(index.Empty());
+    ASSERT(dependents(Position{5, 5}).empty());
+
+    // Лист: на диапазон в тысячи ячеек - одна запись
+    auto sheet = CreateSheet();
+    Sheet& impl = dynamic_cast<Sheet&>(*sheet);
+    sheet->SetCell("B1"_pos, "=SUM(A1:A16000)");
+    sheet->SetCell("C1"_pos, "=B1+MAX(A5:A10)");
+    ASSERT_EQUAL(impl.GetDependentCells(Position{15000, 0}), (std::set{"B1"_pos}));
+    ASSERT_EQUAL(impl.GetDependentCells("A7"_pos), (std::set{"B1"_pos, "C1"_pos}));
+    ASSERT_EQUAL(impl.GetDependentCells("B1"_pos), (std::set{"C1"_pos}));
+    ASSERT(sheet->GetCell("A7"_pos) == nullptr);
+
+    // Цикл через диапазон, в том числе транзитивный
+    auto is_cyclic = [&sheet](Position pos, std::string text) {
+        try {
+            sheet->SetCell(pos, text);
+        } catch (const CircularDependencyException&) {
+            return true;
+        }
+        return false;
+    };
+    ASSERT(is_cyclic("A100"_pos, "=C1"));
+    ASSERT(is_cyclic("A6"_pos, "=SUM(B1:B2)"));
+    ASSERT(!is_cyclic("E1"_pos, "=C1"));
+    ASSERT(is_cyclic("E1"_pos, "=SUM(D1:F1)"));
+    ASSERT_EQUAL(sheet->GetCell("E1"_pos)->GetText(), "=C1");
+
+    // Замена формулы убирает прежние зависимости от диапазонов
+    sheet->SetCell("B1"_pos, "=SUM(A1:A2)");
+    ASSERT(impl.GetDependentCells(Position{15000, 0}).empty());
+    ASSERT(!is_cyclic("A100"_pos, "=C1"));
+    sheet->ClearCell("C1"_pos);
+    ASSERT(impl.GetDependentCells("A7"_pos).empty());
+
+    // Снимок восстанавливает зависимости от диапазонов из формул
+    const std::string path =
+        (std::filesystem::temp_directory_path() / "spreadsheet_test_range_index.bin").string();
+    sheet->SetCell("A1"_pos, "=1");
+    sheet->SetCell("C1"_pos, "=SUM(A1:A3)");
+    ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), CellInterface::Value(1.0));
+    SaveSnapshot(*sheet, path, SnapshotOptions{true});
+    auto loaded = LoadSnapshot(path);
+    loaded->SetCell("A2"_pos, "=4");
+    ASSERT_EQUAL(loaded->GetCell("C1"_pos)->GetValue(), CellInterface::Value(5.0));
+    bool caught = false;
+    try {
+        loaded->SetCell("A3"_pos, "=C1");
+    } catch (const CircularDependencyException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+    std::filesystem::remove(path);
+}
+
+void TestAggregateIndex() {
+    // Одинаковые листы, во втором столбцы A и B индексированы
+    auto plain = CreateSheet();
+    auto indexed = CreateSheet();
+    Sheet& indexed_impl = dynamic_cast<Sheet&>(*indexed);
+    indexed_impl.EnableAggregateIndex(0);
+    auto set = [&](Position pos, const std::string& text) {
+        plain->SetCell(pos, text);
+        indexed->SetCell(pos, text);
+    };
+    for (int row = 0; row < 3000; ++row) {
+        set(Position{row, 0}, std::to_string(row % 17));
+        set(Position{row, 1}, std::to_string(row % 5));
+    }
+    // Столбец B индексируется уже с данными
+    indexed_impl.EnableAggregateIndex(1);
+    ASSERT(indexed_impl.HasAggregateIndex(1));
+    ASSERT(!indexed_impl.HasAggregateIndex(2));
+    set(Position{100, 0}, "=A1+1000");
+    set(Position{2000, 1}, "=A2*2");
+    set(Position{500, 0}, "");
+    plain->ClearCell(Position{700, 1});
+    indexed->ClearCell(Position{700, 1});
+
+    auto check = [&](const std::string& expression) {
+        plain->SetCell("D1"_pos, "=" + expression);
+        indexed->SetCell("D1"_pos, "=" + expression);
+        ASSERT_EQUAL(indexed->GetCell("D1"_pos)->GetValue(), plain->GetCell("D1"_pos)->GetValue());
+    };
+    for (const std::string function : {"SUM", "AVERAGE", "MIN", "MAX", "COUNT"}) {
+        check(function + "(A1:A3000)");
+        check(function + "(A50:B2500)");
+        check(function + "(B1999:B2001)");
+        check(function + "(A501:A501)");
+        check(function + "(A3001:B4000)");
+        check(function + "(A10:C20)");    // C без индекса
+    }
+    check("AVERAGE(A3001:B4000)");
+    ASSERT_EQUAL(indexed->GetCell("D1"_pos)->GetValue(), CellInterface::Value(FormulaError::Category::Div0));
+
+    // Правки после включения индекса: число, текст, формула с ошибкой
+    set(Position{10, 0}, "100");
+    check("SUM(A1:A20)");
+    set(Position{11, 0}, "text");
+    check("SUM(A1:A20)");
+    check("COUNT(A1:A20)");
+    set(Position{11, 0}, "=1/0");
+    check("MAX(A1:A20)");
+    check("COUNT(A1:A20)");
+    set(Position{11, 0}, "7");
+    check("MIN(A1:A3000)");
+    check("AVERAGE(A1:B3000)");
+    ASSERT_EQUAL(indexed->GetCell("D1"_pos)->GetValue(), plain->GetCell("D1"_pos)->GetValue());
+
+    bool caught = false;
+    try {
+        indexed_impl.EnableAggregateIndex(-1);
+    } catch (const InvalidPositionException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+}
+
+void TestLookupFunctions() {
+    auto formula = ParseFormula("VLOOKUP( 5 , A1:C100, 3, 0)+MATCH(B1,A1:A100,0)");
+    ASSERT_EQUAL(formula->GetExpression(), "VLOOKUP(5,A1:C100,3,0)+MATCH(B1,A1:A100,0)");
+    auto program = formula->GetProgram();
+    ASSERT_EQUAL(LoadFormula(program.data(), program.size())->GetExpression(), formula->GetExpression());
+    for (const std::string bad : {"MATCH(1)", "MATCH(1,2)", "XLOOKUP(1,A1:A2,3)", "VLOOKUP(1,A1:B2,1,1,1)"}) {
+        bool caught = false;
+        try {
+            ParseFormula(bad);
+        } catch (const FormulaException&) {
+            caught = true;
+        }
+        ASSERT(caught);
+    }
+
+    // A - ключи 2, 4, ..., 400 числовым текстом, B - значения
+    auto sheet = CreateSheet();
+    for (int row = 0; row < 200; ++row) {
+        sheet->SetCell(Position{row, 0}, std::to_string((row + 1) * 2));
+        sheet->SetCell(Position{row, 1}, "=" + std::to_string(row + 1) + "*100");
+    }
+    auto value = [&sheet](std::string expression) {
+        sheet->SetCell("E1"_pos, "=" + expression);
+        return sheet->GetCell("E1"_pos)->GetValue();
+    };
+    const CellInterface::Value na = FormulaError(FormulaError::Category::NA);
+    ASSERT_EQUAL(value("MATCH(10,A1:A200,0)"), CellInterface::Value(5.0));
+    ASSERT_EQUAL(value("MATCH(11,A1:A200,0)"), na);
+    ASSERT_EQUAL(value("MATCH(11,A1:A200)"), CellInterface::Value(5.0));
+    ASSERT_EQUAL(value("MATCH(1000,A1:A300)"), CellInterface::Value(200.0));    // пустой хвост
+    ASSERT_EQUAL(value("MATCH(1,A1:A200)"), na);
+    ASSERT_EQUAL(value("MATCH(6,A1:A10,0)"), CellInterface::Value(3.0));        // без индекса
+    ASSERT_EQUAL(value("MATCH(1,A1:B2,0)"), CellInterface::Value(FormulaError::Category::Value));
+    ASSERT_EQUAL(value("VLOOKUP(20,A1:B200,2,0)"), CellInterface::Value(1000.0));
+    ASSERT_EQUAL(value("VLOOKUP(21,A1:B200,2)"), CellInterface::Value(1000.0));
+    ASSERT_EQUAL(value("VLOOKUP(20,A1:B200,3,0)"), CellInterface::Value(FormulaError::Category::Ref));
+    ASSERT_EQUAL(value("VLOOKUP(20,A1:B200,0,0)"), CellInterface::Value(FormulaError::Category::Value));
+    ASSERT_EQUAL(value("XLOOKUP(40,A1:A200,B1:B200)"), CellInterface::Value(2000.0));
+    ASSERT_EQUAL(value("XLOOKUP(41,A1:A200,B1:B200)"), na);
+    ASSERT_EQUAL(value("XLOOKUP(41,A1:A200,B1:B200,-1)"), CellInterface::Value(-1.0));
+    ASSERT_EQUAL(value("XLOOKUP(40,A1:A200,B1:B100)"), CellInterface::Value(FormulaError::Category::Value));
+    std::ostringstream out;
+    out << std::get<FormulaError>(na);
+    ASSERT_EQUAL(out.str(), "#N/A");
+
+    // Вектор-строка и убывающий порядок
+    for (int col = 0; col < 10; ++col) {
+        sheet->SetCell(Position{300, col}, std::to_string(100 - col * 10));
+    }
+    ASSERT_EQUAL(value("MATCH(70,A301:J301,0)"), CellInterface::Value(4.0));
+    ASSERT_EQUAL(value("MATCH(65,A301:J301,-1)"), CellInterface::Value(4.0));
+    ASSERT_EQUAL(value("XLOOKUP(30,A301:J301,A301:J301)"), CellInterface::Value(30.0));
+
+    // Индекс следит за правками столбца
+    sheet->SetCell("A5"_pos, "1000");
+    ASSERT_EQUAL(value("MATCH(10,A1:A200,0)"), na);
+    ASSERT_EQUAL(value("MATCH(1000,A1:A200,0)"), CellInterface::Value(5.0));
+    sheet->SetCell("A7"_pos, "1000");
+    ASSERT_EQUAL(value("MATCH(1000,A1:A200,0)"), CellInterface::Value(5.0));
+    ASSERT_EQUAL(value("MATCH(1000,A6:A200,0)"), CellInterface::Value(2.0));
+    sheet->ClearCell("A5"_pos);
+    ASSERT_EQUAL(value("MATCH(1000,A1:A200,0)"), CellInterface::Value(7.0));
+
+    // ... и за значениями формул столбца
+    sheet->SetCell("D1"_pos, "777");
+    sheet->SetCell("A150"_pos, "=D1");
+    ASSERT_EQUAL(value("MATCH(777,A1:A200,0)"), CellInterface::Value(150.0));
+    sheet->SetCell("D1"_pos, "778");
+    ASSERT_EQUAL(value("MATCH(777,A1:A200,0)"), na);
+    ASSERT_EQUAL(value("MATCH(778,A1:A200,0)"), CellInterface::Value(150.0));
+    // Формула столбца, которая сама ищет по нему
+    sheet->SetCell("A160"_pos, "=MATCH(778,A100:A155,0)");
+    ASSERT_EQUAL(value("MATCH(51,A1:A200,0)"), CellInterface::Value(160.0));
+}
+
+void TestConditionalAggregates() {
+    auto formula = ParseFormula("SUMIF( A1:A10 , \">=5\" , B1:B10)+COUNTIF(A1:A10,\"say \"\"hi\"\" to everyone\")");
+    ASSERT_EQUAL(formula->GetExpression(),
+                 "SUMIF(A1:A10,\">=5\",B1:B10)+COUNTIF(A1:A10,\"say \"\"hi\"\" to everyone\")");
+    auto program = formula->GetProgram();
+    ASSERT_EQUAL(LoadFormula(program.data(), program.size())->GetExpression(), formula->GetExpression());
+    // Строка обрезана: её байты не помещаются в программу
+    bool caught = false;
+    try {
+        LoadFormula(program.data(), program.size() - 3);
+    } catch (const FormulaException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+    for (const std::string bad : {"COUNTIF(A1:A2)", "COUNTIF(A1:A2,1,B1:B2)", "SUMIF(1,2)", "SUMIF(A1:A2,1,3)",
+                                  "\"abc"}) {
+        caught = false;
+        try {
+            ParseFormula(bad);
+        } catch (const FormulaException&) {
+            caught = true;
+        }
+        ASSERT(caught);
+    }
+
+    // A - числа 1..100 числовым текстом, B - формулы A*10, C - категории
+    auto sheet = CreateSheet();
+    for (int row = 0; row < 100; ++row) {
+        sheet->SetCell(Position{row, 0}, std::to_string(row + 1));
+        sheet->SetCell(Position{row, 1}, "=A" + std::to_string(row + 1) + "*10");
+        sheet->SetCell(Position{row, 2}, row % 2 == 0 ? "Even" : "odd");
+    }
+    auto value = [&sheet](std::string expression) {
+        sheet->SetCell("E1"_pos, "=" + expression);
+        return sheet->GetCell("E1"_pos)->GetValue();
+    };
+    ASSERT_EQUAL(value("COUNTIF(A1:A100,\">50\")"), CellInterface::Value(50.0));
+    ASSERT_EQUAL(value("COUNTIF(A1:A100,\"<=10\")"), CellInterface::Value(10.0));
+    ASSERT_EQUAL(value("COUNTIF(A1:A100,42)"), CellInterface::Value(1.0));
+    ASSERT_EQUAL(value("COUNTIF(A1:A100,\"=42.0\")"), CellInterface::Value(1.0));
+    ASSERT_EQUAL(value("COUNTIF(A1:A100,\"<>42\")"), CellInterface::Value(99.0));
+    ASSERT_EQUAL(value("COUNTIF(B1:B100,\">=500\")"), CellInterface::Value(51.0));
+    ASSERT_EQUAL(value("COUNTIF(C1:C100,\"EVEN\")"), CellInterface::Value(50.0));
+    ASSERT_EQUAL(value("COUNTIF(C1:C100,\">f\")"), CellInterface::Value(50.0));
+    ASSERT_EQUAL(value("COUNTIF(C1:C100,\">5\")"), CellInterface::Value(0.0));
+    ASSERT_EQUAL(value("COUNTIF(A1:C100,\"<>odd\")"), CellInterface::Value(250.0));
+    ASSERT_EQUAL(value("COUNTIF(A95:A105,\"\")"), CellInterface::Value(5.0));
+    ASSERT_EQUAL(value("COUNTIF(A95:A105,\"<>\")"), CellInterface::Value(6.0));
+    ASSERT_EQUAL(value("SUMIF(A1:A100,\">90\")"), CellInterface::Value(955.0));
+    ASSERT_EQUAL(value("SUMIF(C1:C100,\"odd\",A1:A100)"), CellInterface::Value(2550.0));
+    ASSERT_EQUAL(value("SUMIF(A1:A100,\"<=2\",B1:B100)"), CellInterface::Value(30.0));
+    ASSERT_EQUAL(value("SUMIF(A1:A100,\"<=2\",C1:C100)"), CellInterface::Value(0.0));    // текст пропускается
+    ASSERT_EQUAL(value("AVERAGEIF(A1:A100,\"<=3\",B1:B100)"), CellInterface::Value(20.0));
+    ASSERT_EQUAL(value("AVERAGEIF(A1:A100,\">1000\")"), CellInterface::Value(FormulaError::Category::Div0));
+    ASSERT_EQUAL(value("SUMIF(A1:A100,1,B1:B50)"), CellInterface::Value(FormulaError::Category::Value));
+    ASSERT_EQUAL(value("1+\"abc\""), CellInterface::Value(FormulaError::Category::Value));
+
+    // Карта условия следит за правками диапазона и значениями его формул
+    ASSERT_EQUAL(value("SUMIF(A1:A100,\">95\",B1:B100)"), CellInterface::Value(4900.0));
+    sheet->SetCell("A10"_pos, "96");
+    ASSERT_EQUAL(value("SUMIF(A1:A100,\">95\",B1:B100)"), CellInterface::Value(5860.0));
+    sheet->ClearCell("A100"_pos);
+    ASSERT_EQUAL(value("SUMIF(A1:A100,\">95\",B1:B100)"), CellInterface::Value(4860.0));
+    sheet->SetCell("B3"_pos, "=1/0");
+    ASSERT_EQUAL(value("COUNTIF(B1:B100,\">0\")"), CellInterface::Value(98.0));
+    ASSERT_EQUAL(value("SUMIF(A1:A100,\"<=2\",B1:B100)"), CellInterface::Value(30.0));
+    ASSERT_EQUAL(value("SUMIF(A1:A100,\"<=3\",B1:B100)"), CellInterface::Value(FormulaError::Category::Div0));
+    sheet->SetCell("D1"_pos, "0");
+    sheet->SetCell("B3"_pos, "=D1");
+    ASSERT_EQUAL(value("COUNTIF(B1:B100,\">0\")"), CellInterface::Value(98.0));
+    sheet->SetCell("D1"_pos, "7");
+    ASSERT_EQUAL(value("COUNTIF(B1:B100,\">0\")"), CellInterface::Value(99.0));
+    // Массовая правка перестраивает карту целиком
+    for (int row = 0; row < 50; ++row) {
+        sheet->SetCell(Position{row, 0}, "0");
+    }
+    ASSERT_EQUAL(value("COUNTIF(A1:A100,0)"), CellInterface::Value(50.0));
+    ASSERT_EQUAL(value("SUMIF(A1:A100,\">95\",B1:B100)"), CellInterface::Value(3900.0));
+
+    // Зависимые формулы пересчитываются
+    sheet->SetCell("F1"_pos, "=COUNTIF(C1:C100,\"odd\")");
+    ASSERT_EQUAL(sheet->GetCell("F1"_pos)->GetValue(), CellInterface::Value(50.0));
+    sheet->SetCell("C1"_pos, "ODD");
+    ASSERT_EQUAL(sheet->GetCell("F1"_pos)->GetValue(), CellInterface::Value(51.0));
+    // Условие по диапазону, в который входит сама ячейка, - цикл
+    caught = false;
+    try {
+        sheet->SetCell("C5"_pos, "=COUNTIF(C1:C100,1)");
+    } catch (const CircularDependencyException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+}
+
+void TestLogicalFunctions() {
+    auto formula = ParseFormula("IF( A1 >= 1 , B1 , C1 )+(A1<>B1)*2");
+    ASSERT_EQUAL(formula->GetExpression(), "IF(A1>=1,B1,C1)+(A1<>B1)*2");
+    auto program = formula->GetProgram();
+    ASSERT_EQUAL(LoadFormula(program.data(), program.size())->GetExpression(), formula->GetExpression());
+    ASSERT_EQUAL(ParseFormula("(1<2)<3")->GetExpression(), "1<2<3");
+    ASSERT_EQUAL(ParseFormula("1<(2<3)")->GetExpression(), "1<(2<3)");
+    ASSERT_EQUAL(ParseFormula("-(1=2)")->GetExpression(), "-(1=2)");
+    ASSERT_EQUAL(ParseFormula("(1+2)=3")->GetExpression(), "1+2=3");
+    for (const std::string bad : {"IF(1)", "IF(1,2,3,4)", "AND()", "1<", "1=<2"}) {
+        bool caught = false;
+        try {
+            ParseFormula(bad);
+        } catch (const FormulaException&) {
+            caught = true;
+        }
+        ASSERT(caught);
+    }
+
+    auto sheet = CreateSheet();
+    auto value = [&sheet](std::string expression) {
+        sheet->SetCell("E1"_pos, "=" + expression);
+        return sheet->GetCell("E1"_pos)->GetValue();
+    };
+    ASSERT_EQUAL(value("1<2"), CellInterface::Value(1.0));
+    ASSERT_EQUAL(value("2<=1"), CellInterface::Value(0.0));
+    ASSERT_EQUAL(value("1+1=2"), CellInterface::Value(1.0));
+    ASSERT_EQUAL(value("3<>3"), CellInterface::Value(0.0));
+    ASSERT_EQUAL(value("(2>1)+(2>=2)"), CellInterface::Value(2.0));
+    // Невыбранные аргументы не вычисляются
+    ASSERT_EQUAL(value("IF(1,5,1/0)"), CellInterface::Value(5.0));
+    ASSERT_EQUAL(value("IF(0,1/0)"), CellInterface::Value(0.0));
+    ASSERT_EQUAL(value("IF(0,1/0,7)"), CellInterface::Value(7.0));
+    ASSERT_EQUAL(value("AND(1,0,1/0)"), CellInterface::Value(0.0));
+    ASSERT_EQUAL(value("AND(1,2)"), CellInterface::Value(1.0));
+    ASSERT_EQUAL(value("OR(0,3,1/0)"), CellInterface::Value(1.0));
+    ASSERT_EQUAL(value("OR(0,0)"), CellInterface::Value(0.0));
+    ASSERT_EQUAL(value("AND(1,1/0)"), CellInterface::Value(FormulaError::Category::Div0));
+    sheet->SetCell("A9"_pos, "abc");
+    ASSERT_EQUAL(value("IF(A9,1,2)"), CellInterface::Value(FormulaError::Category::Value));
+
+    // Инвалидация идёт только по прочитанным ссылкам
+    sheet->SetCell("A1"_pos, "1");
+    sheet->SetCell("B1"_pos, "2");
+    sheet->SetCell("C1"_pos, "3");
+    sheet->SetCell("D1"_pos, "=IF(A1>0,B1,C1*10)");
+    const auto* cell = dynamic_cast<const Cell*>(sheet->GetCell("D1"_pos));
+    const FormulaInterface* branches = cell->GetFormula();
+    ASSERT(branches->MayDependOn("C1"_pos));
+    ASSERT_EQUAL(cell->GetValue(), CellInterface::Value(2.0));
+    ASSERT(branches->MayDependOn("A1"_pos));
+    ASSERT(branches->MayDependOn("B1"_pos));
+    ASSERT(!branches->MayDependOn("C1"_pos));
+    sheet->SetCell("C1"_pos, "4");
+    ASSERT(!branches->MayDependOn("C1"_pos));    // D1 не сброшена
+    sheet->SetCell("A1"_pos, "0");
+    ASSERT(branches->MayDependOn("C1"_pos));
+    ASSERT_EQUAL(cell->GetValue(), CellInterface::Value(40.0));
+    ASSERT(!branches->MayDependOn("B1"_pos));
+    // Формулы без ветвления зависят от всех ссылок
+    sheet->SetCell("E2"_pos, "=B1+C1");
+    ASSERT_EQUAL(sheet->GetCell("E2"_pos)->GetValue(), CellInterface::Value(6.0));
+    ASSERT(dynamic_cast<const Cell*>(sheet->GetCell("E2"_pos))->GetFormula()->MayDependOn("B1"_pos));
+    // Цикл проверяется по всем ссылкам, даже непрочитанным
+    bool caught = false;
+    try {
+        sheet->SetCell("B1"_pos, "=D1");
+    } catch (const CircularDependencyException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+
+    // Диапазон невыбранной ветви тоже не читается
+    sheet->SetCell("F1"_pos, "=IF(A1>0,SUM(B1:B10),-1)");
+    const FormulaInterface* range_branch = dynamic_cast<const Cell*>(sheet->GetCell("F1"_pos))->GetFormula();
+    ASSERT_EQUAL(sheet->GetCell("F1"_pos)->GetValue(), CellInterface::Value(-1.0));
+    ASSERT(!range_branch->MayDependOn("B5"_pos));
+    sheet->SetCell("B5"_pos, "5");
+    ASSERT(!range_branch->MayDependOn("B5"_pos));
+    sheet->SetCell("A1"_pos, "1");
+    ASSERT_EQUAL(sheet->GetCell("F1"_pos)->GetValue(), CellInterface::Value(7.0));
+    ASSERT(range_branch->MayDependOn("B5"_pos));
+}
+
+void TestSpillArrays() {
+    auto formula = ParseFormula("A1:A3*(B1:B3+1)");
+    ASSERT_EQUAL(formula->GetExpression(), "A1:A3*(B1:B3+1)");
+    ASSERT(formula->GetArraySize() == (Size{3, 1}));
+    ASSERT(!ParseFormula("SUM(A1:A3)*2")->GetArraySize());
+    auto program = formula->GetProgram();
+    ASSERT(LoadFormula(program.data(), program.size())->GetArraySize() == (Size{3, 1}));
+
+    auto sheet_ptr = CreateSheet();
+    Sheet& sheet = dynamic_cast<Sheet&>(*sheet_ptr);
+    for (int row = 0; row < 3; ++row) {
+        sheet.SetCell(Position{row, 0}, std::to_string(row + 1));
+        sheet.SetCell(Position{row, 1}, std::to_string((row + 1) * 10));
+    }
+    auto value = [&sheet](std::string_view pos) {
+        const CellInterface* cell = sheet.GetCell(Position::FromString(pos));
+        return cell ? cell->GetValue() : CellInterface::Value(0.0);
+    };
+
+    // Массив разливается вниз от якоря, у ячеек области нет своего текста
+    sheet.SetCell("D1"_pos, "=A1:A3*B1:B3");
+    ASSERT(sheet.GetSpillRange("D1"_pos) == (Range{"D1"_pos, "D3"_pos}));
+    ASSERT_EQUAL(value("D1"), CellInterface::Value(10.0));
+    ASSERT_EQUAL(value("D2"), CellInterface::Value(40.0));
+    ASSERT_EQUAL(value("D3"), CellInterface::Value(90.0));
+    ASSERT_EQUAL(sheet.GetCell("D3"_pos)->GetText(), "");
+    ASSERT((sheet.GetPrintableSize() == Size{3, 4}));
+    std::ostringstream values;
+    sheet.PrintValues(values);
+    ASSERT_EQUAL(values.str(), "1\t10\t\t10\n2\t20\t\t40\n3\t30\t\t90\n");
+
+    // На ячейки области можно ссылаться, они меняются вместе с якорем
+    sheet.SetCell("E1"_pos, "=D3+1");
+    sheet.SetCell("E2"_pos, "=SUM(D1:D3)");
+    sheet.SetCell("E3"_pos, "=MATCH(40,D1:D3,0)");
+    ASSERT_EQUAL(value("E1"), CellInterface::Value(91.0));
+    ASSERT_EQUAL(value("E2"), CellInterface::Value(140.0));
+    ASSERT_EQUAL(value("E3"), CellInterface::Value(2.0));
+    sheet.SetCell("A3"_pos, "4");
+    ASSERT_EQUAL(value("E1"), CellInterface::Value(121.0));
+    ASSERT_EQUAL(value("E2"), CellInterface::Value(170.0));
+    std::vector<double> numbers(3);
+    std::vector<ValueCode> codes(3);
+    sheet.GetValues("D1"_pos, Size{3, 1}, ValueBuffers{numbers.data(), codes.data()});
+    ASSERT_EQUAL(numbers, (std::vector{10.0, 40.0, 120.0}));
+
+    // Непустая ячейка в области блокирует разлив
+    sheet.SetCell("D2"_pos, "x");
+    ASSERT_EQUAL(value("D1"), CellInterface::Value(FormulaError::Category::Spill));
+    ASSERT(!sheet.GetSpillRange("D1"_pos));
+    ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetText(), "=A1:A3*B1:B3");
+    ASSERT_EQUAL(value("E1"), CellInterface::Value(1.0));
+    ASSERT_EQUAL(value("E2"), CellInterface::Value(FormulaError::Category::Spill));
+    sheet.ClearCell("D2"_pos);
+    ASSERT_EQUAL(value("E1"), CellInterface::Value(121.0));
+    ASSERT_EQUAL(value("D2"), CellInterface::Value(40.0));
+
+    // Пересекающиеся области блокируют друг друга
+    sheet.SetCell("C2"_pos, "=A1:B2");
+    ASSERT_EQUAL(value("C2"), CellInterface::Value(FormulaError::Category::Spill));
+    ASSERT_EQUAL(value("D1"), CellInterface::Value(FormulaError::Category::Spill));
+    sheet.ClearCell("C2"_pos);
+    ASSERT_EQUAL(value("D1"), CellInterface::Value(10.0));
+    ASSERT_EQUAL(value("E2"), CellInterface::Value(170.0));
+
+    // Удалённый якорь освобождает область
+    sheet.ClearCell("D1"_pos);
+    ASSERT_EQUAL(value("E1"), CellInterface::Value(1.0));
+    ASSERT_EQUAL(value("E2"), CellInterface::Value(0.0));
+    ASSERT((sheet.GetPrintableSize() == Size{3, 5}));
+
+    // Поэлементные ошибки, числа и массивы разного размера
+    sheet.SetCell("B2"_pos, "0");
+    sheet.SetCell("B3"_pos, "abc");
+    sheet.SetCell("G1"_pos, "=A1:A3/B1:B3");
+    ASSERT_EQUAL(value("G1"), CellInterface::Value(0.1));
+    ASSERT_EQUAL(value("G2"), CellInterface::Value(FormulaError::Category::Div0));
+    ASSERT_EQUAL(value("G3"), CellInterface::Value(FormulaError::Category::Value));
+    sheet.SetCell("G1"_pos, "=A1:A3+A1:A2*10-SUM(A1:A2)");
+    ASSERT_EQUAL(value("G2"), CellInterface::Value(19.0));
+    ASSERT_EQUAL(value("G3"), CellInterface::Value(FormulaError::Category::NA));
+    sheet.SetCell("G1"_pos, "=-A1:A3>=2");
+    ASSERT_EQUAL(value("G3"), CellInterface::Value(0.0));
+    sheet.SetCell("G1"_pos, "=A1:A3>=2");
+    ASSERT_EQUAL(value("G3"), CellInterface::Value(1.0));
+
+    // Область разлива участвует в проверке циклов
+    for (const auto& [pos, text] : {std::pair{"H1"_pos, "=H2:H3"}, std::pair{"A1"_pos, "=G3"}}) {
+        bool caught = false;
+        try {
+            sheet.SetCell(pos, text);
+        } catch (const CircularDependencyException&) {
+            caught = true;
+        }
+        ASSERT(caught);
+    }
+    ASSERT_EQUAL(value("G1"), CellInterface::Value(0.0));
+
+    // Массив, не помещающийся в лист
+    const Position last_row{Position::MAX_ROWS - 1, 0};
+    sheet.SetCell(last_row, "=B1:B2");
+    ASSERT_EQUAL(sheet.GetCell(last_row)->GetValue(), CellInterface::Value(FormulaError::Category::Spill));
+    sheet.ClearCell(last_row);
+
+    // Снимок восстанавливает области разлива
+    const std::string path =
+        (std::filesystem::temp_directory_path() / "spreadsheet_test_spill.bin").string();
+    sheet.SetCell("D1"_pos, "=A1:A3*2");
+    sheet.SetCell("J1"_pos, "=A1:A2");
+    sheet.SetCell("J2"_pos, "y");
+    SaveSnapshot(sheet, path, SnapshotOptions{true});
+    auto loaded = LoadSnapshot(path);
+    std::filesystem::remove(path);
+    ASSERT_EQUAL(loaded->GetCell("D3"_pos)->GetValue(), CellInterface::Value(8.0));
+    ASSERT_EQUAL(loaded->GetCell("E1"_pos)->GetValue(), CellInterface::Value(9.0));
+    ASSERT_EQUAL(loaded->GetCell("J1"_pos)->GetValue(), CellInterface::Value(FormulaError::Category::Spill));
+    loaded->ClearCell("J2"_pos);
+    ASSERT_EQUAL(loaded->GetCell("J2"_pos)->GetValue(), CellInterface::Value(2.0));
+}
+
+void TestViewportEvaluation() {
+    auto sheet_ptr = CreateSheet();
+    Sheet& sheet = dynamic_cast<Sheet&>(*sheet_ptr);
+    auto value = [&sheet](std::string_view pos) {
+        return sheet.GetCell(Position::FromString(pos))->GetValue();
+    };
+    auto cached = [&sheet](Position pos) {
+        return dynamic_cast<const Cell&>(*sheet.GetCell(pos)).IsCacheValid();
+    };
+
+    // Столбец B зависит от A1, C1 - от всего столбца B, столбец D - цепочка
+    sheet.SetCell("A1"_pos, "1");
+    for (int row = 0; row < 100; ++row) {
+        sheet.SetCell(Position{row, 1}, "=A1+" + std::to_string(row));
+    }
+    sheet.SetCell("C1"_pos, "=SUM(B1:B100)");
+    sheet.SetCell("D1"_pos, "=A1");
+    for (int row = 1; row < 10; ++row) {
+        sheet.SetCell(Position{row, 3}, "=D" + std::to_string(row) + "+1");
+    }
+
+    // Вычисляются только видимые формулы и те, от которых они зависят
+    ViewportStats stats = sheet.EvaluateViewport(Range{"D5"_pos, "D5"_pos});
+    ASSERT_EQUAL(stats.evaluated, 5u);
+    ASSERT_EQUAL(stats.skipped, 106u);
+    ASSERT(cached("D5"_pos) && !cached("D6"_pos));
+    ASSERT_EQUAL(value("D5"), CellInterface::Value(5.0));
+    ASSERT_EQUAL(sheet.EvaluateViewport(Range{"D1"_pos, "D5"_pos}).evaluated, 0u);
+
+    stats = sheet.EvaluateViewport(Range{"C1"_pos, "C1"_pos});
+    ASSERT_EQUAL(stats.evaluated, 101u);
+    ASSERT_EQUAL(stats.skipped, 5u);
+    ASSERT_EQUAL(value("C1"), CellInterface::Value(5050.0));
+
+    // Правка сбрасывает кэш зависимых формул, и они снова ждут запроса
+    sheet.SetCell("A1"_pos, "2");
+    ASSERT(!cached("C1"_pos));
+    stats = sheet.EvaluateViewport(Range{"D1"_pos, "D2"_pos});
+    ASSERT_EQUAL(stats.evaluated, 2u);
+    ASSERT_EQUAL(stats.skipped, 109u);
+    ASSERT_EQUAL(value("D2"), CellInterface::Value(3.0));
+    ASSERT_EQUAL(value("C1"), CellInterface::Value(5150.0));
+    // Чтение C1 сохранило в кэше и значения столбца B
+    sheet.SetCell("B100"_pos, "0");
+    ASSERT_EQUAL(sheet.EvaluateViewport(Range{"C1"_pos, "C1"_pos}).evaluated, 1u);
+    ASSERT_EQUAL(value("C1"), CellInterface::Value(5150.0 - 101.0));
+
+    // Ячейки области разлива в окне вычисляют формулу якоря
+    sheet.SetCell("F1"_pos, "=D1:D3*10");
+    stats = sheet.EvaluateViewport(Range{"F3"_pos, "F3"_pos});
+    ASSERT_EQUAL(stats.evaluated, 2u);
+    ASSERT_EQUAL(value("F3"), CellInterface::Value(40.0));
+    sheet.SetCell("G1"_pos, "=F2+1");
+    ASSERT_EQUAL(sheet.EvaluateViewport(Range{"G1"_pos, "G1"_pos}).evaluated, 1u);
+    ASSERT_EQUAL(value("G1"), CellInterface::Value(31.0));
+
+    // Удалённые формулы не числятся среди невычисленных
+    sheet.ClearCell("D10"_pos);
+    sheet.SetCell("D9"_pos, "text");
+    ASSERT_EQUAL(sheet.EvaluateViewport(Range{"A1"_pos, "A1"_pos}).skipped, 5u);
+
+    try {
+        sheet.EvaluateViewport(Range{"B2"_pos, "A1"_pos});
+        ASSERT(false);
+    } catch (const InvalidPositionException&) {
+    }
+}
+
+void TestChangeSubscription() {
+    // Запоминает все уведомления
+    struct Recorder : SheetObserver {
+        std::vector<std::vector<Position>> batches;
+        void OnValuesChanged(Span<const Position> changed) override {
+            batches.emplace_back(changed.begin(), changed.end());
+        }
+        std::vector<Position> Take() {
+            std::vector<Position> result;
+            if (!batches.empty()) {
+                result = batches.back();
+            }
+            batches.clear();
+            return result;
+        }
+    };
+
+    auto sheet_ptr = CreateSheet();
+    Sheet& sheet = dynamic_cast<Sheet&>(*sheet_ptr);
+    sheet.SetCell("A1"_pos, "1");
+    sheet.SetCell("A2"_pos, "2");
+    sheet.SetCell("B1"_pos, "=A1+A2");
+    sheet.SetCell("B2"_pos, "=IF(A1>0,1,-1)");
+    sheet.SetCell("C1"_pos, "=SUM(B1:B2)");
+
+    Recorder all;
+    Recorder column_c;
+    sheet.Subscribe(all);
+    sheet.Subscribe(column_c, {Range{"C1"_pos, "C10"_pos}});
+    ASSERT(all.batches.empty());
+
+    // Приходят только изменившиеся значения: B2 осталась равна 1
+    sheet.SetCell("A1"_pos, "=5");
+    ASSERT_EQUAL(all.batches.size(), 1u);
+    ASSERT_EQUAL(all.Take(), (std::vector{"A1"_pos, "B1"_pos, "C1"_pos}));
+    ASSERT_EQUAL(column_c.Take(), (std::vector{"C1"_pos}));
+    ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(8.0));
+
+    // Та же величина другим текстом - не изменение
+    sheet.SetCell("A1"_pos, "=2+3");
+    ASSERT_EQUAL(all.Take(), std::vector<Position>{});
+
+    // Пакет правок - одно уведомление; значение C1 не изменилось
+    sheet.ApplyEdits({{"A1"_pos, "=-1"}, {"A2"_pos, "10"}, {"D5"_pos, "text"}});
+    ASSERT_EQUAL(all.batches.size(), 1u);
+    ASSERT_EQUAL(all.Take(), (std::vector{"A1"_pos, "B1"_pos, "A2"_pos, "B2"_pos, "D5"_pos}));
+    ASSERT(column_c.batches.empty());
+    sheet.SetCell("D5"_pos, "other");
+    ASSERT_EQUAL(all.Take(), (std::vector{"D5"_pos}));
+    sheet.ClearCell("A2"_pos);
+    ASSERT_EQUAL(all.Take(), (std::vector{"B1"_pos, "C1"_pos, "A2"_pos}));
+    ASSERT_EQUAL(column_c.Take(), (std::vector{"C1"_pos}));
+
+    // Ячейки области разлива меняются вместе с якорем
+    sheet.SetCell("E1"_pos, "=A1:A3*2");
+    ASSERT_EQUAL(all.Take(), (std::vector{"E1"_pos, "E2"_pos, "E3"_pos}));
+    sheet.SetCell("A3"_pos, "4");
+    ASSERT_EQUAL(all.Take(), (std::vector{"A3"_pos, "E3"_pos}));
+
+    // После отписки уведомлений нет
+    sheet.Unsubscribe(all);
+    sheet.SetCell("A1"_pos, "100");
+    ASSERT(all.batches.empty());
+    ASSERT_EQUAL(column_c.Take(), (std::vector{"C1"_pos}));
+    sheet.Unsubscribe(column_c);
+
+    try {
+        sheet.Subscribe(all, {Range{"B2"_pos, "A1"_pos}});
+        ASSERT(false);
+    } catch (const InvalidPositionException&) {
+    }
+}
+
+void TestVersionedSheet() {
+    VersionedSheet sheet;
+    auto empty = sheet.Pin();
+    ASSERT_EQUAL(empty->GetNumber(), 0u);
+    ASSERT((empty->GetPrintableSize() == Size{0, 0}));
+
+    auto first = sheet.Commit({{"A1"_pos, "2"}, {"B1"_pos, "=A1*10"}, {"C1"_pos, "'=x"},
+                               {"A100"_pos, "far"}});
+    ASSERT_EQUAL(first->GetNumber(), 1u);
+    ASSERT(sheet.Pin() == first);
+    ASSERT((first->GetPrintableSize() == Size{100, 3}));
+    ASSERT_EQUAL(first->GetValue("B1"_pos).number, 20.0);
+    ASSERT_EQUAL(first->GetText("B1"_pos), "=A1*10");
+    ASSERT(first->GetValue("C1"_pos).code == ValueCode::Text);
+    ASSERT_EQUAL(first->GetValue("C1"_pos).text, "=x");
+    ASSERT_EQUAL(first->GetText("C1"_pos), "'=x");
+    ASSERT(first->GetValue("D1"_pos).code == ValueCode::Empty);
+
+    // Прежняя версия не меняется, нетронутые тайлы общие
+    auto second = sheet.Commit({{"A1"_pos, "=3"}, {"D1"_pos, "=B1:B2+1"}});
+    ASSERT_EQUAL(first->GetValue("B1"_pos).number, 20.0);
+    ASSERT_EQUAL(second->GetValue("B1"_pos).number, 30.0);
+    ASSERT_EQUAL(second->GetValue("D2"_pos).number, 1.0);
+    ASSERT(!second->SharesTile(*first, "A1"_pos));
+    ASSERT(second->SharesTile(*first, "A100"_pos));
+    ASSERT(empty->GetValue("A1"_pos).code == ValueCode::Empty);
+    std::vector<double> numbers(4);
+    second->GetValues("A1"_pos, Size{1, 4}, ValueBuffers{numbers.data()});
+    ASSERT_EQUAL(numbers, (std::vector{3.0, 30.0, 0.0, 31.0}));
+
+    // Правки до некорректной публикуются
+    try {
+        sheet.Commit({{"A2"_pos, "5"}, {"A3"_pos, "=A3"}});
+        ASSERT(false);
+    } catch (const CircularDependencyException&) {
+    }
+    ASSERT_EQUAL(sheet.Pin()->GetNumber(), 3u);
+    ASSERT(sheet.Pin()->GetValue("A2"_pos).code == ValueCode::Text);
+    sheet.Commit({{"A2"_pos, std::nullopt}});
+    ASSERT_EQUAL(sheet.Pin()->GetText("A2"_pos), "");
+
+    // Читатели в других потоках видят только согласованные версии: B1 = A1 * 10
+    std::atomic<bool> stop = false;
+    std::atomic<int> inconsistent = 0;
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; ++i) {
+        readers.emplace_back([&] {
+            while (!stop) {
+                auto version = sheet.Pin();
+                if (version->GetValue("B1"_pos).number != version->GetValue("A1"_pos).number * 10) {
+                    ++inconsistent;
+                }
+            }
+        });
+    }
+    for (int i = 0; i < 200; ++i) {
+        sheet.Commit({{"A1"_pos, "=" + std::to_string(i)}});
+    }
+    stop = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    ASSERT_EQUAL(inconsistent.load(), 0);
+    ASSERT_EQUAL(sheet.Pin()->GetValue("B1"_pos).number, 1990.0);
+}
+
+void TestConcurrentEvaluation() {
+    // Конусы зависимостей формул сильно пересекаются: цепочка B, суммы по
+    // префиксам B, поиск по B, общая карта условия SUMIF
+    constexpr int rows = 200;
+    auto fill = [](SheetInterface& sheet) {
+        for (int row = 0; row < rows; ++row) {
+            const std::string n = std::to_string(row + 1);
+            sheet.SetCell(Position{row, 0}, std::to_string(row % 17));
+            sheet.SetCell(Position{row, 1}, row == 0 ? "=A1*2" : "=A" + n + "*2+B" + std::to_string(row));
+            sheet.SetCell(Position{row, 2}, "=SUM(B1:B" + n + ")");
+            sheet.SetCell(Position{row, 3}, "=MATCH(B" + n + ",B1:B200,0)");
+            sheet.SetCell(Position{row, 4}, "=SUMIF(A1:A200,\">8\",B1:B200)+C" + n);
+            sheet.SetCell(Position{row, 5}, "=IF(C" + n + ">1000,D" + n + ",-E" + n + ")");
+        }
+    };
+    auto sheet = CreateSheet();
+    auto reference = CreateSheet();
+    fill(*sheet);
+    fill(*reference);
+
+    for (int round = 0; round < 3; ++round) {
+        std::vector<CellInterface::Value> expected;
+        for (int row = 0; row < rows; ++row) {
+            for (int col = 1; col < 6; ++col) {
+                expected.push_back(reference->GetCell(Position{row, col})->GetValue());
+            }
+        }
+
+        // Каждый поток читает все формулы в своём порядке
+        std::atomic<int> mismatches = 0;
+        std::vector<std::thread> readers;
+        for (int thread = 0; thread < 8; ++thread) {
+            readers.emplace_back([&, thread] {
+                const int count = static_cast<int>(expected.size());
+                for (int i = 0; i < count; ++i) {
+                    const int index = thread % 2 == 0 ? (i * 7 + thread) % count : count - 1 - i;
+                    const Position pos{index / 5, index % 5 + 1};
+                    if (!(sheet->GetCell(pos)->GetValue() == expected[index])) {
+                        ++mismatches;
+                    }
+                }
+            });
+        }
+        for (auto& reader : readers) {
+            reader.join();
+        }
+        ASSERT_EQUAL(mismatches.load(), 0);
+
+        // Правка между раундами сбрасывает кэш зависимых формул
+        const Position edit{round * 50, 0};
+        sheet->SetCell(edit, std::to_string(round + 20));
+        reference->SetCell(edit, std::to_string(round + 20));
+    }
+}
+
+void TestAsyncRecalc() {
+    AsyncSheet sheet;
+    constexpr int chain = 2000;
+    const Position last{chain - 1, 2};
+    sheet.SetCell("A1"_pos, "1");
+    sheet.SetCell("B1"_pos, "=A1+1");
+    std::vector<CellEdit> edits;
+    for (int row = 0; row < chain; ++row) {
+        const std::string previous = row == 0 ? "B1" : "C" + std::to_string(row);
+        edits.push_back({Position{row, 2}, "=" + previous + "+1"});
+    }
+    sheet.ApplyEdits(edits);
+
+    // Текст известен сразу, формулы досчитываются в фоне
+    ASSERT((sheet.GetValue("A1"_pos).value == CellInterface::Value(std::string("1"))));
+    ASSERT(!sheet.GetValue("A1"_pos).stale);
+    ASSERT_EQUAL(std::get<double>(sheet.GetFreshValue(last).get()), 2.0 + chain);
+    ASSERT(!sheet.GetValue(last).stale);
+
+    // Каждая правка прерывает пересчёт предыдущей. Актуальное значение
+    // соответствует последней правке
+    std::atomic<bool> stop = false;
+    std::atomic<int> not_numbers = 0;
+    std::thread reader([&] {
+        while (!stop) {
+            if (!std::holds_alternative<double>(sheet.GetValue(last).value)) {
+                ++not_numbers;
+            }
+        }
+    });
+    for (int i = 1; i <= 50; ++i) {
+        sheet.SetCell("A1"_pos, "=" + std::to_string(i));
+    }
+    auto fresh = sheet.GetFreshValue(last);
+    ASSERT_EQUAL(std::get<double>(fresh.get()), 51.0 + chain);
+    stop = true;
+    reader.join();
+    ASSERT_EQUAL(not_numbers.load(), 0);
+
+    // Очистка и некорректная правка
+    sheet.ClearCell("B1"_pos);
+    sheet.WaitIdle();
+    ASSERT_EQUAL(std::get<double>(sheet.GetValue(last).value), static_cast<double>(chain));
+    ASSERT(!sheet.GetValue("B1"_pos).stale);
+    ASSERT_EQUAL(std::get<double>(sheet.GetValue("B1"_pos).value), 0.0);
+    try {
+        sheet.SetCell("B1"_pos, "=C1");
+        ASSERT(false);
+    } catch (const CircularDependencyException&) {
+    }
+    ASSERT_EQUAL(std::get<double>(sheet.GetFreshValue("C1"_pos).get()), 1.0);
+    const AsyncRecalcStats stats = sheet.GetStats();
+    ASSERT(stats.passes > 0);
+    ASSERT(stats.evaluated >= static_cast<std::size_t>(chain));
+}
+
+void TestRecalcLimit() {
+    auto sheet_ptr = CreateSheet();
+    Sheet& sheet = dynamic_cast<Sheet&>(*sheet_ptr);
+    // Цепочка в столбце A и формулы столбца B, зависящие от неё
+    constexpr int rows = 200;
+    sheet.SetCell("A1"_pos, "=1");
+    for (int row = 0; row < rows; ++row) {
+        const std::string n = std::to_string(row + 1);
+        if (row > 0) {
+            sheet.SetCell(Position{row, 0}, "=A" + std::to_string(row) + "+1");
+        }
+        sheet.SetCell(Position{row, 1}, "=A" + n + "*2");
+    }
+
+    // Отмена останавливает вычисление до первой формулы
+    std::atomic<bool> cancel = true;
+    RecalcLimit cancelled;
+    cancelled.cancel = &cancel;
+    RecalcProgress progress = sheet.Recalculate(cancelled);
+    ASSERT_EQUAL(progress.evaluated, 0u);
+    ASSERT_EQUAL(progress.remaining, 2u * rows);
+    ASSERT(!progress.complete);
+
+    // Нулевой бюджет: каждый вызов вычисляет одну формулу, вычисленное
+    // остаётся в кэше, и серия вызовов доходит до конца
+    std::size_t calls = 0;
+    std::size_t total = 0;
+    do {
+        progress = sheet.Recalculate(RecalcLimit::Budget(std::chrono::steady_clock::duration::zero()));
+        ASSERT_EQUAL(progress.evaluated, 1u);
+        total += progress.evaluated;
+        ++calls;
+        ASSERT_EQUAL(progress.remaining, progress.complete ? 0u : 2u * rows - total);
+    } while (!progress.complete);
+    ASSERT_EQUAL(calls, 2u * rows);
+    ASSERT_EQUAL(sheet.GetCell(Position{rows - 1, 1})->GetValue(), CellInterface::Value(2.0 * rows));
+
+    // После правки пересчитывается только нужное диапазону
+    sheet.SetCell("A1"_pos, "=2");
+    progress = sheet.Recalculate({Range{"B3"_pos, "B3"_pos}});
+    ASSERT(progress.complete);
+    ASSERT_EQUAL(progress.evaluated, 4u);
+    ASSERT_EQUAL(sheet.GetCell("B3"_pos)->GetValue(), CellInterface::Value(8.0));
+    cancel = false;
+    progress = sheet.Recalculate(cancelled);
+    ASSERT(progress.complete);
+    ASSERT_EQUAL(progress.evaluated, 2u * rows - 4);
+
+    try {
+        sheet.Recalculate({Range{Position{-1, 0}, "A1"_pos}});
+        ASSERT(false);
+    } catch (const InvalidPositionException&) {
+    }
+}
+
+void TestAsyncPriority() {
+    AsyncSheet sheet;
+    constexpr int rows = 3000;
+    std::vector<CellEdit> edits;
+    for (int row = 0; row < rows; ++row) {
+        const std::string n = std::to_string(row + 1);
+        edits.push_back({Position{row, 0}, n});
+        edits.push_back({Position{row, 1}, "=A1+SUM(A" + n + ":A" + std::to_string(std::min(row + 50, rows)) + ")"});
+    }
+    sheet.ApplyEdits(edits);
+    try {
+        sheet.SetPriorityRanges({Range{Position{0, 0}, Position{0, Position::MAX_COLS}}});
+        ASSERT(false);
+    } catch (const InvalidPositionException&) {
+    }
+
+    // Окно в конце листа и ячейки, которые ждут читатели, считаются
+    // первыми, но результат тот же
+    const Range view{Position{rows - 30, 1}, Position{rows - 1, 1}};
+    sheet.SetPriorityRanges({view});
+    for (int edit = 1; edit <= 5; ++edit) {
+        sheet.SetCell("A1"_pos, "=" + std::to_string(edit * 1000));
+        auto fresh = sheet.GetFreshValue(Position{rows / 2, 1});
+        const double window_sum = (rows / 2 + 1 + rows / 2 + 50) * 50 / 2.0;
+        ASSERT_EQUAL(std::get<double>(fresh.get()), edit * 1000.0 + window_sum);
+    }
+    sheet.WaitIdle();
+    ASSERT_EQUAL(std::get<double>(sheet.GetValue(view.to).value), 5000.0 + rows);
+    sheet.SetPriorityRanges({});
+    sheet.SetCell("A1"_pos, "=1");
+    sheet.WaitIdle();
+    ASSERT_EQUAL(std::get<double>(sheet.GetValue(view.to).value), 1.0 + rows);
+}
+
+void TestDeepChain() {
+    // Цепочка из миллиона формул, каждая ссылается на предыдущую. Длина
+    // цепочки не ограничена стеком
+    auto sheet = CreateSheet();
+    constexpr int length = 1'000'000;
+    auto at = [](int i) {
+        return Position{i % Position::MAX_ROWS, i / Position::MAX_ROWS};
+    };
+    sheet->SetCell(at(0), "=1");
+    for (int i = 1; i < length; ++i) {
+        sheet->SetCell(at(i), "=" + at(i - 1).ToString() + "+1");
+    }
+    ASSERT_EQUAL(sheet->GetCell(at(length - 1))->GetValue(), CellInterface::Value(static_cast<double>(length)));
+
+    // После правки начала цепочка пересчитывается заново, в том числе из
+    // другого потока
+    sheet->SetCell(at(0), "=2");
+    ASSERT_EQUAL(sheet->GetCell(at(length / 2))->GetValue(), CellInterface::Value(length / 2 + 2.0));
+    CellInterface::Value last;
+    std::thread reader([&] {
+        last = sheet->GetCell(at(length - 1))->GetValue();
+    });
+    reader.join();
+    ASSERT_EQUAL(last, CellInterface::Value(length + 1.0));
+}
+
+void TestWorkbook() {
+    Workbook book;
+    Sheet& inputs = book.AddSheet("Inputs");
+    Sheet& model = book.AddSheet("Model");
+    ASSERT_EQUAL(book.GetSheetNames(), (std::vector<std::string>{"Inputs", "Model"}));
+    ASSERT_EQUAL(&book.GetSheet("Model"), &model);
+    ASSERT(book.FindSheet("Other") == nullptr);
+
+    inputs.SetCell("A1"_pos, "2");
+    inputs.SetCell("A2"_pos, "3");
+    model.SetCell("A1"_pos, "=Inputs!A1*10");
+    model.SetCell("A2"_pos, "=SUM(Inputs!A1:A2)+A1");
+    ASSERT_EQUAL(model.GetCell("A1"_pos)->GetValue(), CellInterface::Value(20.0));
+    ASSERT_EQUAL(model.GetCell("A2"_pos)->GetValue(), CellInterface::Value(25.0));
+    ASSERT_EQUAL(model.GetCell("A2"_pos)->GetText(), "=SUM(Inputs!A1:A2)+A1");
+
+    // Правка листа сбрасывает кэш формул, ссылающихся на него с других листов
+    inputs.SetCell("A2"_pos, "=A1+5");
+    ASSERT_EQUAL(model.GetCell("A2"_pos)->GetValue(), CellInterface::Value(29.0));
+    inputs.SetCell("A1"_pos, "4");
+    ASSERT_EQUAL(model.GetCell("A1"_pos)->GetValue(), CellInterface::Value(40.0));
+    ASSERT_EQUAL(model.GetCell("A2"_pos)->GetValue(), CellInterface::Value(53.0));
+
+    // Цикл через два листа отвергается, ячейка не меняется
+    bool caught = false;
+    try {
+        inputs.SetCell("A1"_pos, "=Model!A2");
+    } catch (const CircularDependencyException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+    ASSERT_EQUAL(inputs.GetCell("A1"_pos)->GetText(), "4");
+
+    // Ссылка на отсутствующий лист даёт #REF!, пока лист не добавят
+    model.SetCell("B1"_pos, "=Later!B2+1");
+    ASSERT_EQUAL(std::get<FormulaError>(model.GetCell("B1"_pos)->GetValue()).ToString(),
+                 ToString(FormulaError::Category::Ref));
+    Sheet& later = book.AddSheet("Later");
+    later.SetCell("B2"_pos, "6");
+    ASSERT_EQUAL(model.GetCell("B1"_pos)->GetValue(), CellInterface::Value(7.0));
+
+    // Ссылки на другие листы переживают байт-код формулы
+    auto formula = ParseFormula("Later!A1:B2");
+    ASSERT_EQUAL(formula->GetExpression(), "Later!A1:B2");
+    ASSERT_EQUAL(formula->GetSheetReferencesView().size(), 1u);
+    auto program = formula->GetProgram();
+    ASSERT_EQUAL(LoadFormula(program.data(), program.size())->GetExpression(), "Later!A1:B2");
+    ASSERT_EQUAL(ParseFormula("SUM(Later!A1:Later!B2)")->GetExpression(), "SUM(Later!A1:B2)");
+
+    for (const std::string name : {"", "1Sheet", "Two words", "A-B"}) {
+        caught = false;
+        try {
+            book.AddSheet(name);
+        } catch (const std::invalid_argument&) {
+            caught = true;
+        }
+        ASSERT(caught);
+    }
+    caught = false;
+    try {
+        ParseFormula("Inputs!A1:Model!A2");
+    } catch (const FormulaException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+
+    // Пересчёт книги в нескольких потоках: листы после листов, на которые
+    // они ссылаются
+    for (int i = 0; i < 4; ++i) {
+        Sheet& sheet = book.AddSheet("Part" + std::to_string(i));
+        for (int row = 0; row < 100; ++row) {
+            sheet.SetCell(Position{row, 0}, "=Inputs!A1+" + std::to_string(row));
+        }
+    }
+    Sheet& summary = book.AddSheet("Summary");
+    summary.SetCell("A1"_pos, "=SUM(Part0!A1:A100)+SUM(Part3!A1:A100)");
+    inputs.SetCell("A1"_pos, "1");
+    const WorkbookRecalcStats stats = book.Recalculate(3);
+    ASSERT(stats.evaluated >= 401);
+    ASSERT_EQUAL(stats.threads, 3u);
+    ASSERT_EQUAL(summary.GetCell("A1"_pos)->GetValue(), CellInterface::Value(2 * (100 + 4950.0)));
+
+    // Сохранение и загрузка книги
+    const std::string directory =
+        (std::filesystem::temp_directory_path() / "spreadsheet_test_workbook").string();
+    std::filesystem::remove_all(directory);
+    book.Save(directory);
+    book.Save(directory);
+    auto loaded = Workbook::Load(directory, 2);
+    ASSERT_EQUAL(loaded->GetSheetNames(), book.GetSheetNames());
+    for (const std::string& name : book.GetSheetNames()) {
+        std::ostringstream expected;
+        std::ostringstream actual;
+        book.GetSheet(name).PrintValues(expected);
+        loaded->GetSheet(name).PrintValues(actual);
+        ASSERT_EQUAL(actual.str(), expected.str());
+    }
+    loaded->GetSheet("Inputs").SetCell("A1"_pos, "0");
+    ASSERT_EQUAL(loaded->GetSheet("Summary").GetCell("A1"_pos)->GetValue(), CellInterface::Value(2 * 4950.0));
+    // Файлы прежнего сохранения удалены
+    ASSERT_EQUAL(std::distance(std::filesystem::directory_iterator(directory), std::filesystem::directory_iterator()),
+                 static_cast<std::ptrdiff_t>(book.GetSheetCount() + 1));
+    std::filesystem::remove_all(directory);
+
+    // Глубокие цепочки через листы вычисляются без рекурсии: и конец длинной
+    // цепочки другого листа внутри пересчёта, и цепочка, прыгающая между
+    // двумя листами
+    Workbook chains;
+    Sheet& chain = chains.AddSheet("Chain");
+    Sheet& head = chains.AddSheet("Head");
+    Sheet& ping = chains.AddSheet("Ping");
+    Sheet& pong = chains.AddSheet("Pong");
+    constexpr int length = 200'000;
+    auto at = [](int i) {
+        return Position{i % Position::MAX_ROWS, i / Position::MAX_ROWS};
+    };
+    chain.SetCell(at(0), "=1");
+    ping.SetCell(at(0), "=1");
+    for (int i = 1; i < length; ++i) {
+        chain.SetCell(at(i), "=" + at(i - 1).ToString() + "+1");
+        pong.SetCell(at(i), "=Ping!" + at(i - 1).ToString() + "+1");
+        ping.SetCell(at(i), "=Pong!" + at(i).ToString() + "+1");
+    }
+    head.SetCell("A1"_pos, "=Chain!" + at(length - 1).ToString());
+    head.Recalculate();
+    ASSERT_EQUAL(head.GetCell("A1"_pos)->GetValue(), CellInterface::Value(static_cast<double>(length)));
+    ASSERT_EQUAL(ping.GetCell(at(length - 1))->GetValue(), CellInterface::Value(2.0 * length - 1));
+}
+
+void TestCommandProcessor() {
+    auto sheet = CreateSheet();
+    CommandProcessor processor(dynamic_cast<Sheet&>(*sheet));
+    std::string output;
+
+    // Правки подряд - один пакет; некорректная правка получает ERR, остальные
+    // применяются. Команды приходят по частям, последняя строка - без '\n'
+    processor.Feed("set A1 2\nset B1 =A1*3\nset C1 =C1\nset A2 text\nget B1\nge", output);
+    processor.Feed("t A2\nclear A2\nget-range A1:B2\nget-range A1:ZZZZ9\nfoo\nprint", output);
+    processor.Finish(output);
+    ASSERT_EQUAL(output,
+                 "OK\nOK\nERR Circular dependency detected!\nOK\nOK 6\nOK text\nOK\n"
+                 "OK 2 2\n2\t6\n\t\nERR Invalid position: ZZZZ9\nERR Unknown command: foo\nOK 1 2\n2\t6\n");
+    const CommandProcessor::Stats stats = processor.GetStats();
+    ASSERT_EQUAL(stats.commands, 11u);
+    ASSERT_EQUAL(stats.edits, 5u);
+    ASSERT_EQUAL(stats.batches, 3u);
+    ASSERT_EQUAL(sheet->GetCell("C1"_pos), nullptr);
+
+    // После quit команды не выполняются
+    output.clear();
+    processor.Feed("set A1 5\r\nquit\nset A1 7\n", output);
+    ASSERT_EQUAL(output, "OK\nOK\n");
+    ASSERT(processor.IsClosed());
+    ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetText(), "5");
+}
+
+void TestReplication() {
+    const std::string dir =
+        (std::filesystem::temp_directory_path() / "spreadsheet_test_replication").string();
+    std::filesystem::remove_all(dir);
+    auto values = [](const SheetInterface& sheet) {
+        std::ostringstream out;
+        sheet.PrintValues(out);
+        return out.str();
+    };
+
+    // Группы сбрасываются только явно
+    JournalOptions options;
+    options.group_commit_ops = 0;
+    options.group_commit_interval = std::chrono::milliseconds(0);
+    options.compaction_threshold = 0;
+    auto primary_ptr = CreateSheet();
+    Sheet& primary = dynamic_cast<Sheet&>(*primary_ptr);
+    std::string stream;
+    std::string late_stream;
+    {
+        EditJournal journal(dir, options);
+        primary.SetJournal(&journal);
+        ReplicationLog log(journal, ReplicationOptions{4096});
+        auto sink = [](std::string& out) {
+            return [&out](std::string_view frame) {
+                out += frame;
+                return true;
+            };
+        };
+
+        Replica replica(dir);
+        replica.CatchUp();
+        ASSERT_EQUAL(replica.MakeSubscription(), "subscribe 0\n");
+        ASSERT_EQUAL(ReplicationLog::ParseSubscription("subscribe 12").value_or(0), 12u);
+        ASSERT(!ReplicationLog::ParseSubscription("subscribe x"));
+        ASSERT(log.Subscribe(replica.GetSequence(), sink(stream)) != 0);
+
+        // До сброса на диск правки не рассылаются
+        primary.ApplyEdits({{"A1"_pos, "2"}, {"B1"_pos, "=A1*3"}, {"C1"_pos, "text"}});
+        primary.SetCell("A2"_pos, "=SUM(A1:B1)");
+        ASSERT(stream.empty());
+        journal.Sync();
+        // Поток может приходить любыми порциями
+        for (char ch : stream) {
+            ASSERT(replica.Feed(std::string_view(&ch, 1)));
+        }
+        stream.clear();
+        ASSERT_EQUAL(values(replica.GetSheet()), values(primary));
+        ASSERT_EQUAL(replica.GetSequence(), journal.LastSequence());
+
+        primary.ClearCell("C1"_pos);
+        primary.SetCell("A1"_pos, "5");
+        journal.Sync();
+        ASSERT(replica.Feed(stream));
+        stream.clear();
+        ASSERT_EQUAL(values(replica.GetSheet()), values(primary));
+        ASSERT_EQUAL(replica.GetStats().frames, 2u);
+        ASSERT_EQUAL(replica.GetStats().edits, 6u);
+
+        // Отставший ведомый: его правок в памяти уже нет, он догоняет по
+        // снимку и хвосту журнала
+        for (int row = 0; row < 100; ++row) {
+            primary.SetCell(Position{row, 3}, std::string(64, 'x'));
+            journal.Sync();
+        }
+        Replica late(dir);
+        ASSERT_EQUAL(log.Subscribe(late.GetSequence(), sink(late_stream)), 0u);
+        ASSERT(!late.Feed(late_stream));
+        journal.Compact(primary);
+        journal.WaitForCompaction();
+        primary.SetCell("E1"_pos, "=A1+1");
+        journal.Sync();
+        late.CatchUp();
+        late_stream.clear();
+        ASSERT(log.Subscribe(late.GetSequence(), sink(late_stream)) != 0);
+        primary.SetCell("E2"_pos, "=E1*2");
+        journal.Sync();
+        ASSERT(late.Feed(late_stream));
+        ASSERT_EQUAL(values(late.GetSheet()), values(primary));
+        ASSERT_EQUAL(late.GetSequence(), journal.LastSequence());
+
+        // Подписанный ведомый получил всё сам
+        ASSERT(replica.Feed(stream));
+        ASSERT_EQUAL(values(replica.GetSheet()), values(primary));
+        ASSERT_EQUAL(log.GetSubscriberCount(), 2u);
+        primary.SetJournal(nullptr);
+    }
+    std::filesystem::remove_all(dir);
+}
+
+void TestSheetImage() {
+    const std::string path =
+        (std::filesystem::temp_directory_path() / "spreadsheet_test_sheet_image.bin").string();
+    VersionedSheet sheet;
+    auto first = sheet.Commit({{"A1"_pos, "2"}, {"B1"_pos, "=A1*10"}, {"C1"_pos, "'=x"},
+                               {"D1"_pos, "=1/0"}, {"E1"_pos, "=B1:B2+1"}, {"BZ200"_pos, "far"}});
+    WriteSheetImage(*first, path);
+
+    // Образ отвечает так же, как версия, по которой он записан
+    SheetImageReader reader(path);
+    auto image = reader.Get();
+    ASSERT_EQUAL(image->GetNumber(), 1u);
+    ASSERT((image->GetPrintableSize() == first->GetPrintableSize()));
+    ASSERT_EQUAL(image->GetCellCount(), 7u);
+    const Size size = first->GetPrintableSize();
+    for (int row = 0; row < size.rows; ++row) {
+        for (int col = 0; col < size.cols + 1; ++col) {
+            const Position pos{row, col};
+            const CellValueView expected = first->GetValue(pos);
+            const CellValueView actual = image->GetValue(pos);
+            ASSERT(actual.code == expected.code);
+            ASSERT_EQUAL(actual.number, expected.number);
+            ASSERT_EQUAL(actual.text, expected.text);
+            ASSERT_EQUAL(image->GetText(pos), first->GetText(pos));
+        }
+    }
+    ASSERT_EQUAL(image->GetText("C1"_pos), "'=x");
+    ASSERT_EQUAL(image->GetValue("C1"_pos).text, "=x");
+    ASSERT(image->GetValue("D1"_pos).code == ValueCode::ErrorDiv0);
+    ASSERT_EQUAL(image->GetValue("E2"_pos).number, 1.0);
+
+    std::vector<double> numbers(6, -1.0);
+    std::vector<ValueCode> codes(6);
+    std::vector<std::string_view> texts(6);
+    image->GetValues("A1"_pos, Size{2, 3}, ValueBuffers{numbers.data(), codes.data(), texts.data()});
+    ASSERT_EQUAL(numbers, (std::vector{0.0, 20.0, 0.0, 0.0, 0.0, 0.0}));
+    ASSERT(codes[0] == ValueCode::Text && codes[2] == ValueCode::Text && codes[3] == ValueCode::Empty);
+    ASSERT_EQUAL(texts[0], "2");
+    ASSERT_EQUAL(texts[2], "=x");
+    try {
+        image->GetValue(Position::NONE);
+        ASSERT(false);
+    } catch (const InvalidPositionException&) {
+    }
+
+    // Новая версия заменяет файл, а открытый образ продолжает читать прежнюю
+    ASSERT(!reader.Refresh());
+    auto second = sheet.Commit({{"A1"_pos, "3"}, {"C1"_pos, std::nullopt}});
+    WriteSheetImage(*second, path);
+    ASSERT_EQUAL(image->GetValue("B1"_pos).number, 20.0);
+    ASSERT(reader.Get() == image);
+    ASSERT(reader.Refresh());
+    ASSERT_EQUAL(reader.Get()->GetNumber(), 2u);
+    ASSERT_EQUAL(reader.Get()->GetValue("B1"_pos).number, 30.0);
+    ASSERT(reader.Get()->GetValue("C1"_pos).code == ValueCode::Empty);
+    ASSERT_EQUAL(image->GetText("C1"_pos), "'=x");
+
+    // Обрезанный файл не открывается
+    const std::string truncated = path + ".truncated";
+    {
+        std::ifstream in(path, std::ios::binary);
+        std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        std::ofstream out(truncated, std::ios::binary);
+        out << data.substr(0, data.size() - 8);
+    }
+    bool caught = false;
+    try {
+        SheetImage broken(truncated);
+    } catch (const SheetImageException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+
+    std::filesystem::remove(path);
+    std::filesystem::remove(truncated);
+}
+
+void TestSnapshotRoundTrip() {
+    const std::string path =
+        (std::filesystem::temp_directory_path() / "spreadsheet_test_snapshot.bin").string();
+
+    auto sheet = CreateSheet();
+    sheet->SetCell("A1"_pos, "2");
+    sheet->SetCell("B1"_pos, "=A1*3");
+    sheet->SetCell("C1"_pos, "=B1+A1");
+    sheet->SetCell("A2"_pos, "'=escaped");
+    sheet->SetCell("B2"_pos, "=1/0");
+    sheet->SetCell("D3"_pos, "=Z10");
+
+    std::ostringstream texts_before;
+    std::ostringstream values_before;
+    sheet->PrintTexts(texts_before);
+    sheet->PrintValues(values_before);
+
+    for (bool with_values : {false, true}) {
+        SaveSnapshot(*sheet, path, SnapshotOptions{with_values});
+        auto loaded = LoadSnapshot(path);
+
+        ASSERT_EQUAL(loaded->GetPrintableSize(), sheet->GetPrintableSize());
+        std::ostringstream texts_after;
+        std::ostringstream values_after;
+        loaded->PrintTexts(texts_after);
+        loaded->PrintValues(values_after);
+        ASSERT_EQUAL(texts_after.str(), texts_before.str());
+        ASSERT_EQUAL(values_after.str(), values_before.str());
+        ASSERT_EQUAL(loaded->GetCell("C1"_pos)->GetReferencedCells(),
+                     (std::vector{"A1"_pos, "B1"_pos}));
+        ASSERT_EQUAL(std::get<FormulaError>(loaded->GetCell("B2"_pos)->GetValue()).ToString(),
+                     ToString(FormulaError::Category::Div0));
+
+        // Граф зависимостей восстановлен: изменение A1 сбрасывает кэш B1 и C1
+        loaded->SetCell("A1"_pos, "10");
+        ASSERT_EQUAL(loaded->GetCell("B1"_pos)->GetValue(), CellInterface::Value(30.0));
+        ASSERT_EQUAL(loaded->GetCell("C1"_pos)->GetValue(), CellInterface::Value(40.0));
+
+        // Граф проверки циклов тоже работает
+        bool caught = false;
+        try {
+            loaded->SetCell("A1"_pos, "=C1");
+        } catch (const CircularDependencyException&) {
+            caught = true;
+        }
+        ASSERT(caught);
+    }
+
+    std::filesystem::remove(path);
+}
+
+void TestSnapshotCorrupted() {
+    const std::string path =
+        (std::filesystem::temp_directory_path() / "spreadsheet_test_corrupted.bin").string();
+    {
+        std::ofstream out(path, std::ios::binary);
+        out << "definitely not a snapshot, but long enough to have a header of some size";
+    }
+
+    bool caught = false;
+    try {
+        LoadSnapshot(path);
+    } catch (const SnapshotException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+
+    // Вершина графа за пределами листа
+    {
+        auto sheet = CreateSheet();
+        sheet->SetCell("A1"_pos, "1");
+        sheet->SetCell("B1"_pos, "=A1");
+        SaveSnapshot(*sheet, path);
+    }
+    {
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        snapshot::Header header;
+        file.read(reinterpret_cast<char*>(&header), sizeof(header));
+        ASSERT(header.node_count != 0);
+        Position invalid{ -5, 0 };
+        file.seekp(static_cast<std::streamoff>(header.nodes_offset));
+        file.write(reinterpret_cast<const char*>(&invalid), sizeof(invalid));
+    }
+    caught = false;
+    try {
+        LoadSnapshot(path);
+    } catch (const SnapshotException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+
+    std::filesystem::remove(path);
+}
+void TestApplyEdits() {
+    auto sheet = CreateSheet();
+    sheet->SetCell("A1"_pos, "1");
+    sheet->SetCell("B1"_pos, "=A1*2");
+    sheet->SetCell("D4"_pos, "text");
+    ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), CellInterface::Value(2.0));
+
+    dynamic_cast<Sheet&>(*sheet).ApplyEdits({
+        {"A1"_pos, "5"},
+        {"C1"_pos, "=B1+1"},
+        {"D4"_pos, std::nullopt},
+    });
+
+    ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), CellInterface::Value(10.0));
+    ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), CellInterface::Value(11.0));
+    ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{1, 3}));
+
+    // Ошибочная правка прерывает пакет, но уже применённые правки остаются
+    bool caught = false;
+    try {
+        dynamic_cast<Sheet&>(*sheet).ApplyEdits({
+            {"A2"_pos, "7"},
+            {"A1"_pos, "=C1"},
+        });
+    } catch (const CircularDependencyException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+    ASSERT_EQUAL(sheet->GetCell("A2"_pos)->GetText(), "7");
+    ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetText(), "5");
+    ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{2, 3}));
+}
+
+void TestJournalRecovery() {
+    const std::string dir =
+        (std::filesystem::temp_directory_path() / "spreadsheet_test_journal").string();
+    std::filesystem::remove_all(dir);
+
+    JournalOptions options;
+    options.group_commit_interval = std::chrono::milliseconds(0);
+    options.compaction_threshold = 0;
+
+    std::uint64_t last_sequence = 0;
+    {
+        EditJournal journal(dir, options);
+        auto sheet = CreateSheet();
+        dynamic_cast<Sheet&>(*sheet).SetJournal(&journal);
+
+        sheet->SetCell("A1"_pos, "1");
+        sheet->SetCell("B1"_pos, "=A1+1");
+        sheet->SetCell("C1"_pos, "text");
+        sheet->ClearCell("C1"_pos);
+        journal.Compact(*sheet);
+        journal.WaitForCompaction();
+
+        sheet->SetCell("A1"_pos, "5");
+        sheet->SetCell("D1"_pos, "=B1*2");
+        last_sequence = journal.LastSequence();
+        ASSERT_EQUAL(journal.GetStats().compactions, 1u);
+    }
+
+    // Недописанная запись в конце последнего сегмента отбрасывается
+    std::vector<std::filesystem::path> segments;
+    for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+        if (entry.path().extension() == ".log") {
+            segments.push_back(entry.path());
+        }
+    }
+    ASSERT_EQUAL(segments.size(), 1u);
+    {
+        std::ofstream out(segments.back(), std::ios::binary | std::ios::app);
+        out << std::string("\x40\x00\x00\x00\x01\x02", 6) << "torn";
+    }
+
+    auto recovered = RecoverSheet(dir);
+    ASSERT_EQUAL(recovered->GetCell("A1"_pos)->GetText(), "5");
+    ASSERT_EQUAL(recovered->GetCell("B1"_pos)->GetValue(), CellInterface::Value(6.0));
+    ASSERT_EQUAL(recovered->GetCell("D1"_pos)->GetValue(), CellInterface::Value(12.0));
+    ASSERT_EQUAL(recovered->GetPrintableSize(), (Size{1, 4}));
+
+    // Новый журнал продолжает нумерацию после уцелевших записей
+    {
+        EditJournal journal(dir, options);
+        ASSERT_EQUAL(journal.LastSequence(), last_sequence);
+        dynamic_cast<Sheet&>(*recovered).SetJournal(&journal);
+        recovered->SetCell("E1"_pos, "=A1+D1");
+        // Пустая G1 создаётся внутри правки F1 и своей записи не получает
+        recovered->SetCell("F1"_pos, "=G1");
+        journal.Sync();
+        ASSERT_EQUAL(journal.LastSequence(), last_sequence + 2);
+    }
+    auto recovered_again = RecoverSheet(dir);
+    ASSERT_EQUAL(recovered_again->GetCell("E1"_pos)->GetValue(), CellInterface::Value(17.0));
+    ASSERT(recovered_again->GetCell("G1"_pos) != nullptr);
+    ASSERT_EQUAL(recovered_again->GetCell("G1"_pos)->GetText(), "");
+
+    std::filesystem::remove_all(dir);
+}
+#ifndef _WIN32
+void TestJournalWriteFailure() {
+    struct Recorder : SheetObserver {
+        std::vector<Position> changed;
+        void OnValuesChanged(Span<const Position> positions) override {
+            changed.insert(changed.end(), positions.begin(), positions.end());
+        }
+    };
+
+    const std::string dir =
+        (std::filesystem::temp_directory_path() / "spreadsheet_test_journal_failure").string();
+    std::filesystem::remove_all(dir);
+
+    JournalOptions options;
+    options.group_commit_ops = 1;
+    options.group_commit_interval = std::chrono::milliseconds(0);
+    options.compaction_threshold = 0;
+    EditJournal journal(dir, options);
+    auto sheet_ptr = CreateSheet();
+    Sheet& sheet = dynamic_cast<Sheet&>(*sheet_ptr);
+    sheet.SetJournal(&journal);
+    Recorder recorder;
+    sheet.Subscribe(recorder);
+    sheet.SetCell("A1"_pos, "1");
+    recorder.changed.clear();
+
+    // Запись за пределом размера файла завершается ошибкой EFBIG. Предел
+    // снимается и при провале проверки, иначе отчёт о нём не запишется
+    struct FileSizeLimit {
+        rlimit old_limit{};
+        void (*old_handler)(int) = nullptr;
+        FileSizeLimit() {
+            getrlimit(RLIMIT_FSIZE, &old_limit);
+            old_handler = std::signal(SIGXFSZ, SIG_IGN);
+            rlimit limit = old_limit;
+            limit.rlim_cur = 1;
+            setrlimit(RLIMIT_FSIZE, &limit);
+        }
+        ~FileSizeLimit() {
+            setrlimit(RLIMIT_FSIZE, &old_limit);
+            std::signal(SIGXFSZ, old_handler);
+        }
+    };
+    std::optional<FileSizeLimit> file_size_limit(std::in_place);
+
+    // Правка, на которой журнал отказал, применена, и подписчик о ней знает
+    bool caught = false;
+    try {
+        sheet.SetCell("B1"_pos, "=A1+1");
+    } catch (const JournalException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetValue(), CellInterface::Value(2.0));
+    ASSERT(std::find(recorder.changed.begin(), recorder.changed.end(), "B1"_pos) != recorder.changed.end());
+    recorder.changed.clear();
+
+    // Следующие правки отвергаются до применения
+    caught = false;
+    try {
+        sheet.SetCell("C1"_pos, "3");
+    } catch (const JournalException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+    caught = false;
+    try {
+        sheet.ApplyEdits({CellEdit{"A1"_pos, std::string("5")}});
+    } catch (const JournalException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+    caught = false;
+    try {
+        sheet.ClearCell("A1"_pos);
+    } catch (const JournalException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+    ASSERT(sheet.GetCell("C1"_pos) == nullptr);
+    ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetText(), "1");
+    ASSERT(recorder.changed.empty());
+
+    file_size_limit.reset();
+    sheet.SetJournal(nullptr);
+    sheet.Unsubscribe(recorder);
+    std::filesystem::remove_all(dir);
+}
+#endif
+void TestTilePaging() {
+    const std::string path =
+        (std::filesystem::temp_directory_path() / "spreadsheet_test_tiles.bin").string();
+
+    auto sheet = CreateSheet();
+    auto reference = CreateSheet();
+    auto& paged = dynamic_cast<Sheet&>(*sheet);
+    // Бюджет меньше одного тайла: в памяти остаётся только последний тайл
+    paged.EnablePaging(path, PagingOptions{1});
+
+    // Ячейки в разных тайлах, каждая формула ссылается на предыдущий тайл
+    Position prev = Position::NONE;
+    for (int i = 0; i < 5; ++i) {
+        const Position pos{i * 70, i * 70 + 1};
+        const std::string text = i == 0 ? "1" : "=" + prev.ToString() + "+1";
+        sheet->SetCell(pos, text);
+        reference->SetCell(pos, text);
+        prev = pos;
+    }
+    sheet->SetCell("D100"_pos, "'=text");
+    reference->SetCell("D100"_pos, "'=text");
+
+    // Вычисление подкачивает тайлы всей цепочки, а следующее обращение к листу
+    // выгружает лишние
+    ASSERT_EQUAL(sheet->GetCell(prev)->GetValue(), CellInterface::Value(5.0));
+    sheet->GetCell(prev);
+    auto stats = paged.GetPagingStats();
+    ASSERT(stats.page_outs > 0);
+    ASSERT(stats.page_ins > 0);
+    ASSERT_EQUAL(stats.resident_tiles, 1u);
+
+    // Правка выгруженной ячейки видна зависимым
+    sheet->SetCell("B1"_pos, "10");
+    reference->SetCell("B1"_pos, "10");
+    ASSERT_EQUAL(sheet->GetCell(prev)->GetValue(), CellInterface::Value(14.0));
+
+    sheet->ClearCell(prev);
+    reference->ClearCell(prev);
+    ASSERT_EQUAL(sheet->GetPrintableSize(), reference->GetPrintableSize());
+
+    std::ostringstream texts, reference_texts, values, reference_values;
+    sheet->PrintTexts(texts);
+    reference->PrintTexts(reference_texts);
+    sheet->PrintValues(values);
+    reference->PrintValues(reference_values);
+    ASSERT_EQUAL(texts.str(), reference_texts.str());
+    ASSERT_EQUAL(values.str(), reference_values.str());
+
+    // Снимок листа с выгруженными тайлами
+    const std::string snapshot_path =
+        (std::filesystem::temp_directory_path() / "spreadsheet_test_tiles_snapshot.bin").string();
+    SaveSnapshot(*sheet, snapshot_path);
+    std::ostringstream loaded_texts;
+    LoadSnapshot(snapshot_path)->PrintTexts(loaded_texts);
+    ASSERT_EQUAL(loaded_texts.str(), reference_texts.str());
+    std::filesystem::remove(snapshot_path);
+
+    sheet.reset();
+    ASSERT(!std::filesystem::exists(path));
+}
+void TestColumnarExport() {
+    const std::string path =
+        (std::filesystem::temp_directory_path() / "spreadsheet_test_columns.bin").string();
+
+    auto sheet = CreateSheet();
+    sheet->SetCell("B2"_pos, "=1.5");
+    sheet->SetCell("B3"_pos, "text");
+    sheet->SetCell("B4"_pos, "=1/0");
+    sheet->SetCell("C2"_pos, "=B2*2");
+    sheet->SetCell("C3"_pos, "'=escaped");
+    sheet->SetCell("C5"_pos, "=Z100");    // создаёт пустую ячейку Z100
+
+    // Диапазон B2:D6, столбец D и строка 6 пустые
+    ExportColumns(*sheet, "B2"_pos, Size{5, 3}, path);
+    ColumnarFile file(path);
+    ASSERT_EQUAL(file.TopLeft(), "B2"_pos);
+    ASSERT_EQUAL(file.RowCount(), 5);
+    ASSERT_EQUAL(file.ColumnCount(), 3);
+
+    for (int col = 0; col < file.ColumnCount(); ++col) {
+        ASSERT_EQUAL(reinterpret_cast<std::uintptr_t>(file.Numbers(col)) % columnar::ALIGNMENT, 0u);
+        ASSERT_EQUAL(reinterpret_cast<std::uintptr_t>(file.TextOffsets(col)) % columnar::ALIGNMENT, 0u);
+    }
+
+    ASSERT(ColumnarFile::IsValid(file.NumberValidity(0), 0));
+    ASSERT_EQUAL(file.Numbers(0)[0], 1.5);
+    ASSERT(ColumnarFile::IsValid(file.TextValidity(0), 1));
+    ASSERT(!ColumnarFile::IsValid(file.NumberValidity(0), 1));
+    ASSERT_EQUAL(file.Text(0, 1), "text");
+    ASSERT(ColumnarFile::IsValid(file.ErrorValidity(0), 2));
+    ASSERT_EQUAL(file.Errors(0)[2], static_cast<std::int8_t>(FormulaError::Category::Div0));
+
+    ASSERT_EQUAL(file.Numbers(1)[0], 3.0);
+    ASSERT_EQUAL(file.Text(1, 1), "=escaped");
+    ASSERT_EQUAL(file.Numbers(1)[3], 0.0);
+    ASSERT(ColumnarFile::IsValid(file.NumberValidity(1), 3));
+
+    // Отсутствующие ячейки - null во всех картах
+    for (int row = 0; row < file.RowCount(); ++row) {
+        ASSERT(!ColumnarFile::IsValid(file.NumberValidity(2), row));
+        ASSERT(!ColumnarFile::IsValid(file.ErrorValidity(2), row));
+        ASSERT(!ColumnarFile::IsValid(file.TextValidity(2), row));
+    }
+    ASSERT(!ColumnarFile::IsValid(file.NumberValidity(0), 4));
+
+    std::filesystem::remove(path);
+}
+void TestGetValues() {
+    auto sheet_ptr = CreateSheet();
+    auto& sheet = dynamic_cast<Sheet&>(*sheet_ptr);
+    sheet.SetCell("A1"_pos, "=1.5");
+    sheet.SetCell("B1"_pos, "text");
+    sheet.SetCell("A2"_pos, "'=escaped");
+    sheet.SetCell("B2"_pos, "=1/0");
+    sheet.SetCell("C2"_pos, "=A1*2");
+    sheet.SetCell("C3"_pos, "=ZZ1000");    // создаёт пустую ячейку ZZ1000
+    sheet.SetCell(Position{63, 64}, "=C2+1");    // на стыке тайлов
+
+    constexpr int rows = 3;
+    constexpr int cols = 4;
+    std::vector<double> numbers(rows * cols, -1.0);
+    std::vector<ValueCode> codes(rows * cols);
+    std::vector<std::string_view> texts(rows * cols);
+    sheet.GetValues("A1"_pos, Size{rows, cols}, ValueBuffers{numbers.data(), codes.data(), texts.data()});
+
+    ASSERT(codes[0] == ValueCode::Number);
+    ASSERT_EQUAL(numbers[0], 1.5);
+    ASSERT(codes[1] == ValueCode::Text);
+    ASSERT_EQUAL(texts[1], "text");
+    ASSERT_EQUAL(numbers[1], 0.0);
+    ASSERT(codes[4] == ValueCode::Text);
+    ASSERT_EQUAL(texts[4], "=escaped");
+    ASSERT(codes[5] == ValueCode::ErrorDiv0);
+    ASSERT(codes[6] == ValueCode::Number);
+    ASSERT_EQUAL(numbers[6], 3.0);
+    ASSERT(codes[10] == ValueCode::Number);
+    ASSERT_EQUAL(numbers[10], 0.0);
+    for (int index : {2, 3, 7, 8, 9, 11}) {
+        ASSERT(codes[index] == ValueCode::Empty);
+        ASSERT_EQUAL(numbers[index], 0.0);
+        ASSERT(texts[index].empty());
+    }
+
+    // Диапазон через четыре тайла, часть которых не создана; только коды
+    std::vector<ValueCode> block(4 * 4);
+    sheet.GetValues(Position{62, 62}, Size{4, 4}, ValueBuffers{nullptr, block.data(), nullptr});
+    for (std::size_t index = 0; index < block.size(); ++index) {
+        ASSERT(block[index] == (index == 6 ? ValueCode::Number : ValueCode::Empty));
+    }
+    double number = 0;
+    sheet.GetValues(Position{63, 64}, Size{1, 1}, ValueBuffers{&number, nullptr, nullptr});
+    ASSERT_EQUAL(number, 4.0);
+
+    // Пустой диапазон допустим, выход за лист - нет
+    sheet.GetValues("A1"_pos, Size{0, 0}, ValueBuffers{});
+    try {
+        sheet.GetValues(Position{Position::MAX_ROWS - 1, 0}, Size{2, 1}, ValueBuffers{});
+        ASSERT(false);
+    } catch (const InvalidPositionException&) {
+    }
+
+    // Чтение одной ячейки: значение с учётом текста, некорректная позиция
+    ASSERT(sheet.GetValueView("B1"_pos).code == ValueCode::Text);
+    ASSERT_EQUAL(sheet.GetValueView("B1"_pos).text, "text");
+    ASSERT(sheet.GetValueView("D9"_pos).code == ValueCode::Empty);
+    try {
+        sheet.GetValueView(Position{-1, 0});
+        ASSERT(false);
+    } catch (const InvalidPositionException&) {
+    }
+}
 }  // namespace
 
 int main() {
@@ -362,6 +2220,7 @@ int main() {
     RUN_TEST(tr, TestFormulaReferences);
     RUN_TEST(tr, TestFormulaExpressionFormatting);
     RUN_TEST(tr, TestFormulaReferencedCells);
+    RUN_TEST(tr, TestZeroCopyAccessors);
     RUN_TEST(tr, TestErrorValue);
     RUN_TEST(tr, TestErrorDiv0);
     RUN_TEST(tr, TestEmptyCellTreatedAsZero);
@@ -370,4 +2229,34 @@ int main() {
     RUN_TEST(tr, TestCellReferences);
     RUN_TEST(tr, TestFormulaIncorrect);
     RUN_TEST(tr, TestCellCircularReferences);
+    RUN_TEST(tr, TestFormulaProgramRoundTrip);
+    RUN_TEST(tr, TestRangeAggregates);
+    RUN_TEST(tr, TestRangeDependencyIndex);
+    RUN_TEST(tr, TestAggregateIndex);
+    RUN_TEST(tr, TestLookupFunctions);
+    RUN_TEST(tr, TestConditionalAggregates);
+    RUN_TEST(tr, TestLogicalFunctions);
+    RUN_TEST(tr, TestSpillArrays);
+    RUN_TEST(tr, TestViewportEvaluation);
+    RUN_TEST(tr, TestChangeSubscription);
+    RUN_TEST(tr, TestVersionedSheet);
+    RUN_TEST(tr, TestConcurrentEvaluation);
+    RUN_TEST(tr, TestAsyncRecalc);
+    RUN_TEST(tr, TestRecalcLimit);
+    RUN_TEST(tr, TestAsyncPriority);
+    RUN_TEST(tr, TestDeepChain);
+    RUN_TEST(tr, TestSnapshotRoundTrip);
+    RUN_TEST(tr, TestSnapshotCorrupted);
+    RUN_TEST(tr, TestApplyEdits);
+    RUN_TEST(tr, TestJournalRecovery);
+#ifndef _WIN32
+    RUN_TEST(tr, TestJournalWriteFailure);
+#endif
+    RUN_TEST(tr, TestTilePaging);
+    RUN_TEST(tr, TestColumnarExport);
+    RUN_TEST(tr, TestGetValues);
+    RUN_TEST(tr, TestWorkbook);
+    RUN_TEST(tr, TestCommandProcessor);
+    RUN_TEST(tr, TestReplication);
+    RUN_TEST(tr, TestSheetImage);
 }
@@ -0,0 +1,384 @@
+#include "range_index.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iterator>
+#include <cstdint>
+#include <limits>
+
+namespace
+{
+
+// Ветвление дерева
+constexpr std::size_t MAX_ENTRIES = 16;
+constexpr std::size_t MIN_ENTRIES = 6;
+
+std::int64_t Area(const Range& range)
+{
+    return static_cast<std::int64_t>(range.to.row - range.from.row + 1)
+        * (range.to.col - range.from.col + 1);
+}
+
+Range Union(const Range& lhs, const Range& rhs)
+{
+    return { { std::min(lhs.from.row, rhs.from.row), std::min(lhs.from.col, rhs.from.col) },
+             { std::max(lhs.to.row, rhs.to.row), std::max(lhs.to.col, rhs.to.col) } };
+}
+
+bool Covers(const Range& outer, const Range& inner)
+{
+    return outer.Contains(inner.from) && outer.Contains(inner.to);
+}
+
+// Увеличение площади box при добавлении range
+std::int64_t Enlargement(const Range& box, const Range& range)
+{
+    return Area(Union(box, range)) - Area(box);
+}
+
+}  // namespace
+
+RangeIndex::RangeIndex()
+    : root_(std::make_unique<Node>())
+{}
+
+RangeIndex::~RangeIndex() = default;
+RangeIndex::RangeIndex(RangeIndex&&) noexcept = default;
+RangeIndex& RangeIndex::operator=(RangeIndex&&) noexcept = default;
+
+void RangeIndex::Insert(const Range& range, Position dependent)
+{
+    Node* leaf = nullptr;
+    if (Entry* entry = entry_count_ != 0 ? FindEntry(root_.get(), range, leaf) : nullptr)
+    {
+        size_ += entry->dependents.insert(dependent).second ? 1 : 0;
+        return;
+    }
+    InsertEntry(Entry{ range, { dependent } });
+    ++size_;
+}
+
+bool RangeIndex::Erase(const Range& range, Position dependent)
+{
+    if (entry_count_ == 0)
+    {
+        return false;
+    }
+    Node* leaf = nullptr;
+    Entry* entry = FindEntry(root_.get(), range, leaf);
+    if (!entry || entry->dependents.erase(dependent) == 0)
+    {
+        return false;
+    }
+    --size_;
+    if (!entry->dependents.empty())
+    {
+        return true;
+    }
+
+    // Прямоугольник больше никому не нужен
+    leaf->entries.erase(leaf->entries.begin() + (entry - leaf->entries.data()));
+    --entry_count_;
+    CondenseTree(leaf);
+    return true;
+}
+
+std::size_t RangeIndex::Size() const
+{
+    return size_;
+}
+
+bool RangeIndex::Empty() const
+{
+    return size_ == 0;
+}
+
+RangeIndex::Node* RangeIndex::ChooseLeaf(const Range& range) const
+{
+    Node* node = root_.get();
+    while (!node->leaf)
+    {
+        // Поддерево, прямоугольник которого увеличится меньше всего, при
+        // равенстве - меньшее по площади
+        Node* best = nullptr;
+        std::int64_t best_enlargement = std::numeric_limits<std::int64_t>::max();
+        std::int64_t best_area = std::numeric_limits<std::int64_t>::max();
+        for (const auto& child : node->children)
+        {
+            const std::int64_t enlargement = Enlargement(child->box, range);
+            const std::int64_t area = Area(child->box);
+            if (enlargement < best_enlargement || (enlargement == best_enlargement && area < best_area))
+            {
+                best = child.get();
+                best_enlargement = enlargement;
+                best_area = area;
+            }
+        }
+        node = best;
+    }
+    return node;
+}
+
+std::unique_ptr<RangeIndex::Node> RangeIndex::Split(Node& node)
+{
+    auto sibling = std::make_unique<Node>();
+    sibling->leaf = node.leaf;
+    sibling->parent = node.parent;
+
+    // Квадратичное деление одинаково для записей листа и детей внутреннего
+    // узла, различается только доступ к прямоугольнику элемента
+    auto split = [&node, &sibling](auto& items, auto box_of, auto on_move)
+    {
+        using Items = std::remove_reference_t<decltype(items)>;
+        Items pending = std::move(items);
+        items.clear();
+
+        // Затравки - пара, которая вместе заняла бы больше всего лишнего места
+        std::size_t seed_a = 0;
+        std::size_t seed_b = 1;
+        std::int64_t worst_waste = std::numeric_limits<std::int64_t>::min();
+        for (std::size_t i = 0; i < pending.size(); ++i)
+        {
+            for (std::size_t j = i + 1; j < pending.size(); ++j)
+            {
+                const Range& a = box_of(pending[i]);
+                const Range& b = box_of(pending[j]);
+                const std::int64_t waste = Area(Union(a, b)) - Area(a) - Area(b);
+                if (waste > worst_waste)
+                {
+                    worst_waste = waste;
+                    seed_a = i;
+                    seed_b = j;
+                }
+            }
+        }
+
+        Items& group_a = items;
+        Items group_b;
+        Range box_a = box_of(pending[seed_a]);
+        Range box_b = box_of(pending[seed_b]);
+        group_a.push_back(std::move(pending[seed_a]));
+        group_b.push_back(std::move(pending[seed_b]));
+        pending.erase(pending.begin() + seed_b);
+        pending.erase(pending.begin() + seed_a);
+
+        while (!pending.empty())
+        {
+            // Если одной группе нужны все оставшиеся элементы, чтобы набрать
+            // минимум, отдаём их ей
+            if (group_a.size() + pending.size() == MIN_ENTRIES
+                || group_b.size() + pending.size() == MIN_ENTRIES)
+            {
+                const bool to_a = group_a.size() + pending.size() == MIN_ENTRIES;
+                for (auto& item : pending)
+                {
+                    (to_a ? box_a : box_b) = Union(to_a ? box_a : box_b, box_of(item));
+                    (to_a ? group_a : group_b).push_back(std::move(item));
+                }
+                break;
+            }
+
+            // Следующим распределяется элемент с наибольшей разницей в
+            // увеличении групп
+            std::size_t next = 0;
+            std::int64_t best_difference = -1;
+            for (std::size_t i = 0; i < pending.size(); ++i)
+            {
+                const std::int64_t difference = std::abs(Enlargement(box_a, box_of(pending[i]))
+                                                         - Enlargement(box_b, box_of(pending[i])));
+                if (difference > best_difference)
+                {
+                    best_difference = difference;
+                    next = i;
+                }
+            }
+
+            const Range& next_box = box_of(pending[next]);
+            const std::int64_t enlargement_a = Enlargement(box_a, next_box);
+            const std::int64_t enlargement_b = Enlargement(box_b, next_box);
+            bool to_a = enlargement_a < enlargement_b;
+            if (enlargement_a == enlargement_b)
+            {
+                to_a = Area(box_a) < Area(box_b)
+                    || (Area(box_a) == Area(box_b) && group_a.size() <= group_b.size());
+            }
+            (to_a ? box_a : box_b) = Union(to_a ? box_a : box_b, next_box);
+            (to_a ? group_a : group_b).push_back(std::move(pending[next]));
+            pending.erase(pending.begin() + next);
+        }
+
+        for (auto& item : group_b)
+        {
+            on_move(item);
+        }
+        node.box = box_a;
+        sibling->box = box_b;
+        return group_b;
+    };
+
+    if (node.leaf)
+    {
+        sibling->entries = split(node.entries, [](const Entry& entry) -> const Range& { return entry.range; },
+                                 [](Entry&) {});
+    }
+    else
+    {
+        Node* sibling_ptr = sibling.get();
+        sibling->children = split(node.children,
+                                  [](const std::unique_ptr<Node>& child) -> const Range& { return child->box; },
+                                  [sibling_ptr](std::unique_ptr<Node>& child) { child->parent = sibling_ptr; });
+    }
+    return sibling;
+}
+
+void RangeIndex::AdjustTree(Node* node)
+{
+    while (node)
+    {
+        const std::size_t count = node->leaf ? node->entries.size() : node->children.size();
+        if (count <= MAX_ENTRIES)
+        {
+            UpdateBox(*node);
+            node = node->parent;
+            continue;
+        }
+
+        std::unique_ptr<Node> sibling = Split(*node);
+        if (!node->parent)
+        {
+            // Делится корень: дерево растёт на уровень
+            auto root = std::make_unique<Node>();
+            root->leaf = false;
+            node->parent = root.get();
+            sibling->parent = root.get();
+            root->children.push_back(std::move(root_));
+            root->children.push_back(std::move(sibling));
+            root_ = std::move(root);
+            UpdateBox(*root_);
+            return;
+        }
+        node->parent->children.push_back(std::move(sibling));
+        node = node->parent;
+    }
+}
+
+RangeIndex::Entry* RangeIndex::FindEntry(Node* node, const Range& range, Node*& leaf) const
+{
+    if (!Covers(node->box, range))
+    {
+        return nullptr;
+    }
+    if (node->leaf)
+    {
+        for (Entry& entry : node->entries)
+        {
+            if (entry.range == range)
+            {
+                leaf = node;
+                return &entry;
+            }
+        }
+        return nullptr;
+    }
+    for (const auto& child : node->children)
+    {
+        if (Entry* entry = FindEntry(child.get(), range, leaf))
+        {
+            return entry;
+        }
+    }
+    return nullptr;
+}
+
+void RangeIndex::InsertEntry(Entry entry)
+{
+    Node* leaf = ChooseLeaf(entry.range);
+    leaf->entries.push_back(std::move(entry));
+    ++entry_count_;
+    AdjustTree(leaf);
+}
+
+void RangeIndex::CondenseTree(Node* leaf)
+{
+    std::vector<Entry> orphans;
+    Node* node = leaf;
+    while (node->parent)
+    {
+        Node* parent = node->parent;
+        const std::size_t count = node->leaf ? node->entries.size() : node->children.size();
+        if (count < MIN_ENTRIES)
+        {
+            // Недозаполненный узел убираем целиком, его записи вставим заново
+            CollectEntries(*node, orphans);
+            auto it = std::find_if(parent->children.begin(), parent->children.end(),
+                                   [node](const std::unique_ptr<Node>& child) { return child.get() == node; });
+            parent->children.erase(it);
+        }
+        else
+        {
+            UpdateBox(*node);
+        }
+        node = parent;
+    }
+
+    // Корень с единственным ребёнком заменяется им
+    while (!root_->leaf && root_->children.size() == 1)
+    {
+        std::unique_ptr<Node> child = std::move(root_->children.front());
+        child->parent = nullptr;
+        root_ = std::move(child);
+    }
+    if (!root_->leaf && root_->children.empty())
+    {
+        root_ = std::make_unique<Node>();
+    }
+    UpdateBox(*root_);
+
+    entry_count_ -= orphans.size();
+    for (Entry& entry : orphans)
+    {
+        InsertEntry(std::move(entry));
+    }
+}
+
+void RangeIndex::CollectEntries(Node& node, std::vector<Entry>& entries)
+{
+    if (node.leaf)
+    {
+        std::move(node.entries.begin(), node.entries.end(), std::back_inserter(entries));
+        return;
+    }
+    for (const auto& child : node.children)
+    {
+        CollectEntries(*child, entries);
+    }
+}
+
+void RangeIndex::UpdateBox(Node& node)
+{
+    bool first = true;
+    auto add = [&](const Range& range)
+    {
+        node.box = first ? range : Union(node.box, range);
+        first = false;
+    };
+    if (node.leaf)
+    {
+        for (const Entry& entry : node.entries)
+        {
+            add(entry.range);
+        }
+    }
+    else
+    {
+        for (const auto& child : node.children)
+        {
+            add(child->box);
+        }
+    }
+    if (first)
+    {
+        // Пустой узел не содержит ни одной позиции
+        node.box = Range{ Position::NONE, Position::NONE };
+    }
+}
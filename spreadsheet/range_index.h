@@ -0,0 +1,161 @@
+#pragma once
+
+#include "common.h"
+
+#include <cstddef>
+#include <memory>
+#include <set>
+#include <vector>
+
+// Пространственный индекс зависимостей от диапазонов (R-дерево).
+// Хранит пары "диапазон - ячейка с формулой, которая на него ссылается",
+// каждую одной записью независимо от размера диапазона, и отвечает на вопрос
+// "какие формулы зависят от ячейки pos" за O(log n + k) в типичном случае.
+// Одинаковые диапазоны разных формул занимают в дереве один прямоугольник со
+// множеством зависимых ячеек: иначе тысячи формул с общим диапазоном
+// (например, поиск по одному столбцу) вырождали бы дерево.
+// Узлы дерева хранят ограничивающие прямоугольники своих поддеревьев; вставка
+// выбирает поддерево с наименьшим увеличением прямоугольника, переполненный
+// узел делится квадратичным алгоритмом Гуттмана.
+class RangeIndex
+{
+public:
+    RangeIndex();
+    ~RangeIndex();
+
+    RangeIndex(RangeIndex&&) noexcept;
+    RangeIndex& operator=(RangeIndex&&) noexcept;
+
+    // Добавляет зависимость dependent от диапазона range. Пара хранится один
+    // раз, повторная вставка ничего не меняет
+    void Insert(const Range& range, Position dependent);
+    // Удаляет пару. Возвращает false, если её не было
+    bool Erase(const Range& range, Position dependent);
+
+    // Вызывает callback(dependent) для каждой записи, диапазон которой
+    // содержит pos
+    template <typename Callback>
+    void ForEachDependent(Position pos, Callback&& callback) const;
+    // Вызывает callback(range, dependent) для каждой записи, диапазон которой
+    // пересекается с range
+    template <typename Callback>
+    void ForEachIntersecting(const Range& range, Callback&& callback) const;
+
+    // Число пар
+    std::size_t Size() const;
+    bool Empty() const;
+
+private:
+    struct Entry
+    {
+        Range range;
+        std::set<Position> dependents;
+    };
+
+    struct Node
+    {
+        Range box;                                    // объемлющий прямоугольник
+        Node* parent = nullptr;
+        bool leaf = true;
+        std::vector<Entry> entries;                   // записи листа
+        std::vector<std::unique_ptr<Node>> children;  // дети внутреннего узла
+    };
+
+    // Лист, в который следует вставить прямоугольник range
+    Node* ChooseLeaf(const Range& range) const;
+    // Делит переполненный узел, возвращает новый узел-соседа
+    static std::unique_ptr<Node> Split(Node& node);
+    // Поднимается от node к корню, пересчитывая прямоугольники и деля
+    // переполненные узлы
+    void AdjustTree(Node* node);
+    // Запись прямоугольника range или nullptr. leaf - её лист
+    Entry* FindEntry(Node* node, const Range& range, Node*& leaf) const;
+    // Вставляет запись нового прямоугольника
+    void InsertEntry(Entry entry);
+    // Убирает недозаполненные узлы на пути от leaf к корню, записи их
+    // поддеревьев вставляет заново
+    void CondenseTree(Node* leaf);
+    static void CollectEntries(Node& node, std::vector<Entry>& entries);
+    static void UpdateBox(Node& node);
+
+    std::unique_ptr<Node> root_;
+    std::size_t size_ = 0;           // число пар
+    std::size_t entry_count_ = 0;    // число прямоугольников
+};
+
+template <typename Callback>
+void RangeIndex::ForEachDependent(Position pos, Callback&& callback) const
+{
+    if (size_ == 0)
+    {
+        return;
+    }
+
+    // Обход без рекурсии: стек не глубже высоты дерева, умноженной на ветвление
+    std::vector<const Node*> stack{ root_.get() };
+    while (!stack.empty())
+    {
+        const Node* node = stack.back();
+        stack.pop_back();
+        if (!node->box.Contains(pos))
+        {
+            continue;
+        }
+        if (node->leaf)
+        {
+            for (const Entry& entry : node->entries)
+            {
+                if (entry.range.Contains(pos))
+                {
+                    for (const Position& dependent : entry.dependents)
+                    {
+                        callback(dependent);
+                    }
+                }
+            }
+            continue;
+        }
+        for (const auto& child : node->children)
+        {
+            stack.push_back(child.get());
+        }
+    }
+}
+
+template <typename Callback>
+void RangeIndex::ForEachIntersecting(const Range& range, Callback&& callback) const
+{
+    if (size_ == 0)
+    {
+        return;
+    }
+
+    std::vector<const Node*> stack{ root_.get() };
+    while (!stack.empty())
+    {
+        const Node* node = stack.back();
+        stack.pop_back();
+        if (!node->box.Intersects(range))
+        {
+            continue;
+        }
+        if (node->leaf)
+        {
+            for (const Entry& entry : node->entries)
+            {
+                if (entry.range.Intersects(range))
+                {
+                    for (const Position& dependent : entry.dependents)
+                    {
+                        callback(entry.range, dependent);
+                    }
+                }
+            }
+            continue;
+        }
+        for (const auto& child : node->children)
+        {
+            stack.push_back(child.get());
+        }
+    }
+}
@@ -0,0 +1,286 @@
+#include "replication.h"
+
+#include "snapshot.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+using namespace std::literals;
+
+namespace
+{
+
+constexpr std::uint8_t FRAME_BATCH = 1;
+constexpr std::uint8_t FRAME_CATCH_UP = 2;
+
+constexpr std::size_t FRAME_HEADER_SIZE = sizeof(std::uint8_t) + sizeof(std::uint32_t) + 2 * sizeof(std::uint64_t)
+                                          + sizeof(std::int64_t);
+
+constexpr std::string_view SUBSCRIBE = "subscribe "sv;
+
+// Сколько раз CatchUp() перечитывает журнал, который сжимают во время чтения
+constexpr int CATCH_UP_ATTEMPTS = 5;
+
+struct FrameHeader
+{
+    std::uint8_t type = 0;
+    std::uint32_t size = 0;
+    std::uint64_t first = 0;
+    std::uint64_t last = 0;
+    std::int64_t sync_time = 0;
+};
+
+std::int64_t Now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+std::string EncodeFrame(const FrameHeader& header, std::string_view records)
+{
+    std::string frame(FRAME_HEADER_SIZE + records.size(), '\0');
+    char* p = frame.data();
+    std::memcpy(p, &header.type, sizeof(header.type));
+    p += sizeof(header.type);
+    std::memcpy(p, &header.size, sizeof(header.size));
+    p += sizeof(header.size);
+    std::memcpy(p, &header.first, sizeof(header.first));
+    p += sizeof(header.first);
+    std::memcpy(p, &header.last, sizeof(header.last));
+    p += sizeof(header.last);
+    std::memcpy(p, &header.sync_time, sizeof(header.sync_time));
+    p += sizeof(header.sync_time);
+    if (!records.empty())
+    {
+        std::memcpy(p, records.data(), records.size());
+    }
+    return frame;
+}
+
+FrameHeader DecodeFrameHeader(const char* p)
+{
+    FrameHeader header;
+    std::memcpy(&header.type, p, sizeof(header.type));
+    p += sizeof(header.type);
+    std::memcpy(&header.size, p, sizeof(header.size));
+    p += sizeof(header.size);
+    std::memcpy(&header.first, p, sizeof(header.first));
+    p += sizeof(header.first);
+    std::memcpy(&header.last, p, sizeof(header.last));
+    p += sizeof(header.last);
+    std::memcpy(&header.sync_time, p, sizeof(header.sync_time));
+    return header;
+}
+
+}  // namespace
+
+ReplicationLog::ReplicationLog(EditJournal& journal, ReplicationOptions options)
+    : journal_(journal)
+    , options_(options)
+{
+    const std::uint64_t synced = journal_.SetSyncListener([this](const JournalBatch& batch)
+                                                          {
+                                                              OnSync(batch);
+                                                          });
+    // Первая группа могла прийти раньше: тогда начало уже известно
+    std::lock_guard lock(mutex_);
+    if (!started_)
+    {
+        backlog_start_ = last_sequence_ = synced;
+        started_ = true;
+    }
+}
+
+ReplicationLog::~ReplicationLog()
+{
+    journal_.SetSyncListener({});
+}
+
+std::uint64_t ReplicationLog::Subscribe(std::uint64_t after, Sink sink)
+{
+    std::lock_guard lock(mutex_);
+    if (after < backlog_start_)
+    {
+        FrameHeader header;
+        header.type = FRAME_CATCH_UP;
+        header.last = last_sequence_;
+        header.sync_time = Now();
+        sink(EncodeFrame(header, {}));
+        return 0;
+    }
+
+    // Правки после after, которые уже есть у подписчика, он пропустит сам
+    for (const Frame& frame : backlog_)
+    {
+        if (frame.last > after && !sink(frame.data))
+        {
+            return 0;
+        }
+    }
+    const std::uint64_t id = next_id_++;
+    subscribers_.emplace(id, std::move(sink));
+    return id;
+}
+
+void ReplicationLog::Unsubscribe(std::uint64_t id)
+{
+    std::lock_guard lock(mutex_);
+    subscribers_.erase(id);
+}
+
+std::optional<std::uint64_t> ReplicationLog::ParseSubscription(std::string_view line)
+{
+    if (line.substr(0, SUBSCRIBE.size()) != SUBSCRIBE || line.size() == SUBSCRIBE.size())
+    {
+        return std::nullopt;
+    }
+    std::uint64_t sequence = 0;
+    for (char ch : line.substr(SUBSCRIBE.size()))
+    {
+        if (ch < '0' || ch > '9')
+        {
+            return std::nullopt;
+        }
+        sequence = sequence * 10 + static_cast<std::uint64_t>(ch - '0');
+    }
+    return sequence;
+}
+
+std::size_t ReplicationLog::GetSubscriberCount() const
+{
+    std::lock_guard lock(mutex_);
+    return subscribers_.size();
+}
+
+void ReplicationLog::OnSync(const JournalBatch& batch)
+{
+    FrameHeader header;
+    header.type = FRAME_BATCH;
+    header.size = static_cast<std::uint32_t>(batch.records.size());
+    header.first = batch.first;
+    header.last = batch.last;
+    header.sync_time = Now();
+
+    std::lock_guard lock(mutex_);
+    if (!started_)
+    {
+        backlog_start_ = batch.first - 1;
+        started_ = true;
+    }
+    backlog_.push_back(Frame{ batch.last, EncodeFrame(header, batch.records) });
+    backlog_size_ += backlog_.back().data.size();
+    last_sequence_ = batch.last;
+    // Последний кадр остаётся в памяти при любом ограничении
+    while (backlog_size_ > options_.backlog_bytes && backlog_.size() > 1)
+    {
+        backlog_start_ = backlog_.front().last;
+        backlog_size_ -= backlog_.front().data.size();
+        backlog_.pop_front();
+    }
+
+    const std::string& frame = backlog_.back().data;
+    for (auto it = subscribers_.begin(); it != subscribers_.end();)
+    {
+        it = it->second(frame) ? std::next(it) : subscribers_.erase(it);
+    }
+}
+
+Replica::Replica(std::string journal_directory)
+    : directory_(std::move(journal_directory))
+    , sheet_(CreateSheet())
+{}
+
+void Replica::CatchUp()
+{
+    for (int attempt = 1;; ++attempt)
+    {
+        try
+        {
+            std::uint64_t sequence = 0;
+            sheet_ = RecoverSheet(directory_, &sequence);
+            sequence_ = sequence;
+            break;
+        }
+        catch (const JournalException&)
+        {
+            if (attempt == CATCH_UP_ATTEMPTS)
+            {
+                throw;
+            }
+        }
+        catch (const SnapshotException&)
+        {
+            if (attempt == CATCH_UP_ATTEMPTS)
+            {
+                throw;
+            }
+        }
+    }
+    input_.clear();
+    ++stats_.catch_ups;
+}
+
+std::string Replica::MakeSubscription() const
+{
+    return std::string(SUBSCRIBE) + std::to_string(sequence_) + '\n';
+}
+
+bool Replica::Feed(std::string_view data)
+{
+    input_ += data;
+    std::size_t offset = 0;
+    while (input_.size() - offset >= FRAME_HEADER_SIZE)
+    {
+        const FrameHeader header = DecodeFrameHeader(input_.data() + offset);
+        // Пропуск в нумерации правок лечится так же, как отставание
+        if (header.type == FRAME_CATCH_UP || (header.type == FRAME_BATCH && header.first > sequence_ + 1))
+        {
+            input_.clear();
+            return false;
+        }
+        if (header.type != FRAME_BATCH)
+        {
+            throw JournalException("Invalid replication frame");
+        }
+        if (input_.size() - offset - FRAME_HEADER_SIZE < header.size)
+        {
+            break;
+        }
+
+        const std::string_view records(input_.data() + offset + FRAME_HEADER_SIZE, header.size);
+        edits_.clear();
+        const std::uint64_t last = DecodeJournalRecords(records, sequence_, edits_);
+        GetSheet().ApplyEdits(edits_);
+        sequence_ = std::max(sequence_, last);
+        offset += FRAME_HEADER_SIZE + header.size;
+
+        ++stats_.frames;
+        stats_.edits += edits_.size();
+        stats_.last_lag = std::chrono::nanoseconds(Now() - header.sync_time);
+        stats_.max_lag = std::max(stats_.max_lag, stats_.last_lag);
+    }
+    input_.erase(0, offset);
+    return true;
+}
+
+Sheet& Replica::GetSheet()
+{
+    return dynamic_cast<Sheet&>(*sheet_);
+}
+
+const Sheet& Replica::GetSheet() const
+{
+    return dynamic_cast<const Sheet&>(*sheet_);
+}
+
+std::uint64_t Replica::GetSequence() const
+{
+    return sequence_;
+}
+
+ReplicaStats Replica::GetStats() const
+{
+    return stats_;
+}
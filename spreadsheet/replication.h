@@ -0,0 +1,137 @@
+#pragma once
+
+#include "journal.h"
+#include "sheet.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Репликация листа по журналу правок.
+// Ведущий процесс правит лист с подключённым журналом (см. journal.h), а
+// ReplicationLog рассылает подписчикам каждую группу записей журнала, как
+// только она сброшена на диск. Ведомые процессы (Replica) применяют группы
+// к своей копии листа пакетами Sheet::ApplyEdits() и отвечают на чтения
+// сами. Поток от ведущего к ведомому - последовательность кадров:
+//   u8 тип, u32 размер записей, u64 номер первой записи, u64 номер
+//   последней записи, i64 время сброса группы у ведущего (steady_clock, нс),
+//   записи в формате журнала.
+// Кадр типа "догоняй" (без записей) ведущий посылает подписчику, правок
+// которого уже нет в памяти: ведомый загружает снимок и хвост журнала
+// ведущего (RecoverSheet()) и подписывается снова. Поэтому ведомый должен
+// видеть каталог журнала ведущего, т. е. работать на той же машине.
+// Подписка - строка "subscribe <номер последней применённой правки>".
+// Числа кадра записываются в порядке байт машины, как в журнале.
+
+// Итог работы ведомого
+struct ReplicaStats
+{
+    std::size_t frames = 0;         // применено кадров
+    std::size_t edits = 0;          // применено правок
+    std::size_t catch_ups = 0;      // загрузок снимка и журнала
+    std::chrono::nanoseconds last_lag{ 0 };    // от сброса группы у ведущего до её применения
+    std::chrono::nanoseconds max_lag{ 0 };
+};
+
+struct ReplicationOptions
+{
+    // Сколько байт последних групп держать в памяти для подписчиков,
+    // отставших ненадолго
+    std::size_t backlog_bytes = 64 * 1024 * 1024;
+};
+
+// Рассылка групп записей журнала ведущего подписчикам. Подключается к
+// журналу на время жизни; методы можно вызывать из любых потоков.
+class ReplicationLog
+{
+public:
+    // Принимает кадр для подписчика. Вызывается под блокировкой рассылки в
+    // потоке, сбросившем группу журнала, поэтому не должен ждать: если кадр
+    // не отправить сразу, нужно вернуть false - подписка удаляется, а
+    // подписчик догонит ведущего по журналу, подписавшись снова
+    using Sink = std::function<bool(std::string_view frame)>;
+
+    explicit ReplicationLog(EditJournal& journal, ReplicationOptions options = {});
+    ~ReplicationLog();
+
+    ReplicationLog(const ReplicationLog&) = delete;
+    ReplicationLog& operator=(const ReplicationLog&) = delete;
+
+    // Подписывает sink на правки после правки с номером after: сразу
+    // отправляет кадры из памяти, затем каждую новую группу. Возвращает
+    // номер подписки или 0, если подписка не создана: правок после after в
+    // памяти уже нет (sink получил кадр "догоняй") или sink вернул false
+    std::uint64_t Subscribe(std::uint64_t after, Sink sink);
+    void Unsubscribe(std::uint64_t id);
+
+    // Номер правки из строки подписки или nullopt, если это не подписка
+    static std::optional<std::uint64_t> ParseSubscription(std::string_view line);
+
+    std::size_t GetSubscriberCount() const;
+
+private:
+    struct Frame
+    {
+        std::uint64_t last = 0;
+        std::string data;
+    };
+
+    EditJournal& journal_;
+    ReplicationOptions options_;
+
+    mutable std::mutex mutex_;
+    // Последние кадры; правки после backlog_start_ все в них
+    std::deque<Frame> backlog_;
+    std::size_t backlog_size_ = 0;
+    std::uint64_t backlog_start_ = 0;
+    std::uint64_t last_sequence_ = 0;
+    // Известно ли, с какой правки начинается рассылка
+    bool started_ = false;
+    std::map<std::uint64_t, Sink> subscribers_;
+    std::uint64_t next_id_ = 1;
+
+    void OnSync(const JournalBatch& batch);
+};
+
+// Копия листа ведущего в ведомом процессе
+class Replica
+{
+public:
+    // journal_directory - каталог журнала ведущего
+    explicit Replica(std::string journal_directory);
+
+    // Загружает лист заново из снимка и журнала ведущего. Ссылки на прежний
+    // лист (GetSheet()) после этого недействительны. Если журнал сжимают во
+    // время чтения, чтение повторяется
+    void CatchUp();
+    // Строка подписки на правки после последней применённой
+    std::string MakeSubscription() const;
+    // Принимает очередную порцию потока от ведущего и применяет полученные
+    // целиком кадры. Возвращает false, если ведущий потребовал догонять по
+    // журналу: нужно вызвать CatchUp() и подписаться снова (непрочитанный
+    // остаток потока отбрасывается)
+    bool Feed(std::string_view data);
+
+    Sheet& GetSheet();
+    const Sheet& GetSheet() const;
+    // Номер последней применённой правки
+    std::uint64_t GetSequence() const;
+    ReplicaStats GetStats() const;
+
+private:
+    std::string directory_;
+    std::unique_ptr<SheetInterface> sheet_;
+    std::uint64_t sequence_ = 0;
+    std::string input_;
+    std::vector<CellEdit> edits_;
+    ReplicaStats stats_;
+};
@@ -0,0 +1,265 @@
+// Генератор нагрузки для spreadsheet_server: заполняет лист n строками
+// (A - числа, B - формулы =A<i>*2+SUM(A<i>:A<i+9>)), затем отправляет
+// поровну правок set A<i> и чтений get B<i> со случайными i, держа в
+// конвейере до depth команд без ответа. Для каждой глубины конвейера
+// измеряются команды в секунду и задержка команды от отправки до ответа.
+// Без --socket запускает сервер из каталога генератора на временном сокете.
+//
+// Запуск: server_loadgen [--socket путь] [--rows n] [--ops n]
+
+#include "bench/bench_util.h"
+#include "common.h"
+#include "server/unix_socket.h"
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+// Соединение с сервером: команды с отметкой времени отправки и ответы
+class Connection
+{
+public:
+    explicit Connection(const std::string& path)
+        : fd_(unix_socket::Connect(path))
+    {}
+    ~Connection()
+    {
+        ::close(fd_);
+    }
+
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+
+    // Добавляет команду в буфер отправки
+    void Queue(const std::string& command)
+    {
+        output_ += command;
+        output_ += '\n';
+        sent_.push_back(Clock::now());
+    }
+
+    void Send()
+    {
+        unix_socket::WriteAll(fd_, output_);
+        output_.clear();
+    }
+
+    // Читает ответы и дописывает задержки полученных в latencies. Возвращает
+    // число полученных ответов; ответ ERR завершает генератор
+    std::size_t Receive(std::vector<double>& latencies)
+    {
+        char buffer[64 * 1024];
+        const std::size_t count = unix_socket::ReadSome(fd_, buffer, sizeof(buffer));
+        if (count == 0)
+        {
+            throw std::runtime_error("Server closed the connection");
+        }
+        input_.append(buffer, count);
+
+        std::size_t received = 0;
+        std::size_t start = 0;
+        for (std::size_t end = input_.find('\n'); end != std::string::npos; end = input_.find('\n', start))
+        {
+            if (input_.compare(start, 3, "ERR") == 0)
+            {
+                throw std::runtime_error("Server error: " + input_.substr(start, end - start));
+            }
+            const auto latency = std::chrono::duration<double>(Clock::now() - sent_.front());
+            sent_.pop_front();
+            latencies.push_back(latency.count());
+            ++received;
+            start = end + 1;
+        }
+        input_.erase(0, start);
+        return received;
+    }
+
+    std::size_t InFlight() const
+    {
+        return sent_.size();
+    }
+
+private:
+    int fd_;
+    std::string output_;
+    std::string input_;
+    std::deque<Clock::time_point> sent_;
+};
+
+// Отправляет commands(i) для i < ops, держа в конвейере до depth команд
+template <typename Commands>
+std::vector<double> Run(Connection& connection, std::size_t ops, std::size_t depth, Commands&& commands)
+{
+    std::vector<double> latencies;
+    latencies.reserve(ops);
+    std::size_t sent = 0;
+    while (latencies.size() < ops)
+    {
+        while (sent < ops && connection.InFlight() < depth)
+        {
+            connection.Queue(commands(sent++));
+        }
+        connection.Send();
+        connection.Receive(latencies);
+    }
+    return latencies;
+}
+
+void ReportLatency(const std::string& name, std::vector<double> latencies, double seconds)
+{
+    bench::Report(name, latencies.size(), seconds);
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double p)
+    {
+        return latencies[std::min(latencies.size() - 1, static_cast<std::size_t>(p * latencies.size()))] * 1e6;
+    };
+    std::printf("  latency: p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n", percentile(0.5),
+                percentile(0.99), percentile(0.999), latencies.back() * 1e6);
+}
+
+// Сервер, запущенный генератором
+class LocalServer
+{
+public:
+    LocalServer(const std::string& binary, const std::string& socket_path)
+        : socket_path_(socket_path)
+    {
+        std::vector<std::string> args{ binary, "--socket", socket_path };
+        std::vector<char*> argv;
+        for (std::string& arg : args)
+        {
+            argv.push_back(arg.data());
+        }
+        argv.push_back(nullptr);
+        if (posix_spawn(&pid_, binary.c_str(), nullptr, nullptr, argv.data(), environ) != 0)
+        {
+            throw std::runtime_error("Failed to start " + binary);
+        }
+    }
+    ~LocalServer()
+    {
+        ::kill(pid_, SIGTERM);
+        int status = 0;
+        ::waitpid(pid_, &status, 0);
+    }
+
+    LocalServer(const LocalServer&) = delete;
+    LocalServer& operator=(const LocalServer&) = delete;
+
+    // Ждёт, пока сервер начнёт принимать соединения
+    std::unique_ptr<Connection> Connect() const
+    {
+        for (int attempt = 0;; ++attempt)
+        {
+            try
+            {
+                return std::make_unique<Connection>(socket_path_);
+            }
+            catch (const std::system_error&)
+            {
+                if (attempt == 100)
+                {
+                    throw;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            }
+        }
+    }
+
+private:
+    std::string socket_path_;
+    pid_t pid_ = 0;
+};
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    std::string socket_path;
+    std::size_t rows = 10000;
+    std::size_t ops = 100000;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--socket")
+        {
+            socket_path = argv[i + 1];
+        }
+        else if (arg == "--rows")
+        {
+            rows = std::min<std::size_t>(std::stoul(argv[i + 1]), Position::MAX_ROWS - 10);
+        }
+        else if (arg == "--ops")
+        {
+            ops = std::stoul(argv[i + 1]);
+        }
+    }
+
+    std::string directory;
+    std::unique_ptr<LocalServer> server;
+    std::unique_ptr<Connection> connection;
+    if (socket_path.empty())
+    {
+        const std::string binary = (std::filesystem::path(argv[0]).parent_path() / "spreadsheet_server").string();
+        directory = bench::TempDirectory("server");
+        server = std::make_unique<LocalServer>(binary, directory + "/server.sock");
+        connection = server->Connect();
+    }
+    else
+    {
+        connection = std::make_unique<Connection>(socket_path);
+    }
+    std::printf("%zu rows, %zu commands per run (half set, half get)\n", rows, ops);
+
+    {
+        bench::Timer timer;
+        auto fill = [](std::size_t i)
+        {
+            const std::string n = std::to_string(i / 2 + 1);
+            return i % 2 == 0 ? "set A" + n + ' ' + n : "set B" + n + " =A" + n + "*2+SUM(A" + n + ":A" + std::to_string(i / 2 + 10) + ")";
+        };
+        Run(*connection, 2 * rows, 1024, fill);
+        bench::Report("fill, pipelined", 2 * rows, timer.Seconds());
+    }
+
+    std::mt19937 random(42);
+    std::uniform_int_distribution<std::size_t> row(1, rows);
+    for (std::size_t depth : { 1, 16, 256 })
+    {
+        auto mixed = [&](std::size_t i)
+        {
+            const std::string n = std::to_string(row(random));
+            return i % 2 == 0 ? "set A" + n + ' ' + std::to_string(i) : "get B" + n;
+        };
+        bench::Timer timer;
+        std::vector<double> latencies = Run(*connection, ops, depth, mixed);
+        ReportLatency("set/get, pipeline depth " + std::to_string(depth), std::move(latencies), timer.Seconds());
+    }
+
+    connection.reset();
+    server.reset();
+    if (!directory.empty())
+    {
+        std::filesystem::remove_all(directory);
+    }
+    return 0;
+}
@@ -0,0 +1,487 @@
+// Сервер листа: один лист в памяти, к которому процессы обращаются по
+// построчному протоколу (см. command_protocol.h) вместо того, чтобы держать
+// свою копию. Без --socket обслуживает один сеанс через stdin/stdout, с
+// --socket - клиентов Unix-сокета. Клиенты обслуживаются в одном потоке по
+// мере поступления данных, поэтому правки разных клиентов не пересекаются:
+// каждая полученная порция команд выполняется целиком.
+//
+// С --journal лист восстанавливается из каталога журнала и пишет в него
+// правки (см. journal.h); с --replicate ведущий рассылает сохранённые
+// правки ведомым (см. replication.h). Ведомый (--follow сокет ведущего,
+// --journal каталог журнала ведущего) отвечает клиентам своего --socket на
+// чтения, правки отвергает. Отстав или потеряв ведущего, ведомый догоняет
+// его по снимку и журналу и подписывается снова.
+//
+// Запуск:
+//   spreadsheet_server [--socket путь] [--load снимок]
+//   spreadsheet_server [--socket путь] --journal каталог [--replicate путь]
+//   spreadsheet_server --socket путь --journal каталог --follow путь
+
+#include "command_protocol.h"
+#include "journal.h"
+#include "replication.h"
+#include "snapshot.h"
+#include "server/unix_socket.h"
+
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+
+namespace
+{
+
+constexpr std::size_t READ_CHUNK = 64 * 1024;
+// Тайм-аут poll(): на случай сигнала между проверкой флага и poll() и для
+// повторного подключения ведомого к ведущему
+constexpr int POLL_TIMEOUT_MS = 500;
+
+volatile std::sig_atomic_t stop_requested = 0;
+
+void RequestStop(int /* signal */)
+{
+    stop_requested = 1;
+}
+
+struct Options
+{
+    std::string socket_path;
+    std::string snapshot_path;
+    std::string journal_directory;
+    std::string replicate_path;
+    std::string follow_path;
+};
+
+// Сеанс через stdin/stdout
+void ServeStdio(Sheet& sheet)
+{
+    CommandProcessor processor(sheet);
+    std::vector<char> buffer(READ_CHUNK);
+    std::string output;
+    while (!processor.IsClosed() && !stop_requested)
+    {
+        const std::size_t count = unix_socket::ReadSome(STDIN_FILENO, buffer.data(), buffer.size());
+        output.clear();
+        if (count == 0)
+        {
+            processor.Finish(output);
+            unix_socket::WriteAll(STDOUT_FILENO, output);
+            break;
+        }
+        processor.Feed(std::string_view(buffer.data(), count), output);
+        unix_socket::WriteAll(STDOUT_FILENO, output);
+    }
+}
+
+// Обслуживание сокетов в одном потоке: клиенты, ведомые ведущего и поток
+// правок от ведущего у ведомого
+class Server
+{
+public:
+    Server(Sheet& sheet, bool read_only)
+        : sheet_(&sheet)
+        , read_only_(read_only)
+    {}
+
+    ~Server()
+    {
+        for (auto& [fd, follower] : followers_)
+        {
+            replication_log_->Unsubscribe(follower.id);
+            ::close(fd);
+        }
+        for (const auto& [fd, processor] : clients_)
+        {
+            ::close(fd);
+        }
+        if (primary_fd_ >= 0)
+        {
+            ::close(primary_fd_);
+        }
+        for (const auto& [fd, path] : listeners_)
+        {
+            ::close(fd);
+            ::unlink(path.c_str());
+        }
+    }
+
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+
+    void ListenClients(const std::string& path)
+    {
+        client_listener_ = unix_socket::Listen(path);
+        listeners_.emplace(client_listener_, path);
+    }
+
+    // Ведущий: ведомые подключаются к path и подписываются на правки log
+    void ListenFollowers(const std::string& path, ReplicationLog& log)
+    {
+        replication_log_ = &log;
+        follower_listener_ = unix_socket::Listen(path);
+        listeners_.emplace(follower_listener_, path);
+    }
+
+    // Ведомый: лист - копия replica, правки приходят от ведущего по path
+    void Follow(Replica& replica, const std::string& path)
+    {
+        replica_ = &replica;
+        primary_path_ = path;
+        ConnectPrimary();
+    }
+
+    void Run()
+    {
+        std::vector<pollfd> fds;
+        while (!stop_requested)
+        {
+            fds.clear();
+            for (const auto& [fd, path] : listeners_)
+            {
+                fds.push_back(pollfd{ fd, POLLIN, 0 });
+            }
+            for (const auto& [fd, processor] : clients_)
+            {
+                fds.push_back(pollfd{ fd, POLLIN, 0 });
+            }
+            for (const auto& [fd, follower] : followers_)
+            {
+                fds.push_back(pollfd{ fd, POLLIN, 0 });
+            }
+            if (primary_fd_ >= 0)
+            {
+                fds.push_back(pollfd{ primary_fd_, POLLIN, 0 });
+            }
+            if (::poll(fds.data(), fds.size(), POLL_TIMEOUT_MS) < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                unix_socket::ThrowError("poll");
+            }
+
+            for (const pollfd& entry : fds)
+            {
+                if (entry.revents == 0)
+                {
+                    continue;
+                }
+                if (entry.fd == client_listener_ || entry.fd == follower_listener_)
+                {
+                    Accept(entry.fd);
+                }
+                else if (entry.fd == primary_fd_)
+                {
+                    ReadPrimary();
+                }
+                else if (followers_.count(entry.fd) != 0)
+                {
+                    ReadFollower(entry.fd);
+                }
+                else if (clients_.count(entry.fd) != 0)
+                {
+                    ReadClient(entry.fd);
+                }
+            }
+            if (replica_ && primary_fd_ < 0)
+            {
+                ConnectPrimary();
+            }
+        }
+    }
+
+private:
+    // Ведомый, подключённый к ведущему
+    struct Follower
+    {
+        std::string input;       // строка подписки, пока она не получена
+        std::uint64_t id = 0;    // номер подписки в ReplicationLog
+    };
+
+    Sheet* sheet_;
+    bool read_only_;
+    std::map<int, std::string> listeners_;
+    int client_listener_ = -1;
+    int follower_listener_ = -1;
+    std::map<int, std::unique_ptr<CommandProcessor>> clients_;
+
+    ReplicationLog* replication_log_ = nullptr;
+    std::map<int, Follower> followers_;
+
+    Replica* replica_ = nullptr;
+    std::string primary_path_;
+    int primary_fd_ = -1;
+    // Правки, сохранённые в журнале ведущего, пока ведомый не был подписан,
+    // нужно загрузить из журнала
+    bool catch_up_needed_ = true;
+
+    std::vector<char> buffer_ = std::vector<char>(READ_CHUNK);
+    std::string output_;
+
+    void Accept(int listener)
+    {
+        const int fd = ::accept(listener, nullptr, nullptr);
+        if (fd < 0)
+        {
+            return;
+        }
+        if (listener == client_listener_)
+        {
+            clients_.emplace(fd, std::make_unique<CommandProcessor>(*sheet_, read_only_));
+        }
+        else
+        {
+            followers_.emplace(fd, Follower{});
+        }
+    }
+
+    void ReadClient(int fd)
+    {
+        CommandProcessor& processor = *clients_.at(fd);
+        output_.clear();
+        bool close = true;
+        try
+        {
+            const std::size_t count = unix_socket::ReadSome(fd, buffer_.data(), buffer_.size());
+            if (count == 0)
+            {
+                processor.Finish(output_);
+            }
+            else
+            {
+                processor.Feed(std::string_view(buffer_.data(), count), output_);
+                close = processor.IsClosed();
+            }
+            unix_socket::WriteAll(fd, output_);
+        }
+        catch (const std::system_error& error)
+        {
+            // Ошибка одного клиента не останавливает сервер
+            std::fprintf(stderr, "client %d: %s\n", fd, error.what());
+            close = true;
+        }
+        if (close)
+        {
+            ::close(fd);
+            clients_.erase(fd);
+        }
+    }
+
+    // Ведущий: строка подписки от ведомого или закрытие соединения
+    void ReadFollower(int fd)
+    {
+        Follower& follower = followers_.at(fd);
+        std::size_t count = 0;
+        try
+        {
+            count = unix_socket::ReadSome(fd, buffer_.data(), buffer_.size());
+        }
+        catch (const std::system_error&)
+        {
+        }
+
+        bool close = count == 0;
+        if (!close && follower.id == 0)
+        {
+            follower.input.append(buffer_.data(), count);
+            const std::size_t end = follower.input.find('\n');
+            if (end != std::string::npos)
+            {
+                const std::optional<std::uint64_t> after
+                    = ReplicationLog::ParseSubscription(std::string_view(follower.input).substr(0, end));
+                // Кадры уходят без ожидания: не успевший их принять ведомый
+                // отключается и догоняет ведущего по журналу
+                follower.id = after ? replication_log_->Subscribe(*after, [fd](std::string_view frame)
+                                                                  {
+                                                                      const ssize_t sent = ::send(fd, frame.data(), frame.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+                                                                      if (sent != static_cast<ssize_t>(frame.size()))
+                                                                      {
+                                                                          ::shutdown(fd, SHUT_RDWR);
+                                                                          return false;
+                                                                      }
+                                                                      return true;
+                                                                  })
+                                    : 0;
+                // Без подписки соединение не нужно; ведомый, получивший кадр
+                // "догоняй", подключится снова
+                close = follower.id == 0;
+                follower.input.clear();
+            }
+        }
+        if (close)
+        {
+            replication_log_->Unsubscribe(follower.id);
+            ::close(fd);
+            followers_.erase(fd);
+        }
+    }
+
+    // Ведомый: кадры правок от ведущего
+    void ReadPrimary()
+    {
+        std::size_t count = 0;
+        try
+        {
+            count = unix_socket::ReadSome(primary_fd_, buffer_.data(), buffer_.size());
+            if (count > 0 && replica_->Feed(std::string_view(buffer_.data(), count)))
+            {
+                return;
+            }
+            // Ведущий отключился или потребовал догонять по журналу. Без
+            // ведущего правок нет: лист догонять не нужно
+            catch_up_needed_ = count > 0;
+        }
+        catch (const std::exception& error)
+        {
+            std::fprintf(stderr, "replication: %s\n", error.what());
+            catch_up_needed_ = true;
+        }
+        // Подключение заново - после обработки остальных сокетов
+        ::close(primary_fd_);
+        primary_fd_ = -1;
+    }
+
+    void ConnectPrimary()
+    {
+        try
+        {
+            if (catch_up_needed_)
+            {
+                replica_->CatchUp();
+                catch_up_needed_ = false;
+                sheet_ = &replica_->GetSheet();
+                for (auto& [fd, processor] : clients_)
+                {
+                    processor->SetSheet(*sheet_);
+                }
+            }
+            primary_fd_ = unix_socket::Connect(primary_path_);
+            unix_socket::WriteAll(primary_fd_, replica_->MakeSubscription());
+        }
+        catch (const std::exception&)
+        {
+            // Следующая попытка - после тайм-аута poll()
+            if (primary_fd_ >= 0)
+            {
+                ::close(primary_fd_);
+                primary_fd_ = -1;
+            }
+        }
+    }
+};
+
+Options ParseOptions(int argc, char** argv)
+{
+    Options options;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        std::string* value = arg == "--socket"      ? &options.socket_path
+                             : arg == "--load"      ? &options.snapshot_path
+                             : arg == "--journal"   ? &options.journal_directory
+                             : arg == "--replicate" ? &options.replicate_path
+                             : arg == "--follow"    ? &options.follow_path
+                                                    : nullptr;
+        if (!value || i + 1 == argc)
+        {
+            throw std::invalid_argument("Unknown option " + arg);
+        }
+        *value = argv[++i];
+    }
+
+    const bool follower = !options.follow_path.empty();
+    if ((!options.snapshot_path.empty() && !options.journal_directory.empty())
+        || (!options.replicate_path.empty() && (options.journal_directory.empty() || follower))
+        || (follower && (options.journal_directory.empty() || options.socket_path.empty())))
+    {
+        throw std::invalid_argument("Incompatible options");
+    }
+    return options;
+}
+
+void Serve(const Options& options)
+{
+    if (!options.follow_path.empty())
+    {
+        Replica replica(options.journal_directory);
+        Server server(replica.GetSheet(), true);
+        server.ListenClients(options.socket_path);
+        server.Follow(replica, options.follow_path);
+        server.Run();
+        return;
+    }
+
+    std::unique_ptr<SheetInterface> sheet_ptr = !options.journal_directory.empty() ? RecoverSheet(options.journal_directory)
+                                                : !options.snapshot_path.empty()   ? LoadSnapshot(options.snapshot_path)
+                                                                                   : CreateSheet();
+    Sheet& sheet = dynamic_cast<Sheet&>(*sheet_ptr);
+    std::unique_ptr<EditJournal> journal;
+    std::unique_ptr<ReplicationLog> replication_log;
+    if (!options.journal_directory.empty())
+    {
+        journal = std::make_unique<EditJournal>(options.journal_directory);
+        sheet.SetJournal(journal.get());
+    }
+    if (!options.replicate_path.empty())
+    {
+        replication_log = std::make_unique<ReplicationLog>(*journal);
+    }
+
+    if (options.socket_path.empty() && !replication_log)
+    {
+        ServeStdio(sheet);
+    }
+    else
+    {
+        Server server(sheet, false);
+        if (!options.socket_path.empty())
+        {
+            server.ListenClients(options.socket_path);
+        }
+        if (replication_log)
+        {
+            server.ListenFollowers(options.replicate_path, *replication_log);
+        }
+        server.Run();
+    }
+    sheet.SetJournal(nullptr);
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    // Отключение клиента не должно завершать сервер
+    std::signal(SIGPIPE, SIG_IGN);
+    struct sigaction action{};
+    action.sa_handler = RequestStop;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    try
+    {
+        Serve(ParseOptions(argc, argv));
+    }
+    catch (const std::invalid_argument& error)
+    {
+        std::fprintf(stderr,
+                     "%s\nusage: %s [--socket path] [--load snapshot | --journal directory [--replicate path]]\n"
+                     "       %s --socket path --journal directory --follow path\n",
+                     error.what(), argv[0], argv[0]);
+        return 2;
+    }
+    catch (const std::exception& error)
+    {
+        std::fprintf(stderr, "%s\n", error.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+// Unix-сокеты для сервера листа и генератора нагрузки (только POSIX).
+// Функции бросают std::system_error при ошибках.
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace unix_socket
+{
+
+[[noreturn]] inline void ThrowError(const std::string& what)
+{
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+inline sockaddr_un MakeAddress(const std::string& path)
+{
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        throw std::system_error(ENAMETOOLONG, std::generic_category(), "Socket path is too long: " + path);
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+
+// Создаёт слушающий сокет path, удаляя оставшийся от прежнего запуска файл
+inline int Listen(const std::string& path)
+{
+    const sockaddr_un address = MakeAddress(path);
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        ThrowError("socket");
+    }
+    ::unlink(path.c_str());
+    if (::bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || ::listen(fd, SOMAXCONN) != 0)
+    {
+        const int error = errno;
+        ::close(fd);
+        errno = error;
+        ThrowError("Failed to listen on " + path);
+    }
+    return fd;
+}
+
+inline int Connect(const std::string& path)
+{
+    const sockaddr_un address = MakeAddress(path);
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        ThrowError("socket");
+    }
+    if (::connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        const int error = errno;
+        ::close(fd);
+        errno = error;
+        ThrowError("Failed to connect to " + path);
+    }
+    return fd;
+}
+
+// Пишет data целиком
+inline void WriteAll(int fd, std::string_view data)
+{
+    while (!data.empty())
+    {
+        const ssize_t written = ::write(fd, data.data(), data.size());
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            ThrowError("write");
+        }
+        data.remove_prefix(static_cast<std::size_t>(written));
+    }
+}
+
+// Читает доступные данные (не больше size байт), ожидая хотя бы одного.
+// 0 - конец данных
+inline std::size_t ReadSome(int fd, char* buffer, std::size_t size)
+{
+    while (true)
+    {
+        const ssize_t count = ::read(fd, buffer, size);
+        if (count >= 0)
+        {
+            return static_cast<std::size_t>(count);
+        }
+        if (errno != EINTR)
+        {
+            ThrowError("read");
+        }
+    }
+}
+
+}  // namespace unix_socket
@@ -2,14 +2,55 @@
 
 #include "cell.h"
 #include "common.h"
+#include "journal.h"
+#include "workbook.h"
 
 #include <algorithm>
+#include <bitset>
 #include <functional>
 #include <iostream>
+#include <iterator>
+#include <mutex>
 #include <optional>
+#include <utility>
 
 using namespace std::literals;
 
+namespace
+{
+
+// Точный поиск по столбцу короче этого просматривает ячейки, не строя индекс
+constexpr int LOOKUP_INDEX_MIN_ROWS = 64;
+// Диапазон условия при построении карты читается блоками не больше этого
+// числа ячеек
+constexpr int CONDITION_BLOCK_CELLS = 1024;
+// Карты условий сбрасываются все сразу, когда в них больше этого числа бит
+// (32 МБ), чтобы не копить карты условий, которых в формулах уже нет
+constexpr std::size_t PREDICATE_CACHE_MAX_BITS = std::size_t{ 1 } << 28;
+
+// Листы, формулы которых сейчас вычисляет в этом потоке обход в порядке
+// зависимостей (см. Sheet::EvaluateStale()). Влияющие формулы других листов
+// книги тот же обход может и не вычислить
+thread_local std::vector<const Sheet*> ordered_evaluations;
+
+class OrderedEvaluationScope
+{
+public:
+    explicit OrderedEvaluationScope(const Sheet& sheet)
+    {
+        ordered_evaluations.push_back(&sheet);
+    }
+    ~OrderedEvaluationScope()
+    {
+        ordered_evaluations.pop_back();
+    }
+
+    OrderedEvaluationScope(const OrderedEvaluationScope&) = delete;
+    OrderedEvaluationScope& operator=(const OrderedEvaluationScope&) = delete;
+};
+
+}  // namespace
+
 Sheet::~Sheet()
 {}
 
@@ -20,11 +61,48 @@ void Sheet::SetCell(Position pos, const std::string& text)
     {
         throw InvalidPositionException("Invalid position for SetCell()");
     }
+    // Правку, которую журнал не запишет, не применяем
+    if (journal_)
+    {
+        journal_->ThrowIfFailed();
+    }
+
+    {
+        // Пока идёт правка, указатели на ячейки должны оставаться валидными
+        EvictionGuard guard(*this);
+        DoSetCell(pos, text);
+        // Инвалидируем кэш зависимых ячеек
+        InvalidateCell(pos);
+        ExtendPrintableSize(pos);
+    }
+
+    // Правка уже применена: подписчики узнают о ней, даже если журнал не
+    // смог её записать
+    try
+    {
+        if (journal_)
+        {
+            journal_->LogSet(pos, text);
+            if (journal_->NeedsCompaction())
+            {
+                journal_->Compact(*this);
+            }
+        }
+    }
+    catch (...)
+    {
+        PublishChanges();
+        EvictTiles();
+        throw;
+    }
+    PublishChanges();
+    EvictTiles();
+}
 
-    // Выделяем память под ячейку, если нужно
-    Touch(pos);
+void Sheet::DoSetCell(Position pos, const std::string& text)
+{
     // Получаем указатель на ячейку для текущего листа
-    auto cell = GetCell(pos);
+    Cell* cell = FindCell(pos);
 
     if (cell)
     {
@@ -33,27 +111,42 @@ void Sheet::SetCell(Position pos, const std::string& text)
         // По заданию мы должны откатить изменения в этом случае.
         std::string old_text = cell->GetText();
 
-        // Инвалидируем кэш ячейки и зависимых от нее... 
-        InvalidateCell(pos);
-        // ... и удаляем зависимости
+        // Удаляем зависимости
         DeleteDependencies(pos);
         // Очищаем старое содержимое ячейки (не сам unique_ptr, а содержание ячейки по указанному адресу)
-        dynamic_cast<Cell*>(cell)->Clear();
+        cell->Clear();
+
+        // Откат изменений: возвращаем старое содержимое и его зависимости
+        auto rollback = [&]()
+        {
+            cell->Set(old_text);
+            AddDependencies(pos, *cell);
+            MarkStale(pos, cell->GetFormula() != nullptr);
+        };
 
-        dynamic_cast<Cell*>(cell)->Set(text);
+        try
+        {
+            cell->Set(text);
+        }
+        catch (const FormulaException&)
+        {
+            rollback();
+            throw;
+        }
         // Проверяем на циклические зависимости новое содержимое cell
-        if (dynamic_cast<Cell*>(cell)->IsCyclicDependent(dynamic_cast<Cell*>(cell), pos))
+        if (IsCyclicDependent(pos, *cell))
         {
-            // Есть циклическая зависимость. Откат изменений
-            dynamic_cast<Cell*>(cell)->Set(std::move(old_text));
+            // Есть циклическая зависимость
+            rollback();
             throw CircularDependencyException("Circular dependency detected!");
         }
 
         // Сохраняем зависимости
-        for (const auto& ref_cell : dynamic_cast<Cell*>(cell)->GetReferencedCells())
-        {
-            AddDependentCell(ref_cell, pos);
-        }
+        CreateReferencedCells(*cell);
+        AddDependencies(pos, *cell);
+        MarkStale(pos, cell->GetFormula() != nullptr);
+        CellChanged(pos, old_text);
+        UpdateColumnIndexes(pos);
     }
     else
     {
@@ -62,7 +155,7 @@ void Sheet::SetCell(Position pos, const std::string& text)
         new_cell->Set(text);
 
         // Проверяем циклические ссылки
-        if (new_cell.get()->IsCyclicDependent(new_cell.get(), pos))
+        if (IsCyclicDependent(pos, *new_cell))
         {
             throw CircularDependencyException("Circular dependency detected!");
         }
@@ -71,16 +164,14 @@ void Sheet::SetCell(Position pos, const std::string& text)
         // циклических зависимостей проверены.
         // Переходим к модификации Sheet.
 
-        // Проходим по вектору ячеек из формулы и добавляем
-        // для каждой из них нашу ячейку как зависимую
-        for (const auto& ref_cell : new_cell.get()->GetReferencedCells())
-        {
-            AddDependentCell(ref_cell, pos);
-        }
+        // Добавляем нашу ячейку как зависимую для каждой ячейки и каждого
+        // диапазона из формулы
+        CreateReferencedCells(*new_cell);
+        AddDependencies(pos, *new_cell);
 
-        // Заменяем unique_ptr с nullptr из sheet_  на новый указатель
-        sheet_.at(pos.row).at(pos.col) = std::move(new_cell);
-        UpdatePrintableSize();
+        // Помещаем ячейку в её тайл
+        PutCell(pos, std::move(new_cell));
+        UpdateColumnIndexes(pos);
     }
 }
 
@@ -92,19 +183,24 @@ const CellInterface* Sheet::GetCell(Position pos) const
         throw InvalidPositionException("Invalid position for GetCell()");
     }
 
-    // Если память для ячейки выделена...
-    if (CellExists(pos))
+    // Для любых несуществующих ячеек FindCell() возвращает просто nullptr
+    const Cell* cell = FindCell(pos);
+    // Ячейки области разлива и заблокированного якоря отдаются через SpillCell
+    const CellInterface* result = cell;
+    if (FindSpillAnchor(pos))
     {
-        //  ...и ее указатель не nullptr...
-        if (sheet_.at(pos.row).at(pos.col))
+        std::lock_guard<std::mutex> lock(spill_cells_mutex_);
+        auto& spill_cell = spill_cells_[pos];
+        if (!spill_cell)
         {
-            // ...возвращаем его
-            return sheet_.at(pos.row).at(pos.col).get();
+            spill_cell = std::make_unique<SpillCell>(*this, pos);
         }
+        result = spill_cell.get();
     }
-
-    // Для любых несуществующих ячеек возвращаем просто nullptr
-    return nullptr;
+    // Вызов извне вычислений - подходящий момент выгрузить лишние тайлы.
+    // Тайл pos использован последним и выгружен не будет
+    EvictTiles();
+    return result;
 }
 
 CellInterface* Sheet::GetCell(Position pos)
@@ -115,19 +211,8 @@ CellInterface* Sheet::GetCell(Position pos)
         throw InvalidPositionException("Invalid position for GetCell()");
     }
 
-    // Если память для ячейки выделена...
-    if (CellExists(pos))
-    {
-        //  ...и ее указатель не nullptr...
-        if (sheet_.at(pos.row).at(pos.col))
-        {
-            // ...возвращаем его
-            return sheet_.at(pos.row).at(pos.col).get();
-        }
-    }
-
-    // Для любых несуществующих ячеек возвращаем просто nullptr
-    return nullptr;
+    // Ячейка та же, что у константной версии
+    return const_cast<CellInterface*>(std::as_const(*this).GetCell(pos));
 }
 
 void Sheet::ClearCell(Position pos)
@@ -137,186 +222,1923 @@ void Sheet::ClearCell(Position pos)
     {
         throw InvalidPositionException("Invalid position for ClearCell()");
     }
+    if (journal_)
+    {
+        journal_->ThrowIfFailed();
+    }
 
-    if (CellExists(pos))
+    bool cleared = false;
     {
-        sheet_.at(pos.row).at(pos.col).reset();       // Удаляет содержимое ячейки
+        EvictionGuard guard(*this);
+        cleared = DoClearCell(pos);
+        if (cleared)
+        {
+            InvalidateCell(pos);
+
+             // pos.row/col 0-based          max_row/col 1-based
+            if ((pos.row + 1 == max_row_) || (pos.col + 1 == max_col_))
+            {
+                // Удаленная ячейка была на границе Printable Area. Нужен перерасчет
+                area_is_valid_ = false;
+                UpdatePrintableSize();
+            }
+        }
+    }
 
-         // pos.row/col 0-based          max_row/col 1-based
-        if ((pos.row + 1 == max_row_) || (pos.col + 1 == max_col_))
+    try
+    {
+        if (cleared && journal_)
         {
-            // Удаленная ячейка была на границе Printable Area. Нужен перерасчет
-            area_is_valid_ = false;
-            UpdatePrintableSize();
+            journal_->LogClear(pos);
         }
     }
+    catch (...)
+    {
+        PublishChanges();
+        EvictTiles();
+        throw;
+    }
+    PublishChanges();
+    EvictTiles();
 }
 
-Size Sheet::GetPrintableSize() const
+bool Sheet::DoClearCell(Position pos)
 {
-    if (area_is_valid_)
+    if (!FindCell(pos))
     {
-        return Size{ max_row_, max_col_ };
+        return false;
     }
-    // Бросаем исключение
-    throw InvalidPositionException("The size of printable area has not been updated");
+
+    // Ссылки самой ячейки исчезают вместе с ней
+    DeleteDependencies(pos);
+    RemoveCell(pos);       // Удаляет содержимое ячейки
+    UpdateColumnIndexes(pos);
+    return true;
 }
 
-void Sheet::PrintValues(std::ostream& output) const
+void Sheet::ApplyEdits(const std::vector<CellEdit>& edits, std::size_t* applied)
 {
-    for (int x = 0; x < max_row_; ++x)
+    if (journal_)
     {
-        bool need_separator = false;
-        // Проходим по всей ширине Printable area
-        for (int y = 0; y < max_col_; ++y)
+        journal_->ThrowIfFailed();
+    }
+
+    std::vector<Position> changed;
+    changed.reserve(edits.size());
+
+    // Кэш и область печати нужно привести в порядок и в случае ошибки:
+    // правки до неё уже применены
+    auto finish = [&]()
+    {
+        if (applied)
         {
-            // Проверка необходимости печати разделителя
-            if (need_separator)
-            {
-                output << '\t';
-            }
-            need_separator = true;
+            *applied = changed.size();
+        }
+        InvalidateCells(changed);
+        UpdatePrintableSize();
+    };
 
-            // Если мы не вышли за пределы вектора И ячейка не nullptr
-            if ((y < static_cast<int>(sheet_.at(x).size())) && sheet_.at(x).at(y))
+    try
+    {
+        // Тайлы выгружаются только после применения всего пакета
+        EvictionGuard guard(*this);
+        try
+        {
+            for (const auto& edit : edits)
             {
-                // Ячейка существует
-                auto value = sheet_.at(x).at(y)->GetValue();
-                if (std::holds_alternative<std::string>(value))
+                if (!edit.pos.IsValid())
                 {
-                    output << std::get<std::string>(value);
+                    throw InvalidPositionException("Invalid position for ApplyEdits()");
                 }
-                if (std::holds_alternative<double>(value))
+
+                // Правка попадает в changed до записи в журнал: если журнал
+                // откажет, применённая правка всё равно будет обработана
+                if (edit.text)
                 {
-                    output << std::get<double>(value);
+                    DoSetCell(edit.pos, *edit.text);
+                    changed.push_back(edit.pos);
+                    if (journal_)
+                    {
+                        journal_->LogSet(edit.pos, *edit.text);
+                    }
                 }
-                if (std::holds_alternative<FormulaError>(value))
+                else
                 {
-                    output << std::get<FormulaError>(value);
+                    const bool cleared = DoClearCell(edit.pos);
+                    changed.push_back(edit.pos);
+                    if (cleared && journal_)
+                    {
+                        journal_->LogClear(edit.pos);
+                    }
                 }
             }
         }
-        // Разделение строк
-        output << '\n';
+        catch (...)
+        {
+            finish();
+            throw;
+        }
+        finish();
+    }
+    catch (...)
+    {
+        PublishChanges();
+        EvictTiles();
+        throw;
+    }
+
+    try
+    {
+        if (journal_ && journal_->NeedsCompaction())
+        {
+            journal_->Compact(*this);
+        }
     }
+    catch (...)
+    {
+        PublishChanges();
+        EvictTiles();
+        throw;
+    }
+    PublishChanges();
+    EvictTiles();
 }
 
-void Sheet::PrintTexts(std::ostream& output) const
+void Sheet::SetJournal(EditJournal* journal)
 {
-    for (int x = 0; x < max_row_; ++x)
+    journal_ = journal;
+}
+
+void Sheet::EnablePaging(const std::string& path, PagingOptions options)
+{
+    paging_options_ = options;
+    if (!store_)
     {
-        bool need_separator = false;
-        // Проходим по всей ширине Printable area
-        for (int y = 0; y < max_col_; ++y)
+        store_ = std::make_unique<TileStore>(path);
+
+        // Уже созданные тайлы берём под учёт. Порядок обращения к ним
+        // неизвестен, поэтому порядок в LRU - по позиции
+        for (int tile_row = 0; tile_row < static_cast<int>(tiles_.size()); ++tile_row)
         {
-            // Проверка необходимости печати разделителя
-            if (need_separator)
+            for (int tile_col = 0; tile_col < static_cast<int>(tiles_[tile_row].size()); ++tile_col)
             {
-                output << '\t';
-            }
-            need_separator = true;
+                TileSlot& slot = tiles_[tile_row][tile_col];
+                if (!slot.tile)
+                {
+                    continue;
+                }
 
-            // Если мы не вышли за пределы вектора И ячейка не nullptr
-            if ((y < static_cast<int>(sheet_.at(x).size())) && sheet_.at(x).at(y))
-            {
-                // Ячейка существует
-                output << sheet_.at(x).at(y)->GetText();
+                slot.bytes = sizeof(SheetTile);
+                for (const auto& cell : slot.tile->cells)
+                {
+                    if (cell)
+                    {
+                        slot.bytes += EstimateCellBytes(cell->GetTextView());
+                    }
+                }
+                slot.lru_it = lru_.insert(lru_.end(), Position{ tile_row, tile_col });
+                ++paging_stats_.resident_tiles;
+                paging_stats_.resident_bytes += slot.bytes;
             }
         }
-        // Разделение строк
-        output << '\n';
     }
+    EvictTiles();
 }
 
-void Sheet::InvalidateCell(const Position& pos)
+PagingStats Sheet::GetPagingStats() const
+{
+    PagingStats stats = paging_stats_;
+    stats.stored_bytes = store_ ? store_->FileSize() : 0;
+    return stats;
+}
+
+Sheet::EvictionGuard::EvictionGuard(const SheetInterface& sheet)
+    : sheet_(dynamic_cast<const Sheet*>(&sheet))
 {
-    // Для всех зависимых ячеек рекурсивно инвалидируем кэш
-    for (const auto& dependent_cell : GetDependentCells(pos))
+    if (sheet_)
     {
-        auto cell = GetCell(dependent_cell);
-        // InvalidateCache() есть только у Cell, приводим указатель
-        dynamic_cast<Cell*>(cell)->InvalidateCache();
-        InvalidateCell(dependent_cell);
+        ++sheet_->eviction_guards_;
     }
 }
 
-void Sheet::AddDependentCell(const Position& main_cell, const Position& dependent_cell)
+Sheet::EvictionGuard::~EvictionGuard()
 {
-    // При отсутствии записи для main_cell создаем ее через []
-    cells_dependencies_[main_cell].insert(dependent_cell);
+    if (sheet_)
+    {
+        --sheet_->eviction_guards_;
+    }
 }
 
-const std::set<Position> Sheet::GetDependentCells(const Position& pos)
+Size Sheet::GetPrintableSize() const
+{
+    if (area_is_valid_)
+    {
+        return Size{ max_row_, max_col_ };
+    }
+    // Бросаем исключение
+    throw InvalidPositionException("The size of printable area has not been updated");
+}
+
+void Sheet::GetValues(Position top_left, Size size, const ValueBuffers& out) const
+{
+    const Position bottom_right{ top_left.row + size.rows - 1, top_left.col + size.cols - 1 };
+    if (size.rows < 0 || size.cols < 0 || !top_left.IsValid()
+        || (size.rows > 0 && size.cols > 0 && !bottom_right.IsValid()))
+    {
+        throw InvalidPositionException("Invalid range for GetValues()");
+    }
+
+    // Строки в out.texts ссылаются на ячейки, поэтому до конца обхода тайлы
+    // не выгружаются
+    EvictionGuard guard(*this);
+
+    auto write = [&out](std::size_t index, const CellValueView& view)
+    {
+        if (out.numbers)
+        {
+            out.numbers[index] = view.number;
+        }
+        if (out.codes)
+        {
+            out.codes[index] = view.code;
+        }
+        if (out.texts)
+        {
+            out.texts[index] = view.text;
+        }
+    };
+
+    std::size_t index = 0;
+    for (int row = top_left.row; row <= bottom_right.row; ++row)
+    {
+        // Строка диапазона проходится отрезками, лежащими в одном тайле
+        for (int col = top_left.col; col <= bottom_right.col;)
+        {
+            const Position pos{ row, col };
+            const int span_end = std::min(bottom_right.col + 1, (col / TILE_SIZE + 1) * TILE_SIZE);
+
+            TileSlot* slot = FindSlot(pos);
+            if (!slot || slot->cell_count == 0)
+            {
+                for (; col < span_end; ++col)
+                {
+                    write(index++, CellValueView{});
+                }
+                continue;
+            }
+
+            const auto* cells = &LoadTile(*slot, TilePosition(pos))->cells[TileCellIndex(pos)];
+            for (; col < span_end; ++col, ++cells)
+            {
+                write(index++, *cells ? (*cells)->GetValueView() : CellValueView{});
+            }
+        }
+    }
+
+    // Области разлива накладываются поверх прочитанного: их ячейки пусты
+    if (spills_.empty() || size.rows == 0 || size.cols == 0)
+    {
+        return;
+    }
+    const Range rect{ top_left, bottom_right };
+    auto index_of = [&](Position pos)
+    {
+        return static_cast<std::size_t>(pos.row - top_left.row) * size.cols + (pos.col - top_left.col);
+    };
+    spill_areas_.ForEachIntersecting(rect, [&](const Range& area, Position anchor)
+    {
+        if (spills_.at(anchor).blocked)
+        {
+            if (rect.Contains(anchor))
+            {
+                write(index_of(anchor), CellValueView{ ValueCode::ErrorSpill, 0.0, {} });
+            }
+            return;
+        }
+        const ArrayValue& array = *FindCell(anchor)->GetArrayValue();
+        for (int row = std::max(area.from.row, rect.from.row); row <= std::min(area.to.row, rect.to.row); ++row)
+        {
+            for (int col = std::max(area.from.col, rect.from.col); col <= std::min(area.to.col, rect.to.col); ++col)
+            {
+                const Position pos{ row, col };
+                if (pos == anchor)
+                {
+                    continue;
+                }
+                const std::size_t element = static_cast<std::size_t>(row - anchor.row) * array.size.cols
+                    + (col - anchor.col);
+                write(index_of(pos), CellValueView{ array.codes[element], array.numbers[element], {} });
+            }
+        }
+    });
+}
+
+std::optional<Range> Sheet::GetSpillRange(Position anchor) const
+{
+    auto it = spills_.find(anchor);
+    if (it == spills_.end() || it->second.blocked)
+    {
+        return std::nullopt;
+    }
+    return it->second.area;
+}
+
+ViewportStats Sheet::EvaluateViewport(const Range& viewport)
 {
-    if (cells_dependencies_.count(pos) != 0)
+    if (!viewport.IsValid())
     {
-        // Есть такой ключ в словаре зависимостей. Возвращаем значение
-        return cells_dependencies_.at(pos);
+        throw InvalidPositionException("Invalid range for EvaluateViewport()");
     }
 
-    // Если мы здесь, от ячейки pos никто не зависит
-    return {};
+    ViewportStats stats;
+    stats.evaluated = EvaluateStale({ viewport }).evaluated;
+    stats.skipped = stale_formulas_;
+    EvictTiles();
+    return stats;
 }
 
-void Sheet::DeleteDependencies(const Position& pos)
+RecalcLimit RecalcLimit::Budget(std::chrono::steady_clock::duration budget)
 {
-    cells_dependencies_.erase(pos);
+    RecalcLimit limit;
+    limit.deadline = std::chrono::steady_clock::now() + budget;
+    return limit;
 }
 
-void Sheet::UpdatePrintableSize()
+bool RecalcLimit::IsReached() const
 {
-    max_row_ = 0;
-    max_col_ = 0;
+    return (cancel && cancel->load(std::memory_order_relaxed))
+        || (deadline != std::chrono::steady_clock::time_point::max() && std::chrono::steady_clock::now() >= deadline);
+}
 
-    // Сканируем ячейки, пропуская nullptr
-    for (int x = 0; x < static_cast<int>(sheet_.size()); ++x)
+RecalcProgress Sheet::Recalculate(const std::vector<Range>& ranges, const RecalcLimit& limit)
+{
+    for (const Range& range : ranges)
     {
-        for (int y = 0; y < static_cast<int>(sheet_.at(x).size()); ++y)
+        if (!range.IsValid())
         {
-            if (sheet_.at(x).at(y))
-            {
-//                max_row_ = (max_row_ < (x + 1) ? x + 1 : max_row_);
-//                max_col_ = (max_col_ < (y + 1) ? y + 1 : max_col_);
-                max_row_ = std::max(max_row_, x + 1);
-                max_col_ = std::max(max_col_, y + 1);
-            }
+            throw InvalidPositionException("Invalid range for Recalculate()");
         }
     }
 
-    // Перерасчет произведен
-    area_is_valid_ = true;
+    RecalcProgress progress = EvaluateStale(ranges, limit);
+    EvictTiles();
+    return progress;
 }
 
-bool Sheet::CellExists(Position pos) const
+RecalcProgress Sheet::Recalculate(const RecalcLimit& limit)
 {
-    return (pos.row < static_cast<int>(sheet_.size())) && (pos.col < static_cast<int>(sheet_.at(pos.row).size()));
+    // Вне области печати формул нет
+    std::vector<Range> ranges;
+    if (max_row_ > 0 && max_col_ > 0)
+    {
+        ranges.push_back(Range{ Position{ 0, 0 }, Position{ max_row_ - 1, max_col_ - 1 } });
+    }
+    return Recalculate(ranges, limit);
 }
 
-void Sheet::Touch(Position pos)
+void Sheet::EvaluatePrecedents(const FormulaInterface& formula) const
 {
-    // Невалидные позиции не обрабатываем
-    if (!pos.IsValid())
+    // Внутри обхода формул этого листа влияющие формулы уже вычислены
+    if (std::find(ordered_evaluations.begin(), ordered_evaluations.end(), this) != ordered_evaluations.end())
+    {
+        return;
+    }
+
+    const Span<const Position> cells = formula.GetReferencedCellsView();
+    const Span<const Range> ranges = formula.GetReferencedRangesView();
+    if (cells.empty() && ranges.empty())
     {
         return;
     }
+    std::vector<Range> roots;
+    roots.reserve(cells.size() + ranges.size());
+    for (const Position& pos : cells)
+    {
+        roots.push_back(Range{ pos, pos });
+    }
+    roots.insert(roots.end(), ranges.begin(), ranges.end());
+    EvaluateStale(roots, {}, false);
+}
+
+const Sheet* Sheet::GetLinkedSheet(std::string_view name) const
+{
+    return workbook_ ? workbook_->FindSheet(name) : nullptr;
+}
 
-    // size() 1-based          pos.row/col 0-based          sheet_[] 0-based
+RecalcProgress Sheet::EvaluateStale(const std::vector<Range>& roots, const RecalcLimit& limit,
+                                    bool clear_marks) const
+{
+    // Обход в глубину по влияющим ячейкам без рекурсии. Формула вычисляется,
+    // когда вычислены все влияющие на неё (expanded), поэтому каждая
+    // вычисляется один раз и читает только значения из кэша. Формула может
+    // попасть в стек несколько раз; раскрывается первая снятая с вершины
+    // запись, остальные пропускаются. Ссылки на другие листы книги тоже
+    // раскрываются, иначе цепочка через них вычислялась бы рекурсивно.
+    // Отметки stale снимаются только у формул этого листа: листы, на
+    // которые он ссылается, Workbook::Recalculate() вычисляет раньше
+    struct Entry
+    {
+        const Sheet* sheet;
+        Position pos;
+        bool expanded = false;
+    };
+    std::vector<Entry> stack;
+    std::set<std::pair<const Sheet*, Position>> expanded;
+    auto visit_on = [&](const Sheet& sheet, Position pos)
+    {
+        if (expanded.count({ &sheet, pos }) != 0 || !sheet.IsStaleFormula(pos))
+        {
+            return;
+        }
+        // Формулу могли вычислить при чтении её значения: отметка снимается
+        // здесь
+        if (sheet.FindCell(pos)->IsCacheValid())
+        {
+            if (clear_marks && &sheet == this)
+            {
+                MarkStale(pos, false);
+            }
+            return;
+        }
+        stack.push_back(Entry{ &sheet, pos });
+    };
+    auto visit = [&](Position pos)
+    {
+        visit_on(*this, pos);
+    };
+    // Формулы диапазона и якоря разливов, области которых его задевают
+    auto visit_range = [&](const Sheet& sheet, const Range& range)
+    {
+        sheet.ForEachStaleFormula(range, [&](Position pos)
+        {
+            visit_on(sheet, pos);
+        });
+        sheet.spill_areas_.ForEachIntersecting(range, [&](const Range& /* area */, Position anchor)
+        {
+            visit_on(sheet, anchor);
+        });
+    };
 
-    // Если элементов в векторе строк меньше, чем номер строки в pos.row...
-    if (static_cast<int>(sheet_.size()) < (pos.row + 1))
+    // Формулы диапазонов roots обходятся по одной, чтобы прерванный вызов
+    // не тратил время на раскрытие всех сразу. Диапазоны могут пересекаться
+    std::vector<Position> root_cells;
+    for (const Range& root : roots)
+    {
+        ForEachStaleFormula(root, [&](Position pos)
+        {
+            if (!FindCell(pos)->IsCacheValid())
+            {
+                root_cells.push_back(pos);
+            }
+            else if (clear_marks)
+            {
+                MarkStale(pos, false);
+            }
+        });
+        spill_areas_.ForEachIntersecting(root, [&root_cells](const Range& /* area */, Position anchor)
+        {
+            root_cells.push_back(anchor);
+        });
+    }
+    if (roots.size() > 1)
     {
-        // ... резервируем и инициализируем nullptr элементы вплоть до строки pos.row
-        sheet_.reserve(pos.row + 1);
-        sheet_.resize(pos.row + 1);
+        std::sort(root_cells.begin(), root_cells.end());
+        root_cells.erase(std::unique(root_cells.begin(), root_cells.end()), root_cells.end());
     }
 
-    // Если элементов в векторе столбцов меньше, чем номер столбца в pos.col...
-    if (static_cast<int>(sheet_.at(pos.row).size()) < (pos.col + 1))
+    RecalcProgress progress;
+    std::size_t next_root = 0;
+    while (!stack.empty() || next_root < root_cells.size())
     {
-        // ... резервируем и инициализируем nullptr элементы вплоть до столбца pos.col
-        sheet_.at(pos.row).reserve(pos.col + 1);
-        sheet_.at(pos.row).resize(pos.col + 1);
+        // Отмена останавливает сразу, срок - только после первой формулы,
+        // иначе при малом бюджете повторные вызовы не продвигались бы
+        if ((limit.cancel && limit.cancel->load(std::memory_order_relaxed))
+            || (progress.evaluated > 0 && limit.IsReached()))
+        {
+            break;
+        }
+        if (stack.empty())
+        {
+            visit(root_cells[next_root++]);
+            continue;
+        }
+
+        const Sheet& sheet = *stack.back().sheet;
+        const Position pos = stack.back().pos;
+        Cell* cell = sheet.FindCell(pos);
+        if (stack.back().expanded)
+        {
+            stack.pop_back();
+            {
+                // Влияющие формулы уже в кэше: вычисление не рекурсивно
+                OrderedEvaluationScope scope(sheet);
+                cell->FillCache();
+            }
+            if (&sheet == this)
+            {
+                if (clear_marks)
+                {
+                    MarkStale(pos, false);
+                }
+                ++progress.evaluated;
+            }
+            continue;
+        }
+
+        if (!expanded.insert({ &sheet, pos }).second)
+        {
+            // Формула уже вычислена по другой записи
+            stack.pop_back();
+            continue;
+        }
+        stack.back().expanded = true;
+        for (const Position& ref_cell : cell->GetReferencedCellsView())
+        {
+            visit_range(sheet, Range{ ref_cell, ref_cell });
+        }
+        for (const Range& range : cell->GetReferencedRangesView())
+        {
+            visit_range(sheet, range);
+        }
+        if (const FormulaInterface* formula = cell->GetFormula())
+        {
+            for (const SheetReference& reference : formula->GetSheetReferencesView())
+            {
+                if (const Sheet* other = sheet.GetLinkedSheet(reference.sheet))
+                {
+                    visit_range(*other, reference.range);
+                }
+            }
+        }
+    }
+
+    progress.complete = stack.empty() && next_root == root_cells.size();
+    if (!progress.complete)
+    {
+        progress.remaining = std::count_if(root_cells.begin(), root_cells.end(), [this](Position pos)
+                                           {
+                                               return !FindCell(pos)->IsCacheValid();
+                                           });
+    }
+    return progress;
+}
+
+void Sheet::Subscribe(SheetObserver& observer, std::vector<Range> ranges, NotifyMode mode)
+{
+    for (const Range& range : ranges)
+    {
+        if (!range.IsValid())
+        {
+            throw InvalidPositionException("Invalid range for Subscribe()");
+        }
+    }
+    subscriptions_.push_back(Subscription{ &observer, std::move(ranges), mode });
+    RebuildPublished();
+}
+
+void Sheet::Unsubscribe(const SheetObserver& observer)
+{
+    subscriptions_.erase(std::remove_if(subscriptions_.begin(), subscriptions_.end(),
+                                        [&observer](const Subscription& subscription)
+                                        {
+                                            return subscription.observer == &observer;
+                                        }),
+                         subscriptions_.end());
+    RebuildPublished();
+}
+
+void Sheet::RebuildPublished()
+{
+    published_.Clear();
+    // Подписка на весь лист наблюдает область печати: вне её ячейки пусты
+    std::vector<Range> areas;
+    for (const Subscription& subscription : subscriptions_)
+    {
+        // Подписчикам на сброс значения не нужны
+        if (subscription.mode != NotifyMode::Changed)
+        {
+            continue;
+        }
+        if (!subscription.ranges.empty())
+        {
+            areas.insert(areas.end(), subscription.ranges.begin(), subscription.ranges.end());
+        }
+        else if (max_row_ > 0 && max_col_ > 0)
+        {
+            areas.push_back(Range{ Position{ 0, 0 }, Position{ max_row_ - 1, max_col_ - 1 } });
+        }
+    }
+
+    EvictionGuard guard(*this);
+    EvaluateStale(areas);
+    for (const Range& area : areas)
+    {
+        for (int row = area.from.row; row <= area.to.row; ++row)
+        {
+            for (int col = area.from.col; col <= area.to.col; ++col)
+            {
+                const Position pos{ row, col };
+                published_.Update(pos, GetValueView(pos));
+            }
+        }
+    }
+}
+
+void Sheet::PublishChanges()
+{
+    auto is_observed = [this](Position pos)
+    {
+        return std::any_of(subscriptions_.begin(), subscriptions_.end(),
+                           [pos](const Subscription& subscription)
+                           {
+                               return subscription.mode == NotifyMode::Changed && IsObserved(subscription, pos);
+                           });
+    };
+
+    std::vector<Position>& changed = pending_changes_;
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+
+    // Подписчики на сброс узнают обо всех ячейках, ничего не вычисляя
+    for (const Subscription& subscription : subscriptions_)
+    {
+        if (subscription.mode != NotifyMode::Invalidated)
+        {
+            continue;
+        }
+        notification_.clear();
+        std::copy_if(changed.begin(), changed.end(), std::back_inserter(notification_),
+                     [&subscription](Position pos)
+                     {
+                         return IsObserved(subscription, pos);
+                     });
+        if (!notification_.empty())
+        {
+            subscription.observer->OnValuesInvalidated(notification_);
+        }
+    }
+
+    changed.erase(std::remove_if(changed.begin(), changed.end(), [&](Position pos)
+                                 {
+                                     return !is_observed(pos);
+                                 }),
+                  changed.end());
+
+    if (!changed.empty())
+    {
+        {
+            EvictionGuard guard(*this);
+            std::vector<Range> roots;
+            roots.reserve(changed.size());
+            for (const Position& pos : changed)
+            {
+                roots.push_back(Range{ pos, pos });
+            }
+            EvaluateStale(roots);
+            // Остаются только ячейки, значения которых отличаются от
+            // известных подписчикам
+            changed.erase(std::remove_if(changed.begin(), changed.end(), [this](Position pos)
+                                         {
+                                             return !published_.Update(pos, GetValueView(pos));
+                                         }),
+                          changed.end());
+        }
+
+        for (const Subscription& subscription : subscriptions_)
+        {
+            if (subscription.mode != NotifyMode::Changed)
+            {
+                continue;
+            }
+            notification_.clear();
+            std::copy_if(changed.begin(), changed.end(), std::back_inserter(notification_),
+                         [&subscription](Position pos)
+                         {
+                             return IsObserved(subscription, pos);
+                         });
+            if (!notification_.empty())
+            {
+                subscription.observer->OnValuesChanged(notification_);
+            }
+        }
+    }
+    changed.clear();
+
+    // Правка могла изменить значения формул других листов книги
+    if (workbook_)
+    {
+        workbook_->PublishLinkedChanges();
+    }
+}
+
+bool Sheet::IsObserved(const Subscription& subscription, Position pos)
+{
+    return subscription.ranges.empty()
+        || std::any_of(subscription.ranges.begin(), subscription.ranges.end(), [pos](const Range& range)
+                       {
+                           return range.Contains(pos);
+                       });
+}
+
+std::optional<int> Sheet::Lookup(const Range& vector, double key, LookupMode mode) const
+{
+    const Size size = vector.GetSize();
+    const bool is_column = size.cols == 1;
+    const int length = is_column ? size.rows : size.cols;
+
+    EvictionGuard guard(*this);
+    auto key_at = [this](Position pos)
+    {
+        return ToLookupKey(GetValueView(pos));
+    };
+
+    // Индекс общий для всех потоков, читающих лист. Если он занят другим
+    // потоком, столбец просматривается без индекса: ждать нельзя, так как
+    // владелец индекса может ждать ячейку, которую вычисляет этот поток
+    std::unique_lock<std::recursive_mutex> lock;
+    if (mode == LookupMode::Exact && is_column && length >= LOOKUP_INDEX_MIN_ROWS)
+    {
+        lock = std::unique_lock<std::recursive_mutex>(caches_mutex_, std::try_to_lock);
+    }
+    if (!lock.owns_lock())
+    {
+        return FindInVector(length, key, mode, [&](int i)
+                            {
+                                return key_at(is_column ? Position{ vector.from.row + i, vector.from.col }
+                                                        : Position{ vector.from.row, vector.from.col + i });
+                            });
+    }
+
+    const int col = vector.from.col;
+    auto [it, inserted] = lookup_indexes_.try_emplace(col);
+    ColumnLookupIndex& index = it->second;
+    if (inserted)
+    {
+        // Индекс строится лениво: строки тайлов столбца, в которых есть
+        // ячейки, отмечаются устаревшими и читаются при поиске по ним
+        const std::size_t tile_col = col / TILE_SIZE;
+        for (std::size_t tile_row = 0; tile_row < tiles_.size(); ++tile_row)
+        {
+            if (tile_col < tiles_[tile_row].size() && tiles_[tile_row][tile_col].cell_count != 0)
+            {
+                for (int row = 0; row < TILE_SIZE; ++row)
+                {
+                    index.MarkDirty(static_cast<int>(tile_row) * TILE_SIZE + row);
+                }
+            }
+        }
+        // Строки областей разлива, задевающих столбец, - тоже
+        const Range column{ Position{ 0, col }, Position{ Position::MAX_ROWS - 1, col } };
+        spill_areas_.ForEachIntersecting(column, [&index](const Range& area, Position /* anchor */)
+        {
+            for (int row = area.from.row; row <= area.to.row; ++row)
+            {
+                index.MarkDirty(row);
+            }
+        });
+    }
+
+    index.Refresh(vector.from.row, vector.to.row, [&](int row)
+                  {
+                      return key_at(Position{ row, col });
+                  });
+    const std::optional<int> row = index.Find(key, vector.from.row, vector.to.row);
+    if (!row)
+    {
+        return std::nullopt;
+    }
+    return *row - vector.from.row;
+}
+
+ConditionalResult Sheet::ConditionalAggregate(const Range& range, const Criterion& criterion,
+                                             const Range* values) const
+{
+    const Size size = range.GetSize();
+    EvictionGuard guard(*this);
+    auto value_at = [this](Position pos)
+    {
+        return GetValueView(pos);
+    };
+
+    // Блок - несколько целых строк диапазона, прочитанных одним вызовом
+    auto match_all = [&](std::vector<std::uint64_t>& bits)
+    {
+        std::fill(bits.begin(), bits.end(), 0);
+        const int block_rows = std::max(1, CONDITION_BLOCK_CELLS / size.cols);
+        const std::size_t block_cells = static_cast<std::size_t>(std::min(block_rows, size.rows)) * size.cols;
+        std::vector<double> numbers(block_cells);
+        std::vector<ValueCode> codes(block_cells);
+        std::vector<std::string_view> texts(block_cells);
+        for (int row = range.from.row; row <= range.to.row; row += block_rows)
+        {
+            const int rows = std::min(block_rows, range.to.row - row + 1);
+            GetValues(Position{ row, range.from.col }, Size{ rows, size.cols },
+                      ValueBuffers{ numbers.data(), codes.data(), texts.data() });
+            criterion.MatchValues(numbers.data(), codes.data(), texts.data(),
+                                  static_cast<std::size_t>(rows) * size.cols, bits.data(),
+                                  static_cast<std::size_t>(row - range.from.row) * size.cols);
+        }
+    };
+
+    // Карты общие для всех потоков, читающих лист. Если они заняты другим
+    // потоком, условие проверяется без кэша (см. Lookup())
+    std::unique_lock<std::recursive_mutex> lock(caches_mutex_, std::try_to_lock);
+    std::vector<std::uint64_t> local_bits;
+    const std::vector<std::uint64_t>* matched = &local_bits;
+    if (!lock.owns_lock())
+    {
+        local_bits.resize((static_cast<std::size_t>(size.rows) * size.cols + 63) / 64);
+        match_all(local_bits);
+    }
+    else
+    {
+        // Вложенные вычисления формул не обращаются к этой же карте: формула
+        // с условием по диапазону, от которого зависит ячейка диапазона, - цикл
+        PredicateBitmap& bitmap = predicate_cache_.Get(range, criterion);
+        if (!bitmap.built)
+        {
+            match_all(bitmap.bits);
+            bitmap.built = true;
+            bitmap.dirty.clear();
+        }
+        else if (!bitmap.dirty.empty())
+        {
+            std::vector<std::uint32_t> dirty;
+            dirty.swap(bitmap.dirty);
+            for (const std::uint32_t cell : dirty)
+            {
+                const Position pos{ range.from.row + static_cast<int>(cell) / size.cols,
+                                    range.from.col + static_cast<int>(cell) % size.cols };
+                const std::uint64_t mask = std::uint64_t{ 1 } << (cell % 64);
+                if (criterion.Matches(value_at(pos)))
+                {
+                    bitmap.bits[cell / 64] |= mask;
+                }
+                else
+                {
+                    bitmap.bits[cell / 64] &= ~mask;
+                }
+            }
+        }
+        matched = &bitmap.bits;
+    }
+
+    // Значения читаются только на местах установленных бит
+    ConditionalResult result;
+    for (std::size_t word = 0; word < matched->size(); ++word)
+    {
+        const std::uint64_t bits = (*matched)[word];
+        if (bits == 0)
+        {
+            continue;
+        }
+        result.matches += std::bitset<64>(bits).count();
+        if (!values)
+        {
+            continue;
+        }
+        for (int bit = 0; bit < 64; ++bit)
+        {
+            if ((bits >> bit & 1) == 0)
+            {
+                continue;
+            }
+            const int cell = static_cast<int>(word * 64) + bit;
+            const CellValueView value = value_at(Position{ values->from.row + cell / size.cols,
+                                                           values->from.col + cell % size.cols });
+            if (value.code == ValueCode::Number)
+            {
+                result.values.Add(value.number);
+            }
+            else if (value.code == ValueCode::Text)
+            {
+                if (const std::optional<double> number = ToLookupKey(value))
+                {
+                    result.values.Add(*number);
+                }
+            }
+            else if (value.code != ValueCode::Empty)
+            {
+                throw ToFormulaError(value.code);
+            }
+        }
+    }
+    return result;
+}
+
+void Sheet::EnableAggregateIndex(int col)
+{
+    if (!Position{ 0, col }.IsValid())
+    {
+        throw InvalidPositionException("Invalid column for EnableAggregateIndex()");
+    }
+    if (aggregate_indexes_.count(col) != 0)
+    {
+        return;
+    }
+
+    ColumnAggregateIndex& index = aggregate_indexes_[col];
+    {
+        EvictionGuard guard(*this);
+        for (int row = 0; row < max_row_; ++row)
+        {
+            if (const Cell* cell = FindCell(Position{ row, col }))
+            {
+                index.Set(row, cell);
+            }
+        }
+    }
+    EvictTiles();
+}
+
+bool Sheet::HasAggregateIndex(int col) const
+{
+    return aggregate_indexes_.count(col) != 0;
+}
+
+bool Sheet::AggregateRange(const Range& range, Aggregate& aggregate) const
+{
+    // Значений областей разлива в индексах нет
+    bool has_spills = false;
+    spill_areas_.ForEachIntersecting(range, [&has_spills](const Range& /* area */, Position /* anchor */)
+    {
+        has_spills = true;
+    });
+    if (has_spills)
+    {
+        return false;
+    }
+
+    ColumnAggregateIndex::Summary summary;
+    std::vector<Position> formulas;
+    for (int col = range.from.col; col <= range.to.col; ++col)
+    {
+        auto it = aggregate_indexes_.find(col);
+        if (it == aggregate_indexes_.end())
+        {
+            return false;
+        }
+        summary.Merge(it->second.Query(range.from.row, range.to.row));
+        it->second.ForEachFormula(range.from.row, range.to.row, [&formulas, col](int row)
+        {
+            formulas.push_back(Position{ row, col });
+        });
+    }
+    if (summary.invalid_texts != 0 && aggregate.GetFunction() != AggregateFunction::Count)
+    {
+        return false;
+    }
+
+    // Формулы вычисляются по порядку ячеек диапазона, как при полном
+    // чтении: результатом становится первая ошибка
+    if (range.from.col != range.to.col)
+    {
+        std::sort(formulas.begin(), formulas.end());
+    }
+    aggregate.AddSummary(summary.numbers);
+    EvictionGuard guard(*this);
+    for (const Position& pos : formulas)
+    {
+        const CellValueView value = FindCell(pos)->GetValueView();
+        if (value.code == ValueCode::Number)
+        {
+            aggregate.Add(value.number);
+        }
+        else if (value.code != ValueCode::Empty)
+        {
+            aggregate.AddError(ToFormulaError(value.code));
+        }
+    }
+    return true;
+}
+
+void Sheet::PrintValues(std::ostream& output) const
+{
+    for (int x = 0; x < max_row_; ++x)
+    {
+        bool need_separator = false;
+        // Проходим по всей ширине Printable area
+        for (int y = 0; y < max_col_; ++y)
+        {
+            // Проверка необходимости печати разделителя
+            if (need_separator)
+            {
+                output << '\t';
+            }
+            need_separator = true;
+
+            // Если ячейка не nullptr или на её место разлит массив
+            const Cell* cell = FindCell(Position{ x, y });
+            const std::optional<CellValueView> spill = FindSpillValue(Position{ x, y });
+            if (cell || spill)
+            {
+                // Ячейка существует. Текст печатаем без копирования
+                const CellValueView value = spill ? *spill : cell->GetValueView();
+                switch (value.code)
+                {
+                case ValueCode::Text:
+                    output << value.text;
+                    break;
+                case ValueCode::Empty:    // значение пустой ячейки - 0, как в GetValue()
+                case ValueCode::Number:
+                    output << value.number;
+                    break;
+                default:
+                    output << ToFormulaError(value.code);
+                    break;
+                }
+            }
+        }
+        // Разделение строк
+        output << '\n';
+
+        // Строка тайлов напечатана, лишние тайлы можно выгрузить
+        if ((x + 1) % TILE_SIZE == 0)
+        {
+            EvictTiles();
+        }
+    }
+}
+
+void Sheet::PrintTexts(std::ostream& output) const
+{
+    for (int x = 0; x < max_row_; ++x)
+    {
+        bool need_separator = false;
+        // Проходим по всей ширине Printable area
+        for (int y = 0; y < max_col_; ++y)
+        {
+            // Проверка необходимости печати разделителя
+            if (need_separator)
+            {
+                output << '\t';
+            }
+            need_separator = true;
+
+            // Если ячейка не nullptr
+            if (const Cell* cell = FindCell(Position{ x, y }))
+            {
+                // Ячейка существует
+                output << cell->GetTextView();
+            }
+        }
+        // Разделение строк
+        output << '\n';
+
+        // Строка тайлов напечатана, лишние тайлы можно выгрузить
+        if ((x + 1) % TILE_SIZE == 0)
+        {
+            EvictTiles();
+        }
+    }
+}
+
+void Sheet::InvalidateCell(const Position& pos)
+{
+    InvalidateCells({ pos });
+}
+
+void Sheet::InvalidateCells(const std::vector<Position>& changed)
+{
+    // Обход в глубину по графу зависимых ячеек. Каждую ячейку посещаем один
+    // раз, даже если до неё ведёт несколько путей
+    std::set<Position> visited;
+    std::vector<Position> stack(changed.begin(), changed.end());
+    // Правка могла заблокировать разлив или освободить для него место
+    RefreshSpills(changed, stack);
+    // Подписчики узнают об изменившихся значениях из PublishChanges()
+    const bool observed = !subscriptions_.empty();
+    if (observed)
+    {
+        pending_changes_.insert(pending_changes_.end(), stack.begin(), stack.end());
+    }
+    // Изменившиеся значения могут читать формулы других листов книги
+    const bool linked = workbook_ && workbook_->HasSheetDependents(*this);
+    std::vector<Position> touched;
+    if (linked)
+    {
+        touched = stack;
+    }
+    while (!stack.empty())
+    {
+        Position pos = stack.back();
+        stack.pop_back();
+
+        ForEachDependentCell(pos, [&](const Position& dependent_cell)
+        {
+            // Формула с ветвлением, не читавшая pos, от её изменения не
+            // меняется. Через другую ячейку до неё ещё можно дойти
+            if (visited.count(dependent_cell) != 0 || !MayDependOn(dependent_cell, pos))
+            {
+                return;
+            }
+            visited.insert(dependent_cell);
+            InvalidateValue(dependent_cell);
+            if (observed)
+            {
+                pending_changes_.push_back(dependent_cell);
+            }
+            stack.push_back(dependent_cell);
+        });
+    }
+
+    if (linked)
+    {
+        touched.insert(touched.end(), visited.begin(), visited.end());
+        workbook_->InvalidateSheetDependents(*this, touched);
+    }
+}
+
+void Sheet::InvalidateFormulas(const std::vector<Position>& cells)
+{
+    EvictionGuard guard(*this);
+    for (const Position& pos : cells)
+    {
+        InvalidateValue(pos);
+    }
+    InvalidateCells(cells);
+}
+
+void Sheet::InvalidateValue(Position pos)
+{
+    // Значение формулы могло измениться, её ключ поиска - тоже
+    MarkValueChanged(pos);
+    // Выгруженные тайлы не загружаем: кэш их формул сбросится при загрузке
+    if (TileSlot* slot = FindSlot(pos); slot && slot->cell_count != 0)
+    {
+        if (!slot->tile)
+        {
+            slot->values_are_stale = true;
+        }
+        else if (const auto& cell = slot->tile->cells[TileCellIndex(pos)])
+        {
+            cell->InvalidateCache();
+            if (cell->GetFormula())
+            {
+                MarkStale(pos, true);
+            }
+            // Копия тайла в хранилище могла сохранить прежнее значение
+            slot->stored = false;
+        }
+    }
+}
+
+void Sheet::MarkValueChanged(Position pos)
+{
+    if (auto it = lookup_indexes_.find(pos.col); it != lookup_indexes_.end())
+    {
+        it->second.MarkDirty(pos.row);
+    }
+    predicate_cache_.MarkDirty(pos);
+}
+
+bool Sheet::MayDependOn(Position dependent, Position pos) const
+{
+    // Формулы выгруженного тайла при загрузке всё равно пересчитываются
+    const TileSlot* slot = FindSlot(dependent);
+    if (!slot || !slot->tile)
+    {
+        return true;
+    }
+    const Cell* cell = slot->tile->cells[TileCellIndex(dependent)].get();
+    const FormulaInterface* formula = cell ? cell->GetFormula() : nullptr;
+    return !formula || formula->MayDependOn(pos);
+}
+
+void Sheet::AddDependencies(Position pos, const Cell& cell)
+{
+    for (const Position& ref_cell : cell.GetReferencedCellsView())
+    {
+        AddDependentCell(ref_cell, pos);
+    }
+    for (const Range& range : cell.GetReferencedRangesView())
+    {
+        range_dependencies_.Insert(range, pos);
+    }
+    if (workbook_)
+    {
+        workbook_->AddSheetReferences(*this, pos, cell);
+    }
+    AddSpill(pos, cell);
+}
+
+Sheet::SpillArea Sheet::MakeSpillArea(Position anchor, Size size)
+{
+    SpillArea spill;
+    const Position last{ anchor.row + size.rows - 1, anchor.col + size.cols - 1 };
+    spill.fits = last.IsValid()
+        && static_cast<std::size_t>(size.rows) * static_cast<std::size_t>(size.cols) <= MAX_ARRAY_CELLS;
+    spill.area = Range{ anchor, spill.fits ? last : anchor };
+    spill.blocked = !spill.fits;
+    return spill;
+}
+
+void Sheet::AddSpill(Position anchor, const Cell& cell)
+{
+    const FormulaInterface* formula = cell.GetFormula();
+    const std::optional<Size> size = formula ? formula->GetArraySize() : std::nullopt;
+    if (!size)
+    {
+        return;
+    }
+
+    SpillArea spill = MakeSpillArea(anchor, *size);
+    // Новая область может заблокировать соседние
+    spill_areas_.ForEachIntersecting(spill.area, [this](const Range& /* area */, Position other)
+    {
+        spill_checks_.insert(other);
+    });
+    // Блокировка самого якоря нужна сразу: при откате правки область
+    // удаляется и добавляется снова без сброса кэша
+    spill.blocked = IsSpillBlocked(anchor, spill);
+    spill_areas_.Insert(spill.area, anchor);
+    spills_.emplace(anchor, spill);
+    spills_changed_ = true;
+}
+
+void Sheet::RemoveSpill(Position anchor)
+{
+    auto it = spills_.find(anchor);
+    if (it == spills_.end())
+    {
+        return;
+    }
+
+    const SpillArea spill = it->second;
+    spills_.erase(it);
+    spill_areas_.Erase(spill.area, anchor);
+    // Соседние области могли быть заблокированы этой
+    spill_areas_.ForEachIntersecting(spill.area, [this](const Range& /* area */, Position other)
+    {
+        spill_checks_.insert(other);
+    });
+    if (!spill.blocked)
+    {
+        removed_spills_.push_back(spill.area);
+    }
+    for (auto cell_it = spill_cells_.lower_bound(spill.area.from);
+         cell_it != spill_cells_.end() && !(spill.area.to < cell_it->first);)
+    {
+        cell_it = spill.area.Contains(cell_it->first) ? spill_cells_.erase(cell_it) : std::next(cell_it);
+    }
+    spills_changed_ = true;
+}
+
+bool Sheet::IsSpillBlocked(Position anchor, const SpillArea& spill) const
+{
+    if (!spill.fits)
+    {
+        return true;
+    }
+
+    bool blocked = false;
+    spill_areas_.ForEachIntersecting(spill.area, [&blocked, anchor](const Range& /* area */, Position other)
+    {
+        blocked = blocked || !(other == anchor);
+    });
+    if (blocked)
+    {
+        return true;
+    }
+
+    // Непустые ячейки ищем только в существующих тайлах
+    const Range& area = spill.area;
+    for (int tile_row = area.from.row / TILE_SIZE; tile_row <= area.to.row / TILE_SIZE; ++tile_row)
+    {
+        for (int tile_col = area.from.col / TILE_SIZE; tile_col <= area.to.col / TILE_SIZE; ++tile_col)
+        {
+            const Position tile_origin{ tile_row * TILE_SIZE, tile_col * TILE_SIZE };
+            TileSlot* slot = FindSlot(tile_origin);
+            if (!slot || slot->cell_count == 0)
+            {
+                continue;
+            }
+            const SheetTile* tile = LoadTile(*slot, Position{ tile_row, tile_col });
+            for (int row = std::max(area.from.row, tile_origin.row);
+                 row <= std::min(area.to.row, tile_origin.row + TILE_SIZE - 1); ++row)
+            {
+                for (int col = std::max(area.from.col, tile_origin.col);
+                     col <= std::min(area.to.col, tile_origin.col + TILE_SIZE - 1); ++col)
+                {
+                    const Position pos{ row, col };
+                    const Cell* cell = tile->cells[TileCellIndex(pos)].get();
+                    if (cell && !(pos == anchor) && !cell->GetTextView().empty())
+                    {
+                        return true;
+                    }
+                }
+            }
+        }
+    }
+    return false;
+}
+
+void Sheet::RefreshSpills(const std::vector<Position>& changed, std::vector<Position>& changed_values)
+{
+    // Ячейки удалённых живых разливов опустели
+    for (const Range& area : removed_spills_)
+    {
+        for (int row = area.from.row; row <= area.to.row; ++row)
+        {
+            for (int col = area.from.col; col <= area.to.col; ++col)
+            {
+                const Position pos{ row, col };
+                if (!(pos == area.from))
+                {
+                    MarkValueChanged(pos);
+                    changed_values.push_back(pos);
+                }
+            }
+        }
+    }
+    removed_spills_.clear();
+
+    for (const Position& pos : changed)
+    {
+        spill_areas_.ForEachDependent(pos, [this, pos](Position anchor)
+        {
+            if (!(anchor == pos))
+            {
+                spill_checks_.insert(anchor);
+            }
+        });
+    }
+    for (const Position& anchor : spill_checks_)
+    {
+        auto it = spills_.find(anchor);
+        if (it == spills_.end())
+        {
+            continue;
+        }
+        const bool blocked = IsSpillBlocked(anchor, it->second);
+        if (blocked == it->second.blocked)
+        {
+            continue;
+        }
+        // Меняются значения якоря и всех ячеек области
+        it->second.blocked = blocked;
+        MarkValueChanged(anchor);
+        changed_values.push_back(anchor);
+        spills_changed_ = true;
+    }
+    spill_checks_.clear();
+
+    if (spills_changed_)
+    {
+        spills_changed_ = false;
+        UpdatePrintableSize();
+    }
+}
+
+std::optional<Position> Sheet::FindSpillAnchor(Position pos) const
+{
+    std::optional<Position> result;
+    spill_areas_.ForEachDependent(pos, [this, pos, &result](Position anchor)
+    {
+        const bool blocked = spills_.at(anchor).blocked;
+        if (anchor == pos ? blocked : !blocked)
+        {
+            result = anchor;
+        }
+    });
+    return result;
+}
+
+std::optional<CellValueView> Sheet::FindSpillValue(Position pos) const
+{
+    const std::optional<Position> anchor = FindSpillAnchor(pos);
+    if (!anchor)
+    {
+        return std::nullopt;
+    }
+    if (*anchor == pos)
+    {
+        return CellValueView{ ValueCode::ErrorSpill, 0.0, {} };
+    }
+    const ArrayValue& array = *FindCell(*anchor)->GetArrayValue();
+    const std::size_t element = static_cast<std::size_t>(pos.row - anchor->row) * array.size.cols
+        + (pos.col - anchor->col);
+    return CellValueView{ array.codes[element], array.numbers[element], {} };
+}
+
+CellValueView Sheet::GetValueView(Position pos) const
+{
+    if (!pos.IsValid())
+    {
+        throw InvalidPositionException("Invalid position for GetValueView()");
+    }
+    if (const std::optional<CellValueView> spill = FindSpillValue(pos))
+    {
+        return *spill;
+    }
+    const Cell* cell = FindCell(pos);
+    return cell ? cell->GetValueView() : CellValueView{};
+}
+
+Sheet::SpillCell::SpillCell(const Sheet& sheet, Position pos)
+    : sheet_(sheet)
+    , pos_(pos)
+{}
+
+CellInterface::Value Sheet::SpillCell::GetValue() const
+{
+    if (const std::optional<CellValueView> value = sheet_.FindSpillValue(pos_))
+    {
+        // Элемент массива - число или ошибка
+        if (value->code == ValueCode::Number)
+        {
+            return value->number;
+        }
+        return ToFormulaError(value->code);
+    }
+    // Разлива здесь больше нет
+    const Cell* cell = sheet_.FindCell(pos_);
+    return cell ? cell->GetValue() : Value(0.0);
+}
+
+std::string Sheet::SpillCell::GetText() const
+{
+    const Cell* cell = sheet_.FindCell(pos_);
+    return cell ? cell->GetText() : std::string{};
+}
+
+std::vector<Position> Sheet::SpillCell::GetReferencedCells() const
+{
+    const Cell* cell = sheet_.FindCell(pos_);
+    return cell ? cell->GetReferencedCells() : std::vector<Position>{};
+}
+
+bool Sheet::IsCyclicDependent(Position pos, const Cell& cell) const
+{
+    const FormulaInterface* formula = cell.GetFormula();
+    Span<const Position> refs = cell.GetReferencedCellsView();
+    Span<const Range> ranges = cell.GetReferencedRangesView();
+    Span<const SheetReference> sheet_refs = formula ? formula->GetSheetReferencesView() : Span<const SheetReference>{};
+    if (refs.empty() && ranges.empty() && sheet_refs.empty())
+    {
+        return false;
+    }
+
+    // Ссылки формулы отсортированы, диапазонов в формуле обычно немного
+    auto is_referenced = [&](const Position& target)
+    {
+        if (std::binary_search(refs.begin(), refs.end(), target))
+        {
+            return true;
+        }
+        return std::any_of(ranges.begin(), ranges.end(), [&](const Range& range)
+                           {
+                               return range.Contains(target);
+                           });
+    };
+
+    // Значение формулы массива попадает и в ячейки её области разлива
+    std::vector<Position> sources{ pos };
+    if (const std::optional<Size> size = formula ? formula->GetArraySize() : std::nullopt)
+    {
+        const Range area = MakeSpillArea(pos, *size).area;
+        for (int row = area.from.row; row <= area.to.row; ++row)
+        {
+            for (int col = area.from.col; col <= area.to.col; ++col)
+            {
+                if (!(Position{ row, col } == pos))
+                {
+                    sources.push_back(Position{ row, col });
+                }
+            }
+        }
+    }
+
+    // Цикл через другие листы книги проходит по ссылке на этот лист: такой
+    // обход ведёт книга по графу всех листов
+    if (workbook_ && (workbook_->HasSheetDependents(*this) || !sheet_refs.empty()))
+    {
+        return workbook_->IsCyclicDependent(*this, sources, cell);
+    }
+
+    // Обход в ширину от источников по зависимым ячейкам: цикл есть, если
+    // формула ссылается на источник или на ячейку, транзитивно зависящую от него
+    if (std::any_of(sources.begin(), sources.end(), is_referenced))
+    {
+        return true;
+    }
+    std::set<Position> visited(sources.begin(), sources.end());
+    std::vector<Position> queue = std::move(sources);
+    for (std::size_t i = 0; i < queue.size(); ++i)
+    {
+        bool found = false;
+        ForEachDependentCell(queue[i], [&](const Position& dependent_cell)
+        {
+            if (found || !visited.insert(dependent_cell).second)
+            {
+                return;
+            }
+            found = is_referenced(dependent_cell);
+            queue.push_back(dependent_cell);
+        });
+        if (found)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Sheet::CreateReferencedCells(const Cell& cell)
+{
+    // По заданию, ссылаться на несуществующие ячейки можно: на их месте
+    // создаются пустые. Ячейки диапазонов не создаются
+    for (const Position& ref_cell : cell.GetReferencedCellsView())
+    {
+        if (!FindCell(ref_cell))
+        {
+            // Не через SetCell(): пустая ячейка - часть внешней правки, она
+            // не журналируется и не сжимает журнал посреди неё. При
+            // восстановлении её снова создаст повтор внешней правки
+            auto empty_cell = std::make_unique<Cell>(*this);
+            empty_cell->Set("");
+            PutCell(ref_cell, std::move(empty_cell));
+            UpdateColumnIndexes(ref_cell);
+            InvalidateCell(ref_cell);
+            ExtendPrintableSize(ref_cell);
+        }
+    }
+}
+
+void Sheet::AddDependentCell(const Position& main_cell, const Position& dependent_cell)
+{
+    // При отсутствии записи для main_cell создаем ее через []
+    cells_dependencies_[main_cell].insert(dependent_cell);
+}
+
+const std::set<Position> Sheet::GetDependentCells(const Position& pos)
+{
+    std::set<Position> dependent_cells;
+    ForEachDependentCell(pos, [&](const Position& dependent_cell)
+    {
+        dependent_cells.insert(dependent_cell);
+    });
+    return dependent_cells;
+}
+
+void Sheet::DeleteDependencies(const Position& pos)
+{
+    const Cell* cell = FindCell(pos);
+    if (!cell)
+    {
+        return;
+    }
+
+    for (const Position& ref_cell : cell->GetReferencedCellsView())
+    {
+        auto it = cells_dependencies_.find(ref_cell);
+        if (it == cells_dependencies_.end())
+        {
+            continue;
+        }
+        it->second.erase(pos);
+        // Пустые списки не храним, чтобы словарь не разрастался
+        if (it->second.empty())
+        {
+            cells_dependencies_.erase(it);
+        }
+    }
+    for (const Range& range : cell->GetReferencedRangesView())
+    {
+        range_dependencies_.Erase(range, pos);
+    }
+    if (workbook_)
+    {
+        workbook_->RemoveSheetReferences(*this, pos, *cell);
+    }
+    RemoveSpill(pos);
+}
+
+void Sheet::UpdateColumnIndexes(Position pos)
+{
+    if (auto it = aggregate_indexes_.find(pos.col); it != aggregate_indexes_.end())
+    {
+        it->second.Set(pos.row, FindCell(pos));
+    }
+    if (auto it = lookup_indexes_.find(pos.col); it != lookup_indexes_.end())
+    {
+        it->second.MarkDirty(pos.row);
+    }
+    // Правки идут вне вычисления формул, поэтому карты можно сбросить здесь
+    if (predicate_cache_.GetBitCount() > PREDICATE_CACHE_MAX_BITS)
+    {
+        predicate_cache_.Clear();
+    }
+    predicate_cache_.MarkDirty(pos);
+}
+
+void Sheet::UpdatePrintableSize()
+{
+    max_row_ = 0;
+    max_col_ = 0;
+
+    // Сканируем тайлы, пропуская пустые
+    for (int tile_row = 0; tile_row < static_cast<int>(tiles_.size()); ++tile_row)
+    {
+        for (int tile_col = 0; tile_col < static_cast<int>(tiles_[tile_row].size()); ++tile_col)
+        {
+            TileSlot& slot = tiles_[tile_row][tile_col];
+            if (slot.cell_count == 0)
+            {
+                continue;
+            }
+            if (!slot.extent_is_valid)
+            {
+                UpdateTileExtent(slot);
+            }
+            max_row_ = std::max(max_row_, tile_row * TILE_SIZE + slot.rows);
+            max_col_ = std::max(max_col_, tile_col * TILE_SIZE + slot.cols);
+        }
+    }
+    // Живые области разлива печатаются вместе с ячейками
+    for (const auto& [anchor, spill] : spills_)
+    {
+        if (!spill.blocked)
+        {
+            max_row_ = std::max(max_row_, spill.area.to.row + 1);
+            max_col_ = std::max(max_col_, spill.area.to.col + 1);
+        }
+    }
+
+    // Перерасчет произведен
+    area_is_valid_ = true;
+}
+
+void Sheet::ExtendPrintableSize(Position pos)
+{
+    if (!area_is_valid_)
+    {
+        UpdatePrintableSize();
+        return;
+    }
+    // Ячейка по pos существует, значит область печати её включает
+    max_row_ = std::max(max_row_, pos.row + 1);
+    max_col_ = std::max(max_col_, pos.col + 1);
+}
+
+Cell* Sheet::FindCell(Position pos) const
+{
+    TileSlot* slot = FindSlot(pos);
+    if (!slot || slot->cell_count == 0)
+    {
+        return nullptr;
+    }
+    return LoadTile(*slot, TilePosition(pos))->cells[TileCellIndex(pos)].get();
+}
+
+void Sheet::PutCell(Position pos, std::unique_ptr<Cell> cell)
+{
+    const Position tile_pos = TilePosition(pos);
+    TileSlot& slot = GetOrCreateSlot(pos);
+
+    SheetTile* tile = nullptr;
+    if (slot.cell_count == 0)
+    {
+        // Первая ячейка тайла: создаём тайл
+        slot.tile = std::make_unique<SheetTile>();
+        tile = slot.tile.get();
+        if (store_)
+        {
+            slot.bytes = sizeof(SheetTile);
+            slot.lru_it = lru_.insert(lru_.begin(), tile_pos);
+            ++paging_stats_.resident_tiles;
+            paging_stats_.resident_bytes += slot.bytes;
+        }
+    }
+    else
+    {
+        tile = LoadTile(slot, tile_pos);
+    }
+
+    if (store_)
+    {
+        const std::size_t bytes = EstimateCellBytes(cell->GetTextView());
+        slot.bytes += bytes;
+        paging_stats_.resident_bytes += bytes;
+    }
+    const bool stale = cell->GetFormula() && !cell->IsCacheValid();
+    tile->cells[TileCellIndex(pos)] = std::move(cell);
+    MarkStale(pos, stale);
+
+    ++slot.cell_count;
+    slot.rows = std::max(slot.rows, pos.row % TILE_SIZE + 1);
+    slot.cols = std::max(slot.cols, pos.col % TILE_SIZE + 1);
+    slot.stored = false;
+}
+
+bool Sheet::RemoveCell(Position pos)
+{
+    TileSlot* slot = FindSlot(pos);
+    if (!slot || slot->cell_count == 0)
+    {
+        return false;
+    }
+
+    const Position tile_pos = TilePosition(pos);
+    auto& cell = LoadTile(*slot, tile_pos)->cells[TileCellIndex(pos)];
+    if (!cell)
+    {
+        return false;
+    }
+
+    if (store_)
+    {
+        const std::size_t bytes = EstimateCellBytes(cell->GetTextView());
+        slot->bytes -= bytes;
+        paging_stats_.resident_bytes -= bytes;
+    }
+    cell.reset();
+    MarkStale(pos, false);
+    slot->stored = false;
+
+    if (--slot->cell_count == 0)
+    {
+        // Тайл опустел: освобождаем его и место в хранилище
+        if (store_)
+        {
+            lru_.erase(slot->lru_it);
+            --paging_stats_.resident_tiles;
+            paging_stats_.resident_bytes -= slot->bytes;
+            store_->Erase(TileId(tile_pos));
+        }
+        *slot = TileSlot{};
+    }
+    else
+    {
+        slot->extent_is_valid = false;
+    }
+    return true;
+}
+
+void Sheet::CellChanged(Position pos, std::string_view old_text)
+{
+    TileSlot* slot = FindSlot(pos);
+    slot->stored = false;
+    if (store_)
+    {
+        const std::size_t old_bytes = EstimateCellBytes(old_text);
+        const std::size_t new_bytes = EstimateCellBytes(slot->tile->cells[TileCellIndex(pos)]->GetTextView());
+        slot->bytes = slot->bytes - old_bytes + new_bytes;
+        paging_stats_.resident_bytes = paging_stats_.resident_bytes - old_bytes + new_bytes;
+    }
+}
+
+void Sheet::MarkStale(Position pos, bool stale) const
+{
+    TileSlot* slot = FindSlot(pos);
+    auto bit = slot->stale_formulas[TileCellIndex(pos)];
+    if (bit != stale)
+    {
+        bit = stale;
+        if (stale)
+        {
+            ++stale_formulas_;
+        }
+        else
+        {
+            --stale_formulas_;
+        }
+    }
+}
+
+bool Sheet::IsStaleFormula(Position pos) const
+{
+    TileSlot* slot = FindSlot(pos);
+    if (!slot || slot->cell_count == 0)
+    {
+        return false;
+    }
+    if (!slot->tile && slot->values_are_stale)
+    {
+        LoadTile(*slot, TilePosition(pos));
+    }
+    return slot->stale_formulas[TileCellIndex(pos)];
+}
+
+Sheet::TileSlot* Sheet::FindSlot(Position pos) const
+{
+    const Position tile_pos = TilePosition(pos);
+    if (tile_pos.row >= static_cast<int>(tiles_.size())
+        || tile_pos.col >= static_cast<int>(tiles_[tile_pos.row].size()))
+    {
+        return nullptr;
+    }
+    return &tiles_[tile_pos.row][tile_pos.col];
+}
+
+Sheet::TileSlot& Sheet::GetOrCreateSlot(Position pos)
+{
+    const Position tile_pos = TilePosition(pos);
+
+    // Если строк тайлов меньше, чем нужно, добавляем пустые
+    if (static_cast<int>(tiles_.size()) < tile_pos.row + 1)
+    {
+        tiles_.resize(tile_pos.row + 1);
+    }
+    // То же для тайлов в строке
+    if (static_cast<int>(tiles_[tile_pos.row].size()) < tile_pos.col + 1)
+    {
+        tiles_[tile_pos.row].resize(tile_pos.col + 1);
+    }
+    return tiles_[tile_pos.row][tile_pos.col];
+}
+
+SheetTile* Sheet::LoadTile(TileSlot& slot, Position tile_pos) const
+{
+    if (slot.tile)
+    {
+        if (store_)
+        {
+            // Отмечаем обращение
+            lru_.splice(lru_.begin(), lru_, slot.lru_it);
+        }
+        return slot.tile.get();
+    }
+
+    // Тайл выгружен. Ячейки создаются для этого листа; константность
+    // снимаем, так как подкачка не меняет содержимое листа
+    auto tile = std::make_unique<SheetTile>();
+    DecodeTile(store_->Read(TileId(tile_pos)), *tile, const_cast<Sheet&>(*this), !slot.values_are_stale);
+    slot.tile = std::move(tile);
+    if (slot.values_are_stale)
+    {
+        // В хранилище остались устаревшие значения, копию нужно перезаписать
+        slot.values_are_stale = false;
+        slot.stored = false;
+        // Значения формул тайла не загружены
+        for (int i = 0; i < TILE_CELLS; ++i)
+        {
+            const Cell* cell = slot.tile->cells[i].get();
+            if (cell && cell->GetFormula())
+            {
+                MarkStale(Position{ tile_pos.row * TILE_SIZE + i / TILE_SIZE, tile_pos.col * TILE_SIZE + i % TILE_SIZE },
+                          true);
+            }
+        }
+    }
+
+    slot.lru_it = lru_.insert(lru_.begin(), tile_pos);
+    ++paging_stats_.page_ins;
+    ++paging_stats_.resident_tiles;
+    paging_stats_.resident_bytes += slot.bytes;
+    return slot.tile.get();
+}
+
+void Sheet::EvictTiles() const
+{
+    if (!store_ || eviction_guards_ != 0)
+    {
+        return;
+    }
+
+    // Последний использованный тайл не выгружаем: указатель на его ячейку
+    // мог только что вернуть GetCell()
+    while (paging_stats_.resident_bytes > paging_options_.memory_budget && lru_.size() > 1)
+    {
+        const Position tile_pos = lru_.back();
+        EvictTile(tiles_[tile_pos.row][tile_pos.col], tile_pos);
+    }
+}
+
+void Sheet::EvictTile(TileSlot& slot, Position tile_pos) const
+{
+    // Занятая часть нужна для области печати и после выгрузки
+    if (!slot.extent_is_valid)
+    {
+        UpdateTileExtent(slot);
+    }
+    if (!slot.stored)
+    {
+        store_->Write(TileId(tile_pos), EncodeTile(*slot.tile));
+        slot.stored = true;
+        ++paging_stats_.tile_writes;
+    }
+
+    lru_.erase(slot.lru_it);
+    slot.tile.reset();
+    ++paging_stats_.page_outs;
+    --paging_stats_.resident_tiles;
+    paging_stats_.resident_bytes -= slot.bytes;
+}
+
+void Sheet::UpdateTileExtent(TileSlot& slot)
+{
+    slot.rows = 0;
+    slot.cols = 0;
+    for (int i = 0; i < TILE_CELLS; ++i)
+    {
+        if (slot.tile->cells[i])
+        {
+            slot.rows = std::max(slot.rows, i / TILE_SIZE + 1);
+            slot.cols = std::max(slot.cols, i % TILE_SIZE + 1);
+        }
     }
+    slot.extent_is_valid = true;
 }
 
 // Создаёт готовую к работе пустую таблицу. Объявление в common.h
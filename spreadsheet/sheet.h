@@ -1,12 +1,91 @@
 #pragma once
 
 #include "cell.h"
+#include "change_feed.h"
+#include "column_index.h"
 #include "common.h"
+#include "criteria.h"
+#include "lookup.h"
+#include "range_index.h"
+#include "snapshot.h"
+#include "tile_store.h"
 
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <chrono>
 #include <functional>
+#include <list>
 #include <map>
+#include <mutex>
+#include <optional>
 #include <set>
 
+class EditJournal;
+class Workbook;
+
+// Правка ячейки для пакетного применения через Sheet::ApplyEdits()
+struct CellEdit
+{
+    Position pos;
+    std::optional<std::string> text;    // std::nullopt - очистить ячейку
+};
+
+// Буферы вызывающей стороны для Sheet::GetValues(). Каждый указатель, если
+// он не nullptr, указывает на массив из rows * cols элементов, в который
+// значения диапазона записываются построчно.
+struct ValueBuffers
+{
+    double* numbers = nullptr;             // число; 0 для остальных значений
+    ValueCode* codes = nullptr;
+    std::string_view* texts = nullptr;     // текст без экранирующего апострофа
+};
+
+// Итог Sheet::EvaluateViewport()
+struct ViewportStats
+{
+    std::size_t evaluated = 0;    // формул вычислено: в окне и влияющих на них
+    std::size_t skipped = 0;      // формул листа, оставшихся без значения в кэше
+};
+
+// Ограничение Sheet::Recalculate(): вычисление останавливается между
+// ячейками, как только наступил срок deadline или выставлен флаг cancel
+struct RecalcLimit
+{
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    const std::atomic<bool>* cancel = nullptr;    // флаг не принадлежит ограничению
+
+    // Ограничение временем budget от текущего момента
+    static RecalcLimit Budget(std::chrono::steady_clock::duration budget);
+    bool IsReached() const;
+};
+
+// Итог Sheet::Recalculate()
+struct RecalcProgress
+{
+    std::size_t evaluated = 0;    // формул вычислено этим вызовом
+    std::size_t remaining = 0;    // формул диапазонов, оставшихся без значения в кэше
+    bool complete = false;        // все формулы диапазонов вычислены
+};
+
+// Лист таблицы.
+// Формула массива (см. formula.h) разливается: её массив занимает область
+// своего размера с левым верхним углом в ячейке формулы (якоре). Ячейки
+// области, кроме якоря, не хранятся и не имеют своих формул и рёбер графа:
+// их значения - элементы массива, вычисляемого за один проход и хранимого у
+// якоря, а зависят они от якоря. Если в области есть непустая ячейка, она
+// пересекается с областью другого якоря или не помещается в лист, массив не
+// разливается, и значение якоря - #SPILL!. Живые области разлива входят в
+// область печати.
+//
+// Константные чтения (GetCell, значения ячеек, GetValues) можно вызывать из
+// нескольких потоков одновременно, если лист никто не правит и подкачка
+// тайлов выключена. Каждая формула при этом вычисляется один раз: первый
+// поток вычисляет её, остальные ждут готового значения (см. Cell).
+//
+// Лист может принадлежать книге (см. Workbook): тогда его формулы читают
+// ячейки других листов книги по ссылкам вида Sheet2!A1, а правка листа
+// сбрасывает кэш формул других листов, зависящих от изменившихся значений.
 class Sheet : public SheetInterface
 {
 public:
@@ -22,40 +101,482 @@ public:
 
     Size GetPrintableSize() const override;
 
+    // Читает значения диапазона size с левым верхним углом top_left за один
+    // проход по тайлам, вычисляя формулы при необходимости. Строки в texts
+    // ссылаются прямо на тексты ячеек и валидны до следующего вызова методов
+    // листа. Бросает InvalidPositionException, если диапазон выходит за
+    // пределы листа.
+    void GetValues(Position top_left, Size size, const ValueBuffers& out) const;
+    // Значение одной ячейки pos с учётом разлива, без копирования текста и
+    // без выгрузки тайлов. Текст действителен до следующего вызова методов
+    // листа. Бросает InvalidPositionException для некорректной позиции.
+    CellValueView GetValueView(Position pos) const;
+
+    // Вычисляет формулы окна viewport и все формулы, от которых они
+    // транзитивно зависят, и сохраняет их значения в кэше ячеек. Остальные
+    // формулы не вычисляются, пока их значения не понадобятся. Формулы,
+    // значения которых уже в кэше, пропускаются вместе с влияющими на них;
+    // правка сбрасывает кэш всех зависимых формул. Бросает
+    // InvalidPositionException для некорректного окна.
+    ViewportStats EvaluateViewport(const Range& viewport);
+
+    // Вычисляет формулы диапазонов ranges (без аргумента - всего листа) и
+    // влияющие на них, как EvaluateViewport(), пока не сработает limit.
+    // Ячейки вычисляются по одной в порядке зависимостей, и проверка limit
+    // идёт между ними, поэтому вычисленные значения остаются в кэше, а
+    // следующий вызов продолжает с оставшихся. По сроку вызов останавливается
+    // не раньше первой вычисленной формулы, так что серия вызовов с любым
+    // бюджетом доходит до конца; по флагу отмены - сразу. Бросает
+    // InvalidPositionException для некорректного диапазона.
+    RecalcProgress Recalculate(const std::vector<Range>& ranges, const RecalcLimit& limit = {});
+    RecalcProgress Recalculate(const RecalcLimit& limit = {});
+
+    // Вычисляет формулы, от значений которых зависит formula (её ячейки и
+    // диапазоны), без рекурсии, в порядке зависимостей. После этого formula
+    // читает только значения из кэша, и длина цепочки ссылок ограничена
+    // памятью, а не стеком. Ячейка вызывает метод перед вычислением своей
+    // формулы; внутри обхода формул этого листа он ничего не делает. Ссылки
+    // на другие листы книги обход тоже раскрывает. Можно вызывать из
+    // нескольких потоков на тех же условиях, что и константные чтения.
+    void EvaluatePrecedents(const FormulaInterface& formula) const;
+
+    // Лист name книги, которой принадлежит этот лист, или nullptr, если
+    // такого листа нет или лист не в книге. По нему вычисляются ссылки
+    // формул на другие листы (см. SheetReference)
+    const Sheet* GetLinkedSheet(std::string_view name) const;
+
+    // Подписывает observer на изменения значений ячеек диапазонов ranges
+    // (пустой вектор - всего листа). После каждой правки (SetCell(),
+    // ClearCell(), пакета ApplyEdits()) формулы, значения которых могли
+    // измениться, вычисляются, и observer получает одним списком ячейки, чьи
+    // значения действительно изменились. Наблюдаемые значения хранятся, пока
+    // есть подписки. В режиме NotifyMode::Invalidated ничего не вычисляется:
+    // observer получает все ячейки, значения которых могли измениться.
+    // Observer не принадлежит листу и должен жить, пока подписан. Бросает
+    // InvalidPositionException для некорректного диапазона.
+    void Subscribe(SheetObserver& observer, std::vector<Range> ranges = {},
+                   NotifyMode mode = NotifyMode::Changed);
+    void Unsubscribe(const SheetObserver& observer);
+
+    // Область, на которую разлился массив формулы в ячейке anchor, или
+    // nullopt, если массива там нет или ему негде разлиться
+    std::optional<Range> GetSpillRange(Position anchor) const;
+
+    // Включает индекс агрегатов столбца col (см. ColumnAggregateIndex). После
+    // этого SUM, AVERAGE, MIN, MAX и COUNT по диапазонам из индексированных
+    // столбцов обходятся за O(log n) плюс число формул в диапазоне вместо
+    // чтения всего диапазона. Индекс обновляется при каждой правке ячейки
+    // столбца. Бросает InvalidPositionException для несуществующего столбца.
+    void EnableAggregateIndex(int col);
+    bool HasAggregateIndex(int col) const;
+    // Добавляет значения range в aggregate через индексы столбцов. Возвращает
+    // false, не трогая aggregate, если какой-то столбец не индексирован или
+    // в диапазоне есть нечисловой текст: тогда результат (кроме COUNT) -
+    // первая по порядку ошибка, и диапазон нужно читать целиком.
+    bool AggregateRange(const Range& range, Aggregate& aggregate) const;
+
+    // Ищет key в векторе vector (диапазон из одной строки или одного
+    // столбца, см. lookup.h). Возвращает номер найденной ячейки вектора
+    // (с 0) или nullopt. Для точного поиска по достаточно длинному столбцу
+    // при первом обращении строится хэш-индекс столбца, который затем
+    // поддерживается при правках листа.
+    std::optional<int> Lookup(const Range& vector, double key, LookupMode mode) const;
+
+    // Условная функция по диапазону range (см. criteria.h): число ячеек,
+    // удовлетворяющих criterion, и сводка чисел values на их местах (values -
+    // диапазон того же размера или nullptr, если сводка не нужна). Подходящие
+    // ячейки берутся из битовой карты условия, общей для всех формул с тем же
+    // условием по тому же диапазону; после правок листа в ней перепроверяются
+    // только изменившиеся ячейки. Бросает FormulaError, если среди выбранных
+    // значений values есть ошибка.
+    ConditionalResult ConditionalAggregate(const Range& range, const Criterion& criterion,
+                                           const Range* values) const;
+
     void PrintValues(std::ostream& output) const override;
     void PrintTexts(std::ostream& output) const override;
 
-    // Производит сброс кэша для указанной ячейки и всех зависящих от нее
+    // Применяет правки по порядку. В отличие от серии вызовов SetCell() и
+    // ClearCell(), кэш зависимых ячеек сбрасывается и область печати
+    // пересчитывается один раз на весь пакет. Некорректная правка бросает то
+    // же исключение, что и SetCell(); правки до неё остаются применёнными.
+    // Если applied не nullptr, в него записывается число применённых правок,
+    // в том числе перед исключением - номер некорректной правки.
+    void ApplyEdits(const std::vector<CellEdit>& edits, std::size_t* applied = nullptr);
+
+    // Подключает журнал правок (nullptr - отключает). Каждая успешная правка
+    // записывается в журнал сразу после применения. После сбоя записи
+    // журнала правки бросают его исключение, не меняя лист; правка, на
+    // которой случился сбой, остаётся применённой. Журнал не принадлежит
+    // листу и должен жить, пока подключён.
+    void SetJournal(EditJournal* journal);
+
+    // Подключает хранилище тайлов в файле path. После этого тайлы, к которым
+    // дольше всего не обращались, выгружаются в файл, как только загруженные
+    // тайлы превышают options.memory_budget, и загружаются обратно при
+    // обращении к их ячейкам (в том числе при вычислении формул). Граф
+    // зависимостей остаётся в памяти.
+    // Указатель, полученный через GetCell(), остаётся валидным до следующего
+    // вызова методов листа; внутри вычисления формулы и правки листа тайлы
+    // не выгружаются (см. EvictionGuard).
+    void EnablePaging(const std::string& path, PagingOptions options = {});
+    PagingStats GetPagingStats() const;
+
+    // Пока объект жив, лист sheet не выгружает тайлы, и указатели на его
+    // ячейки остаются валидными
+    class EvictionGuard
+    {
+    public:
+        explicit EvictionGuard(const SheetInterface& sheet);
+        ~EvictionGuard();
+
+        EvictionGuard(const EvictionGuard&) = delete;
+        EvictionGuard& operator=(const EvictionGuard&) = delete;
+
+    private:
+        const Sheet* sheet_;
+    };
+
+    // Производит сброс кэша для всех ячеек, зависящих от указанной
     void InvalidateCell(const Position& pos);
     // Добавляет взаимосвязь "основная ячейка" - "зависящая ячейка".
     // dependent_cell чаще всего == this
     void AddDependentCell(const Position& main_cell, const Position& dependent_cell);
-    // Возвращает перечень ячеек, зависящих от pos
+    // Возвращает перечень ячеек, зависящих от pos, в том числе через диапазоны
     const std::set<Position> GetDependentCells(const Position& pos);
-    // Удаляет все зависимости для ячейки pos.
+    // Удаляет ячейку pos из списков зависимых у всех ячеек и диапазонов, на
+    // которые она ссылается. Ячейки, зависящие от самой pos, не затрагиваются.
     void DeleteDependencies(const Position& pos);
 
 private:
-    // Единый для всего листа словарь зависимых ячеек (ячейка - список зависимых от нее)
+    // Сохранение и загрузка бинарного снимка работают напрямую с ячейками и
+    // графом зависимостей (см. snapshot.h)
+    friend void WriteSnapshot(const SheetInterface& sheet, std::ostream& out,
+                              const SnapshotOptions& options);
+    friend std::unique_ptr<SheetInterface> LoadSnapshot(const std::string& path, SnapshotInfo* info);
+    // Книга ведёт зависимости между листами и обходит граф листов целиком
+    friend class Workbook;
+
+    // Единый для всего листа словарь зависимых ячеек (ячейка - список зависимых от нее).
+    // Содержит только ссылки на отдельные ячейки
     std::map<Position, std::set<Position>> cells_dependencies_;
+    // Ссылки на диапазоны: одна запись на диапазон формулы, сколько бы ячеек
+    // он ни покрывал
+    RangeIndex range_dependencies_;
+
+    // Область разлива формулы массива
+    struct SpillArea
+    {
+        Range area;              // только якорь, если массив не помещается в лист
+        bool fits = true;        // массив помещается в лист
+        bool blocked = false;    // массиву негде разлиться
+    };
+
+    // Ячейка области разлива, которую возвращает GetCell(): значение
+    // берётся у якоря. Заблокированный якорь тоже возвращается через неё,
+    // со значением #SPILL! и текстом самой ячейки
+    class SpillCell final : public CellInterface
+    {
+    public:
+        SpillCell(const Sheet& sheet, Position pos);
+
+        Value GetValue() const override;
+        std::string GetText() const override;
+        std::vector<Position> GetReferencedCells() const override;
+
+    private:
+        const Sheet& sheet_;
+        Position pos_;
+    };
+
+    // Области разлива по якорю и в пространственном индексе (область - якорь)
+    std::map<Position, SpillArea> spills_;
+    RangeIndex spill_areas_;
+    // Якоря, блокировку которых нужно перепроверить, и области удалённых
+    // живых разливов: изменения применяются при сбросе кэша (см. RefreshSpills())
+    std::set<Position> spill_checks_;
+    std::vector<Range> removed_spills_;
+    bool spills_changed_ = false;    // области разлива менялись: пересчитать область печати
+    // Ячейки, возвращённые GetCell() для областей разлива
+    mutable std::map<Position, std::unique_ptr<SpillCell>> spill_cells_;
+    mutable std::mutex spill_cells_mutex_;
+
+    // Подписка на изменения значений: ranges пуст - весь лист
+    struct Subscription
+    {
+        SheetObserver* observer = nullptr;
+        std::vector<Range> ranges;
+        NotifyMode mode = NotifyMode::Changed;
+    };
+    std::vector<Subscription> subscriptions_;
+    PublishedValues published_;
+    // Ячейки, значения которых могли измениться с прошлого уведомления
+    // подписчиков, и буфер уведомления. Память буферов переиспользуется
+    std::vector<Position> pending_changes_;
+    std::vector<Position> notification_;
+
+    // Индексы агрегатов по номеру столбца
+    std::map<int, ColumnAggregateIndex> aggregate_indexes_;
+    // Индексы поиска по номеру столбца. Строятся при вычислении формул
+    mutable std::map<int, ColumnLookupIndex> lookup_indexes_;
+    // Битовые карты условий SUMIF/COUNTIF/AVERAGEIF. Строятся при вычислении формул
+    mutable PredicateCache predicate_cache_;
+    // Защищает индексы поиска и карты условий при чтении листа из нескольких
+    // потоков. Рекурсивный: вычисление формулы с поиском может вложенно
+    // искать по другому столбцу
+    mutable std::recursive_mutex caches_mutex_;
+
+    // Ячейка тайловой сетки. Сведения о тайле хранятся и тогда, когда сам
+    // тайл выгружен в хранилище
+    struct TileSlot
+    {
+        std::unique_ptr<SheetTile> tile;    // nullptr - тайла нет или он выгружен
+        int cell_count = 0;                 // число ячеек (не nullptr) в тайле
+        int rows = 0;                       // занятая часть тайла для области печати
+        int cols = 0;
+        bool extent_is_valid = true;        // rows/cols актуальны
+        // Формулы без значения в кэше. У выгруженного тайла с values_are_stale
+        // отмечаются при загрузке
+        std::bitset<TILE_CELLS> stale_formulas;
+        // Подкачка
+        bool stored = false;                // в хранилище есть актуальная копия тайла
+        bool values_are_stale = false;      // кэш формул выгруженного тайла устарел
+        std::size_t bytes = 0;              // оценка занятой тайлом памяти
+        std::list<Position>::iterator lru_it;
+    };
+
+    // Сетка тайлов по аналогии с прежней сеткой ячеек: вектор строк тайлов,
+    // каждая растёт по мере необходимости. Подкачка тайлов не меняет
+    // содержимое листа, поэтому сетка и состояние подкачки mutable
+    mutable std::vector<std::vector<TileSlot>> tiles_;
+
+    std::unique_ptr<TileStore> store_;      // Хранилище тайлов, если подключено
+    PagingOptions paging_options_;
+    mutable std::list<Position> lru_;       // Загруженные тайлы, в начале - недавние
+    mutable PagingStats paging_stats_;
+    mutable std::atomic<int> eviction_guards_{ 0 };    // Число активных EvictionGuard
+    // Число формул без значения в кэше (см. TileSlot::stale_formulas)
+    mutable std::size_t stale_formulas_ = 0;
 
-    std::vector<std::vector<std::unique_ptr<Cell>>> sheet_;
-    /* Мой комментарий к вектору векторов для ревью (все равно вопросы возникнут)
-    *  1) Такой вариант валиден, предусмотрен подсказкой
-    *  2) Укладывается в заданные временнЫе рамки требований к скорости алгоритмов
-    *  3) Более легкая организация вектора векторов компенсируется более сложной
-    *     частью навигации по индексам при модификациях листа.
-    */
+    EditJournal* journal_ = nullptr;    // Журнал правок, если подключён
+    Workbook* workbook_ = nullptr;      // Книга, которой принадлежит лист
 
     int max_row_ = 0;    // Число строк в Printable Area
     int max_col_ = 0;    // Число столбцов в Printable Area
     bool area_is_valid_ = true;    // Флаг валидности текущих значений max_row_/col_
 
+    // Меняют содержимое ячейки и граф зависимостей, не трогая кэш зависимых
+    // ячеек, область печати и журнал. DoClearCell() возвращает false, если
+    // ячейки не было
+    void DoSetCell(Position pos, const std::string& text);
+    bool DoClearCell(Position pos);
+    // Обновляет индексы столбца pos и карты условий после правки ячейки pos
+    void UpdateColumnIndexes(Position pos);
+    // Сбрасывает кэш всех ячеек, транзитивно зависящих от ячеек из changed.
+    // Рёбра графа, которые формула с ветвлением при последнем вычислении не
+    // использовала, пропускаются (см. MayDependOn())
+    void InvalidateCells(const std::vector<Position>& changed);
+    // Сбрасывает кэш формул cells, значения которых зависят от изменившихся
+    // ячеек другого листа книги, и всех ячеек, транзитивно зависящих от них
+    void InvalidateFormulas(const std::vector<Position>& cells);
+    // Сбрасывает кэш ячейки pos, значение которой могло измениться
+    void InvalidateValue(Position pos);
+    // Вычисляет изменившиеся значения ячеек из pending_changes_ и уведомляет
+    // подписчиков
+    void PublishChanges();
+    // Запоминает текущие значения всех наблюдаемых ячеек
+    void RebuildPublished();
+    // Наблюдает ли подписка subscription за ячейкой pos
+    static bool IsObserved(const Subscription& subscription, Position pos);
+    // Вычисляет формулы диапазонов roots без значения в кэше и влияющие на
+    // них, сохраняя значения в кэше, пока не сработает limit (см.
+    // Recalculate()). remaining в итоге считается, только если вычисление
+    // прервано. Без clear_marks отметки stale не меняются: так обход можно
+    // вести из нескольких потоков сразу (см. EvaluatePrecedents())
+    RecalcProgress EvaluateStale(const std::vector<Range>& roots, const RecalcLimit& limit = {},
+                                 bool clear_marks = true) const;
+    // Отмечает в индексах поиска и картах условий, что значение pos изменилось
+    void MarkValueChanged(Position pos);
+    // Может ли значение ячейки dependent, ссылающейся на pos, зависеть от pos
+    // (см. FormulaInterface::MayDependOn()). Для ячеек выгруженных тайлов - да
+    bool MayDependOn(Position dependent, Position pos) const;
+    // Регистрирует ячейку pos зависимой от ячеек и диапазонов её формулы
+    // и область разлива формулы массива
+    void AddDependencies(Position pos, const Cell& cell);
+
+    // Область разлива массива размера size с якорем anchor
+    static SpillArea MakeSpillArea(Position anchor, Size size);
+    // Регистрирует область разлива формулы массива cell в якоре anchor и
+    // удаляет её. Блокировка соседних якорей перепроверяется в RefreshSpills()
+    void AddSpill(Position anchor, const Cell& cell);
+    void RemoveSpill(Position anchor);
+    // Негде ли разлиться массиву якоря anchor
+    bool IsSpillBlocked(Position anchor, const SpillArea& spill) const;
+    // Перепроверяет блокировку якорей, области которых содержат ячейки
+    // changed или менялись соседние области. В changed_values добавляет
+    // ячейки, значения которых от этого изменились
+    void RefreshSpills(const std::vector<Position>& changed, std::vector<Position>& changed_values);
+    // Якорь живого разлива, область которого содержит pos (кроме самого
+    // якоря), или pos, если это заблокированный якорь, иначе nullopt
+    std::optional<Position> FindSpillAnchor(Position pos) const;
+    // Значение pos, заданное разливом (см. FindSpillAnchor()), или nullopt
+    std::optional<CellValueView> FindSpillValue(Position pos) const;
+    // Проверяет, замкнёт ли содержимое cell, помещённое в pos, цикл: ведёт
+    // ли от pos путь по зависимым ячейкам к одной из ссылок cell. Обходятся
+    // только зависимые от pos ячейки, диапазоны не раскрываются
+    bool IsCyclicDependent(Position pos, const Cell& cell) const;
+    // Создаёт пустые ячейки на месте несуществующих ячеек, на которые прямо
+    // ссылается формула cell. Часть текущей правки: журнал, публикация
+    // изменений и выгрузка тайлов остаются за ней
+    void CreateReferencedCells(const Cell& cell);
+    // Вызывает callback(dependent) для каждой ячейки, формула которой прямо
+    // ссылается на pos или на содержащий её диапазон
+    template <typename Callback>
+    void ForEachDependentCell(Position pos, Callback&& callback) const;
+
     // Пересчитывет максимальный размер области печати листа
     void UpdatePrintableSize();
-    // Проверяет существование ячейки по координатам pos, сама она может быть nullptr
-    bool CellExists(Position pos) const;
-    // Резервирует память для ячейки, если ячейка с таким адресом не существует.
-    // Не производит непосредственное создание элементов и не инвалидирует Printale Area
-    void Touch(Position pos);
+    // Расширяет область печати до существующей ячейки pos
+    void ExtendPrintableSize(Position pos);
+    // Возвращает ячейку pos, загружая её тайл при необходимости, или nullptr
+    Cell* FindCell(Position pos) const;
+    // Помещает новую ячейку в пустую позицию pos, создавая тайл при необходимости
+    void PutCell(Position pos, std::unique_ptr<Cell> cell);
+    // Удаляет ячейку pos. Возвращает false, если ячейки не было
+    bool RemoveCell(Position pos);
+    // Отмечает изменение содержимого ячейки pos, прежний текст которой old_text
+    void CellChanged(Position pos, std::string_view old_text);
+
+    // Отмечает, что значения формулы в ячейке pos нет в кэше (stale) или есть
+    void MarkStale(Position pos, bool stale) const;
+    // Нет ли значения формулы в ячейке pos в кэше. Загружает тайл, если его
+    // отметки могли устареть
+    bool IsStaleFormula(Position pos) const;
+    // Вызывает callback(pos) для формул диапазона range без значения в кэше
+    template <typename Callback>
+    void ForEachStaleFormula(const Range& range, Callback&& callback) const;
+
+    // Возвращает сведения о тайле, содержащем pos, или nullptr, если тайла нет
+    TileSlot* FindSlot(Position pos) const;
+    TileSlot& GetOrCreateSlot(Position pos);
+    // Загружает тайл из хранилища, если он выгружен, и отмечает обращение к нему
+    SheetTile* LoadTile(TileSlot& slot, Position tile_pos) const;
+    // Выгружает давно не использованные тайлы, пока не уложится в бюджет памяти.
+    // Ничего не делает внутри EvictionGuard
+    void EvictTiles() const;
+    void EvictTile(TileSlot& slot, Position tile_pos) const;
+    // Пересчитывает занятую часть тайла
+    static void UpdateTileExtent(TileSlot& slot);
+
+    // Вызывает callback(pos, cell) для всех ячеек листа по возрастанию позиции
+    template <typename Callback>
+    void ForEachCell(Callback&& callback) const;
 };
+
+template <typename Callback>
+void Sheet::ForEachDependentCell(Position pos, Callback&& callback) const
+{
+    if (auto it = cells_dependencies_.find(pos); it != cells_dependencies_.end())
+    {
+        for (const Position& dependent_cell : it->second)
+        {
+            callback(dependent_cell);
+        }
+    }
+    range_dependencies_.ForEachDependent(pos, callback);
+
+    // Ячейки области разлива зависят от якоря, хотя рёбер графа у них нет
+    if (auto it = spills_.find(pos); it != spills_.end())
+    {
+        const Range& area = it->second.area;
+        for (int row = area.from.row; row <= area.to.row; ++row)
+        {
+            for (int col = area.from.col; col <= area.to.col; ++col)
+            {
+                const Position spill_cell{ row, col };
+                if (!(spill_cell == pos))
+                {
+                    callback(spill_cell);
+                }
+            }
+        }
+    }
+}
+
+template <typename Callback>
+void Sheet::ForEachStaleFormula(const Range& range, Callback&& callback) const
+{
+    const Position first_tile = TilePosition(range.from);
+    const Position last_tile = TilePosition(range.to);
+    for (int tile_row = first_tile.row; tile_row <= last_tile.row && tile_row < static_cast<int>(tiles_.size());
+         ++tile_row)
+    {
+        auto& row_slots = tiles_[tile_row];
+        for (int tile_col = first_tile.col; tile_col <= last_tile.col && tile_col < static_cast<int>(row_slots.size());
+             ++tile_col)
+        {
+            TileSlot& slot = row_slots[tile_col];
+            if (slot.cell_count == 0)
+            {
+                continue;
+            }
+            if (!slot.tile && slot.values_are_stale)
+            {
+                // Отметки выгруженного тайла обновятся при загрузке
+                LoadTile(slot, Position{ tile_row, tile_col });
+            }
+            if (slot.stale_formulas.none())
+            {
+                continue;
+            }
+
+            const int from_row = std::max(range.from.row, tile_row * TILE_SIZE);
+            const int to_row = std::min(range.to.row, tile_row * TILE_SIZE + TILE_SIZE - 1);
+            const int from_col = std::max(range.from.col, tile_col * TILE_SIZE);
+            const int to_col = std::min(range.to.col, tile_col * TILE_SIZE + TILE_SIZE - 1);
+            for (int row = from_row; row <= to_row; ++row)
+            {
+                for (int col = from_col; col <= to_col; ++col)
+                {
+                    const Position pos{ row, col };
+                    if (slot.stale_formulas[TileCellIndex(pos)])
+                    {
+                        callback(pos);
+                    }
+                }
+            }
+        }
+    }
+}
+
+template <typename Callback>
+void Sheet::ForEachCell(Callback&& callback) const
+{
+    // Обход построчный, поэтому строка тайлов должна помещаться в бюджет
+    // памяти, иначе тайлы будут подкачиваться на каждой строке
+    for (int tile_row = 0; tile_row < static_cast<int>(tiles_.size()); ++tile_row)
+    {
+        for (int row = 0; row < TILE_SIZE; ++row)
+        {
+            for (int tile_col = 0; tile_col < static_cast<int>(tiles_[tile_row].size()); ++tile_col)
+            {
+                TileSlot& slot = tiles_[tile_row][tile_col];
+                // rows не меньше реально занятой части, даже если устарел
+                if (slot.cell_count == 0 || row >= slot.rows)
+                {
+                    continue;
+                }
+
+                const SheetTile* tile = LoadTile(slot, Position{ tile_row, tile_col });
+                for (int col = 0; col < slot.cols; ++col)
+                {
+                    if (const Cell* cell = tile->cells[row * TILE_SIZE + col].get())
+                    {
+                        callback(Position{ tile_row * TILE_SIZE + row, tile_col * TILE_SIZE + col }, *cell);
+                    }
+                }
+            }
+        }
+        // Строка тайлов пройдена, лишние тайлы можно выгрузить
+        EvictTiles();
+    }
+}
@@ -0,0 +1,383 @@
+#include "sheet_image.h"
+
+#include "durable_file.h"
+#include "tile_store.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+namespace
+{
+
+std::uint64_t AlignUp(std::uint64_t offset)
+{
+    return (offset + 7) & ~std::uint64_t{ 7 };
+}
+
+// Возвращает указатель на секцию из count элементов типа T, предварительно
+// проверив, что она целиком лежит внутри файла и правильно выровнена
+template <typename T>
+const T* GetSection(const MappedFile& file, std::uint64_t offset, std::uint64_t count)
+{
+    if (count == 0)
+    {
+        return nullptr;
+    }
+    if (offset % alignof(T) != 0 || offset > file.Size() || count > (file.Size() - offset) / sizeof(T))
+    {
+        throw SheetImageException("Sheet image section is out of file bounds");
+    }
+    return reinterpret_cast<const T*>(file.Data() + offset);
+}
+
+// Проверяет заголовок образа
+sheet_image::Header ParseHeader(const char* data, std::size_t size)
+{
+    sheet_image::Header header{};
+    if (size < sizeof(header))
+    {
+        throw SheetImageException("Sheet image file is too small");
+    }
+    std::memcpy(&header, data, sizeof(header));
+
+    if (std::memcmp(header.magic, sheet_image::MAGIC, sizeof(header.magic)) != 0)
+    {
+        throw SheetImageException("Not a sheet image file");
+    }
+    if (header.version != sheet_image::VERSION)
+    {
+        throw SheetImageException("Unsupported sheet image version " + std::to_string(header.version));
+    }
+    if (header.endian_mark != sheet_image::ENDIAN_MARK || header.header_size != sizeof(header))
+    {
+        throw SheetImageException("Sheet image was written on an incompatible platform");
+    }
+    return header;
+}
+
+// Секция образа: данные и их смещение в файле
+struct Section
+{
+    const void* data = nullptr;
+    std::uint64_t size = 0;
+    std::uint64_t offset = 0;
+};
+
+}  // namespace
+
+void WriteSheetImage(const SheetVersion& version, const std::string& path)
+{
+    std::vector<sheet_image::Row> rows;
+    std::vector<std::int32_t> columns;
+    std::vector<ValueCode> codes;
+    std::vector<double> numbers;
+    std::vector<sheet_image::Text> texts;
+    std::string strings;
+
+    // Ячейки обходим построчно через все тайлы строки, поэтому они сразу
+    // отсортированы по позиции
+    for (std::size_t tile_row = 0; tile_row < version.rows_.size(); ++tile_row)
+    {
+        if (!version.rows_[tile_row])
+        {
+            continue;
+        }
+        const SheetVersion::TileRow& tiles = *version.rows_[tile_row];
+        for (int r = 0; r < TILE_SIZE; ++r)
+        {
+            const auto row = static_cast<std::int32_t>(tile_row * TILE_SIZE + r);
+            const std::size_t row_first = columns.size();
+            for (std::size_t tile_col = 0; tile_col < tiles.size(); ++tile_col)
+            {
+                const SheetVersion::Tile* tile = tiles[tile_col].get();
+                if (!tile)
+                {
+                    continue;
+                }
+                for (int c = 0; c < TILE_SIZE; ++c)
+                {
+                    const int index = r * TILE_SIZE + c;
+                    auto text_it = tile->texts.find(index);
+                    if (tile->codes[index] == ValueCode::Empty && text_it == tile->texts.end())
+                    {
+                        continue;
+                    }
+                    columns.push_back(static_cast<std::int32_t>(tile_col * TILE_SIZE + c));
+                    codes.push_back(tile->codes[index]);
+                    numbers.push_back(tile->codes[index] == ValueCode::Number ? tile->numbers[index] : 0.0);
+                    sheet_image::Text text{ strings.size(), 0 };
+                    if (text_it != tile->texts.end())
+                    {
+                        text.size = text_it->second.size();
+                        strings += text_it->second;
+                    }
+                    texts.push_back(text);
+                }
+            }
+            if (columns.size() != row_first)
+            {
+                rows.push_back(sheet_image::Row{ row, 0, row_first });
+            }
+        }
+    }
+    const std::size_t row_count = rows.size();
+    rows.push_back(sheet_image::Row{ Position::MAX_ROWS, 0, columns.size() });
+
+    sheet_image::Header header{};
+    std::memcpy(header.magic, sheet_image::MAGIC, sizeof(header.magic));
+    header.version = sheet_image::VERSION;
+    header.endian_mark = sheet_image::ENDIAN_MARK;
+    header.header_size = sizeof(sheet_image::Header);
+    header.number = version.GetNumber();
+    header.printable_rows = version.GetPrintableSize().rows;
+    header.printable_cols = version.GetPrintableSize().cols;
+    header.row_count = row_count;
+    header.cell_count = columns.size();
+    header.string_size = strings.size();
+
+    // Раскладываем секции по файлу, выравнивая каждую по 8 байт
+    Section sections[] = {
+        { rows.data(), rows.size() * sizeof(sheet_image::Row) },
+        { columns.data(), columns.size() * sizeof(std::int32_t) },
+        { codes.data(), codes.size() * sizeof(ValueCode) },
+        { numbers.data(), numbers.size() * sizeof(double) },
+        { texts.data(), texts.size() * sizeof(sheet_image::Text) },
+        { strings.data(), strings.size() },
+    };
+    std::uint64_t offset = sizeof(sheet_image::Header);
+    for (auto& section : sections)
+    {
+        section.offset = AlignUp(offset);
+        offset = section.offset + section.size;
+    }
+    header.rows_offset = sections[0].offset;
+    header.columns_offset = sections[1].offset;
+    header.codes_offset = sections[2].offset;
+    header.numbers_offset = sections[3].offset;
+    header.texts_offset = sections[4].offset;
+    header.strings_offset = sections[5].offset;
+    header.file_size = offset;
+
+    std::string data(offset, '\0');
+    std::memcpy(data.data(), &header, sizeof(header));
+    for (const auto& section : sections)
+    {
+        if (section.size != 0)
+        {
+            std::memcpy(data.data() + section.offset, section.data, section.size);
+        }
+    }
+
+    try
+    {
+        WriteFileDurably(path, data);
+    }
+    catch (const std::exception& ex)
+    {
+        throw SheetImageException("Cannot write sheet image " + path + ": " + ex.what());
+    }
+}
+
+SheetImage::SheetImage(const std::string& path)
+{
+    try
+    {
+        file_ = std::make_unique<MappedFile>(path);
+    }
+    catch (const std::runtime_error& ex)
+    {
+        throw SheetImageException(ex.what());
+    }
+
+    header_ = ParseHeader(file_->Data(), file_->Size());
+    if (header_.file_size != file_->Size())
+    {
+        throw SheetImageException("Sheet image file is truncated");
+    }
+    if (header_.printable_rows < 0 || header_.printable_rows > Position::MAX_ROWS || header_.printable_cols < 0
+        || header_.printable_cols > Position::MAX_COLS)
+    {
+        throw SheetImageException("Sheet image printable size is invalid");
+    }
+    rows_ = GetSection<sheet_image::Row>(*file_, header_.rows_offset, header_.row_count + 1);
+    columns_ = GetSection<std::int32_t>(*file_, header_.columns_offset, header_.cell_count);
+    codes_ = GetSection<ValueCode>(*file_, header_.codes_offset, header_.cell_count);
+    numbers_ = GetSection<double>(*file_, header_.numbers_offset, header_.cell_count);
+    texts_ = GetSection<sheet_image::Text>(*file_, header_.texts_offset, header_.cell_count);
+    strings_ = GetSection<char>(*file_, header_.strings_offset, header_.string_size);
+}
+
+std::uint64_t SheetImage::GetNumber() const
+{
+    return header_.number;
+}
+
+Size SheetImage::GetPrintableSize() const
+{
+    return Size{ header_.printable_rows, header_.printable_cols };
+}
+
+std::size_t SheetImage::GetCellCount() const
+{
+    return static_cast<std::size_t>(header_.cell_count);
+}
+
+std::pair<std::uint64_t, std::uint64_t> SheetImage::FindRow(int row) const
+{
+    const sheet_image::Row* end = rows_ + header_.row_count;
+    const sheet_image::Row* it = std::lower_bound(rows_, end, row, [](const sheet_image::Row& entry, int value)
+                                                  {
+                                                      return entry.row < value;
+                                                  });
+    if (it == end || it->row != row)
+    {
+        return { 0, 0 };
+    }
+    // Следующая запись есть всегда: последняя строка - замыкающая
+    const std::uint64_t begin = it->first;
+    const std::uint64_t last = (it + 1)->first;
+    if (begin > last || last > header_.cell_count)
+    {
+        throw SheetImageException("Sheet image row index is corrupted");
+    }
+    return { begin, last };
+}
+
+std::uint64_t SheetImage::FindCell(Position pos) const
+{
+    const auto [begin, end] = FindRow(pos.row);
+    const std::int32_t* it = std::lower_bound(columns_ + begin, columns_ + end, pos.col);
+    return (it != columns_ + end && *it == pos.col) ? static_cast<std::uint64_t>(it - columns_)
+                                                    : header_.cell_count;
+}
+
+CellValueView SheetImage::ValueAt(std::uint64_t index) const
+{
+    const ValueCode code = codes_[index];
+    if (code > ValueCode::ErrorSpill)
+    {
+        throw SheetImageException("Sheet image value code is corrupted");
+    }
+    CellValueView value{ code, numbers_[index], {} };
+    if (code == ValueCode::Text)
+    {
+        // Значение текста - текст ячейки без экранирующего апострофа
+        value.text = TextAt(index);
+        if (!value.text.empty() && value.text.front() == ESCAPE_SIGN)
+        {
+            value.text.remove_prefix(1);
+        }
+    }
+    return value;
+}
+
+std::string_view SheetImage::TextAt(std::uint64_t index) const
+{
+    const sheet_image::Text& text = texts_[index];
+    if (text.offset > header_.string_size || text.size > header_.string_size - text.offset)
+    {
+        throw SheetImageException("Sheet image cell text is out of bounds");
+    }
+    return text.size == 0 ? std::string_view{} : std::string_view(strings_ + text.offset, text.size);
+}
+
+CellValueView SheetImage::GetValue(Position pos) const
+{
+    if (!pos.IsValid())
+    {
+        throw InvalidPositionException("Invalid position for SheetImage::GetValue()");
+    }
+    const std::uint64_t index = FindCell(pos);
+    return index != header_.cell_count ? ValueAt(index) : CellValueView{};
+}
+
+std::string_view SheetImage::GetText(Position pos) const
+{
+    if (!pos.IsValid())
+    {
+        throw InvalidPositionException("Invalid position for SheetImage::GetText()");
+    }
+    const std::uint64_t index = FindCell(pos);
+    return index != header_.cell_count ? TextAt(index) : std::string_view{};
+}
+
+void SheetImage::GetValues(Position top_left, Size size, const ValueBuffers& out) const
+{
+    const Position bottom_right{ top_left.row + size.rows - 1, top_left.col + size.cols - 1 };
+    if (size.rows < 0 || size.cols < 0 || !top_left.IsValid()
+        || (size.rows > 0 && size.cols > 0 && !bottom_right.IsValid()))
+    {
+        throw InvalidPositionException("Invalid range for SheetImage::GetValues()");
+    }
+
+    const std::size_t count = static_cast<std::size_t>(size.rows) * static_cast<std::size_t>(size.cols);
+    if (out.numbers)
+    {
+        std::fill(out.numbers, out.numbers + count, 0.0);
+    }
+    if (out.codes)
+    {
+        std::fill(out.codes, out.codes + count, ValueCode::Empty);
+    }
+    if (out.texts)
+    {
+        std::fill(out.texts, out.texts + count, std::string_view{});
+    }
+
+    // В каждой строке проходим только её ячейки внутри диапазона
+    for (int row = top_left.row; row <= bottom_right.row; ++row)
+    {
+        const auto [begin, end] = FindRow(row);
+        const std::size_t row_offset = static_cast<std::size_t>(row - top_left.row) * size.cols;
+        for (const std::int32_t* it = std::lower_bound(columns_ + begin, columns_ + end, top_left.col);
+             it != columns_ + end && *it <= bottom_right.col; ++it)
+        {
+            const std::uint64_t index = static_cast<std::uint64_t>(it - columns_);
+            const CellValueView value = ValueAt(index);
+            const std::size_t i = row_offset + static_cast<std::size_t>(*it - top_left.col);
+            if (out.numbers)
+            {
+                out.numbers[i] = value.code == ValueCode::Number ? value.number : 0.0;
+            }
+            if (out.codes)
+            {
+                out.codes[i] = value.code;
+            }
+            if (out.texts)
+            {
+                out.texts[i] = value.text;
+            }
+        }
+    }
+}
+
+SheetImageReader::SheetImageReader(std::string path)
+    : path_(std::move(path))
+    , current_(std::make_shared<const SheetImage>(path_))
+{}
+
+std::shared_ptr<const SheetImage> SheetImageReader::Get() const
+{
+    return std::atomic_load(&current_);
+}
+
+bool SheetImageReader::Refresh()
+{
+    // Номер версии читается из заголовка, не отображая файл
+    std::ifstream in(path_, std::ios::binary);
+    char buffer[sizeof(sheet_image::Header)];
+    in.read(buffer, sizeof(buffer));
+    const sheet_image::Header header = ParseHeader(buffer, static_cast<std::size_t>(in.gcount()));
+    if (header.number == Get()->GetNumber())
+    {
+        return false;
+    }
+
+    // Между чтением заголовка и открытием файл могли заменить ещё раз:
+    // тогда откроется более новая версия
+    auto image = std::make_shared<const SheetImage>(path_);
+    std::atomic_store(&current_, std::shared_ptr<const SheetImage>(std::move(image)));
+    return true;
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include "common.h"
+#include "mapped_file.h"
+#include "versioned_sheet.h"
+
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// Образ листа для читателей в других процессах.
+// Ведущий процесс записывает зафиксированную версию листа (SheetVersion) в
+// файл образа, а процессы-читатели отображают его в память и отвечают на
+// запросы значений и текстов прямо из отображения, ничего не разбирая и не
+// копируя. Страницы файла лежат в страничном кэше один раз, сколько бы
+// процессов его ни читало; файл в tmpfs (/dev/shm) живёт только в памяти.
+//
+// Файл состоит из заголовка и секций, выровненных по 8 байт:
+//  * rows    - непустые строки по возрастанию (Row) и замыкающая запись;
+//              first - номер первой ячейки строки в секциях ячеек;
+//  * columns - столбцы ячеек (i32) по возрастанию внутри строки;
+//  * codes   - коды значений ячеек (ValueCode);
+//  * numbers - числовые значения ячеек, 0 для остальных;
+//  * texts   - тексты ячеек (Text) в секции strings;
+//  * strings - тексты ячеек подряд, без разделителей.
+// Значение текстовой ячейки - её текст без экранирующего апострофа, поэтому
+// отдельно не хранится. Пустые ячейки в образ не попадают.
+//
+// Новая версия публикуется атомарно: образ пишется во временный файл и
+// переименовывается поверх прежнего (см. WriteFileDurably()). Читатель,
+// отобразивший прежний файл, продолжает читать его, пока не откроет новый
+// (см. SheetImageReader). Замена файла, отображённого другим процессом,
+// работает на POSIX-системах; на Windows она завершается ошибкой.
+// Формат привязан к платформе, как и снимок (см. snapshot.h).
+
+// Исключение, выбрасываемое при ошибке записи или чтения образа
+class SheetImageException : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+namespace sheet_image
+{
+
+inline constexpr char MAGIC[4] = { 'S', 'P', 'I', 'M' };
+inline constexpr std::uint32_t VERSION = 1;
+inline constexpr std::uint32_t ENDIAN_MARK = 0x01020304;
+
+struct Header
+{
+    char magic[4];
+    std::uint32_t version;
+    std::uint32_t endian_mark;
+    std::uint32_t header_size;        // sizeof(Header)
+
+    std::uint64_t number;             // номер версии листа (SheetVersion::GetNumber())
+    std::int32_t printable_rows;
+    std::int32_t printable_cols;
+    std::uint64_t row_count;          // без замыкающей записи
+    std::uint64_t cell_count;
+    std::uint64_t string_size;        // в байтах
+
+    // Смещения секций от начала файла
+    std::uint64_t rows_offset;
+    std::uint64_t columns_offset;
+    std::uint64_t codes_offset;
+    std::uint64_t numbers_offset;
+    std::uint64_t texts_offset;
+    std::uint64_t strings_offset;
+    std::uint64_t file_size;
+};
+
+struct Row
+{
+    std::int32_t row;
+    std::uint32_t reserved;
+    std::uint64_t first;
+};
+
+struct Text
+{
+    std::uint64_t offset;             // относительно начала секции strings
+    std::uint64_t size;
+};
+
+}  // namespace sheet_image
+
+// Записывает образ версии листа в path, атомарно заменяя прежний.
+// Бросает SheetImageException при ошибке записи.
+void WriteSheetImage(const SheetVersion& version, const std::string& path);
+
+// Отображённый в память образ листа. Методы повторяют чтения SheetVersion;
+// строки ссылаются прямо на отображение и действительны, пока жив образ.
+// Методы можно вызывать из любых потоков без синхронизации.
+class SheetImage
+{
+public:
+    // Отображает образ path в память. Читается и проверяется только
+    // заголовок, секции - при обращении к ним. Бросает SheetImageException,
+    // если файл не удалось открыть или он не является образом
+    explicit SheetImage(const std::string& path);
+
+    SheetImage(const SheetImage&) = delete;
+    SheetImage& operator=(const SheetImage&) = delete;
+
+    std::uint64_t GetNumber() const;
+    Size GetPrintableSize() const;
+    std::size_t GetCellCount() const;
+
+    // Значение и текст ячейки, как в SheetVersion. Бросают
+    // InvalidPositionException для некорректной позиции и
+    // SheetImageException, если прочитанная запись образа повреждена
+    CellValueView GetValue(Position pos) const;
+    std::string_view GetText(Position pos) const;
+    // Читает значения диапазона, как Sheet::GetValues()
+    void GetValues(Position top_left, Size size, const ValueBuffers& out) const;
+
+private:
+    std::unique_ptr<MappedFile> file_;
+    sheet_image::Header header_{};
+    const sheet_image::Row* rows_ = nullptr;
+    const std::int32_t* columns_ = nullptr;
+    const ValueCode* codes_ = nullptr;
+    const double* numbers_ = nullptr;
+    const sheet_image::Text* texts_ = nullptr;
+    const char* strings_ = nullptr;
+
+    // Ячейки строки row: [begin, end) в секциях ячеек; пустой отрезок, если
+    // строки в образе нет
+    std::pair<std::uint64_t, std::uint64_t> FindRow(int row) const;
+    // Номер ячейки pos или cell_count, если её нет
+    std::uint64_t FindCell(Position pos) const;
+    CellValueView ValueAt(std::uint64_t index) const;
+    std::string_view TextAt(std::uint64_t index) const;
+};
+
+// Текущий образ листа для процесса-читателя. Refresh() открывает образ
+// заново, если ведущий опубликовал новую версию; до этого читатели
+// продолжают работать с прежней. Методы можно вызывать из любых потоков.
+// Чтение полученного образа идёт без блокировок, но Get() и замена образа
+// в Refresh() - нет: std::atomic_load/store для shared_ptr в libstdc++
+// берут мьютекс из общего пула на время копирования указателя.
+class SheetImageReader
+{
+public:
+    // Открывает образ path. Бросает SheetImageException, как SheetImage
+    explicit SheetImageReader(std::string path);
+
+    // Текущий образ. Остаётся действительным, пока его держит вызывающий
+    std::shared_ptr<const SheetImage> Get() const;
+    // Проверяет номер версии в заголовке файла и открывает новый образ,
+    // если номер изменился. Возвращает true, если образ заменён
+    bool Refresh();
+
+private:
+    std::string path_;
+    // Читается и заменяется через std::atomic_load/store: в C++17 другого
+    // атомарного shared_ptr нет, а эти функции обычно не lock-free
+    std::shared_ptr<const SheetImage> current_;
+};
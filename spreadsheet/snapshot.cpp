@@ -0,0 +1,478 @@
+#include "snapshot.h"
+
+#include "cell.h"
+#include "durable_file.h"
+#include "formula.h"
+#include "mapped_file.h"
+#include "sheet.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+
+namespace
+{
+
+std::uint64_t AlignUp(std::uint64_t offset)
+{
+    return (offset + 7) & ~std::uint64_t{ 7 };
+}
+
+// Возвращает указатель на секцию из count элементов типа T, предварительно
+// проверив, что она целиком лежит внутри файла и правильно выровнена
+template <typename T>
+const T* GetSection(const MappedFile& file, std::uint64_t offset, std::uint64_t count)
+{
+    if (count == 0)
+    {
+        return nullptr;
+    }
+    if (offset % alignof(T) != 0 || offset > file.Size()
+        || count > (file.Size() - offset) / sizeof(T))
+    {
+        throw SnapshotException("Snapshot section is out of file bounds");
+    }
+    return reinterpret_cast<const T*>(file.Data() + offset);
+}
+
+// Секция снимка: данные и их смещение в файле
+struct Section
+{
+    const void* data = nullptr;
+    std::uint64_t size = 0;
+    std::uint64_t offset = 0;
+};
+
+// Проверяет заголовок снимка и приводит его к текущей версии формата
+snapshot::Header ParseHeader(const char* data, std::size_t size)
+{
+    // Поле, с которого начинаются добавленные в версии 2 поля
+    constexpr std::size_t V1_HEADER_SIZE = offsetof(snapshot::Header, edit_sequence);
+
+    snapshot::Header header{};
+    if (size < V1_HEADER_SIZE)
+    {
+        throw SnapshotException("Snapshot file is too small");
+    }
+    std::memcpy(&header, data, std::min(size, sizeof(header)));
+
+    if (std::memcmp(header.magic, snapshot::MAGIC, sizeof(header.magic)) != 0)
+    {
+        throw SnapshotException("Not a snapshot file");
+    }
+    if (header.version == 0 || header.version > snapshot::VERSION)
+    {
+        throw SnapshotException("Unsupported snapshot version " + std::to_string(header.version));
+    }
+
+    const std::size_t expected_header_size = (header.version == 1) ? V1_HEADER_SIZE
+                                                                   : sizeof(snapshot::Header);
+    if (header.endian_mark != snapshot::ENDIAN_MARK || header.header_size != expected_header_size
+        || header.instruction_size != sizeof(FormulaInstruction))
+    {
+        throw SnapshotException("Snapshot was written on an incompatible platform");
+    }
+    if (header.version == 1)
+    {
+        header.edit_sequence = 0;
+    }
+    return header;
+}
+
+SnapshotInfo ToSnapshotInfo(const snapshot::Header& header)
+{
+    SnapshotInfo info;
+    info.version = header.version;
+    info.with_values = (header.flags & snapshot::FLAG_WITH_VALUES) != 0;
+    info.cell_count = header.cell_count;
+    info.edit_sequence = header.edit_sequence;
+    return info;
+}
+
+}  // namespace
+
+void WriteSnapshot(const SheetInterface& sheet_interface, std::ostream& out,
+                   const SnapshotOptions& options)
+{
+    const Sheet* sheet = dynamic_cast<const Sheet*>(&sheet_interface);
+    if (!sheet)
+    {
+        throw SnapshotException("Snapshot can be saved only for Sheet");
+    }
+
+    std::vector<snapshot::Cell> cells;
+    std::string texts;
+    std::vector<FormulaInstruction> program;
+    std::vector<snapshot::Value> values;
+
+    // Ячейки обходим построчно, поэтому они сразу отсортированы по позиции
+    sheet->ForEachCell([&](Position pos, const Cell& cell)
+        {
+            snapshot::Cell record{};
+            record.row = pos.row;
+            record.col = pos.col;
+
+            const std::string_view text = cell.GetTextView();
+            record.text_offset = texts.size();
+            record.text_size = text.size();
+            texts += text;
+
+            snapshot::Value value{};
+            value.kind = snapshot::ValueKind::None;
+
+            switch (cell.GetType())
+            {
+            case CellType::FORMULA:
+            {
+                record.kind = snapshot::CellKind::Formula;
+                auto formula_program = cell.GetFormula()->GetProgram();
+                record.program_offset = program.size();
+                record.program_size = formula_program.size();
+                program.insert(program.end(), formula_program.begin(), formula_program.end());
+
+                if (options.with_values)
+                {
+                    auto cell_value = cell.GetValue();
+                    if (std::holds_alternative<double>(cell_value))
+                    {
+                        value.kind = snapshot::ValueKind::Number;
+                        value.number = std::get<double>(cell_value);
+                    }
+                    else
+                    {
+                        value.kind = snapshot::ValueKind::Error;
+                        value.error = static_cast<std::uint32_t>(
+                            std::get<FormulaError>(cell_value).GetCategory());
+                    }
+                }
+                break;
+            }
+            case CellType::TEXT:
+                record.kind = snapshot::CellKind::Text;
+                break;
+            default:
+                record.kind = snapshot::CellKind::Empty;
+                break;
+            }
+
+            cells.push_back(record);
+            if (options.with_values)
+            {
+                values.push_back(value);
+            }
+        });
+
+    // Граф зависимостей в формате CSR. Вершины - все позиции, встречающиеся
+    // в графе, рёбра - номера вершин в отсортированном списке
+    std::vector<Position> nodes;
+    for (const auto& [main_cell, dependent_cells] : sheet->cells_dependencies_)
+    {
+        nodes.push_back(main_cell);
+        nodes.insert(nodes.end(), dependent_cells.begin(), dependent_cells.end());
+    }
+    std::sort(nodes.begin(), nodes.end());
+    nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+
+    auto node_index = [&nodes](const Position& pos)
+    {
+        return static_cast<std::uint32_t>(
+            std::lower_bound(nodes.begin(), nodes.end(), pos) - nodes.begin());
+    };
+
+    std::vector<std::uint64_t> edge_offsets;
+    std::vector<std::uint32_t> edges;
+    edge_offsets.reserve(nodes.size() + 1);
+    auto dependencies_it = sheet->cells_dependencies_.begin();
+    for (const auto& node : nodes)
+    {
+        edge_offsets.push_back(edges.size());
+        if (dependencies_it != sheet->cells_dependencies_.end() && dependencies_it->first == node)
+        {
+            for (const auto& dependent_cell : dependencies_it->second)
+            {
+                edges.push_back(node_index(dependent_cell));
+            }
+            ++dependencies_it;
+        }
+    }
+    edge_offsets.push_back(edges.size());
+
+    snapshot::Header header{};
+    std::memcpy(header.magic, snapshot::MAGIC, sizeof(header.magic));
+    header.version = snapshot::VERSION;
+    header.endian_mark = snapshot::ENDIAN_MARK;
+    header.flags = options.with_values ? snapshot::FLAG_WITH_VALUES : 0;
+    header.header_size = sizeof(snapshot::Header);
+    header.instruction_size = sizeof(FormulaInstruction);
+    header.cell_count = cells.size();
+    header.text_size = texts.size();
+    header.instruction_count = program.size();
+    header.node_count = nodes.size();
+    header.edge_count = edges.size();
+    header.edit_sequence = options.edit_sequence;
+
+    // Раскладываем секции по файлу, выравнивая каждую по 8 байт
+    Section sections[] = {
+        { cells.data(), cells.size() * sizeof(snapshot::Cell) },
+        { texts.data(), texts.size() },
+        { program.data(), program.size() * sizeof(FormulaInstruction) },
+        { nodes.data(), nodes.size() * sizeof(Position) },
+        { edge_offsets.data(), edge_offsets.size() * sizeof(std::uint64_t) },
+        { edges.data(), edges.size() * sizeof(std::uint32_t) },
+        { values.data(), values.size() * sizeof(snapshot::Value) },
+    };
+    std::uint64_t offset = sizeof(snapshot::Header);
+    for (auto& section : sections)
+    {
+        section.offset = AlignUp(offset);
+        offset = section.offset + section.size;
+    }
+    header.cells_offset = sections[0].offset;
+    header.texts_offset = sections[1].offset;
+    header.program_offset = sections[2].offset;
+    header.nodes_offset = sections[3].offset;
+    header.edge_offsets_offset = sections[4].offset;
+    header.edges_offset = sections[5].offset;
+    header.values_offset = options.with_values ? sections[6].offset : 0;
+    header.file_size = offset;
+
+    static const char zeros[8] = {};
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    offset = sizeof(snapshot::Header);
+    for (const auto& section : sections)
+    {
+        out.write(zeros, static_cast<std::streamsize>(section.offset - offset));
+        if (section.size != 0)
+        {
+            out.write(static_cast<const char*>(section.data), static_cast<std::streamsize>(section.size));
+        }
+        offset = section.offset + section.size;
+    }
+
+    if (!out)
+    {
+        throw SnapshotException("Cannot write snapshot");
+    }
+}
+
+void SaveSnapshot(const SheetInterface& sheet, const std::string& path,
+                  const SnapshotOptions& options)
+{
+    const std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out)
+        {
+            throw SnapshotException("Cannot create snapshot file " + tmp_path);
+        }
+        WriteSnapshot(sheet, out, options);
+        out.close();
+        if (!out)
+        {
+            throw SnapshotException("Cannot write snapshot file " + tmp_path);
+        }
+    }
+
+    try
+    {
+        ReplaceFileDurably(tmp_path, path);
+    }
+    catch (const std::exception& ex)
+    {
+        throw SnapshotException("Cannot replace snapshot file " + path + ": " + ex.what());
+    }
+}
+
+SnapshotInfo ReadSnapshotInfo(const std::string& path)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+    {
+        throw SnapshotException("Cannot open snapshot file " + path);
+    }
+
+    char buffer[sizeof(snapshot::Header)];
+    in.read(buffer, sizeof(buffer));
+    return ToSnapshotInfo(ParseHeader(buffer, static_cast<std::size_t>(in.gcount())));
+}
+
+std::unique_ptr<SheetInterface> LoadSnapshot(const std::string& path, SnapshotInfo* info)
+{
+    std::unique_ptr<MappedFile> file;
+    try
+    {
+        file = std::make_unique<MappedFile>(path);
+    }
+    catch (const std::runtime_error& ex)
+    {
+        throw SnapshotException(ex.what());
+    }
+
+    snapshot::Header header = ParseHeader(file->Data(), file->Size());
+    if (header.file_size != file->Size())
+    {
+        throw SnapshotException("Snapshot file is truncated");
+    }
+
+    const bool with_values = (header.flags & snapshot::FLAG_WITH_VALUES) != 0;
+    const auto* cells = GetSection<snapshot::Cell>(*file, header.cells_offset, header.cell_count);
+    const auto* texts = GetSection<char>(*file, header.texts_offset, header.text_size);
+    const auto* program = GetSection<FormulaInstruction>(*file, header.program_offset,
+                                                         header.instruction_count);
+    const auto* nodes = GetSection<Position>(*file, header.nodes_offset, header.node_count);
+    const auto* edge_offsets = GetSection<std::uint64_t>(
+        *file, header.edge_offsets_offset, header.node_count == 0 ? 0 : header.node_count + 1);
+    const auto* edges = GetSection<std::uint32_t>(*file, header.edges_offset, header.edge_count);
+    const auto* values = with_values
+        ? GetSection<snapshot::Value>(*file, header.values_offset, header.cell_count)
+        : nullptr;
+
+    auto sheet = std::make_unique<Sheet>();
+
+    // Ячейки отсортированы, поэтому последняя ячейка задаёт число строк
+    // области печати
+    Position prev = Position::NONE;
+    for (std::uint64_t i = 0; i < header.cell_count; ++i)
+    {
+        Position pos{ cells[i].row, cells[i].col };
+        if (!pos.IsValid() || (i != 0 && !(prev < pos)))
+        {
+            throw SnapshotException("Snapshot cells are invalid or not sorted");
+        }
+        prev = pos;
+    }
+    if (header.cell_count != 0)
+    {
+        sheet->max_row_ = cells[header.cell_count - 1].row + 1;
+        for (std::uint64_t i = 0; i < header.cell_count; ++i)
+        {
+            sheet->max_col_ = std::max(sheet->max_col_, cells[i].col + 1);
+        }
+    }
+
+    for (std::uint64_t i = 0; i < header.cell_count; ++i)
+    {
+        const snapshot::Cell& record = cells[i];
+        if (record.text_offset > header.text_size || record.text_size > header.text_size - record.text_offset)
+        {
+            throw SnapshotException("Snapshot cell text is out of bounds");
+        }
+
+        auto cell = std::make_unique<Cell>(*sheet);
+        switch (record.kind)
+        {
+        case snapshot::CellKind::Empty:
+            cell->Set("");
+            break;
+        case snapshot::CellKind::Text:
+        {
+            std::string text(texts + record.text_offset, record.text_size);
+            // Текст, похожий на формулу, в снимке появиться не может
+            if (text.empty() || (text[0] == FORMULA_SIGN && text.size() > 1))
+            {
+                throw SnapshotException("Snapshot text cell is invalid");
+            }
+            cell->Set(text);
+            break;
+        }
+        case snapshot::CellKind::Formula:
+        {
+            if (record.program_offset > header.instruction_count
+                || record.program_size > header.instruction_count - record.program_offset)
+            {
+                throw SnapshotException("Snapshot formula program is out of bounds");
+            }
+
+            std::optional<CellInterface::Value> cached_value;
+            if (values)
+            {
+                if (values[i].kind == snapshot::ValueKind::Number)
+                {
+                    cached_value = values[i].number;
+                }
+                else if (values[i].kind == snapshot::ValueKind::Error
+                         && values[i].error <= static_cast<std::uint32_t>(FormulaError::Category::Spill))
+                {
+                    cached_value = FormulaError(static_cast<FormulaError::Category>(values[i].error));
+                }
+            }
+
+            try
+            {
+                cell->SetFormula(LoadFormula(program + record.program_offset, record.program_size),
+                                 std::move(cached_value));
+            }
+            catch (const FormulaException& ex)
+            {
+                throw SnapshotException(ex.what());
+            }
+            break;
+        }
+        default:
+            throw SnapshotException("Snapshot cell kind is invalid");
+        }
+
+        // Зависимости от диапазонов в граф снимка не входят: одна запись на
+        // диапазон восстанавливается прямо из формулы
+        for (const Range& range : cell->GetReferencedRangesView())
+        {
+            sheet->range_dependencies_.Insert(range, Position{ record.row, record.col });
+        }
+        sheet->AddSpill(Position{ record.row, record.col }, *cell);
+        sheet->PutCell(Position{ record.row, record.col }, std::move(cell));
+    }
+
+    // Вершины графа проверяются так же, как записи ячеек: по ним потом
+    // адресуются плитки, а вставка в конец словаря требует порядка
+    for (std::uint64_t i = 0; i < header.node_count; ++i)
+    {
+        if (!nodes[i].IsValid() || (i != 0 && !(nodes[i - 1] < nodes[i])))
+        {
+            throw SnapshotException("Snapshot graph nodes are invalid or not sorted");
+        }
+    }
+
+    // Граф: списки зависимых в CSR уже отсортированы, поэтому и словарь, и
+    // множества заполняются вставкой в конец за линейное время
+    for (std::uint64_t i = 0; i < header.node_count; ++i)
+    {
+        std::uint64_t begin = edge_offsets[i];
+        std::uint64_t end = edge_offsets[i + 1];
+        if (begin > end || end > header.edge_count)
+        {
+            throw SnapshotException("Snapshot dependency graph is invalid");
+        }
+        if (begin == end)
+        {
+            continue;
+        }
+
+        std::set<Position> dependent_cells;
+        for (std::uint64_t e = begin; e < end; ++e)
+        {
+            if (edges[e] >= header.node_count)
+            {
+                throw SnapshotException("Snapshot dependency graph is invalid");
+            }
+            dependent_cells.insert(dependent_cells.end(), nodes[edges[e]]);
+        }
+        sheet->cells_dependencies_.emplace_hint(sheet->cells_dependencies_.end(), nodes[i],
+                                                std::move(dependent_cells));
+    }
+
+    // Блокировку разливов можно проверить только по всем ячейкам. Кэша,
+    // который нужно было бы сбросить, у нового листа нет
+    for (const auto& [anchor, spill] : sheet->spills_)
+    {
+        sheet->spill_checks_.insert(anchor);
+    }
+    std::vector<Position> changed_values;
+    sheet->RefreshSpills({}, changed_values);
+
+    if (info)
+    {
+        *info = ToSnapshotInfo(header);
+    }
+    return sheet;
+}
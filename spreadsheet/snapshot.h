@@ -0,0 +1,151 @@
+#pragma once
+
+#include "common.h"
+
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+// Бинарный снимок листа.
+// Снимок позволяет восстановить лист без повторного разбора формул и без
+// перестроения графа зависимостей через SetCell(). Файл состоит из заголовка
+// и секций, выровненных по 8 байт:
+//  * cells   - SnapshotCell на каждую ячейку, отсортированы по позиции;
+//  * texts   - тексты ячеек подряд, без разделителей;
+//  * program - программы формул (FormulaInstruction) подряд;
+//  * graph   - граф зависимостей в формате CSR: список вершин (позиций),
+//              массив смещений (node_count + 1) и массив номеров зависимых
+//              вершин. Содержит только ссылки на отдельные ячейки,
+//              зависимости от диапазонов восстанавливаются из формул;
+//  * values  - необязательные вычисленные значения формул (SnapshotValue).
+// При загрузке файл отображается в память (mmap), секции читаются прямо из
+// отображения.
+// Начиная с версии 2 заголовок хранит номер последней правки журнала,
+// вошедшей в снимок (см. journal.h). Файлы версии 1 по-прежнему читаются.
+// Формат привязан к платформе: порядок байт и размеры структур проверяются
+// при загрузке.
+
+// Исключение, выбрасываемое при ошибке записи или чтения снимка
+class SnapshotException : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+struct SnapshotOptions
+{
+    // Сохранять ли вычисленные значения формул. Загруженный лист в этом
+    // случае не пересчитывает формулы до первого изменения их аргументов.
+    bool with_values = false;
+    // Номер последней правки журнала, вошедшей в снимок
+    std::uint64_t edit_sequence = 0;
+};
+
+// Сведения из заголовка снимка
+struct SnapshotInfo
+{
+    std::uint32_t version = 0;
+    bool with_values = false;
+    std::uint64_t cell_count = 0;
+    std::uint64_t edit_sequence = 0;
+};
+
+namespace snapshot
+{
+
+inline constexpr char MAGIC[4] = { 'S', 'P', 'S', 'N' };
+inline constexpr std::uint32_t VERSION = 2;
+inline constexpr std::uint32_t ENDIAN_MARK = 0x01020304;
+
+inline constexpr std::uint32_t FLAG_WITH_VALUES = 0x1;
+
+struct Header
+{
+    char magic[4];
+    std::uint32_t version;
+    std::uint32_t endian_mark;
+    std::uint32_t flags;
+    std::uint32_t header_size;        // sizeof(Header)
+    std::uint32_t instruction_size;   // sizeof(FormulaInstruction)
+
+    std::uint64_t cell_count;
+    std::uint64_t text_size;          // в байтах
+    std::uint64_t instruction_count;
+    std::uint64_t node_count;
+    std::uint64_t edge_count;
+
+    // Смещения секций от начала файла
+    std::uint64_t cells_offset;
+    std::uint64_t texts_offset;
+    std::uint64_t program_offset;
+    std::uint64_t nodes_offset;
+    std::uint64_t edge_offsets_offset;
+    std::uint64_t edges_offset;
+    std::uint64_t values_offset;      // 0, если значения не сохранены
+    std::uint64_t file_size;
+
+    // Поля версии 2
+    std::uint64_t edit_sequence;
+};
+
+// Тип содержимого ячейки в снимке
+enum class CellKind : std::uint32_t
+{
+    Empty = 0,
+    Text = 1,
+    Formula = 2,
+};
+
+struct Cell
+{
+    std::int32_t row;
+    std::int32_t col;
+    CellKind kind;
+    std::uint32_t reserved;
+    std::uint64_t text_offset;        // относительно начала секции texts
+    std::uint64_t text_size;
+    std::uint64_t program_offset;     // в инструкциях, относительно секции program
+    std::uint64_t program_size;
+};
+
+// Тип значения формулы в снимке
+enum class ValueKind : std::uint32_t
+{
+    None = 0,      // не формула
+    Number = 1,
+    Error = 2,
+};
+
+struct Value
+{
+    ValueKind kind;
+    std::uint32_t error;              // FormulaError::Category для ValueKind::Error
+    double number;
+};
+
+}  // namespace snapshot
+
+// Записывает снимок листа в поток.
+// Бросает SnapshotException при ошибке записи.
+void WriteSnapshot(const SheetInterface& sheet, std::ostream& out,
+                   const SnapshotOptions& options = {});
+
+// Сохраняет лист в файл path. Запись идёт во временный файл, который затем
+// сбрасывается на диск и переименовывается, поэтому существующий снимок не
+// портится при сбое.
+// Бросает SnapshotException при ошибке записи.
+void SaveSnapshot(const SheetInterface& sheet, const std::string& path,
+                  const SnapshotOptions& options = {});
+
+// Читает только заголовок снимка. Бросает SnapshotException, если файл не
+// удалось прочитать или он не является снимком.
+SnapshotInfo ReadSnapshotInfo(const std::string& path);
+
+// Загружает лист из снимка. Если info не nullptr, в него записывается
+// заголовок того же отображения файла: файл могут заменить между двумя
+// открытиями, и ReadSnapshotInfo() отдельно от загрузки прочитал бы другой
+// снимок. Бросает SnapshotException, если файл не удалось прочитать или он
+// повреждён.
+std::unique_ptr<SheetInterface> LoadSnapshot(const std::string& path, SnapshotInfo* info = nullptr);
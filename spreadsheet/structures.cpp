@@ -86,7 +86,85 @@ Position Position::FromString(std::string_view str)
     return { row - 1, col - 1 };
 }
 
+bool Range::operator==(const Range& rhs) const
+{
+    return from == rhs.from && to == rhs.to;
+}
+
+bool Range::operator<(const Range& rhs) const
+{
+    return std::tie(from, to) < std::tie(rhs.from, rhs.to);
+}
+
+Range Range::FromCorners(Position first, Position second)
+{
+    return { { std::min(first.row, second.row), std::min(first.col, second.col) },
+             { std::max(first.row, second.row), std::max(first.col, second.col) } };
+}
+
+bool Range::IsValid() const
+{
+    return from.IsValid() && to.IsValid() && from.row <= to.row && from.col <= to.col;
+}
+
+bool Range::Contains(Position pos) const
+{
+    return pos.row >= from.row && pos.row <= to.row && pos.col >= from.col && pos.col <= to.col;
+}
+
+bool Range::Intersects(const Range& other) const
+{
+    return from.row <= other.to.row && other.from.row <= to.row && from.col <= other.to.col
+        && other.from.col <= to.col;
+}
+
+Size Range::GetSize() const
+{
+    return { to.row - from.row + 1, to.col - from.col + 1 };
+}
+
+std::string Range::ToString() const
+{
+    if (!IsValid())
+    {
+        return "";
+    }
+    return from.ToString() + ':' + to.ToString();
+}
+
 bool Size::operator==(Size rhs) const
 {
     return cols == rhs.cols && rows == rhs.rows;
 }
+
+FormulaError::FormulaError(Category category)
+    : category_(category)
+{}
+
+FormulaError::Category FormulaError::GetCategory() const
+{
+    return category_;
+}
+
+bool FormulaError::operator==(FormulaError rhs) const
+{
+    return category_ == rhs.category_;
+}
+
+std::string_view FormulaError::ToString() const
+{
+    switch (category_)
+    {
+    case Category::Ref:
+        return "#REF!";
+    case Category::Value:
+        return "#VALUE!";
+    case Category::Div0:
+        return "#DIV/0!";
+    case Category::NA:
+        return "#N/A";
+    case Category::Spill:
+        return "#SPILL!";
+    }
+    return "";
+}
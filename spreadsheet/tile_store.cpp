@@ -0,0 +1,290 @@
+#include "tile_store.h"
+
+#include "cell.h"
+#include "formula.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+
+// Тип содержимого ячейки в записи тайла
+enum class TileCellKind : std::uint8_t
+{
+    Empty = 0,
+    Text = 1,
+    Formula = 2,
+};
+
+// Тип сохранённого значения формулы
+enum class TileValueKind : std::uint8_t
+{
+    None = 0,
+    Number = 1,
+    Error = 2,
+};
+
+// Заголовок записи ячейки. За ним идут число (для TileValueKind::Number) или
+// категория ошибки (для TileValueKind::Error), затем size байт текста или size
+// инструкций программы формулы
+struct TileCellHeader
+{
+    std::uint16_t index;
+    TileCellKind kind;
+    TileValueKind value_kind;
+    std::uint32_t size;
+};
+
+// Объект Cell с реализацией и служебными данными аллокатора
+constexpr std::size_t CELL_BASE_BYTES = 128;
+// AST формулы занимает в несколько раз больше её текста
+constexpr std::size_t FORMULA_BYTES_PER_CHAR = 24;
+
+template <typename T>
+void Append(std::string& out, const T& value)
+{
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+T Take(std::string_view& data)
+{
+    if (data.size() < sizeof(T))
+    {
+        throw TileStoreException("Tile data is truncated");
+    }
+    T value;
+    std::memcpy(&value, data.data(), sizeof(T));
+    data.remove_prefix(sizeof(T));
+    return value;
+}
+
+}  // namespace
+
+SheetTile::SheetTile() = default;
+
+SheetTile::~SheetTile() = default;
+
+TileStore::TileStore(std::string path)
+    : path_(std::move(path))
+    , file_(path_, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc)
+{
+    if (!file_)
+    {
+        throw TileStoreException("Cannot open tile store " + path_);
+    }
+}
+
+TileStore::~TileStore()
+{
+    file_.close();
+    std::remove(path_.c_str());
+}
+
+void TileStore::Write(std::uint32_t id, std::string_view data)
+{
+    Erase(id);
+
+    // Первый подходящий по размеру свободный участок, иначе конец файла
+    Extent extent{ file_size_, data.size() };
+    auto it = free_.lower_bound(data.size());
+    if (it != free_.end())
+    {
+        extent.offset = it->second;
+        const std::uint64_t rest = it->first - data.size();
+        free_.erase(it);
+        if (rest != 0)
+        {
+            free_.emplace(rest, extent.offset + data.size());
+        }
+    }
+    else
+    {
+        file_size_ += data.size();
+    }
+
+    file_.seekp(static_cast<std::streamoff>(extent.offset));
+    file_.write(data.data(), static_cast<std::streamsize>(data.size()));
+    if (!file_)
+    {
+        throw TileStoreException("Cannot write tile store " + path_);
+    }
+    index_[id] = extent;
+}
+
+std::string TileStore::Read(std::uint32_t id)
+{
+    auto it = index_.find(id);
+    if (it == index_.end())
+    {
+        throw TileStoreException("Tile is missing in tile store");
+    }
+
+    std::string data(it->second.size, '\0');
+    file_.seekg(static_cast<std::streamoff>(it->second.offset));
+    file_.read(data.data(), static_cast<std::streamsize>(data.size()));
+    if (!file_)
+    {
+        throw TileStoreException("Cannot read tile store " + path_);
+    }
+    return data;
+}
+
+void TileStore::Erase(std::uint32_t id)
+{
+    auto it = index_.find(id);
+    if (it != index_.end())
+    {
+        Free(it->second);
+        index_.erase(it);
+    }
+}
+
+std::uint64_t TileStore::FileSize() const
+{
+    return file_size_;
+}
+
+void TileStore::Free(Extent extent)
+{
+    if (extent.size != 0)
+    {
+        free_.emplace(extent.size, extent.offset);
+    }
+}
+
+std::string EncodeTile(const SheetTile& tile)
+{
+    std::string out;
+    for (int i = 0; i < TILE_CELLS; ++i)
+    {
+        const Cell* cell = tile.cells[i].get();
+        if (!cell)
+        {
+            continue;
+        }
+
+        TileCellHeader header{};
+        header.index = static_cast<std::uint16_t>(i);
+        header.value_kind = TileValueKind::None;
+
+        std::string_view text;
+        std::vector<FormulaInstruction> program;
+        CellInterface::Value value;
+        switch (cell->GetType())
+        {
+        case CellType::FORMULA:
+            header.kind = TileCellKind::Formula;
+            program = cell->GetFormula()->GetProgram();
+            header.size = static_cast<std::uint32_t>(program.size());
+            if (cell->IsCacheValid())
+            {
+                value = cell->GetValue();
+                header.value_kind = std::holds_alternative<double>(value) ? TileValueKind::Number
+                                                                          : TileValueKind::Error;
+            }
+            break;
+        case CellType::TEXT:
+            header.kind = TileCellKind::Text;
+            text = cell->GetTextView();
+            header.size = static_cast<std::uint32_t>(text.size());
+            break;
+        default:
+            header.kind = TileCellKind::Empty;
+            header.size = 0;
+            break;
+        }
+
+        Append(out, header);
+        if (header.value_kind == TileValueKind::Number)
+        {
+            Append(out, std::get<double>(value));
+        }
+        else if (header.value_kind == TileValueKind::Error)
+        {
+            Append(out, static_cast<std::uint32_t>(std::get<FormulaError>(value).GetCategory()));
+        }
+        out += text;
+        if (!program.empty())
+        {
+            out.append(reinterpret_cast<const char*>(program.data()),
+                       program.size() * sizeof(FormulaInstruction));
+        }
+    }
+    return out;
+}
+
+void DecodeTile(std::string_view data, SheetTile& tile, SheetInterface& sheet, bool with_values)
+{
+    while (!data.empty())
+    {
+        const auto header = Take<TileCellHeader>(data);
+        if (header.index >= TILE_CELLS)
+        {
+            throw TileStoreException("Tile cell index is out of range");
+        }
+
+        std::optional<CellInterface::Value> value;
+        if (header.value_kind == TileValueKind::Number)
+        {
+            value = Take<double>(data);
+        }
+        else if (header.value_kind == TileValueKind::Error)
+        {
+            value = FormulaError(static_cast<FormulaError::Category>(Take<std::uint32_t>(data)));
+        }
+        if (!with_values)
+        {
+            value.reset();
+        }
+
+        auto cell = std::make_unique<Cell>(sheet);
+        switch (header.kind)
+        {
+        case TileCellKind::Formula:
+        {
+            const std::size_t bytes = std::size_t{ header.size } * sizeof(FormulaInstruction);
+            if (data.size() < bytes)
+            {
+                throw TileStoreException("Tile data is truncated");
+            }
+            // Данные из файла не выровнены, копируем программу
+            std::vector<FormulaInstruction> program(header.size);
+            std::memcpy(program.data(), data.data(), bytes);
+            data.remove_prefix(bytes);
+            try
+            {
+                cell->SetFormula(LoadFormula(program.data(), program.size()), std::move(value));
+            }
+            catch (const FormulaException& ex)
+            {
+                throw TileStoreException(ex.what());
+            }
+            break;
+        }
+        case TileCellKind::Text:
+            if (data.size() < header.size)
+            {
+                throw TileStoreException("Tile data is truncated");
+            }
+            cell->Set(std::string(data.substr(0, header.size)));
+            data.remove_prefix(header.size);
+            break;
+        default:
+            cell->Set("");
+            break;
+        }
+        tile.cells[header.index] = std::move(cell);
+    }
+}
+
+std::size_t EstimateCellBytes(std::string_view text)
+{
+    if (!text.empty() && text[0] == FORMULA_SIGN && text.size() > 1)
+    {
+        return CELL_BASE_BYTES + text.size() * FORMULA_BYTES_PER_CHAR;
+    }
+    return CELL_BASE_BYTES + text.size();
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "common.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+class Cell;
+
+// Лист хранит ячейки тайлами TILE_SIZE x TILE_SIZE. Тайл создаётся при первой
+// записи в его область, поэтому пустые участки листа память не занимают.
+inline constexpr int TILE_SIZE = 64;
+inline constexpr int TILE_CELLS = TILE_SIZE * TILE_SIZE;
+inline constexpr int TILES_PER_ROW = (Position::MAX_COLS + TILE_SIZE - 1) / TILE_SIZE;
+
+// Координаты тайла, содержащего ячейку pos
+inline Position TilePosition(Position pos)
+{
+    return Position{ pos.row / TILE_SIZE, pos.col / TILE_SIZE };
+}
+
+// Индекс ячейки pos в массиве ячеек её тайла
+inline int TileCellIndex(Position pos)
+{
+    return (pos.row % TILE_SIZE) * TILE_SIZE + pos.col % TILE_SIZE;
+}
+
+// Номер тайла с координатами tile_pos в хранилище
+inline std::uint32_t TileId(Position tile_pos)
+{
+    return static_cast<std::uint32_t>(tile_pos.row) * TILES_PER_ROW + static_cast<std::uint32_t>(tile_pos.col);
+}
+
+struct SheetTile
+{
+    SheetTile();
+    ~SheetTile();
+
+    // Ячейки тайла построчно: индекс (row % TILE_SIZE) * TILE_SIZE + col % TILE_SIZE
+    std::array<std::unique_ptr<Cell>, TILE_CELLS> cells;
+};
+
+// Настройки подкачки тайлов (см. Sheet::EnablePaging())
+struct PagingOptions
+{
+    // Сколько памяти могут занимать загруженные тайлы. Оценка приблизительная:
+    // учитываются сами тайлы, объекты ячеек, тексты и формулы
+    std::size_t memory_budget = 256 * 1024 * 1024;
+};
+
+// Счётчики подкачки
+struct PagingStats
+{
+    std::uint64_t page_ins = 0;        // тайлов загружено из хранилища
+    std::uint64_t page_outs = 0;       // тайлов выгружено из памяти
+    std::uint64_t tile_writes = 0;     // тайлов записано в хранилище
+    std::size_t resident_tiles = 0;    // тайлов в памяти
+    std::size_t resident_bytes = 0;    // оценка занятой ими памяти
+    std::uint64_t stored_bytes = 0;    // размер файла хранилища
+};
+
+// Исключение, выбрасываемое при ошибке чтения или записи хранилища тайлов
+class TileStoreException : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// Хранилище выгруженных тайлов в локальном файле. Файл временный: он
+// создаётся (или перезаписывается) в конструкторе и удаляется в деструкторе.
+// Место освободившихся записей переиспользуется.
+class TileStore
+{
+public:
+    explicit TileStore(std::string path);
+    ~TileStore();
+
+    TileStore(const TileStore&) = delete;
+    TileStore& operator=(const TileStore&) = delete;
+
+    // Сохраняет данные тайла id, заменяя прежние
+    void Write(std::uint32_t id, std::string_view data);
+    // Читает данные тайла id. Бросает TileStoreException, если их нет
+    std::string Read(std::uint32_t id);
+    void Erase(std::uint32_t id);
+
+    std::uint64_t FileSize() const;
+
+private:
+    struct Extent
+    {
+        std::uint64_t offset = 0;
+        std::uint64_t size = 0;
+    };
+
+    void Free(Extent extent);
+
+    std::string path_;
+    std::fstream file_;
+    std::uint64_t file_size_ = 0;
+    std::unordered_map<std::uint32_t, Extent> index_;
+    // Свободные участки файла: размер - смещение
+    std::multimap<std::uint64_t, std::uint64_t> free_;
+};
+
+// Сериализует ячейки тайла: тексты, программы формул и (если кэш валиден)
+// вычисленные значения
+std::string EncodeTile(const SheetTile& tile);
+// Восстанавливает ячейки тайла, созданные для листа sheet. Если with_values
+// равен false, сохранённые значения формул отбрасываются.
+// Бросает TileStoreException, если данные повреждены.
+void DecodeTile(std::string_view data, SheetTile& tile, SheetInterface& sheet, bool with_values);
+
+// Оценка памяти, которую занимает ячейка с текстом text
+std::size_t EstimateCellBytes(std::string_view text);
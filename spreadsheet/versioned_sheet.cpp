@@ -0,0 +1,234 @@
+#include "versioned_sheet.h"
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <utility>
+
+std::uint64_t SheetVersion::GetNumber() const
+{
+    return number_;
+}
+
+Size SheetVersion::GetPrintableSize() const
+{
+    return printable_size_;
+}
+
+const SheetVersion::Tile* SheetVersion::FindTile(Position pos) const
+{
+    const Position tile_pos = TilePosition(pos);
+    if (tile_pos.row >= static_cast<int>(rows_.size()) || !rows_[tile_pos.row])
+    {
+        return nullptr;
+    }
+    const TileRow& row = *rows_[tile_pos.row];
+    return tile_pos.col < static_cast<int>(row.size()) ? row[tile_pos.col].get() : nullptr;
+}
+
+CellValueView SheetVersion::GetValue(Position pos) const
+{
+    if (!pos.IsValid())
+    {
+        throw InvalidPositionException("Invalid position for SheetVersion::GetValue()");
+    }
+
+    const Tile* tile = FindTile(pos);
+    if (!tile)
+    {
+        return CellValueView{};
+    }
+    const int index = TileCellIndex(pos);
+    CellValueView value{ tile->codes[index], tile->numbers[index], {} };
+    if (value.code == ValueCode::Text)
+    {
+        // Значение текста - текст ячейки без экранирующего апострофа
+        value.text = tile->texts.at(index);
+        if (!value.text.empty() && value.text.front() == ESCAPE_SIGN)
+        {
+            value.text.remove_prefix(1);
+        }
+    }
+    return value;
+}
+
+std::string_view SheetVersion::GetText(Position pos) const
+{
+    if (!pos.IsValid())
+    {
+        throw InvalidPositionException("Invalid position for SheetVersion::GetText()");
+    }
+
+    const Tile* tile = FindTile(pos);
+    if (!tile)
+    {
+        return {};
+    }
+    auto it = tile->texts.find(TileCellIndex(pos));
+    return it != tile->texts.end() ? std::string_view(it->second) : std::string_view{};
+}
+
+void SheetVersion::GetValues(Position top_left, Size size, const ValueBuffers& out) const
+{
+    const Position bottom_right{ top_left.row + size.rows - 1, top_left.col + size.cols - 1 };
+    if (size.rows < 0 || size.cols < 0 || !top_left.IsValid()
+        || (size.rows > 0 && size.cols > 0 && !bottom_right.IsValid()))
+    {
+        throw InvalidPositionException("Invalid range for SheetVersion::GetValues()");
+    }
+
+    std::size_t i = 0;
+    for (int row = top_left.row; row <= bottom_right.row; ++row)
+    {
+        for (int col = top_left.col; col <= bottom_right.col; ++col, ++i)
+        {
+            const CellValueView value = GetValue(Position{ row, col });
+            if (out.numbers)
+            {
+                out.numbers[i] = value.code == ValueCode::Number ? value.number : 0.0;
+            }
+            if (out.codes)
+            {
+                out.codes[i] = value.code;
+            }
+            if (out.texts)
+            {
+                out.texts[i] = value.text;
+            }
+        }
+    }
+}
+
+bool SheetVersion::SharesTile(const SheetVersion& other, Position pos) const
+{
+    return FindTile(pos) == other.FindTile(pos);
+}
+
+VersionedSheet::VersionedSheet()
+    : sheet_ptr_(CreateSheet())
+    , sheet_(dynamic_cast<Sheet&>(*sheet_ptr_))
+    , current_(std::make_shared<const SheetVersion>())
+{
+    sheet_.Subscribe(*this);
+}
+
+VersionedSheet::~VersionedSheet()
+{
+    sheet_.Unsubscribe(*this);
+}
+
+std::shared_ptr<const SheetVersion> VersionedSheet::Commit(const std::vector<CellEdit>& edits)
+{
+    // Правленые ячейки публикуются, даже если значение не изменилось: мог
+    // измениться текст
+    changed_.clear();
+    for (const CellEdit& edit : edits)
+    {
+        changed_.push_back(edit.pos);
+    }
+
+    try
+    {
+        sheet_.ApplyEdits(edits);
+    }
+    catch (...)
+    {
+        // Правки до некорректной уже применены
+        Publish();
+        throw;
+    }
+    return Publish();
+}
+
+std::shared_ptr<const SheetVersion> VersionedSheet::Pin() const
+{
+    return std::atomic_load(&current_);
+}
+
+const Sheet& VersionedSheet::GetSheet() const
+{
+    return sheet_;
+}
+
+void VersionedSheet::OnValuesChanged(Span<const Position> changed)
+{
+    changed_.insert(changed_.end(), changed.begin(), changed.end());
+}
+
+std::shared_ptr<const SheetVersion> VersionedSheet::Publish()
+{
+    // Писатель один, поэтому текущую версию можно читать без atomic_load
+    const SheetVersion& previous = *current_;
+    auto version = std::make_shared<SheetVersion>();
+    version->number_ = previous.number_ + 1;
+    version->printable_size_ = sheet_.GetPrintableSize();
+    version->rows_ = previous.rows_;
+
+    // Строки и тайлы, уже скопированные для этой версии
+    std::map<int, SheetVersion::TileRow*> copied_rows;
+    std::map<Position, SheetVersion::Tile*> copied_tiles;
+    auto tile_for = [&](Position pos) -> SheetVersion::Tile&
+    {
+        const Position tile_pos = TilePosition(pos);
+        auto tile_it = copied_tiles.find(tile_pos);
+        if (tile_it != copied_tiles.end())
+        {
+            return *tile_it->second;
+        }
+
+        auto row_it = copied_rows.find(tile_pos.row);
+        if (row_it == copied_rows.end())
+        {
+            if (static_cast<int>(version->rows_.size()) <= tile_pos.row)
+            {
+                version->rows_.resize(tile_pos.row + 1);
+            }
+            auto& row_ptr = version->rows_[tile_pos.row];
+            auto row = row_ptr ? std::make_shared<SheetVersion::TileRow>(*row_ptr)
+                               : std::make_shared<SheetVersion::TileRow>();
+            row_it = copied_rows.emplace(tile_pos.row, row.get()).first;
+            row_ptr = std::move(row);
+        }
+
+        SheetVersion::TileRow& row = *row_it->second;
+        if (static_cast<int>(row.size()) <= tile_pos.col)
+        {
+            row.resize(tile_pos.col + 1);
+        }
+        auto tile = row[tile_pos.col] ? std::make_shared<SheetVersion::Tile>(*row[tile_pos.col])
+                                       : std::make_shared<SheetVersion::Tile>();
+        SheetVersion::Tile* result = tile.get();
+        row[tile_pos.col] = std::move(tile);
+        copied_tiles.emplace(tile_pos, result);
+        return *result;
+    };
+
+    std::sort(changed_.begin(), changed_.end());
+    changed_.erase(std::unique(changed_.begin(), changed_.end()), changed_.end());
+    for (const Position& pos : changed_)
+    {
+        double number = 0.0;
+        ValueCode code = ValueCode::Empty;
+        sheet_.GetValues(pos, Size{ 1, 1 }, ValueBuffers{ &number, &code, nullptr });
+        const CellInterface* cell = sheet_.GetCell(pos);
+        std::string text = cell ? cell->GetText() : std::string{};
+
+        SheetVersion::Tile& tile = tile_for(pos);
+        const int index = TileCellIndex(pos);
+        tile.numbers[index] = number;
+        tile.codes[index] = code;
+        if (text.empty())
+        {
+            tile.texts.erase(index);
+        }
+        else
+        {
+            tile.texts[index] = std::move(text);
+        }
+    }
+    changed_.clear();
+
+    std::shared_ptr<const SheetVersion> result = std::move(version);
+    std::atomic_store(&current_, result);
+    return result;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "change_feed.h"
+#include "common.h"
+#include "sheet.h"
+#include "tile_store.h"
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Неизменяемая версия листа: значения и тексты ячеек на момент фиксации
+// (см. VersionedSheet). Соседние версии разделяют тайлы, в которых ничего не
+// менялось, поэтому фиксация копирует только тайлы изменённых ячеек и
+// строки тайлов, в которых они лежат. Методы можно вызывать из любых потоков
+// без синхронизации.
+class SheetVersion
+{
+public:
+    // Номер версии: 0 - пустой лист, каждая фиксация добавляет 1
+    std::uint64_t GetNumber() const;
+    Size GetPrintableSize() const;
+
+    // Значение ячейки. Текст ссылается на память версии и действителен, пока
+    // версия жива. Бросает InvalidPositionException для некорректной позиции
+    CellValueView GetValue(Position pos) const;
+    // Текст ячейки, как CellInterface::GetText()
+    std::string_view GetText(Position pos) const;
+    // Читает значения диапазона, как Sheet::GetValues()
+    void GetValues(Position top_left, Size size, const ValueBuffers& out) const;
+
+    // Разделяют ли версии тайл, содержащий pos (для тестов и диагностики)
+    bool SharesTile(const SheetVersion& other, Position pos) const;
+
+private:
+    friend class VersionedSheet;
+    // Образ листа пишется прямо из тайлов версии (см. sheet_image.h)
+    friend void WriteSheetImage(const SheetVersion& version, const std::string& path);
+
+    struct Tile
+    {
+        std::array<double, TILE_CELLS> numbers{};
+        std::array<ValueCode, TILE_CELLS> codes{};
+        // Тексты непустых ячеек по индексу в тайле
+        std::unordered_map<int, std::string> texts;
+    };
+    // Тайлы строки по номеру столбца тайла, nullptr - тайл пуст
+    using TileRow = std::vector<std::shared_ptr<const Tile>>;
+
+    std::uint64_t number_ = 0;
+    Size printable_size_;
+    std::vector<std::shared_ptr<const TileRow>> rows_;
+
+    // Тайл, содержащий pos, или nullptr
+    const Tile* FindTile(Position pos) const;
+};
+
+// Лист с версиями для одного писателя и многих читателей. Писатель применяет
+// пакеты правок через Commit(): пакет применяется к листу, изменившиеся
+// значения вычисляются, и результат публикуется новой версией (SheetVersion).
+// Читатели в любых потоках берут текущую версию через Pin() и читают её, не
+// блокируя писателя и не видя незафиксированных правок. Старая версия живёт,
+// пока её держит хотя бы один читатель. Само чтение версии идёт без
+// блокировок, но Pin() - нет: std::atomic_load для shared_ptr в libstdc++
+// берёт мьютекс из общего пула, и на время копирования указателя читатели
+// и публикация версии упираются в него.
+class VersionedSheet final : private SheetObserver
+{
+public:
+    VersionedSheet();
+    ~VersionedSheet();
+
+    VersionedSheet(const VersionedSheet&) = delete;
+    VersionedSheet& operator=(const VersionedSheet&) = delete;
+
+    // Только писатель: применяет правки одним пакетом (см. Sheet::ApplyEdits())
+    // и публикует новую версию. Некорректная правка бросает то же исключение,
+    // что и Sheet::ApplyEdits(); правки до неё публикуются.
+    std::shared_ptr<const SheetVersion> Commit(const std::vector<CellEdit>& edits);
+
+    // Любой поток: текущая версия
+    std::shared_ptr<const SheetVersion> Pin() const;
+
+    // Только писатель: лист последней версии
+    const Sheet& GetSheet() const;
+
+private:
+    std::unique_ptr<SheetInterface> sheet_ptr_;
+    Sheet& sheet_;
+    // Ячейки, изменённые текущим пакетом: правленые и с изменившимися значениями
+    std::vector<Position> changed_;
+    // Текущая версия. Читается и заменяется через std::atomic_load/store:
+    // в C++17 другого атомарного shared_ptr нет (std::atomic<std::shared_ptr>
+    // появился в C++20), а реализация этих функций обычно не lock-free
+    std::shared_ptr<const SheetVersion> current_;
+
+    void OnValuesChanged(Span<const Position> changed) override;
+    // Публикует версию с изменениями из changed_
+    std::shared_ptr<const SheetVersion> Publish();
+};
@@ -0,0 +1,648 @@
+#include "workbook.h"
+
+#include "durable_file.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+namespace
+{
+
+// Оглавление сохранённой книги: строка заголовка и по строке на лист
+constexpr std::string_view MANIFEST_NAME = "workbook";
+constexpr std::string_view MANIFEST_MAGIC = "SPWB";
+constexpr int MANIFEST_VERSION = 1;
+
+// Число потоков: 0 - по числу ядер
+unsigned ThreadCount(unsigned threads)
+{
+    return threads != 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Вызывает task(i) для i от 0 до count - 1 в threads потоках. Первое
+// исключение задачи бросается после завершения всех потоков
+template <typename Task>
+void RunParallel(std::size_t count, unsigned threads, Task&& task)
+{
+    std::atomic<std::size_t> next{ 0 };
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto work = [&]()
+    {
+        for (std::size_t i = next++; i < count; i = next++)
+        {
+            try
+            {
+                task(i);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error)
+                {
+                    error = std::current_exception();
+                }
+                next = count;
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < std::min<std::size_t>(threads, count); ++i)
+    {
+        workers.emplace_back(work);
+    }
+    work();
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+// Содержимое оглавления книги
+struct Manifest
+{
+    std::uint64_t generation = 0;    // номер сохранения: входит в имена снимков
+    std::vector<std::pair<std::string, std::string>> sheets;    // имя листа и файл снимка
+};
+
+// Читает оглавление каталога directory или nullopt, если его нет. Бросает
+// SnapshotException, если оглавление повреждено
+std::optional<Manifest> ReadManifest(const std::filesystem::path& directory)
+{
+    std::ifstream in(directory / MANIFEST_NAME);
+    if (!in)
+    {
+        return std::nullopt;
+    }
+
+    Manifest manifest;
+    std::string magic;
+    int version = 0;
+    std::size_t count = 0;
+    in >> magic >> version >> manifest.generation >> count;
+    if (!in || magic != MANIFEST_MAGIC || version != MANIFEST_VERSION)
+    {
+        throw SnapshotException("Invalid workbook manifest in " + directory.string());
+    }
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        std::string name;
+        std::string file;
+        in >> name >> file;
+        // Файл снимка лежит в самом каталоге книги
+        if (!in || !IsValidSheetName(name) || file.empty()
+            || std::filesystem::path(file).filename().string() != file)
+        {
+            throw SnapshotException("Invalid workbook manifest in " + directory.string());
+        }
+        manifest.sheets.emplace_back(std::move(name), std::move(file));
+    }
+    return manifest;
+}
+
+}  // namespace
+
+Workbook::Workbook()
+{}
+
+Workbook::~Workbook()
+{
+    // Листы разрушаются вместе с книгой: ссылки между ними не нужно удалять
+    // по одной
+    for (SheetEntry& entry : sheets_)
+    {
+        entry.sheet->workbook_ = nullptr;
+    }
+}
+
+Sheet& Workbook::AddSheet(const std::string& name)
+{
+    if (!IsValidSheetName(name))
+    {
+        throw std::invalid_argument("Invalid sheet name: " + name);
+    }
+    if (indexes_.count(name) != 0)
+    {
+        throw std::invalid_argument("Duplicate sheet name: " + name);
+    }
+
+    Sheet& sheet = Adopt(name, CreateSheet());
+    // Ссылки на лист до его появления давали #REF!
+    InvalidateReferencesTo(name);
+    PublishLinkedChanges();
+    return sheet;
+}
+
+Sheet* Workbook::FindSheet(std::string_view name)
+{
+    return const_cast<Sheet*>(std::as_const(*this).FindSheet(name));
+}
+
+const Sheet* Workbook::FindSheet(std::string_view name) const
+{
+    auto it = indexes_.find(name);
+    return it != indexes_.end() ? sheets_[it->second].sheet : nullptr;
+}
+
+Sheet& Workbook::GetSheet(std::string_view name)
+{
+    return const_cast<Sheet&>(std::as_const(*this).GetSheet(name));
+}
+
+const Sheet& Workbook::GetSheet(std::string_view name) const
+{
+    const Sheet* sheet = FindSheet(name);
+    if (!sheet)
+    {
+        throw std::out_of_range("No sheet named " + std::string(name));
+    }
+    return *sheet;
+}
+
+std::vector<std::string> Workbook::GetSheetNames() const
+{
+    std::vector<std::string> names;
+    names.reserve(sheets_.size());
+    for (const SheetEntry& entry : sheets_)
+    {
+        names.push_back(entry.name);
+    }
+    return names;
+}
+
+std::size_t Workbook::GetSheetCount() const
+{
+    return sheets_.size();
+}
+
+WorkbookRecalcStats Workbook::Recalculate(unsigned threads)
+{
+    const std::size_t count = sheets_.size();
+    // Листы, на которые ссылаются формулы каждого листа
+    std::vector<std::vector<std::size_t>> precedents(count);
+    for (const auto& [target, by_sheet] : references_)
+    {
+        auto target_it = indexes_.find(target);
+        if (target_it == indexes_.end())
+        {
+            continue;
+        }
+        for (const auto& [index, dependencies] : by_sheet)
+        {
+            if (index != target_it->second)
+            {
+                precedents[index].push_back(target_it->second);
+            }
+        }
+    }
+
+    // Группа - листы, взаимно достижимые по ссылкам. Листов немного, поэтому
+    // достижимость считается обходом из каждого листа
+    std::vector<std::vector<bool>> reaches(count, std::vector<bool>(count, false));
+    for (std::size_t from = 0; from < count; ++from)
+    {
+        std::vector<std::size_t> stack{ from };
+        reaches[from][from] = true;
+        while (!stack.empty())
+        {
+            const std::size_t index = stack.back();
+            stack.pop_back();
+            for (std::size_t precedent : precedents[index])
+            {
+                if (!reaches[from][precedent])
+                {
+                    reaches[from][precedent] = true;
+                    stack.push_back(precedent);
+                }
+            }
+        }
+    }
+    constexpr std::size_t NO_GROUP = static_cast<std::size_t>(-1);
+    std::vector<std::size_t> group_of(count, NO_GROUP);
+    std::vector<std::vector<std::size_t>> groups;
+    for (std::size_t index = 0; index < count; ++index)
+    {
+        if (group_of[index] != NO_GROUP)
+        {
+            continue;
+        }
+        groups.emplace_back();
+        for (std::size_t other = index; other < count; ++other)
+        {
+            if (reaches[index][other] && reaches[other][index])
+            {
+                group_of[other] = groups.size() - 1;
+                groups.back().push_back(other);
+            }
+        }
+    }
+
+    // Группа готова к вычислению, когда вычислены все группы, на которые
+    // ссылаются её листы
+    std::vector<std::set<std::size_t>> dependents(groups.size());
+    std::vector<std::size_t> waiting(groups.size(), 0);
+    for (std::size_t index = 0; index < count; ++index)
+    {
+        for (std::size_t precedent : precedents[index])
+        {
+            if (group_of[precedent] != group_of[index]
+                && dependents[group_of[precedent]].insert(group_of[index]).second)
+            {
+                ++waiting[group_of[index]];
+            }
+        }
+    }
+    std::vector<std::size_t> ready;
+    for (std::size_t group = 0; group < groups.size(); ++group)
+    {
+        if (waiting[group] == 0)
+        {
+            ready.push_back(group);
+        }
+    }
+
+    WorkbookRecalcStats stats;
+    stats.groups = groups.size();
+    stats.threads = static_cast<unsigned>(std::max<std::size_t>(1, std::min<std::size_t>(ThreadCount(threads), groups.size())));
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::size_t done = 0;
+    std::exception_ptr error;
+    auto work = [&]()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            changed.wait(lock, [&]
+                         {
+                             return !ready.empty() || done == groups.size() || error;
+                         });
+            if (ready.empty() || error)
+            {
+                return;
+            }
+            const std::size_t group = ready.back();
+            ready.pop_back();
+            lock.unlock();
+
+            std::size_t evaluated = 0;
+            std::exception_ptr group_error;
+            try
+            {
+                for (std::size_t index : groups[group])
+                {
+                    evaluated += sheets_[index].sheet->Recalculate().evaluated;
+                }
+            }
+            catch (...)
+            {
+                group_error = std::current_exception();
+            }
+
+            lock.lock();
+            stats.evaluated += evaluated;
+            ++done;
+            if (group_error && !error)
+            {
+                error = group_error;
+            }
+            for (std::size_t dependent : dependents[group])
+            {
+                if (--waiting[dependent] == 0)
+                {
+                    ready.push_back(dependent);
+                }
+            }
+            changed.notify_all();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < stats.threads; ++i)
+    {
+        workers.emplace_back(work);
+    }
+    work();
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+    return stats;
+}
+
+void Workbook::Save(const std::string& directory, const SnapshotOptions& options) const
+{
+    const std::filesystem::path path(directory);
+    Manifest manifest;
+    try
+    {
+        std::filesystem::create_directories(path);
+        std::optional<Manifest> previous = ReadManifest(path);
+        manifest.generation = previous ? previous->generation + 1 : 1;
+
+        // Снимки нового сохранения не совпадают по именам с прежними: до
+        // замены оглавления прежняя книга остаётся целой
+        for (std::size_t index = 0; index < sheets_.size(); ++index)
+        {
+            std::string file = std::to_string(manifest.generation) + '_' + std::to_string(index) + ".snapshot";
+            SaveSnapshot(*sheets_[index].sheet, (path / file).string(), options);
+            manifest.sheets.emplace_back(sheets_[index].name, std::move(file));
+        }
+
+        std::ostringstream out;
+        out << MANIFEST_MAGIC << ' ' << MANIFEST_VERSION << ' ' << manifest.generation << ' '
+            << manifest.sheets.size() << '\n';
+        for (const auto& [name, file] : manifest.sheets)
+        {
+            out << name << ' ' << file << '\n';
+        }
+        WriteFileDurably((path / MANIFEST_NAME).string(), out.str());
+
+        if (previous)
+        {
+            for (const auto& [name, file] : previous->sheets)
+            {
+                std::error_code ignored;
+                std::filesystem::remove(path / file, ignored);
+            }
+        }
+    }
+    catch (const SnapshotException&)
+    {
+        throw;
+    }
+    catch (const std::exception& error)
+    {
+        throw SnapshotException("Failed to save workbook to " + directory + ": " + error.what());
+    }
+}
+
+std::unique_ptr<Workbook> Workbook::Load(const std::string& directory, unsigned threads)
+{
+    const std::filesystem::path path(directory);
+    const std::optional<Manifest> manifest = ReadManifest(path);
+    if (!manifest)
+    {
+        throw SnapshotException("No workbook manifest in " + directory);
+    }
+
+    // Снимки листов независимы и читаются параллельно
+    std::vector<std::unique_ptr<SheetInterface>> sheets(manifest->sheets.size());
+    RunParallel(sheets.size(), ThreadCount(threads), [&](std::size_t index)
+    {
+        sheets[index] = LoadSnapshot((path / manifest->sheets[index].second).string());
+    });
+
+    auto workbook = std::make_unique<Workbook>();
+    for (std::size_t index = 0; index < sheets.size(); ++index)
+    {
+        const std::string& name = manifest->sheets[index].first;
+        if (workbook->indexes_.count(name) != 0)
+        {
+            throw SnapshotException("Duplicate sheet name in workbook manifest: " + name);
+        }
+        workbook->Adopt(name, std::move(sheets[index]));
+    }
+    return workbook;
+}
+
+std::size_t Workbook::IndexOf(const Sheet& sheet) const
+{
+    // Листов в книге немного
+    auto it = std::find_if(sheets_.begin(), sheets_.end(), [&sheet](const SheetEntry& entry)
+                           {
+                               return entry.sheet == &sheet;
+                           });
+    return static_cast<std::size_t>(std::distance(sheets_.begin(), it));
+}
+
+Sheet& Workbook::Adopt(const std::string& name, std::unique_ptr<SheetInterface> sheet)
+{
+    Sheet& tiled_sheet = dynamic_cast<Sheet&>(*sheet);
+    sheets_.push_back(SheetEntry{ name, std::move(sheet), &tiled_sheet });
+    indexes_.emplace(name, sheets_.size() - 1);
+
+    tiled_sheet.workbook_ = this;
+    tiled_sheet.ForEachCell([this, &tiled_sheet](Position pos, const Cell& cell)
+    {
+        AddSheetReferences(tiled_sheet, pos, cell);
+    });
+    return tiled_sheet;
+}
+
+void Workbook::AddSheetReferences(const Sheet& sheet, Position pos, const Cell& cell)
+{
+    const FormulaInterface* formula = cell.GetFormula();
+    if (!formula || formula->GetSheetReferencesView().empty())
+    {
+        return;
+    }
+    const std::size_t index = IndexOf(sheet);
+    for (const SheetReference& reference : formula->GetSheetReferencesView())
+    {
+        references_[reference.sheet][index].Insert(reference.range, pos);
+    }
+}
+
+void Workbook::RemoveSheetReferences(const Sheet& sheet, Position pos, const Cell& cell)
+{
+    const FormulaInterface* formula = cell.GetFormula();
+    if (!formula || formula->GetSheetReferencesView().empty())
+    {
+        return;
+    }
+    const std::size_t index = IndexOf(sheet);
+    for (const SheetReference& reference : formula->GetSheetReferencesView())
+    {
+        auto target_it = references_.find(reference.sheet);
+        if (target_it == references_.end())
+        {
+            continue;
+        }
+        auto sheet_it = target_it->second.find(index);
+        if (sheet_it == target_it->second.end())
+        {
+            continue;
+        }
+        sheet_it->second.Erase(reference.range, pos);
+        // Пустые индексы не храним: по ним HasSheetDependents() отвечает сразу
+        if (sheet_it->second.Empty())
+        {
+            target_it->second.erase(sheet_it);
+            if (target_it->second.empty())
+            {
+                references_.erase(target_it);
+            }
+        }
+    }
+}
+
+bool Workbook::HasSheetDependents(const Sheet& sheet) const
+{
+    return references_.count(sheets_[IndexOf(sheet)].name) != 0;
+}
+
+void Workbook::InvalidateSheetDependents(const Sheet& sheet, const std::vector<Position>& changed)
+{
+    auto it = references_.find(sheets_[IndexOf(sheet)].name);
+    if (it == references_.end())
+    {
+        return;
+    }
+
+    // Сброс кэша не меняет ссылок, поэтому индекс можно обходить, пока
+    // листы сбрасывают кэш дальше по графу
+    std::vector<Position> dependents;
+    for (const auto& [index, dependencies] : it->second)
+    {
+        dependents.clear();
+        for (const Position& pos : changed)
+        {
+            dependencies.ForEachDependent(pos, [&dependents](Position dependent)
+            {
+                dependents.push_back(dependent);
+            });
+        }
+        if (dependents.empty())
+        {
+            continue;
+        }
+        std::sort(dependents.begin(), dependents.end());
+        dependents.erase(std::unique(dependents.begin(), dependents.end()), dependents.end());
+        // Вложенный вызов для следующих листов переиспользовал бы буфер
+        const std::vector<Position> cells = dependents;
+        sheets_[index].sheet->InvalidateFormulas(cells);
+        pending_publish_.insert(index);
+    }
+}
+
+void Workbook::InvalidateReferencesTo(const std::string& name)
+{
+    auto it = references_.find(name);
+    if (it == references_.end())
+    {
+        return;
+    }
+
+    const Range whole_sheet{ Position{ 0, 0 }, Position{ Position::MAX_ROWS - 1, Position::MAX_COLS - 1 } };
+    for (const auto& [index, dependencies] : it->second)
+    {
+        std::set<Position> dependents;
+        dependencies.ForEachIntersecting(whole_sheet, [&dependents](const Range& /* range */, Position dependent)
+        {
+            dependents.insert(dependent);
+        });
+        sheets_[index].sheet->InvalidateFormulas(std::vector<Position>(dependents.begin(), dependents.end()));
+        pending_publish_.insert(index);
+    }
+}
+
+void Workbook::PublishLinkedChanges()
+{
+    // Уведомление листа может снова дойти сюда через его PublishChanges()
+    if (publishing_)
+    {
+        return;
+    }
+    publishing_ = true;
+    try
+    {
+        while (!pending_publish_.empty())
+        {
+            const std::size_t index = *pending_publish_.begin();
+            pending_publish_.erase(pending_publish_.begin());
+            sheets_[index].sheet->PublishChanges();
+        }
+    }
+    catch (...)
+    {
+        publishing_ = false;
+        throw;
+    }
+    publishing_ = false;
+}
+
+bool Workbook::IsCyclicDependent(const Sheet& sheet, const std::vector<Position>& sources, const Cell& cell) const
+{
+    const std::size_t own = IndexOf(sheet);
+    const FormulaInterface* formula = cell.GetFormula();
+    Span<const Position> refs = cell.GetReferencedCellsView();
+    Span<const Range> ranges = cell.GetReferencedRangesView();
+    Span<const SheetReference> sheet_refs = formula ? formula->GetSheetReferencesView() : Span<const SheetReference>{};
+
+    // Ссылается ли формула на ячейку target листа с номером index
+    auto is_referenced = [&](std::size_t index, Position target)
+    {
+        if (index == own
+            && (std::binary_search(refs.begin(), refs.end(), target)
+                || std::any_of(ranges.begin(), ranges.end(), [&](const Range& range)
+                               {
+                                   return range.Contains(target);
+                               })))
+        {
+            return true;
+        }
+        return std::any_of(sheet_refs.begin(), sheet_refs.end(), [&](const SheetReference& reference)
+                           {
+                               return reference.sheet == sheets_[index].name && reference.range.Contains(target);
+                           });
+    };
+
+    // Обход в ширину по зависимым ячейкам всех листов
+    using Node = std::pair<std::size_t, Position>;
+    std::set<Node> visited;
+    std::vector<Node> queue;
+    for (const Position& pos : sources)
+    {
+        if (is_referenced(own, pos))
+        {
+            return true;
+        }
+        visited.insert(Node{ own, pos });
+        queue.push_back(Node{ own, pos });
+    }
+    for (std::size_t i = 0; i < queue.size(); ++i)
+    {
+        const auto [index, pos] = queue[i];
+        bool found = false;
+        auto visit = [&](std::size_t dependent_index, Position dependent)
+        {
+            if (found || !visited.insert(Node{ dependent_index, dependent }).second)
+            {
+                return;
+            }
+            found = is_referenced(dependent_index, dependent);
+            queue.push_back(Node{ dependent_index, dependent });
+        };
+        sheets_[index].sheet->ForEachDependentCell(pos, [&visit, index = index](const Position& dependent)
+        {
+            visit(index, dependent);
+        });
+        ForEachSheetDependent(sheets_[index].name, pos, visit);
+        if (found)
+        {
+            return true;
+        }
+    }
+    return false;
+}
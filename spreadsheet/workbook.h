@@ -0,0 +1,148 @@
+#pragma once
+
+#include "cell.h"
+#include "common.h"
+#include "range_index.h"
+#include "sheet.h"
+#include "snapshot.h"
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Итог Workbook::Recalculate()
+struct WorkbookRecalcStats
+{
+    std::size_t evaluated = 0;    // формул вычислено
+    std::size_t groups = 0;       // групп листов, каждая вычислялась в одном потоке
+    unsigned threads = 0;         // потоков вычисления
+};
+
+// Книга: именованные листы, формулы которых ссылаются на ячейки друг друга
+// (Sheet2!A1, SUM(Sheet2!A1:A100), см. SheetReference). Листы правятся и
+// читаются как обычно, через Sheet; книга подключена к ним и ведёт
+// зависимости между листами.
+// Граф зависимостей книги - графы листов и индекс ссылок между листами: для
+// каждого листа, на который ссылаются, по R-дереву (см. RangeIndex) на
+// каждый лист со ссылающимися формулами. Проверка циклов и сброс кэша после
+// правки обходят этот граф по всем листам сразу, поэтому цикл через
+// несколько листов отвергается так же, как внутри листа: SetCell() бросает
+// CircularDependencyException и не меняет ячейку.
+// Ссылка на лист, которого нет, даёт #REF!, пока лист с таким именем не
+// добавят. Книга не копируется и не перемещается: листы хранят указатель на
+// неё.
+class Workbook
+{
+public:
+    Workbook();
+    ~Workbook();
+
+    Workbook(const Workbook&) = delete;
+    Workbook& operator=(const Workbook&) = delete;
+
+    // Добавляет пустой лист name в конец книги. Бросает std::invalid_argument,
+    // если имя не годится (см. IsValidSheetName()) или лист с таким именем
+    // уже есть
+    Sheet& AddSheet(const std::string& name);
+    // Лист name или nullptr, если его нет
+    Sheet* FindSheet(std::string_view name);
+    const Sheet* FindSheet(std::string_view name) const;
+    // Лист name. Бросает std::out_of_range, если его нет
+    Sheet& GetSheet(std::string_view name);
+    const Sheet& GetSheet(std::string_view name) const;
+    // Имена листов в порядке добавления
+    std::vector<std::string> GetSheetNames() const;
+    std::size_t GetSheetCount() const;
+
+    // Вычисляет все формулы книги без значения в кэше в threads потоках
+    // (0 - по числу ядер). Лист вычисляется после листов, на которые
+    // ссылаются его формулы, поэтому читает их готовые значения; независимые
+    // листы вычисляются параллельно, каждый целиком в одном потоке. Листы,
+    // ссылающиеся друг на друга по кругу, вычисляются одной группой. Во время
+    // вычисления книгу нельзя править и читать из других потоков, подкачка
+    // тайлов листов должна быть выключена (см. Sheet).
+    WorkbookRecalcStats Recalculate(unsigned threads = 0);
+
+    // Сохраняет книгу в каталог directory (создаётся при необходимости):
+    // снимок каждого листа (см. snapshot.h) и оглавление со списком листов.
+    // Оглавление записывается последним и атомарно заменяет прежнее, поэтому
+    // при сбое остаётся прежняя книга; снимки прежнего сохранения после этого
+    // удаляются. Бросает SnapshotException при ошибке записи.
+    void Save(const std::string& directory, const SnapshotOptions& options = {}) const;
+    // Загружает книгу, сохранённую Save(). Снимки листов читаются в threads
+    // потоках (0 - по числу ядер) без разбора формул, затем по формулам
+    // восстанавливается индекс ссылок между листами. Бросает
+    // SnapshotException, если каталог не удалось прочитать или он повреждён.
+    static std::unique_ptr<Workbook> Load(const std::string& directory, unsigned threads = 0);
+
+private:
+    // Лист вызывает методы ниже при правках и вычислениях (см. Sheet)
+    friend class Sheet;
+
+    struct SheetEntry
+    {
+        std::string name;
+        std::unique_ptr<SheetInterface> owner;
+        Sheet* sheet = nullptr;
+    };
+
+    // Листы в порядке добавления и номера листов по имени
+    std::vector<SheetEntry> sheets_;
+    std::map<std::string, std::size_t, std::less<>> indexes_;
+    // Ссылки между листами: имя листа, на который ссылаются (его может ещё
+    // не быть), - номер листа формул - диапазоны и ссылающиеся на них ячейки
+    std::map<std::string, std::map<std::size_t, RangeIndex>, std::less<>> references_;
+    // Листы, кэш формул которых сбросила правка другого листа: их
+    // подписчиков уведомит PublishLinkedChanges()
+    std::set<std::size_t> pending_publish_;
+    bool publishing_ = false;
+
+    std::size_t IndexOf(const Sheet& sheet) const;
+    // Добавляет лист и подключает его к книге, регистрируя ссылки его формул
+    Sheet& Adopt(const std::string& name, std::unique_ptr<SheetInterface> sheet);
+
+    // Регистрирует и удаляет ссылки на другие листы формулы cell в ячейке pos
+    // листа sheet
+    void AddSheetReferences(const Sheet& sheet, Position pos, const Cell& cell);
+    void RemoveSheetReferences(const Sheet& sheet, Position pos, const Cell& cell);
+    // Ссылаются ли на лист sheet формулы других листов (или его собственные
+    // через его имя)
+    bool HasSheetDependents(const Sheet& sheet) const;
+    // Сбрасывает кэш формул, ссылающихся на ячейки changed листа sheet, и
+    // зависящих от них ячеек на всех листах
+    void InvalidateSheetDependents(const Sheet& sheet, const std::vector<Position>& changed);
+    // Сбрасывает кэш формул, ссылающихся на лист name: он появился
+    void InvalidateReferencesTo(const std::string& name);
+    // Уведомляет подписчиков листов из pending_publish_
+    void PublishLinkedChanges();
+    // То же, что Sheet::IsCyclicDependent(), по графу всех листов: ведёт ли
+    // от источников sources листа sheet путь по зависимым ячейкам к одной из
+    // ссылок cell
+    bool IsCyclicDependent(const Sheet& sheet, const std::vector<Position>& sources, const Cell& cell) const;
+    // Вызывает callback(index, dependent) для каждой формулы листа с номером
+    // index, ссылающейся на ячейку pos листа target
+    template <typename Callback>
+    void ForEachSheetDependent(std::string_view target, Position pos, Callback&& callback) const;
+};
+
+template <typename Callback>
+void Workbook::ForEachSheetDependent(std::string_view target, Position pos, Callback&& callback) const
+{
+    auto it = references_.find(target);
+    if (it == references_.end())
+    {
+        return;
+    }
+    for (const auto& [index, dependencies] : it->second)
+    {
+        dependencies.ForEachDependent(pos, [&callback, index = index](Position dependent)
+        {
+            callback(index, dependent);
+        });
+    }
+}